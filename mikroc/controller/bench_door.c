@@ -0,0 +1,329 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "loop.h"
+#include "door.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Events of the world around the doors, as timer kinds after those of a door */
+enum world_event { WORLD_ARRIVAL = NUM_DOOR_EVENTS, WORLD_LATCH, WORLD_CLOSE };
+
+/* Behaviour of the people using the doors in milliseconds */
+#define ARRIVAL_MS   10000  // Mean time between messages at a door
+#define PUSH_MS      400    // Most time after the unlocker starts until the latch opens
+#define CLOSE_MS     1500   // Time that the door stays open
+#define ACCEPTED     90     // Percentage of messages that are accepted
+
+
+/* A door that runs on its own thread */
+struct door_thread {
+    pthread_t thread;
+    sem_t wake;
+    uint8_t waits, event, accept;
+    int64_t timer;
+};
+
+
+/* Global variables */
+int num_doors = 1000;
+int num_secs = 3600;
+uint64_t rng_state = 1;
+struct timer_wheel tw;
+struct doors ds;
+struct door_thread* threads;
+sem_t done;
+int stopping;
+uint64_t resumes;
+uint64_t timeouts;
+uint32_t max_busy, num_busy;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_door [-d doors] [-s secs]\n\n"
+    "Runs the workflow of process_load() and bolt_unlock() for many doors on a\n"
+    "simulated clock, once as coroutines on a single thread and once with a\n"
+    "thread per door that blocks where the firmware would. Messages arrive at\n"
+    "every door at random, and the latch opens some time after the unlocker\n"
+    "starts. Reports the memory per door and the cost of each switch from the\n"
+    "loop to a door and back.\n\n"
+    "    -d doors  Number of doors (default: 1000)\n"
+    "    -s secs   Simulated time in seconds (default: 3600)\n"
+);
+
+
+double run_coroutines();
+double run_threads(long* rss);
+void fire_coroutine(void* ctx, uint32_t id, uint16_t kind, uint32_t arg);
+void fire_thread(void* ctx, uint32_t id, uint16_t kind, uint32_t arg);
+int world_event(uint16_t kind, uint32_t arg, int* accept);
+void* thread_main(void* arg);
+void thread_await(struct door_thread* td, uint32_t door, int mask, uint32_t ms);
+void thread_wake(uint32_t door, int event, int accept);
+long resident_bytes();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    double secs;
+    long rss;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:h")) != -1) {
+        switch (opt) {
+        case 'd': num_doors = atoi(optarg); break;
+        case 's': num_secs = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_doors < 1 || num_secs < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    printf("Workflow of %d doors over %d simulated seconds:\n", num_doors, num_secs);
+    printf("    %-11s %12s %14s %12s %14s\n", "doors as", "resumes", "bytes/door", "ns/switch", "busy at most");
+
+    secs = run_coroutines();
+    printf("    %-11s %12lu %14.1f %12.1f %14u\n", "coroutines", (unsigned long)resumes,
+        (double)(sizeof(struct door_frame) * max_busy) / num_doors + sizeof(*ds.frames) + 2,
+        secs*1e9/resumes, max_busy);
+
+    secs = run_threads(&rss);
+    if (secs < 0)
+        return -1;
+    printf("    %-11s %12lu %14.1f %12.1f %14u\n", "threads", (unsigned long)resumes,
+        (double)rss / num_doors, secs*1e9/resumes, max_busy);
+
+    printf("\nThe coroutines need a frame of %zu bytes only while a door is busy, and\n"
+        "the index of it otherwise. A thread also reserves its stack in address space\n"
+        "and kernel memory that is not counted here. The latch did not open in time\n"
+        "for %lu of the unlocks.\n", sizeof(struct door_frame), (unsigned long)timeouts);
+    return 0;
+}
+
+
+// Run the doors as coroutines drawn from a pool that has a frame for every
+// door. Returns the time taken in seconds.
+double run_coroutines() {
+    uint64_t tick;
+    uint32_t idx;
+
+    if (wheel_init(&tw, 4*num_doors, 0) || doors_init(&ds, &tw, num_doors, num_doors))
+        exit(-1);
+    for (idx = 0; idx < (uint32_t)num_doors; idx++)
+        wheel_add(&tw, rand64() % ARRIVAL_MS, WORLD_ARRIVAL, idx);
+    resumes = max_busy = num_busy = 0;
+
+    uint64_t start = loop_clock();
+    for (tick = 1; tick <= (uint64_t)num_secs * 1000; tick++)
+        wheel_advance(&tw, tick, fire_coroutine, NULL);
+    double secs = (loop_clock() - start) / 1e9;
+    resumes = ds.resumes;
+    timeouts = ds.timeouts;
+    doors_free(&ds);
+    wheel_free(&tw);
+    return secs;
+}
+
+
+// Pass a timer of the coroutine run to the door it is for.
+void fire_coroutine(void* ctx, uint32_t id, uint16_t kind, uint32_t arg) {
+    int accept = 0, event = world_event(kind, arg, &accept);
+
+    if (event >= 0) {
+        int idle = (ds.frames[arg] == DOOR_NIL);
+        if (door_wake(&ds, arg, event, accept) < 0)
+            exit(-1);
+        num_busy += idle - (ds.frames[arg] == DOOR_NIL);
+        if (num_busy > max_busy)
+            max_busy = num_busy;
+    }
+}
+
+
+// Run the doors as threads that each block on a semaphore where the firmware
+// would wait, and hand control back to the loop through another. Stores the
+// memory that the threads took and returns the time taken in seconds, or -1
+// if the threads could not be started.
+double run_threads(long* rss) {
+    pthread_attr_t attr;
+    uint64_t tick;
+    uint32_t idx;
+    long before = resident_bytes();
+
+    if (wheel_init(&tw, 4*num_doors, 0) || doors_init(&ds, &tw, num_doors, 0))
+        exit(-1);
+    threads = calloc(num_doors, sizeof(*threads));
+    if (threads == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    sem_init(&done, 0, 0);
+    stopping = 0;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64*1024);
+    for (idx = 0; idx < (uint32_t)num_doors; idx++) {
+        sem_init(&threads[idx].wake, 0, 0);
+        threads[idx].timer = -1;
+        if (pthread_create(&threads[idx].thread, &attr, thread_main, (void*)(uintptr_t)idx))
+            PRINT_RETURN("Could not start the door threads\n", -1);
+        sem_wait(&done);
+        wheel_add(&tw, rand64() % ARRIVAL_MS, WORLD_ARRIVAL, idx);
+    }
+    resumes = max_busy = num_busy = 0;
+
+    uint64_t start = loop_clock();
+    for (tick = 1; tick <= (uint64_t)num_secs * 1000; tick++)
+        wheel_advance(&tw, tick, fire_thread, NULL);
+    double secs = (loop_clock() - start) / 1e9;
+    *rss = resident_bytes() - before;
+
+    stopping = 1;
+    for (idx = 0; idx < (uint32_t)num_doors; idx++) {
+        sem_post(&threads[idx].wake);
+        pthread_join(threads[idx].thread, NULL);
+    }
+    free(threads);
+    doors_free(&ds);
+    wheel_free(&tw);
+    return secs;
+}
+
+
+// Pass a timer of the thread run to the door it is for.
+void fire_thread(void* ctx, uint32_t id, uint16_t kind, uint32_t arg) {
+    int accept = 0, event = world_event(kind, arg, &accept);
+
+    if (event >= 0)
+        thread_wake(arg, event, accept);
+}
+
+
+// Play the part of the world for a timer, and return the event that it is for
+// a door, or -1 if there is none. A message arrival stores whether it was
+// accepted in accept.
+int world_event(uint16_t kind, uint32_t arg, int* accept) {
+    switch (kind) {
+    case WORLD_ARRIVAL:
+        // A message arrives, and the latch is pushed open once the unlocker runs
+        wheel_add(&tw, tw.now + 1 + (uint64_t)(-log((rand64() >> 11) * 0x1.0p-53 + 0x1.0p-54) * ARRIVAL_MS),
+            WORLD_ARRIVAL, arg);
+        *accept = (rand64() % 100 < ACCEPTED);
+        if (*accept)
+            wheel_add(&tw, tw.now + DOOR_WRITE_MS + DOOR_PULSE_MS + DOOR_REST_MS + rand64() % PUSH_MS,
+                WORLD_LATCH, arg);
+        return DOOR_MESSAGE;
+    case WORLD_LATCH:
+        ds.latches[arg] = 1;
+        wheel_add(&tw, tw.now + CLOSE_MS, WORLD_CLOSE, arg);
+        return DOOR_LATCH;
+    case WORLD_CLOSE:
+        ds.latches[arg] = 0;
+        return -1;
+    }
+    return DOOR_TIMER;
+}
+
+
+// The workflow of door_run() as straight-line code on a thread of its own.
+void* thread_main(void* arg) {
+    uint32_t door = (uintptr_t)arg;
+    struct door_thread* td = &threads[door];
+    uint8_t* out = &ds.outputs[door];
+
+    while (1) {
+        thread_await(td, door, 1 << DOOR_MESSAGE, 0);
+        if (!td->accept) {
+            thread_await(td, door, 0, DOOR_STALL_MS);
+            continue;
+        }
+        thread_await(td, door, 0, DOOR_WRITE_MS);
+        if (!ds.latches[door]) {
+            *out = DOOR_UNLOCKER;
+            thread_await(td, door, 0, DOOR_PULSE_MS);
+            *out = 0;
+            thread_await(td, door, 0, DOOR_REST_MS);
+            if (!ds.latches[door]) {
+                *out = DOOR_UNLOCKER;
+                thread_await(td, door, 1 << DOOR_LATCH, DOOR_LATCH_MS);
+            }
+            *out = 0;
+            thread_await(td, door, 0, DOOR_OPEN_MS);
+        }
+        *out = DOOR_LOCKER;
+        thread_await(td, door, 0, DOOR_LOCK_MS);
+        *out = 0;
+        thread_await(td, door, 0, DOOR_HOLD_MS);
+    }
+}
+
+
+// Block a door thread until one of a mask of events or a timeout in
+// milliseconds, if not 0. The loop is blocked while a door thread runs, so
+// the thread may arm timers in the wheel.
+void thread_await(struct door_thread* td, uint32_t door, int mask, uint32_t ms) {
+    td->waits = mask;
+    if (ms) {
+        td->waits |= 1 << DOOR_TIMER;
+        td->timer = wheel_add(&tw, tw.now + ms, DOOR_TIMER, door);
+    }
+    if (mask & (1 << DOOR_MESSAGE))
+        num_busy--;
+    sem_post(&done);
+    sem_wait(&td->wake);
+    if (stopping)
+        pthread_exit(NULL);
+}
+
+
+// Pass an event to a door thread and wait until it blocks again, unless it is
+// not waiting for the event.
+void thread_wake(uint32_t door, int event, int accept) {
+    struct door_thread* td = &threads[door];
+
+    if (!(td->waits & (1 << event)))
+        return;
+    if (td->timer >= 0 && event != DOOR_TIMER)
+        wheel_cancel(&tw, td->timer);
+    if (event == DOOR_MESSAGE && ++num_busy > max_busy)
+        max_busy = num_busy;
+    td->timer = -1;
+    td->event = event;
+    td->accept = accept;
+    resumes++;
+    sem_post(&td->wake);
+    sem_wait(&done);
+}
+
+
+// Return the resident memory of the process in bytes.
+long resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE* fp = fopen("/proc/self/statm", "r");
+
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+            resident = 0;
+        fclose(fp);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,377 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "loop.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Range of the timeouts of a controller in milliseconds */
+#define MIN_TIMEOUT  5       // The shortest delay_ms() of bolt_unlock()
+#define MAX_TIMEOUT  60000   // Expiry of a dedupe or rate-limit entry
+
+/* Kinds of timers of the benchmarks */
+enum kind { KIND_REARM, KIND_LATENESS };
+
+
+/* A binary heap of timers, which tracks the position of each for cancelling */
+struct heap {
+    uint64_t* keys;  // Expiry of the timer at each position
+    uint32_t* ids;   // Timer at each position
+    uint32_t* pos;   // Position of each timer, or -1
+    uint32_t num, max;
+};
+
+
+/* Global variables */
+int num_timers = 1000000;
+int num_ops = 10000000;
+uint64_t rng_state = 1;
+uint64_t* deadlines;   // Deadline of each timer in nanoseconds
+uint32_t* latenesses;  // Lateness of each timer in microseconds
+uint32_t num_late;
+uint64_t start_ns;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_timer [-t timers] [-n ops]\n\n"
+    "Compares the timing wheel of the controller against a binary heap with\n"
+    "the given number of armed timers, whose timeouts span those of a door from\n"
+    "the 5ms polls of bolt_unlock() to a minute. Measures cancelling and\n"
+    "re-arming timers, which is what happens to most of them, expiring them\n"
+    "as a simulated clock advances, and how late they fire against the real\n"
+    "clock in the event loop.\n\n"
+    "    -t timers  Number of armed timers (default: 1000000)\n"
+    "    -n ops     Number of cancels and re-arms (default: 10000000)\n"
+);
+
+
+double bench_wheel_ops(uint32_t* ids);
+double bench_heap_ops(struct heap* hp);
+double bench_wheel_expiry(uint64_t* fired);
+double bench_heap_expiry(struct heap* hp, uint64_t* fired);
+void bench_wheel_jitter();
+void bench_heap_jitter(struct heap* hp);
+void fire_rearm(void* ctx, uint32_t id, uint16_t kind, uint32_t arg);
+void fire_lateness(void* ctx, uint32_t id, uint16_t kind, uint32_t arg);
+void print_lateness(const char* name);
+int heap_init(struct heap* hp, uint32_t max);
+void heap_free(struct heap* hp);
+void heap_add(struct heap* hp, uint32_t id, uint64_t key);
+void heap_remove(struct heap* hp, uint32_t id);
+void heap_sift(struct heap* hp, uint32_t idx);
+uint64_t rand_timeout();
+uint64_t rand64();
+int cmp_lateness(const void* a, const void* b);
+
+
+int main(int argc, char* argv[]) {
+    uint32_t* ids;
+    struct heap hp;
+    uint64_t fired;
+    double secs;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:h")) != -1) {
+        switch (opt) {
+        case 't': num_timers = atoi(optarg); break;
+        case 'n': num_ops = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_timers < 1 || num_ops < 1)
+        PRINT_RETURN(help_msg, -1);
+    ids = malloc(num_timers*sizeof(*ids));
+    deadlines = malloc(num_timers*sizeof(*deadlines));
+    latenesses = malloc(num_timers*sizeof(*latenesses));
+    if (ids == NULL || deadlines == NULL || latenesses == NULL || heap_init(&hp, num_timers))
+        PRINT_RETURN("Out of memory\n", -1);
+
+    printf("Timers of a controller with %d armed:\n", num_timers);
+    printf("    %-8s %16s %16s %12s %12s %12s\n", "queue", "Mops/s cancel+arm",
+        "Mfires/s expire", "p50 late us", "p99 late us", "max late us");
+
+    secs = bench_wheel_ops(ids);
+    printf("    %-8s %16.2f", "wheel", 2*num_ops/secs/1e6);
+    secs = bench_wheel_expiry(&fired);
+    printf(" %16.2f", fired/secs/1e6);
+    bench_wheel_jitter();
+    print_lateness("wheel");
+
+    secs = bench_heap_ops(&hp);
+    printf("    %-8s %16.2f", "heap", 2*num_ops/secs/1e6);
+    secs = bench_heap_expiry(&hp, &fired);
+    printf(" %16.2f", fired/secs/1e6);
+    bench_heap_jitter(&hp);
+    print_lateness("heap");
+
+    printf("\nThe wheel fires at the resolution of its 1ms ticks, so its timers are up\n"
+        "to a tick late even when the loop keeps up.\n");
+    heap_free(&hp);
+    free(ids);
+    free(deadlines);
+    free(latenesses);
+    return 0;
+}
+
+
+// Arm the timers in a wheel, then cancel and re-arm random ones. Returns the
+// time taken by the cancels and re-arms in seconds.
+double bench_wheel_ops(uint32_t* ids) {
+    struct timer_wheel tw;
+    int idx;
+
+    if (wheel_init(&tw, num_timers, 0))
+        exit(-1);
+    for (idx = 0; idx < num_timers; idx++)
+        ids[idx] = wheel_add(&tw, rand_timeout(), KIND_REARM, idx);
+    uint64_t start = loop_clock();
+    for (idx = 0; idx < num_ops; idx++) {
+        uint32_t which = rand64() % num_timers;
+        wheel_cancel(&tw, ids[which]);
+        ids[which] = wheel_add(&tw, tw.now + rand_timeout(), KIND_REARM, which);
+    }
+    double secs = (loop_clock() - start) / 1e9;
+    wheel_free(&tw);
+    return secs;
+}
+
+
+// Arm the timers in a heap, then cancel and re-arm random ones. Returns the
+// time taken by the cancels and re-arms in seconds.
+double bench_heap_ops(struct heap* hp) {
+    int idx;
+
+    hp->num = 0;
+    for (idx = 0; idx < num_timers; idx++)
+        heap_add(hp, idx, rand_timeout());
+    uint64_t start = loop_clock();
+    for (idx = 0; idx < num_ops; idx++) {
+        uint32_t which = rand64() % num_timers;
+        heap_remove(hp, which);
+        heap_add(hp, which, rand_timeout());
+    }
+    return (loop_clock() - start) / 1e9;
+}
+
+
+// Advance a simulated clock a tick at a time over the longest timeout, with
+// every timer re-armed as it fires so that the number armed stays the same.
+// Stores the number of timers fired and returns the time taken in seconds.
+double bench_wheel_expiry(uint64_t* fired) {
+    struct timer_wheel tw;
+    uint64_t tick;
+    int idx;
+
+    if (wheel_init(&tw, num_timers, 0))
+        exit(-1);
+    for (idx = 0; idx < num_timers; idx++)
+        wheel_add(&tw, rand_timeout(), KIND_REARM, idx);
+    *fired = 0;
+    uint64_t start = loop_clock();
+    for (tick = 1; tick <= MAX_TIMEOUT; tick++)
+        *fired += wheel_advance(&tw, tick, fire_rearm, &tw);
+    double secs = (loop_clock() - start) / 1e9;
+    wheel_free(&tw);
+    return secs;
+}
+
+
+// Run the same clock as bench_wheel_expiry() over a heap.
+double bench_heap_expiry(struct heap* hp, uint64_t* fired) {
+    uint64_t tick;
+    int idx;
+
+    hp->num = 0;
+    for (idx = 0; idx < num_timers; idx++)
+        heap_add(hp, idx, rand_timeout());
+    *fired = 0;
+    uint64_t start = loop_clock();
+    for (tick = 1; tick <= MAX_TIMEOUT; tick++) {
+        while (hp->num > 0 && hp->keys[0] <= tick) {
+            uint32_t id = hp->ids[0];
+            heap_remove(hp, id);
+            heap_add(hp, id, tick + rand_timeout());
+            (*fired)++;
+        }
+    }
+    return (loop_clock() - start) / 1e9;
+}
+
+
+// Arm every timer to fire within the next two seconds of the real clock and
+// run the event loop until they all have, noting how late each one fired.
+void bench_wheel_jitter() {
+    struct loop lp;
+    int idx;
+
+    if (loop_init(&lp, num_timers, fire_lateness, &lp))
+        exit(-1);
+    start_ns = lp.start;
+    num_late = 0;
+    for (idx = 0; idx < num_timers; idx++) {
+        uint64_t ms = 100 + rand64() % 2000;
+        deadlines[idx] = start_ns + ms * LOOP_TICK_NS;
+        wheel_add(&lp.tw, ms, KIND_LATENESS, idx);
+    }
+    while (lp.tw.num_armed > 0)
+        loop_run_once(&lp, -1);
+    loop_free(&lp);
+}
+
+
+// Run the same timers as bench_wheel_jitter() from a heap, sleeping in poll()
+// until the earliest one.
+void bench_heap_jitter(struct heap* hp) {
+    int idx;
+
+    hp->num = 0;
+    num_late = 0;
+    start_ns = loop_clock();
+    for (idx = 0; idx < num_timers; idx++) {
+        deadlines[idx] = start_ns + (100 + rand64() % 2000) * LOOP_TICK_NS;
+        heap_add(hp, idx, deadlines[idx]);
+    }
+    while (hp->num > 0) {
+        uint64_t now = loop_clock();
+        if (hp->keys[0] > now) {
+            poll(NULL, 0, (hp->keys[0] - now + LOOP_TICK_NS - 1) / LOOP_TICK_NS);
+            now = loop_clock();
+        }
+        while (hp->num > 0 && hp->keys[0] <= now) {
+            uint32_t id = hp->ids[0];
+            heap_remove(hp, id);
+            fire_lateness(NULL, id, KIND_LATENESS, id);
+        }
+    }
+}
+
+
+// Re-arm a timer that fired in bench_wheel_expiry().
+void fire_rearm(void* ctx, uint32_t id, uint16_t kind, uint32_t arg) {
+    struct timer_wheel* tw = ctx;
+    wheel_add(tw, tw->now + rand_timeout(), kind, arg);
+}
+
+
+// Note how late a timer of the jitter benchmarks fired.
+void fire_lateness(void* ctx, uint32_t id, uint16_t kind, uint32_t arg) {
+    uint64_t now = loop_clock();
+    latenesses[num_late++] = (now > deadlines[arg]) ? (now - deadlines[arg]) / 1000 : 0;
+}
+
+
+// Print the percentiles of the latenesses of the last jitter benchmark.
+void print_lateness(const char* name) {
+    qsort(latenesses, num_late, sizeof(*latenesses), cmp_lateness);
+    printf(" %12u %12u %12u\n", latenesses[num_late/2], latenesses[(uint64_t)num_late*99/100],
+        latenesses[num_late-1]);
+}
+
+
+// Allocate an empty heap for up to max timers. Returns -1 if out of memory.
+int heap_init(struct heap* hp, uint32_t max) {
+    memset(hp, 0, sizeof(*hp));
+    hp->max = max;
+    hp->keys = malloc(max*sizeof(*hp->keys));
+    hp->ids = malloc(max*sizeof(*hp->ids));
+    hp->pos = malloc(max*sizeof(*hp->pos));
+    if (hp->keys == NULL || hp->ids == NULL || hp->pos == NULL)
+        return -1;
+    return 0;
+}
+
+
+// Release the memory of a heap.
+void heap_free(struct heap* hp) {
+    free(hp->keys);
+    free(hp->ids);
+    free(hp->pos);
+}
+
+
+// Add a timer with the given expiry to a heap.
+void heap_add(struct heap* hp, uint32_t id, uint64_t key) {
+    uint32_t idx = hp->num++;
+
+    hp->keys[idx] = key;
+    hp->ids[idx] = id;
+    hp->pos[id] = idx;
+    heap_sift(hp, idx);
+}
+
+
+// Remove a timer from a heap by moving the last timer into its place.
+void heap_remove(struct heap* hp, uint32_t id) {
+    uint32_t idx = hp->pos[id], last = --hp->num;
+
+    if (idx != last) {
+        hp->keys[idx] = hp->keys[last];
+        hp->ids[idx] = hp->ids[last];
+        hp->pos[hp->ids[idx]] = idx;
+        heap_sift(hp, idx);
+    }
+}
+
+
+// Restore the order of a heap after the timer at a position changed, by moving
+// it up or down.
+void heap_sift(struct heap* hp, uint32_t idx) {
+    uint64_t key = hp->keys[idx];
+    uint32_t id = hp->ids[idx];
+
+    while (idx > 0 && hp->keys[(idx-1)/2] > key) {
+        hp->keys[idx] = hp->keys[(idx-1)/2];
+        hp->ids[idx] = hp->ids[(idx-1)/2];
+        hp->pos[hp->ids[idx]] = idx;
+        idx = (idx-1)/2;
+    }
+    while (2*idx+1 < hp->num) {
+        uint32_t child = 2*idx+1;
+        if (child+1 < hp->num && hp->keys[child+1] < hp->keys[child])
+            child++;
+        if (hp->keys[child] >= key)
+            break;
+        hp->keys[idx] = hp->keys[child];
+        hp->ids[idx] = hp->ids[child];
+        hp->pos[hp->ids[idx]] = idx;
+        idx = child;
+    }
+    hp->keys[idx] = key;
+    hp->ids[idx] = id;
+    hp->pos[id] = idx;
+}
+
+
+// Return a random timeout in milliseconds, spread evenly over the orders of
+// magnitude between the shortest and longest timeouts.
+uint64_t rand_timeout() {
+    double unit = (rand64() >> 11) * 0x1.0p-53;
+    return (uint64_t)(MIN_TIMEOUT * pow((double)MAX_TIMEOUT / MIN_TIMEOUT, unit));
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+// Compare two latenesses for qsort().
+int cmp_lateness(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,237 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CONTROLLER_DOOR_H
+#define _CONTROLLER_DOOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "timer.h"
+
+
+// This runs the workflow of process_load() and bolt_unlock() in receiver.c for
+// many doors on the single thread of the event loop. The workflow is written
+// as the same straight-line code, but as a coroutine in the style of
+// protothreads: where the firmware blocks in delay_ms() or polls the latch,
+// the coroutine arms a timer or waits for a sensor edge, saves the line to
+// resume at in its frame and returns to the loop. Every local that lives
+// across a wait is kept in the frame, which is the whole state of the door.
+//
+// A door only needs a frame while its workflow runs. The frames are drawn from
+// a pool when a message arrives at an idle door and returned once the door is
+// idle again, so an idle door costs only the index of its frame. Events that
+// the door is not waiting for are dropped, just as the firmware is deaf while
+// it is busy.
+
+#define DOOR_NIL  0xFFFFFFFF
+
+/* Timing of the workflow in milliseconds, from receiver.c */
+#define DOOR_WRITE_MS    80    // write_channel_code()
+#define DOOR_PULSE_MS    150   // First pulse of the bolt unlocker
+#define DOOR_REST_MS     300   // Rest after the first pulse
+#define DOOR_LATCH_MS    1250  // Most time to run the unlocker until the latch opens
+#define DOOR_OPEN_MS     1000  // Rest after the latch opens
+#define DOOR_LOCK_MS     1000  // Running the bolt locker
+#define DOOR_HOLD_MS     3000  // Display hold after an accepted message
+#define DOOR_STALL_MS    5000  // Display hold after a rejected message
+
+/* Outputs of a door, as on PORTC of the receiver */
+#define DOOR_UNLOCKER  0x80
+#define DOOR_LOCKER    0x40
+
+/* Events that wake a door, which are also the timer kinds of its timers */
+enum door_event { DOOR_MESSAGE, DOOR_LATCH, DOOR_TIMER, NUM_DOOR_EVENTS };
+
+
+/* Resumable functions in the style of protothreads */
+#define CO_BEGIN(fr)  switch ((fr)->line) { case 0:
+#define CO_WAIT(fr)   do { (fr)->line = __LINE__; return 0; case __LINE__:; } while (0)
+#define CO_EXIT(fr)   do { (fr)->line = 0; return 1; } while (0)
+#define CO_END(fr)    } (fr)->line = 0; return 1;
+
+/* Wait for any of a mask of events or a timeout in milliseconds, if not 0 */
+#define DOOR_AWAIT(ds, fr, mask, ms) do {              \
+        if (door_arm((ds), (fr), (mask), (ms)))        \
+            return -1;                                 \
+        CO_WAIT(fr);                                   \
+    } while (0)
+
+
+/* The frame of a running door workflow */
+struct door_frame {
+    uint16_t line;    // The line to resume at, or 0 to start
+    uint8_t waits;    // Mask of the events that the door waits for
+    uint8_t event;    // The event that resumed the door
+    uint8_t accept;   // Whether the message was accepted
+    uint8_t latched;  // Whether the latch is open, shown once the bolt locks
+    int64_t timer;    // The armed timer, or -1
+    uint32_t door;
+    uint32_t next;    // The next free frame
+};
+
+/* The doors of a controller */
+struct doors {
+    struct timer_wheel* tw;
+    uint32_t num_doors;
+    uint32_t* frames;  // The frame of each door, or DOOR_NIL when idle
+    uint8_t* outputs;  // The outputs of each door
+    uint8_t* latches;  // The latch sensor of each door, 1 when open
+    struct door_frame* pool;
+    uint32_t max_frames;
+    uint32_t free;
+    uint64_t resumes;
+    uint64_t timeouts; // Workflows that ended without the latch open
+};
+
+
+int doors_init(struct doors* ds, struct timer_wheel* tw, uint32_t num_doors, uint32_t max_frames);
+void doors_free(struct doors* ds);
+int door_wake(struct doors* ds, uint32_t door, int event, int accept);
+int door_arm(struct doors* ds, struct door_frame* fr, int mask, uint32_t ms);
+int door_run(struct doors* ds, struct door_frame* fr);
+
+
+// Set up the given number of idle doors that share a pool of max_frames
+// frames and arm their timers in tw. Returns -1 if out of memory.
+int doors_init(struct doors* ds, struct timer_wheel* tw, uint32_t num_doors, uint32_t max_frames) {
+    uint32_t idx;
+
+    memset(ds, 0, sizeof(*ds));
+    ds->tw = tw;
+    ds->num_doors = num_doors;
+    ds->max_frames = max_frames;
+    ds->frames = malloc(num_doors*sizeof(*ds->frames));
+    ds->outputs = calloc(num_doors, sizeof(*ds->outputs));
+    ds->latches = calloc(num_doors, sizeof(*ds->latches));
+    ds->pool = malloc(max_frames*sizeof(*ds->pool));
+    if (ds->frames == NULL || ds->outputs == NULL || ds->latches == NULL || ds->pool == NULL) {
+        doors_free(ds);
+        fprintf(stderr, "Could not allocate the doors\n");
+        return -1;
+    }
+    memset(ds->frames, 0xFF, num_doors*sizeof(*ds->frames));
+    for (idx = 0; idx < max_frames; idx++)
+        ds->pool[idx].next = (idx+1 < max_frames) ? idx+1 : DOOR_NIL;
+    ds->free = max_frames ? 0 : DOOR_NIL;
+    return 0;
+}
+
+
+// Release the memory of the doors.
+void doors_free(struct doors* ds) {
+    free(ds->frames);
+    free(ds->outputs);
+    free(ds->latches);
+    free(ds->pool);
+    memset(ds, 0, sizeof(*ds));
+}
+
+
+// Pass an event to a door, which for a message carries whether the verifier
+// accepted it, and run the door until it waits again. An idle door only wakes
+// for a message, and takes a frame from the pool for it. Returns 1 if the
+// door ran, 0 if it dropped the event, or -1 if the frames or timers ran out.
+int door_wake(struct doors* ds, uint32_t door, int event, int accept) {
+    struct door_frame* fr;
+    uint32_t idx = ds->frames[door];
+    int ret;
+
+    if (idx == DOOR_NIL) {
+        if (event != DOOR_MESSAGE)
+            return 0;
+        if ((idx = ds->free) == DOOR_NIL) {
+            fprintf(stderr, "Out of door frames\n");
+            return -1;
+        }
+        fr = &ds->pool[idx];
+        ds->free = fr->next;
+        memset(fr, 0, sizeof(*fr));
+        fr->door = door;
+        fr->timer = -1;
+        fr->accept = accept;
+        ds->frames[door] = idx;
+    } else {
+        fr = &ds->pool[idx];
+        if (!(fr->waits & (1 << event)))
+            return 0;
+        if (fr->timer >= 0 && event != DOOR_TIMER)
+            wheel_cancel(ds->tw, fr->timer);
+        fr->timer = -1;
+    }
+    fr->event = event;
+    fr->waits = 0;
+
+    ds->resumes++;
+    if ((ret = door_run(ds, fr)) == 0)
+        return 1;
+    ds->frames[door] = DOOR_NIL;
+    fr->next = ds->free;
+    ds->free = idx;
+    return (ret < 0) ? -1 : 1;
+}
+
+
+// Make a door wait for a mask of events, and for a timer if ms is not 0.
+// Returns -1 if every timer is armed.
+int door_arm(struct doors* ds, struct door_frame* fr, int mask, uint32_t ms) {
+    fr->waits = mask;
+    if (ms) {
+        fr->waits |= 1 << DOOR_TIMER;
+        if ((fr->timer = wheel_add(ds->tw, ds->tw->now + ms, DOOR_TIMER, fr->door)) < 0) {
+            fprintf(stderr, "Out of timers\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// The workflow of a door from a message to being idle again, following
+// process_load() and bolt_unlock(). Returns 0 when it waits, 1 when it is
+// done and -1 if it failed.
+int door_run(struct doors* ds, struct door_frame* fr) {
+    uint8_t* out = &ds->outputs[fr->door];
+
+    CO_BEGIN(fr);
+    if (!fr->accept) {
+        DOOR_AWAIT(ds, fr, 0, DOOR_STALL_MS);
+        CO_EXIT(fr);
+    }
+    DOOR_AWAIT(ds, fr, 0, DOOR_WRITE_MS);
+
+    // Unlock the bolt, unless the latch is already open
+    fr->latched = ds->latches[fr->door];
+    if (!fr->latched) {
+        *out = DOOR_UNLOCKER;
+        DOOR_AWAIT(ds, fr, 0, DOOR_PULSE_MS);
+        *out = 0;
+        DOOR_AWAIT(ds, fr, 0, DOOR_REST_MS);
+
+        // Run the unlocker until the latch opens rather than polling it
+        fr->latched = ds->latches[fr->door];
+        if (!fr->latched) {
+            *out = DOOR_UNLOCKER;
+            DOOR_AWAIT(ds, fr, 1 << DOOR_LATCH, DOOR_LATCH_MS);
+            fr->latched = (fr->event == DOOR_LATCH);
+        }
+        *out = 0;
+        DOOR_AWAIT(ds, fr, 0, DOOR_OPEN_MS);
+    }
+
+    // Activate the bolt locker, then show whether the door was opened and hold
+    // the display
+    *out = DOOR_LOCKER;
+    DOOR_AWAIT(ds, fr, 0, DOOR_LOCK_MS);
+    *out = 0;
+    if (!fr->latched)
+        ds->timeouts++;
+    DOOR_AWAIT(ds, fr, 0, DOOR_HOLD_MS);
+    CO_END(fr);
+}
+
+
+#endif /* _CONTROLLER_DOOR_H */
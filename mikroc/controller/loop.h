@@ -0,0 +1,149 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CONTROLLER_LOOP_H
+#define _CONTROLLER_LOOP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+
+#include "timer.h"
+
+
+// This is the event loop of a host controller, which runs every door on a
+// single thread. It waits on the file descriptors of the receivers and sensors
+// with poll(), sleeping no longer than until the next timer of the wheel, and
+// passes everything that happened to a single function as a kind and an
+// argument, much like the event types of a simulation. The ticks of the wheel
+// are milliseconds of the monotonic clock since the loop started, which is the
+// resolution of every delay_ms() in the firmware.
+
+#define LOOP_MAX_FDS  1024
+#define LOOP_TICK_NS  1000000
+
+
+/* An event loop of timers and file descriptors */
+struct loop {
+    struct timer_wheel tw;
+    uint64_t start; // The monotonic time of tick 0 in nanoseconds
+    wheel_fn fn;
+    void* ctx;
+
+    struct pollfd fds[LOOP_MAX_FDS];
+    uint16_t fd_kinds[LOOP_MAX_FDS];
+    uint32_t fd_args[LOOP_MAX_FDS];
+    int num_fds;
+    int stop;
+};
+
+
+int loop_init(struct loop* lp, uint32_t max_timers, wheel_fn fn, void* ctx);
+void loop_free(struct loop* lp);
+uint64_t loop_clock();
+uint64_t loop_now(const struct loop* lp);
+int64_t loop_after(struct loop* lp, uint64_t ms, uint16_t kind, uint32_t arg);
+int loop_cancel(struct loop* lp, uint32_t id);
+int loop_watch(struct loop* lp, int fd, uint16_t kind, uint32_t arg);
+int loop_run_once(struct loop* lp, int max_wait);
+void loop_run(struct loop* lp);
+
+
+// Set up a loop for up to max_timers armed timers that passes every event to
+// fn. A timer is passed with its id, and a file descriptor that is ready to be
+// read with the index it was watched at. Returns -1 if out of memory.
+int loop_init(struct loop* lp, uint32_t max_timers, wheel_fn fn, void* ctx) {
+    memset(lp, 0, sizeof(*lp));
+    lp->start = loop_clock();
+    lp->fn = fn;
+    lp->ctx = ctx;
+    return wheel_init(&lp->tw, max_timers, 0);
+}
+
+
+// Release the memory of a loop.
+void loop_free(struct loop* lp) {
+    wheel_free(&lp->tw);
+    memset(lp, 0, sizeof(*lp));
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t loop_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return the current tick of a loop.
+uint64_t loop_now(const struct loop* lp) {
+    return (loop_clock() - lp->start) / LOOP_TICK_NS;
+}
+
+
+// Arm a timer that fires after the given number of milliseconds. Returns the
+// id of the timer, or -1 if every timer is armed.
+int64_t loop_after(struct loop* lp, uint64_t ms, uint16_t kind, uint32_t arg) {
+    return wheel_add(&lp->tw, loop_now(lp) + ms, kind, arg);
+}
+
+
+// Disarm a timer that has not fired yet. Returns -1 if it is not armed.
+int loop_cancel(struct loop* lp, uint32_t id) {
+    return wheel_cancel(&lp->tw, id);
+}
+
+
+// Watch a file descriptor for input. Returns -1 if too many are watched.
+int loop_watch(struct loop* lp, int fd, uint16_t kind, uint32_t arg) {
+    if (lp->num_fds >= LOOP_MAX_FDS) {
+        fprintf(stderr, "Too many file descriptors\n");
+        return -1;
+    }
+    lp->fds[lp->num_fds].fd = fd;
+    lp->fds[lp->num_fds].events = POLLIN;
+    lp->fd_kinds[lp->num_fds] = kind;
+    lp->fd_args[lp->num_fds] = arg;
+    return lp->num_fds++;
+}
+
+
+// Wait up to max_wait milliseconds for input or the next timer, or forever if
+// max_wait is negative, and pass on everything that happened. Returns the
+// number of events, or -1 if poll() failed.
+int loop_run_once(struct loop* lp, int max_wait) {
+    uint64_t next = wheel_next(&lp->tw), now = loop_now(lp);
+    int wait = max_wait, num, idx, events = 0;
+
+    if (next != UINT64_MAX) {
+        uint64_t until = (next > now) ? next - now : 0;
+        if (wait < 0 || until < (uint64_t)wait)
+            wait = until;
+    }
+    if ((num = poll(lp->fds, lp->num_fds, wait)) < 0) {
+        perror("poll");
+        return -1;
+    }
+    for (idx = 0; idx < lp->num_fds && num > 0; idx++) {
+        if (lp->fds[idx].revents) {
+            lp->fn(lp->ctx, idx, lp->fd_kinds[idx], lp->fd_args[idx]);
+            events++;
+            num--;
+        }
+    }
+    return events + wheel_advance(&lp->tw, loop_now(lp), lp->fn, lp->ctx);
+}
+
+
+// Run the loop until stop is set.
+void loop_run(struct loop* lp) {
+    while (!lp->stop && loop_run_once(lp, -1) >= 0)
+        ;
+}
+
+
+#endif /* _CONTROLLER_LOOP_H */
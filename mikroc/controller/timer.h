@@ -0,0 +1,272 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CONTROLLER_TIMER_H
+#define _CONTROLLER_TIMER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This is a hierarchical timing wheel for the many timeouts of a controller
+// that drives many doors, such as the display holds of process_load() and the
+// motor phases of bolt_unlock(). Time is counted in ticks, and the wheel has
+// four levels of 256 slots, each level 256 times coarser:
+//
+//  level 0:  One slot per tick, for timers within the current 256 ticks
+//  level 1:  One slot per 256 ticks, for timers within the current 65536
+//  level 2:  One slot per 65536 ticks, and so on
+//
+// A timer goes into the lowest level whose slot is still ahead of the current
+// time, found from the highest byte in which its expiry differs from now. When
+// the low bytes of now wrap to zero, the next slot of each coarser level is
+// cascaded down. Adding and cancelling a timer are constant time, since the
+// slots are doubly linked lists, and advancing jumps over empty slots with the
+// bitmaps of occupied ones. Expiry is batched, as every timer in a slot fires
+// in one go, at tick resolution. Timers beyond the range of the top level wait
+// in an overflow list until the top level wraps.
+
+#define WHEEL_BITS    8
+#define WHEEL_SLOTS   (1 << WHEEL_BITS)
+#define WHEEL_LEVELS  4
+#define WHEEL_NIL     0xFFFFFFFF
+#define WHEEL_IDLE    0xFFFF  // Slot of a timer that is not armed
+#define WHEEL_OVER    (WHEEL_LEVELS * WHEEL_SLOTS) // Slot of the overflow list
+
+
+/* A timer in the wheel */
+struct wheel_timer {
+    uint64_t expires;
+    uint32_t next, prev; // Links in the list of the slot, or the free list
+    uint16_t slot;       // The slot that the timer is in, or WHEEL_IDLE
+    uint16_t kind;       // What the timer is for, passed back when it fires
+    uint32_t arg;
+};
+
+/* A hierarchical timing wheel */
+struct timer_wheel {
+    uint64_t now; // The last tick that was processed
+    uint32_t slots[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+    uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+    struct wheel_timer* timers;
+    uint32_t max_timers;
+    uint32_t free;
+    uint32_t num_armed;
+};
+
+/* The function that fired timers are passed to */
+typedef void (*wheel_fn)(void* ctx, uint32_t id, uint16_t kind, uint32_t arg);
+
+
+int wheel_init(struct timer_wheel* tw, uint32_t max_timers, uint64_t now);
+void wheel_free(struct timer_wheel* tw);
+int64_t wheel_add(struct timer_wheel* tw, uint64_t expires, uint16_t kind, uint32_t arg);
+int wheel_cancel(struct timer_wheel* tw, uint32_t id);
+int wheel_advance(struct timer_wheel* tw, uint64_t now, wheel_fn fn, void* ctx);
+uint64_t wheel_next(const struct timer_wheel* tw);
+void wheel_link(struct timer_wheel* tw, uint32_t id);
+void wheel_unlink(struct timer_wheel* tw, uint32_t id);
+void wheel_cascade(struct timer_wheel* tw, uint32_t slot);
+int wheel_scan(const uint64_t* occupied, int from);
+
+
+// Set up an empty wheel for up to max_timers armed timers at the given tick.
+// Returns -1 if out of memory.
+int wheel_init(struct timer_wheel* tw, uint32_t max_timers, uint64_t now) {
+    uint32_t idx;
+
+    memset(tw, 0, sizeof(*tw));
+    memset(tw->slots, 0xFF, sizeof(tw->slots));
+    tw->now = now;
+    tw->max_timers = max_timers;
+    tw->timers = malloc(max_timers*sizeof(*tw->timers));
+    if (tw->timers == NULL) {
+        fprintf(stderr, "Could not allocate the timers\n");
+        return -1;
+    }
+    for (idx = 0; idx < max_timers; idx++) {
+        tw->timers[idx].next = (idx+1 < max_timers) ? idx+1 : WHEEL_NIL;
+        tw->timers[idx].slot = WHEEL_IDLE;
+    }
+    tw->free = max_timers ? 0 : WHEEL_NIL;
+    return 0;
+}
+
+
+// Release the memory of a wheel.
+void wheel_free(struct timer_wheel* tw) {
+    free(tw->timers);
+    memset(tw, 0, sizeof(*tw));
+}
+
+
+// Arm a timer that fires at the given tick, or on the next tick if that has
+// already passed. Returns the id of the timer, or -1 if every timer is armed.
+int64_t wheel_add(struct timer_wheel* tw, uint64_t expires, uint16_t kind, uint32_t arg) {
+    uint32_t id = tw->free;
+
+    if (id == WHEEL_NIL)
+        return -1;
+    tw->free = tw->timers[id].next;
+    tw->timers[id].expires = (expires > tw->now) ? expires : tw->now + 1;
+    tw->timers[id].kind = kind;
+    tw->timers[id].arg = arg;
+    wheel_link(tw, id);
+    tw->num_armed++;
+    return id;
+}
+
+
+// Disarm a timer that has not fired yet. Returns -1 if it is not armed.
+int wheel_cancel(struct timer_wheel* tw, uint32_t id) {
+    if (id >= tw->max_timers || tw->timers[id].slot == WHEEL_IDLE)
+        return -1;
+    wheel_unlink(tw, id);
+    tw->timers[id].next = tw->free;
+    tw->free = id;
+    tw->num_armed--;
+    return 0;
+}
+
+
+// Process every tick up to now, passing each timer that fires to fn. A timer
+// is disarmed before it is passed on, so fn may arm it again or arm others.
+// Returns the number of timers that fired.
+int wheel_advance(struct timer_wheel* tw, uint64_t now, wheel_fn fn, void* ctx) {
+    int fired = 0, level;
+
+    while (tw->now < now) {
+        // Jump to the next occupied slot of level 0 or the end of its turn
+        uint64_t base = tw->now & ~(uint64_t)(WHEEL_SLOTS-1);
+        int idx = wheel_scan(tw->occupied[0], (tw->now & (WHEEL_SLOTS-1)) + 1);
+        uint64_t tick = (idx >= 0) ? base + idx : base + WHEEL_SLOTS;
+        if (tick > now) {
+            tw->now = now;
+            break;
+        }
+        tw->now = tick;
+
+        // Cascade the slots of the coarser levels whose turn has come
+        if ((tick & (WHEEL_SLOTS-1)) == 0) {
+            for (level = WHEEL_LEVELS-1; level > 0; level--) {
+                if (tick & (((uint64_t)1 << (level*WHEEL_BITS)) - 1))
+                    continue;
+                if (level == WHEEL_LEVELS-1 && ((tick >> (level*WHEEL_BITS)) & (WHEEL_SLOTS-1)) == 0)
+                    wheel_cascade(tw, WHEEL_OVER);
+                wheel_cascade(tw, level*WHEEL_SLOTS + ((tick >> (level*WHEEL_BITS)) & (WHEEL_SLOTS-1)));
+            }
+        }
+
+        // Fire every timer in the slot of this tick
+        uint32_t slot = tick & (WHEEL_SLOTS-1), id;
+        while ((id = tw->slots[slot]) != WHEEL_NIL) {
+            struct wheel_timer* tm = &tw->timers[id];
+            wheel_cancel(tw, id);
+            fn(ctx, id, tm->kind, tm->arg);
+            fired++;
+        }
+    }
+    return fired;
+}
+
+
+// Return the earliest tick at which a timer may fire, which is exact for
+// timers in level 0 and the start of the slot for the coarser levels. Timers in
+// the overflow list are cascaded at the next wrap of the top level, which is
+// returned for them. Returns UINT64_MAX if no timer is armed.
+uint64_t wheel_next(const struct timer_wheel* tw) {
+    int level, idx;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = level * WHEEL_BITS;
+        idx = wheel_scan(tw->occupied[level], ((tw->now >> shift) & (WHEEL_SLOTS-1)) + 1);
+        if (idx >= 0) {
+            uint64_t turn = tw->now >> (shift + WHEEL_BITS) << (shift + WHEEL_BITS);
+            return turn + ((uint64_t)idx << shift);
+        }
+    }
+    if (tw->slots[WHEEL_OVER] != WHEEL_NIL)
+        return ((tw->now >> (WHEEL_LEVELS*WHEEL_BITS)) + 1) << (WHEEL_LEVELS*WHEEL_BITS);
+    return UINT64_MAX;
+}
+
+
+// Put an armed timer into the slot for its expiry, as described above.
+void wheel_link(struct timer_wheel* tw, uint32_t id) {
+    struct wheel_timer* tm = &tw->timers[id];
+    uint64_t diff = tm->expires ^ tw->now;
+    uint32_t slot = WHEEL_OVER;
+    int level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if ((diff >> ((level+1) * WHEEL_BITS)) == 0) {
+            uint32_t idx = (tm->expires >> (level*WHEEL_BITS)) & (WHEEL_SLOTS-1);
+            tw->occupied[level][idx / 64] |= (uint64_t)1 << (idx % 64);
+            slot = level*WHEEL_SLOTS + idx;
+            break;
+        }
+    }
+    tm->slot = slot;
+    tm->prev = WHEEL_NIL;
+    tm->next = tw->slots[slot];
+    if (tm->next != WHEEL_NIL)
+        tw->timers[tm->next].prev = id;
+    tw->slots[slot] = id;
+}
+
+
+// Take an armed timer out of its slot.
+void wheel_unlink(struct timer_wheel* tw, uint32_t id) {
+    struct wheel_timer* tm = &tw->timers[id];
+
+    if (tm->prev != WHEEL_NIL)
+        tw->timers[tm->prev].next = tm->next;
+    else
+        tw->slots[tm->slot] = tm->next;
+    if (tm->next != WHEEL_NIL)
+        tw->timers[tm->next].prev = tm->prev;
+    if (tw->slots[tm->slot] == WHEEL_NIL && tm->slot != WHEEL_OVER) {
+        uint32_t level = tm->slot / WHEEL_SLOTS, idx = tm->slot % WHEEL_SLOTS;
+        tw->occupied[level][idx / 64] &= ~((uint64_t)1 << (idx % 64));
+    }
+    tm->slot = WHEEL_IDLE;
+}
+
+
+// Move every timer in a slot of a coarser level down to where it now belongs.
+// Timers from the overflow list may go back into it.
+void wheel_cascade(struct timer_wheel* tw, uint32_t slot) {
+    uint32_t id = tw->slots[slot], next;
+
+    tw->slots[slot] = WHEEL_NIL;
+    if (slot != WHEEL_OVER)
+        tw->occupied[slot / WHEEL_SLOTS][slot % WHEEL_SLOTS / 64] &= ~((uint64_t)1 << (slot % 64));
+    for (; id != WHEEL_NIL; id = next) {
+        next = tw->timers[id].next;
+        wheel_link(tw, id);
+    }
+}
+
+
+// Return the first occupied slot at or after from in a level, or -1.
+int wheel_scan(const uint64_t* occupied, int from) {
+    int word = from / 64;
+    uint64_t bits;
+
+    if (from >= WHEEL_SLOTS)
+        return -1;
+    bits = occupied[word] & (~(uint64_t)0 << (from % 64));
+    while (1) {
+        if (bits)
+            return word*64 + __builtin_ctzll(bits);
+        if (++word >= WHEEL_SLOTS / 64)
+            return -1;
+        bits = occupied[word];
+    }
+}
+
+
+#endif /* _CONTROLLER_TIMER_H */
@@ -0,0 +1,88 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CRYPTO_CIPHER_H
+#define _CRYPTO_CIPHER_H
+
+#include "types.h"
+
+
+// This selects the block cipher that protects the rolling code. The cipher
+// number is sent in the frame version field, so that a receiver can accept
+// remotes using either cipher during a migration. Define CIPHER before
+// including this file to select the cipher:
+//
+//  CIPHER_BLOWFISH  BlowFish32 only (the default)
+//  CIPHER_SPECK     Speck32/64 only
+//  CIPHER_ALL       Both ciphers, chosen by the version field of each frame
+//
+// The subkeys of every selected cipher must be declared by key.h beforehand.
+
+#define CIPHER_BLOWFISH 0
+#define CIPHER_SPECK    1
+#define CIPHER_ALL      0xFF
+
+#ifndef CIPHER
+#define CIPHER CIPHER_BLOWFISH
+#endif
+
+#if CIPHER == CIPHER_BLOWFISH || CIPHER == CIPHER_ALL
+#include "blowfish.h"
+#endif
+#if CIPHER == CIPHER_SPECK || CIPHER == CIPHER_ALL
+#include "speck.h"
+#endif
+
+
+// HACK(jtsai): MikroC cannot call through function pointers into ROM tables
+//  cheaply. When a single cipher is selected, the cipher functions are plain
+//  macros so that no dispatch code is generated for the transmitter.
+#if CIPHER == CIPHER_BLOWFISH
+#define cipher_setkeys()        blowfish_setkeys(arr_p, arr_s1, arr_s2, arr_s3, arr_s4)
+#define cipher_valid(ver)       ((ver) == CIPHER_BLOWFISH)
+#define cipher_encrypt(ver, x)  blowfish_encrypt(x)
+#define cipher_decrypt(ver, x)  blowfish_decrypt(x)
+#elif CIPHER == CIPHER_SPECK
+#define cipher_setkeys()        speck_setkeys(arr_rk)
+#define cipher_valid(ver)       ((ver) == CIPHER_SPECK)
+#define cipher_encrypt(ver, x)  speck_encrypt(x)
+#define cipher_decrypt(ver, x)  speck_decrypt(x)
+#else
+void cipher_setkeys();
+short cipher_valid(short ver);
+uint32_t cipher_encrypt(short ver, uint32_t data);
+uint32_t cipher_decrypt(short ver, uint32_t data);
+
+
+// Load the keys of every cipher.
+void cipher_setkeys() {
+    blowfish_setkeys(arr_p, arr_s1, arr_s2, arr_s3, arr_s4);
+    speck_setkeys(arr_rk);
+}
+
+
+// Report whether the version field names a known cipher.
+short cipher_valid(short ver) {
+    return (ver == CIPHER_BLOWFISH || ver == CIPHER_SPECK);
+}
+
+
+// Encrypt a single 4-byte block with the cipher of the given version.
+uint32_t cipher_encrypt(short ver, uint32_t data) {
+    if (ver == CIPHER_SPECK)
+        return speck_encrypt(data);
+    return blowfish_encrypt(data);
+}
+
+
+// Decrypt a single 4-byte block with the cipher of the given version.
+uint32_t cipher_decrypt(short ver, uint32_t data) {
+    if (ver == CIPHER_SPECK)
+        return speck_decrypt(data);
+    return blowfish_decrypt(data);
+}
+#endif
+
+
+#endif /* _CRYPTO_CIPHER_H */
@@ -0,0 +1,62 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CRYPTO_MAC_H
+#define _CRYPTO_MAC_H
+
+#include "types.h"
+#include "speck.h"
+
+
+/* The number of Speck rounds per block of the MAC */
+#define MAC_ROUNDS 6
+
+
+/* Global variables */
+static const uint16_t* _key_mk;
+
+
+// HACK(jtsai): See blowfish.h for why the code lives in the header file.
+void mac_setkeys(const uint16_t* mk);
+uint16_t mac_tag(uint8_t* data);
+uint32_t mac_block(uint32_t data);
+
+
+// Set the round keys of the frame MAC.
+void mac_setkeys(const uint16_t* mk) {
+    _key_mk = mk;
+}
+
+
+// Compute the 16-bit truncated MAC over the first 8 bytes of a message. This is
+// a CBC-MAC over a reduced round Speck32/64, which lets the receiver throw away
+// forged messages without decrypting them or reading any channel state.
+uint16_t mac_tag(uint8_t* data) {
+    uint32_t block;
+
+    block = mac_block(*((uint32_t*)data));
+    block = mac_block(block ^ *((uint32_t*)(data+4)));
+    return (block >> 16) ^ block;
+}
+
+
+// Run the reduced round Speck32/64 used by the MAC on a single block.
+uint32_t mac_block(uint32_t data) {
+    short idx;
+    uint16_t data_hi = data >> 16;
+    uint16_t data_lo = data;
+
+    for (idx = 0; idx < MAC_ROUNDS; idx++) {
+        data_hi = SPECK_ROR16(data_hi, 7);
+        data_hi += data_lo;
+        data_hi ^= _key_mk[idx];
+        data_lo = SPECK_ROL16(data_lo, 2);
+        data_lo ^= data_hi;
+    }
+
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+#endif /* _CRYPTO_MAC_H */
@@ -0,0 +1,74 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _CRYPTO_SPECK_H
+#define _CRYPTO_SPECK_H
+
+#include "types.h"
+
+
+/* Helper macros */
+#define SPECK_ROL16(x, n) (((x) << (n)) | ((x) >> (16-(n))))
+#define SPECK_ROR16(x, n) (((x) >> (n)) | ((x) << (16-(n))))
+
+/* The number of rounds, each of which uses one round key */
+#define SPECK_ROUNDS 22
+
+
+/* Global variables */
+static const uint16_t* _key_rk;
+
+
+// HACK(jtsai): See blowfish.h for why the code lives in the header file.
+void speck_setkeys(const uint16_t* rk);
+uint32_t speck_encrypt(uint32_t data);
+uint32_t speck_decrypt(uint32_t data);
+
+
+// Set the Speck32/64 round keys that will be used for all encryption and
+// decryption operations. The round keys are expanded ahead of time by key_gen,
+// which keeps them in ROM just like the BlowFish32 subkeys.
+void speck_setkeys(const uint16_t* rk) {
+    _key_rk = rk;
+}
+
+
+// Run Speck32/64 encryption for a single 4-byte block. Each round is only a
+// 16-bit rotate, add and XOR, which avoids the table lookups of BlowFish32.
+uint32_t speck_encrypt(uint32_t data) {
+    short idx;
+    uint16_t data_hi = data >> 16;
+    uint16_t data_lo = data;
+
+    for (idx = 0; idx < SPECK_ROUNDS; idx++) {
+        data_hi = SPECK_ROR16(data_hi, 7);
+        data_hi += data_lo;
+        data_hi ^= _key_rk[idx];
+        data_lo = SPECK_ROL16(data_lo, 2);
+        data_lo ^= data_hi;
+    }
+
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+// Run Speck32/64 decryption for a single 4-byte block.
+uint32_t speck_decrypt(uint32_t data) {
+    short idx;
+    uint16_t data_hi = data >> 16;
+    uint16_t data_lo = data;
+
+    for (idx = SPECK_ROUNDS-1; idx >= 0; idx--) {
+        data_lo ^= data_hi;
+        data_lo = SPECK_ROR16(data_lo, 2);
+        data_hi ^= _key_rk[idx];
+        data_hi -= data_lo;
+        data_hi = SPECK_ROL16(data_hi, 7);
+    }
+
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+#endif /* _CRYPTO_SPECK_H */
@@ -0,0 +1,261 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _DOOR_SIM_CALENDAR_H
+#define _DOOR_SIM_CALENDAR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This is a calendar queue of timed events, as described by R. Brown in 1988.
+// The events are hashed by time into a ring of buckets, each as wide as a
+// typical gap between events, like the days of a year on a desk calendar:
+//
+//  push:  Insert the event in time order into the bucket of its day
+//  pop:   Walk the ring from the bucket of the last event, taking the first
+//         event that falls within the current year of each bucket
+//
+// Each bucket holds only a few events, so both take constant time on average
+// regardless of the number of events. The ring doubles and halves with the
+// number of events, and the bucket width is then picked afresh from the gaps
+// between the next few events. Events at the same time pop in the order that
+// they were pushed. The events live in a pool that grows as needed and are
+// linked by index, so popping an event never frees memory.
+
+#define CALENDAR_NIL      0xFFFFFFFF
+#define CALENDAR_MIN      16   // The fewest buckets in the ring
+#define CALENDAR_SAMPLE   25   // Number of events sampled to pick the width
+
+
+/* An event in the calendar */
+struct cal_event {
+    uint64_t time;
+    uint32_t next; // The next event in the bucket or free list
+    uint32_t type;
+    uint32_t arg;
+    uint32_t seq;  // The order in which events at the same time were pushed
+};
+
+/* A calendar queue of events */
+struct calendar {
+    struct cal_event* events;
+    uint32_t max_events;
+    uint32_t free; // The first unused event
+
+    uint32_t* buckets;
+    uint32_t num_buckets; // Always a power of two
+    uint64_t width;
+    uint32_t cur;  // The bucket of the last event popped
+    uint64_t top;  // The end of the current year of that bucket
+    uint64_t now;  // The time of the last event popped
+    uint32_t size;
+    uint32_t seq;
+    int resizing;
+};
+
+
+int calendar_init(struct calendar* cal, uint64_t width);
+void calendar_free(struct calendar* cal);
+int calendar_push(struct calendar* cal, uint64_t time, uint32_t type, uint32_t arg);
+int calendar_pop(struct calendar* cal, struct cal_event* ev);
+uint32_t calendar_take(struct calendar* cal);
+void calendar_insert(struct calendar* cal, uint32_t idx);
+int calendar_resize(struct calendar* cal, uint32_t num_buckets);
+
+
+// Set up an empty calendar with the given initial bucket width. Returns -1 if
+// out of memory.
+int calendar_init(struct calendar* cal, uint64_t width) {
+    memset(cal, 0, sizeof(*cal));
+    cal->free = CALENDAR_NIL;
+    cal->num_buckets = CALENDAR_MIN;
+    cal->width = width ? width : 1;
+    cal->top = cal->width;
+    cal->buckets = malloc(CALENDAR_MIN*sizeof(*cal->buckets));
+    if (cal->buckets == NULL) {
+        fprintf(stderr, "Could not allocate the calendar\n");
+        return -1;
+    }
+    memset(cal->buckets, 0xFF, CALENDAR_MIN*sizeof(*cal->buckets));
+    return 0;
+}
+
+
+// Release the memory of a calendar.
+void calendar_free(struct calendar* cal) {
+    free(cal->events);
+    free(cal->buckets);
+    memset(cal, 0, sizeof(*cal));
+}
+
+
+// Schedule an event at a time no earlier than the last event popped. Returns
+// -1 if out of memory.
+int calendar_push(struct calendar* cal, uint64_t time, uint32_t type, uint32_t arg) {
+    uint32_t idx;
+
+    // Take an event from the free list, or grow the pool
+    if (cal->free == CALENDAR_NIL) {
+        uint32_t num = cal->max_events ? 2*cal->max_events : 1024;
+        struct cal_event* events = realloc(cal->events, num*sizeof(*events));
+        if (events == NULL) {
+            fprintf(stderr, "Could not grow the calendar\n");
+            return -1;
+        }
+        for (idx = cal->max_events; idx < num; idx++)
+            events[idx].next = (idx+1 < num) ? idx+1 : CALENDAR_NIL;
+        cal->free = cal->max_events;
+        cal->events = events;
+        cal->max_events = num;
+    }
+    idx = cal->free;
+    cal->free = cal->events[idx].next;
+
+    cal->events[idx].time = time;
+    cal->events[idx].type = type;
+    cal->events[idx].arg = arg;
+    cal->events[idx].seq = cal->seq++;
+    calendar_insert(cal, idx);
+    if (++cal->size > 2*cal->num_buckets && !cal->resizing)
+        return calendar_resize(cal, 2*cal->num_buckets);
+    return 0;
+}
+
+
+// Remove the earliest event and store it in ev. Returns -1 if the calendar is
+// empty.
+int calendar_pop(struct calendar* cal, struct cal_event* ev) {
+    uint32_t idx;
+
+    if (cal->size == 0)
+        return -1;
+    idx = calendar_take(cal);
+    *ev = cal->events[idx];
+    cal->events[idx].next = cal->free;
+    cal->free = idx;
+    if (cal->size < cal->num_buckets/2 && cal->num_buckets > CALENDAR_MIN && !cal->resizing)
+        return calendar_resize(cal, cal->num_buckets/2);
+    return 0;
+}
+
+
+// Unlink the earliest event from its bucket and return its index. The
+// calendar must not be empty.
+uint32_t calendar_take(struct calendar* cal) {
+    uint32_t mask = cal->num_buckets - 1;
+    uint32_t bkt = cal->cur, idx, num;
+
+    // Walk one year of the ring from the current bucket
+    for (num = 0; num < cal->num_buckets; num++) {
+        idx = cal->buckets[bkt];
+        if (idx != CALENDAR_NIL && cal->events[idx].time < cal->top)
+            goto found;
+        bkt = (bkt+1) & mask;
+        cal->top += cal->width;
+    }
+
+    // Every event is more than a year away, so jump to the earliest one
+    idx = CALENDAR_NIL;
+    for (num = 0; num < cal->num_buckets; num++) {
+        uint32_t head = cal->buckets[num];
+        if (head != CALENDAR_NIL && (idx == CALENDAR_NIL || cal->events[head].time < cal->events[idx].time)) {
+            idx = head;
+            bkt = num;
+        }
+    }
+    cal->top = (cal->events[idx].time / cal->width + 1) * cal->width;
+
+found:
+    cal->buckets[bkt] = cal->events[idx].next;
+    cal->cur = bkt;
+    cal->now = cal->events[idx].time;
+    cal->size--;
+    return idx;
+}
+
+
+// Link an event into its bucket after every event that comes before it.
+void calendar_insert(struct calendar* cal, uint32_t idx) {
+    const struct cal_event* ev = &cal->events[idx];
+    uint32_t* link = &cal->buckets[(ev->time / cal->width) & (cal->num_buckets-1)];
+
+    while (*link != CALENDAR_NIL && (cal->events[*link].time < ev->time ||
+            (cal->events[*link].time == ev->time && (int32_t)(cal->events[*link].seq - ev->seq) < 0)))
+        link = &cal->events[*link].next;
+    cal->events[idx].next = *link;
+    *link = idx;
+}
+
+
+// Rebuild the ring with a new number of buckets and a bucket width picked from
+// the gaps between the next few events. Large gaps are left out of the
+// average, since they are the ends of bursts rather than the typical spacing.
+// Returns -1 if out of memory.
+int calendar_resize(struct calendar* cal, uint32_t num_buckets) {
+    uint32_t sample[CALENDAR_SAMPLE], *buckets, head = CALENDAR_NIL;
+    uint32_t idx, num, bkt, cnt = 0, size = cal->size;
+    uint64_t gaps = 0, span, width, now = cal->now;
+
+    buckets = malloc(num_buckets*sizeof(*buckets));
+    if (buckets == NULL) {
+        fprintf(stderr, "Could not resize the calendar\n");
+        return -1;
+    }
+
+    // Measure the spacing of the next events
+    cal->resizing = 1;
+    for (num = 0; num < CALENDAR_SAMPLE && cal->size > 0; num++)
+        sample[num] = calendar_take(cal);
+    width = cal->width;
+    if (num > 1) {
+        span = cal->events[sample[num-1]].time - cal->events[sample[0]].time;
+        for (idx = 1; idx < num; idx++) {
+            uint64_t gap = cal->events[sample[idx]].time - cal->events[sample[idx-1]].time;
+            if (gap * (num-1) <= 2*span) {
+                gaps += gap;
+                cnt++;
+            }
+        }
+        if (cnt > 0 && gaps > 0)
+            width = 3 * gaps / cnt;
+        if (width == 0)
+            width = 1;
+    }
+
+    // Collect every event and hash them into the new ring
+    for (bkt = 0; bkt < cal->num_buckets; bkt++) {
+        while ((idx = cal->buckets[bkt]) != CALENDAR_NIL) {
+            cal->buckets[bkt] = cal->events[idx].next;
+            cal->events[idx].next = head;
+            head = idx;
+        }
+    }
+    while (num > 0) {
+        cal->events[sample[--num]].next = head;
+        head = sample[num];
+    }
+    free(cal->buckets);
+    cal->buckets = buckets;
+    cal->num_buckets = num_buckets;
+    cal->width = width;
+    memset(buckets, 0xFF, num_buckets*sizeof(*buckets));
+    while ((idx = head) != CALENDAR_NIL) {
+        head = cal->events[idx].next;
+        calendar_insert(cal, idx);
+    }
+
+    // Restart the walk from the time of the last event popped
+    cal->size = size;
+    cal->now = now;
+    cal->cur = (now / width) & (num_buckets-1);
+    cal->top = (now / width + 1) * width;
+    cal->resizing = 0;
+    return 0;
+}
+
+
+#endif /* _DOOR_SIM_CALENDAR_H */
@@ -0,0 +1,410 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "calendar.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+#define MS(x) ((uint64_t)(x) * 1000)
+
+/* Timing of the transmitter firmware in microseconds. The bounds of the wcet
+   tool are used as the durations of the code that is not a delay_ms(). */
+#define BYTE_TIME     27285   // man_send() of a byte and the delay_ms(5) after it
+#define NUM_BURSTS    16      // Number of times transmit_code() sends a message
+
+/* Timing of the receiver firmware in microseconds */
+#define LOAD_TIME     885708  // process_code() until the checks of process_load(),
+                              // most of which is writing to the LCD
+#define WRITE_TIME    MS(80)  // write_channel_code()
+#define UNLOCK_TIME   MS(450) // bolt_unlock() until it polls the latch
+#define LATCH_STEP    MS(5)   // Each poll of the latch
+#define RELOCK_TIME   MS(2000)// bolt_unlock() after the latch opens
+#define HOLD_TIME     MS(3000)// process_load() after an accepted message
+#define STALL_TIME    MS(5000)// process_load() after a rejected message
+#define CLEAR_TIME    11086   // process_code() after process_load()
+#define ROLLING_WINDOW 0x0400
+
+/* Behaviour of the people using the doors */
+#define LATCH_STEPS   40      // Most polls until the door is pushed open
+#define THINK_TIME    MS(1000)// Mean time before pressing again
+#define MAX_PRESSES   8       // Presses before giving up on a door
+#define MAX_WAITS     (1 << 16)
+
+/* Kinds of events */
+enum event_type { EV_ARRIVE, EV_PRESS, EV_BURST_START, EV_BURST_END, EV_ENTRY };
+
+/* States of a person with a fob */
+enum fob_state { FOB_AWAY, FOB_WAITING, FOB_SERVED };
+
+
+/* A remote and the person holding it */
+struct fob {
+    uint32_t door;   // The door that the fob is enrolled at
+    uint32_t code;   // The rolling code of the transmitter
+    uint32_t stored; // The rolling code that the door expects next
+    uint32_t burst;  // The current burst of the transmission
+    uint64_t first;  // When the person first pressed the button
+    uint8_t state;
+    uint8_t bursts;  // Bursts sent of the current press
+    uint8_t presses; // Presses since arriving at the door
+};
+
+/* A door and its receiver */
+struct door {
+    uint64_t busy_until; // When process_code() returns to receive_code()
+    uint64_t air_until;  // When the last burst heard by the receiver ends
+    uint32_t burst;      // The burst that the receiver can decode, or NIL
+    uint32_t fob;        // The fob being let in
+    uint8_t listening;   // Whether receive_code() was waiting when it began
+};
+
+/* Results of a simulation */
+struct results {
+    uint64_t events, arrivals, presses, entries, gave_up;
+    uint64_t bursts, collided, stalls;
+    double p50, p95, p99, secs;
+};
+
+
+/* Global variables */
+int num_doors = 1000;
+int fobs_per_door = 0;
+int range = 0;
+int mac_frames = 0;
+double rate = 6;
+double hours = 1;
+double target = 2;
+uint64_t rng_state;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: door_sim [-d doors] [-f fobs] [-r rate] [-t hours] [-x range] [-w secs] [-m] [-q]\n\n"
+    "Simulates a building of doors running the receiver firmware and the people\n"
+    "with remotes who use them. Each press sends 16 bursts that take as long as\n"
+    "transmit_code() does, and bursts that overlap at a receiver collide. While a\n"
+    "door runs process_load() and bolt_unlock() its receiver is deaf, so the\n"
+    "people who arrive meanwhile press again until they are let in. The entry\n"
+    "wait is from the first press until the latch opens.\n\n"
+    "Without -f, the number of fobs per door is swept to find the most that\n"
+    "keep the p95 entry wait within the target.\n\n"
+    "    -d doors   Number of doors (default: 1000)\n"
+    "    -f fobs    Number of fobs per door (default: sweep)\n"
+    "    -r rate    Arrivals per fob per hour (default: 6)\n"
+    "    -t hours   Simulated time (default: 1)\n"
+    "    -x range   Number of neighbouring doors on each side that hear a fob\n"
+    "               (default: 0)\n"
+    "    -w secs    The p95 entry wait target (default: 2)\n"
+    "    -m         Send MAC frames instead of CRC frames\n"
+    "    -q         Measure the calendar queue alone\n"
+);
+
+
+int simulate(int num_fobs, struct results* res);
+void hear_start(struct door* door, uint32_t burst, uint64_t now, uint64_t end);
+int hear_end(struct calendar* cal, struct door* doors, struct fob* fobs, int door, int fob, struct results* res);
+void bench_queue();
+double percentile(uint32_t* hist, uint64_t num, double pct);
+double rand_exp(double mean);
+uint64_t rand64();
+double now();
+
+
+int main(int argc, char* argv[]) {
+    const int sweep[] = {1, 2, 4, 8, 16, 32, 64, 128};
+    int num_sweep = sizeof(sweep)/sizeof(sweep[0]);
+    int opt, idx, best = 0, queue = 0;
+    struct results res;
+
+    while ((opt = getopt(argc, argv, "d:f:r:t:x:w:mqh")) != -1) {
+        switch (opt) {
+        case 'd': num_doors = atoi(optarg); break;
+        case 'f': fobs_per_door = atoi(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 't': hours = atof(optarg); break;
+        case 'x': range = atoi(optarg); break;
+        case 'w': target = atof(optarg); break;
+        case 'm': mac_frames = 1; break;
+        case 'q': queue = 1; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_doors < 1 || fobs_per_door < 0 || rate <= 0 || hours <= 0 || range < 0)
+        PRINT_RETURN(help_msg, -1);
+    if (queue) {
+        bench_queue();
+        return 0;
+    }
+
+    printf("Building of %d doors, %.1f arrivals per fob per hour, %s frames, range %d:\n",
+        num_doors, rate, mac_frames ? "MAC" : "CRC", range);
+    printf("    %-9s %8s %8s %8s %8s %8s %9s %8s %8s %10s\n", "fobs/door", "p50 s", "p95 s",
+        "p99 s", "presses", "gave up", "collided", "stalls", "Mevents", "Mevents/s");
+    if (fobs_per_door)
+        num_sweep = 1;
+    for (idx = 0; idx < num_sweep; idx++) {
+        int fpd = fobs_per_door ? fobs_per_door : sweep[idx];
+        if (simulate(fpd * num_doors, &res))
+            return -1;
+        printf("    %9d %8.2f %8.2f %8.2f %8.2f %7.2f%% %8.2f%% %8lu %8.1f %10.2f\n", fpd,
+            res.p50, res.p95, res.p99, (double)res.presses / res.arrivals,
+            100.0*res.gave_up/res.arrivals, 100.0*res.collided/res.bursts,
+            (unsigned long)res.stalls, res.events/1e6, res.events/res.secs/1e6);
+        if (res.p95 <= target)
+            best = fpd;
+        else if (!fobs_per_door)
+            break;
+    }
+    if (!fobs_per_door) {
+        if (best)
+            printf("\nAt most %d fobs per door keep the p95 entry wait within %.1f s.\n", best, target);
+        else
+            printf("\nNo number of fobs per door keeps the p95 entry wait within %.1f s.\n", target);
+    }
+    return 0;
+}
+
+
+// Run the building with the given number of fobs, spread evenly over the
+// doors, and store the results. Returns -1 if out of memory.
+int simulate(int num_fobs, struct results* res) {
+    uint64_t end = (uint64_t)(hours * 3600e6), burst_len;
+    uint32_t* waits = calloc(MAX_WAITS, sizeof(*waits));
+    struct fob* fobs = calloc(num_fobs, sizeof(*fobs));
+    struct door* doors = calloc(num_doors, sizeof(*doors));
+    uint32_t next_burst = 0;
+    struct calendar cal;
+    struct cal_event ev;
+    int idx, lo, hi, ret = -1;
+
+    memset(res, 0, sizeof(*res));
+    if (waits == NULL || fobs == NULL || doors == NULL || calendar_init(&cal, MS(10))) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+    rng_state = 0x9E3779B97F4A7C15ull;
+    burst_len = ((mac_frames ? 10 : 6) + 1) * BYTE_TIME;
+    for (idx = 0; idx < num_doors; idx++)
+        doors[idx].burst = CALENDAR_NIL;
+    for (idx = 0; idx < num_fobs; idx++) {
+        fobs[idx].door = idx % num_doors;
+        fobs[idx].bursts = NUM_BURSTS;
+        if (calendar_push(&cal, rand_exp(3600e6 / rate), EV_ARRIVE, idx))
+            goto done;
+    }
+
+    double start = now();
+    while (calendar_pop(&cal, &ev) == 0 && ev.time < end) {
+        struct fob* fob = &fobs[ev.arg];
+        uint64_t when = ev.time;
+        int err = 0;
+
+        res->events++;
+        lo = (int)fob->door - range < 0 ? 0 : fob->door - range;
+        hi = (int)fob->door + range >= num_doors ? num_doors-1 : (int)fob->door + range;
+        switch (ev.type) {
+        case EV_ARRIVE:
+            // Someone walks up to their door, unless they are still at it or
+            // their remote is still sending
+            err = calendar_push(&cal, when + rand_exp(3600e6 / rate), EV_ARRIVE, ev.arg);
+            if (fob->state != FOB_AWAY || fob->bursts < NUM_BURSTS)
+                break;
+            res->arrivals++;
+            fob->state = FOB_WAITING;
+            fob->first = when;
+            fob->presses = 0;
+            // fall through
+        case EV_PRESS:
+            // The transmitter wakes up and starts sending the next code
+            res->presses++;
+            fob->presses++;
+            fob->code++;
+            fob->bursts = 0;
+            // fall through
+        case EV_BURST_START:
+            fob->burst = next_burst++;
+            res->bursts++;
+            for (idx = lo; idx <= hi; idx++)
+                hear_start(&doors[idx], fob->burst, when, when + burst_len);
+            err = err || calendar_push(&cal, when + burst_len, EV_BURST_END, ev.arg);
+            break;
+
+        case EV_BURST_END:
+            for (idx = lo; idx <= hi && !err; idx++)
+                err = hear_end(&cal, doors, fobs, idx, ev.arg, res);
+            if (++fob->bursts < NUM_BURSTS) {
+                err = err || calendar_push(&cal, when, EV_BURST_START, ev.arg);
+                break;
+            }
+
+            // Once the transmission is over, press again if the door did not
+            // react, or give up after a few times
+            if (fob->state != FOB_WAITING)
+                break;
+            if (fob->presses >= MAX_PRESSES) {
+                res->gave_up++;
+                fob->state = FOB_AWAY;
+                break;
+            }
+            err = calendar_push(&cal, when + rand_exp(THINK_TIME), EV_PRESS, ev.arg);
+            break;
+
+        case EV_ENTRY:
+            // The latch of a door opens
+            fob = &fobs[doors[ev.arg].fob];
+            idx = (when - fob->first) / MS(10);
+            waits[idx < MAX_WAITS ? idx : MAX_WAITS-1]++;
+            res->entries++;
+            fob->state = FOB_AWAY;
+            break;
+        }
+        if (err)
+            goto done;
+    }
+    res->secs = now() - start;
+    res->p50 = percentile(waits, res->entries, 0.50);
+    res->p95 = percentile(waits, res->entries, 0.95);
+    res->p99 = percentile(waits, res->entries, 0.99);
+    ret = 0;
+
+done:
+    calendar_free(&cal);
+    free(waits);
+    free(fobs);
+    free(doors);
+    return ret;
+}
+
+
+// Note the start of a burst at a receiver. Only a burst that starts while
+// receive_code() is waiting for a frame marker and that overlaps no other
+// burst can be decoded.
+void hear_start(struct door* door, uint32_t burst, uint64_t now, uint64_t end) {
+    if (door->air_until > now) {
+        door->burst = CALENDAR_NIL;
+    } else {
+        door->burst = burst;
+        door->listening = (door->busy_until <= now);
+    }
+    if (door->air_until < end)
+        door->air_until = end;
+}
+
+
+// Note the end of a burst from a fob at a receiver, and run the receiver
+// firmware on it if it can be decoded. A burst garbled by a collision passes
+// the CRC8 or the MAC by chance and is then rejected. Returns -1 if out of
+// memory.
+int hear_end(struct calendar* cal, struct door* doors, struct fob* fobs, int idx, int arg, struct results* res) {
+    struct door* door = &doors[idx];
+    struct fob* fob = &fobs[arg];
+    uint64_t now = cal->now, when;
+
+    if (door->burst != fob->burst && (uint32_t)idx == fob->door)
+        res->collided++;
+    if (door->busy_until > now)
+        return 0;
+    if (door->burst != fob->burst) {
+        if (rand64() & (mac_frames ? 0xFFFF : 0xFF))
+            return 0;
+        res->stalls++;
+        door->busy_until = now + LOAD_TIME + STALL_TIME + CLEAR_TIME;
+        return 0;
+    }
+    door->burst = CALENDAR_NIL;
+    if (!door->listening)
+        return 0;
+
+    // Reject the message as process_load() does if the fob is not enrolled at
+    // this door or its code is outside the window
+    when = now + LOAD_TIME;
+    if (fob->door != (uint32_t)idx || fob->code - fob->stored >= ROLLING_WINDOW) {
+        res->stalls++;
+        door->busy_until = when + STALL_TIME + CLEAR_TIME;
+        return 0;
+    }
+    fob->stored = fob->code + 1;
+    fob->state = FOB_SERVED;
+
+    // Unlock the bolt, and let the person in once the latch opens
+    when += WRITE_TIME + UNLOCK_TIME + (rand64() % (LATCH_STEPS+1)) * LATCH_STEP;
+    door->fob = arg;
+    door->busy_until = when + RELOCK_TIME + HOLD_TIME + CLEAR_TIME;
+    return calendar_push(cal, when, EV_ENTRY, idx);
+}
+
+
+// Measure the calendar queue alone with the classic hold model, where every
+// event popped pushes another at a random time after it, for a range of queue
+// sizes.
+void bench_queue() {
+    const int sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+    struct calendar cal;
+    struct cal_event ev;
+    int idx, jdx;
+
+    printf("Hold model of the calendar queue with exponential gaps:\n");
+    printf("    %-10s %12s %10s\n", "events", "Mholds/s", "buckets");
+    for (idx = 0; idx < (int)(sizeof(sizes)/sizeof(sizes[0])); idx++) {
+        int num = sizes[idx], holds = 5000000;
+        if (calendar_init(&cal, 1))
+            return;
+        rng_state = 1;
+        for (jdx = 0; jdx < num; jdx++)
+            calendar_push(&cal, rand_exp(1e6), 0, jdx);
+        double start = now();
+        for (jdx = 0; jdx < holds; jdx++) {
+            calendar_pop(&cal, &ev);
+            calendar_push(&cal, ev.time + rand_exp(1e6), 0, ev.arg);
+        }
+        double secs = now() - start;
+        printf("    %-10d %12.2f %10u\n", num, holds/secs/1e6, cal.num_buckets);
+        calendar_free(&cal);
+    }
+}
+
+
+// Return the given percentile in seconds of a histogram of waits in 10 ms
+// buckets holding num waits.
+double percentile(uint32_t* hist, uint64_t num, double pct) {
+    uint64_t sum = 0;
+    int idx;
+
+    for (idx = 0; idx < MAX_WAITS; idx++)
+        if ((sum += hist[idx]) > pct * num)
+            return (idx + 1) / 100.0;
+    return MAX_WAITS / 100.0;
+}
+
+
+// Return a random time with an exponential distribution of the given mean.
+double rand_exp(double mean) {
+    return -log((rand64() >> 11) * 0x1.0p-53 + 0x1.0p-54) * mean;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,543 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../key_gen/schedule.h"
+#include "../pic14/ihex.h"
+#include "../pic14/pic14.h"
+#include "../pic14/sim.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Limits of the tool */
+#define MAX_FOBS     1000000
+#define MAX_THREADS  64
+#define MAX_ROM      0x800
+
+/* Values that the transmitter firmware depends on */
+#define REG_GPIO      0x05
+#define GPIO_BUTTON   2     // Input pin of the push button
+#define GPIO_POWER    4     // Output pin powering the RF module
+#define GPIO_DATA     5     // Output pin of the Manchester encoder
+#define FRAME_MARK    0x96
+#define FRAME_SPECK   0x10  // Version bit of messages encrypted with Speck32/64
+#define FRAME_MAC     0x20  // Version bit of messages that end in a MAC
+#define EEPROM_CODE   0     // EEPROM address of the rolling code
+#define EEPROM_SERIAL 4     // EEPROM address of the serial number
+
+/* Lengths of the P and S subkey tables in RETLW instructions */
+#define LEN_P  (18*2)
+#define LEN_S  (16*2)
+
+/* Lengths of the Speck32/64 and MAC round key tables in RETLW instructions */
+#define LEN_RK  (SPECK_ROUNDS*2)
+#define LEN_MK  (MAC_ROUNDS*2)
+
+
+/* The locations in the reference image that are patched for each fob */
+struct layout {
+    uint16_t tables[5];  // Word addresses of the P, S1, S2, S3 and S4 tables
+    uint16_t speck_keys; // Word address of the Speck32/64 round keys
+    uint16_t mac_keys;   // Word address of the MAC round keys, 0 if not sent
+    uint16_t chan_addr; // Word address of the MOVLW loading the channel
+};
+
+/* The keys of a fob, as they are patched into its image */
+struct fob_keys {
+    struct blowfish_keys bf;
+    uint16_t rk[SPECK_ROUNDS];
+    uint16_t mk[MAC_ROUNDS];
+};
+
+/* A fob to stamp an image for */
+struct fob {
+    char name[64];
+    uint8_t chan;
+    uint16_t key[KEY_WORDS];
+    uint32_t counter;
+    uint32_t serial;
+};
+
+
+/* Global variables */
+struct ihex_image base;
+struct layout layout;
+struct fob* fobs;
+int num_fobs;
+const char* out_dir = ".";
+int sample_rate = 1000;
+volatile int next_fob;
+volatile int num_verified;
+volatile int num_errors;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: fob_stamp [-o dir] [-j threads] [-s rate] transmitter.hex fobs.txt\n\n"
+    "Stamps a copy of the reference transmitter image for every fob listed in\n"
+    "the fob file, which contains lines of the form:\n\n"
+    "    NAME CHAN SEED [COUNTER [SERIAL]]\n\n"
+    "The BlowFish32 subkeys, the Speck32/64 round keys and the MAC round keys\n"
+    "are generated from the hexadecimal SEED just like key_gen does and are\n"
+    "patched into whichever key tables the image has, along with the channel\n"
+    "number, and the initial rolling code and the serial number in EEPROM. The\n"
+    "image for each fob is written to NAME.hex in the output directory.\n\n"
+    "    -o dir      Output directory (default: current directory)\n"
+    "    -j threads  Number of worker threads (default: number of CPUs)\n"
+    "    -s rate     Verify every rate-th image in the simulator, 0 for none\n"
+    "                (default: 1000)\n"
+);
+
+
+int load_fobs(const char* path);
+int locate_tables(const uint16_t* rom, int top);
+int locate_table(const uint16_t* rom, int top, int len);
+int locate_channel(uint16_t* rom, int top);
+void stamp(const struct fob* fob, const struct fob_keys* keys, struct ihex_image* img);
+void stamp_table(struct ihex_image* img, int addr, const uint16_t* words, int num);
+int verify(const struct fob* fob, const struct fob_keys* keys, const struct ihex_image* img);
+void* worker(void* arg);
+int reads_w(const struct pic14_insn* insn);
+int writes_w(const struct pic14_insn* insn);
+uint16_t chan_byte(const struct fob* fob);
+
+
+int main(int argc, char* argv[]) {
+    static uint16_t rom[MAX_ROM];
+    pthread_t threads[MAX_THREADS];
+    int opt, idx, num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct timespec start, stop;
+
+    while ((opt = getopt(argc, argv, "o:j:s:h")) != -1) {
+        switch (opt) {
+        case 'o': out_dir = optarg; break;
+        case 'j': num_threads = atoi(optarg); break;
+        case 's': sample_rate = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind+2 != argc || sample_rate < 0)
+        PRINT_RETURN(help_msg, -1);
+    num_threads = (num_threads < 1) ? 1 : (num_threads > MAX_THREADS) ? MAX_THREADS : num_threads;
+
+    // Load the reference image and find the locations to patch
+    if (ihex_load(argv[optind], &base))
+        return -1;
+    int top = ihex_rom(&base, rom, MAX_ROM);
+    if (top == 0 || base.used[MAX_ROM*2])
+        PRINT_RETURN("Reference image is not a PIC12F683 image\n", -1);
+    if (locate_tables(rom, top) || locate_channel(rom, top))
+        return -1;
+    if ((idx = locate_table(rom, top, LEN_RK)) < 0)
+        return -1;
+    layout.speck_keys = idx;
+    if ((idx = locate_table(rom, top, LEN_MK)) < 0)
+        return -1;
+    layout.mac_keys = idx;
+    for (idx = 0; idx < top; idx++)
+        if (base.used[idx*2])
+            ihex_set_word(&base, idx, rom[idx]);
+
+    // The image must have the keys of the cipher named by its frame version
+    if ((ihex_word(&base, layout.chan_addr) & FRAME_SPECK) ? !layout.speck_keys : !layout.tables[0])
+        PRINT_RETURN("Could not locate the subkey tables\n", -1);
+
+    if (load_fobs(argv[optind+1]))
+        return -1;
+
+    // Stamp all of the images in parallel
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (idx = 0; idx < num_threads; idx++)
+        if (pthread_create(&threads[idx], NULL, worker, NULL))
+            PRINT_RETURN("Could not create thread\n", -1);
+    for (idx = 0; idx < num_threads; idx++)
+        pthread_join(threads[idx], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    printf(
+        "Stamped %d images in %.2f s (%.0f per minute), verified %d, %d errors\n",
+        num_fobs, secs, (secs > 0) ? num_fobs*60/secs : 0.0, num_verified, num_errors
+    );
+    free(fobs);
+    return num_errors ? -1 : 0;
+}
+
+
+// Read the list of fobs to stamp. Blank lines and text after a '#' are ignored.
+int load_fobs(const char* path) {
+    char line[512], seed[400];
+    long long chan, counter, serial;
+    int lnum = 0, max_fobs = 0;
+
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "%s: could not open file\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        char* cmt = strchr(line, '#');
+        lnum++;
+        if (cmt != NULL)
+            *cmt = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        // Grow the list of fobs as needed
+        if (num_fobs >= max_fobs) {
+            if (num_fobs < MAX_FOBS) {
+                max_fobs = max_fobs ? 2*max_fobs : 1024;
+                max_fobs = (max_fobs > MAX_FOBS) ? MAX_FOBS : max_fobs;
+                fobs = realloc(fobs, max_fobs*sizeof(*fobs));
+            }
+            if (fobs == NULL || num_fobs == MAX_FOBS) {
+                fprintf(stderr, "%s:%d: too many fobs\n", path, lnum);
+                fclose(in);
+                return -1;
+            }
+        }
+
+        struct fob* fob = &fobs[num_fobs];
+        memset(fob, 0, sizeof(*fob));
+        counter = serial = 0;
+        int num = sscanf(line, "%63s %lli %399s %lli %lli", fob->name, &chan, seed, &counter, &serial);
+        if (num < 3 || chan < 0 || chan > 0x0F || strchr(fob->name, '/') != NULL || key_parse(seed, fob->key) ||
+            counter < 0 || counter > UINT32_MAX || serial < 0 || serial >= 1 << 24 ||
+            (serial & 0xFF) == FRAME_MARK || (serial >> 8 & 0xFF) == FRAME_MARK || (serial >> 16) == FRAME_MARK) {
+            fprintf(stderr, "%s:%d: malformed fob\n", path, lnum);
+            fclose(in);
+            return -1;
+        }
+        fob->chan = chan;
+        fob->counter = counter;
+        fob->serial = serial;
+        num_fobs++;
+    }
+    fclose(in);
+    return 0;
+}
+
+
+// Locate the P and S subkey tables. MikroC stores each table as a sequence of
+// RETLW instructions, one for each byte of the table in little endian order,
+// followed by a RETURN. The tables are found through the pointers that main()
+// passes to blowfish_setkeys(), which are loaded into consecutive argument
+// registers with MOVLW and MOVWF right before the call. An image built for
+// Speck32/64 alone has no such tables, which are then left at 0.
+int locate_tables(const uint16_t* rom, int top) {
+    struct pic14_insn insn;
+    int addr, idx, jdx, found = 0;
+
+    for (addr = 20; addr < top; addr++) {
+        uint16_t ptrs[5];
+        bool ok = true;
+
+        pic14_decode(rom[addr], &insn);
+        if (insn.op != OP_CALL)
+            continue;
+
+        // Collect the pointer arguments
+        for (idx = 0; idx < 20 && ok; idx += 2) {
+            struct pic14_insn lit, mov;
+            pic14_decode(rom[addr-20+idx], &lit);
+            pic14_decode(rom[addr-19+idx], &mov);
+            ok = (lit.op == OP_MOVLW && mov.op == OP_MOVWF);
+            if (idx % 4 == 0)
+                ptrs[idx/4] = lit.k;
+            else
+                ptrs[idx/4] |= lit.k << 8;
+        }
+
+        // Every pointer must point to a table of the right length
+        for (idx = 0; idx < 5 && ok; idx++) {
+            int len = (idx == 0) ? LEN_P : LEN_S;
+            if (ptrs[idx] + len >= top || rom[ptrs[idx] + len] != 0x0008)
+                ok = false;
+            for (jdx = 0; jdx < len && ok; jdx++) {
+                pic14_decode(rom[ptrs[idx] + jdx], &insn);
+                ok = (insn.op == OP_RETLW);
+            }
+        }
+        if (!ok)
+            continue;
+        memcpy(layout.tables, ptrs, sizeof(ptrs));
+        found++;
+    }
+
+    if (found > 1)
+        PRINT_RETURN("Could not locate the subkey tables\n", -1);
+    return 0;
+}
+
+
+// Locate a table of len RETLW instructions that is passed alone to a function,
+// as the Speck32/64 round keys are to speck_setkeys() and the MAC round keys to
+// mac_setkeys(), the same way as locate_tables().
+// Returns the word address of the table, 0 if the image has no such table, or
+// -1 if it has several.
+int locate_table(const uint16_t* rom, int top, int len) {
+    struct pic14_insn insn, lit_lo, mov_lo, lit_hi, mov_hi;
+    int addr, idx, ptr, found = 0;
+    bool ok;
+
+    for (addr = 4; addr < top; addr++) {
+        pic14_decode(rom[addr], &insn);
+        pic14_decode(rom[addr-4], &lit_lo);
+        pic14_decode(rom[addr-3], &mov_lo);
+        pic14_decode(rom[addr-2], &lit_hi);
+        pic14_decode(rom[addr-1], &mov_hi);
+        if (insn.op != OP_CALL || lit_lo.op != OP_MOVLW || mov_lo.op != OP_MOVWF ||
+            lit_hi.op != OP_MOVLW || mov_hi.op != OP_MOVWF)
+            continue;
+        ptr = lit_lo.k | lit_hi.k << 8;
+        ok = (ptr > 0 && ptr + len < top && rom[ptr + len] == 0x0008);
+        for (idx = 0; idx < len && ok; idx++) {
+            pic14_decode(rom[ptr + idx], &insn);
+            ok = (insn.op == OP_RETLW);
+        }
+        if (!ok || ptr == found)
+            continue;
+        if (found)
+            PRINT_RETURN("Could not locate a key table\n", -1);
+        found = ptr;
+    }
+    return found;
+}
+
+
+// Locate where the channel number is stored. The channel is the first value
+// stored into the message after transmit_code() powers on the RF module.
+//
+// MikroC loads a nonzero CHAN_NUM with MOVLW and MOVWF, where the MOVLW can be
+// patched directly. A CHAN_NUM of zero is stored with a single CLRF instead.
+// The PIC12F683 only has two banks, so the BCF STATUS,RP1 that starts the
+// function is redundant and the prologue is rewritten to make room for a MOVLW.
+// This is only done if W is overwritten before it is read again.
+int locate_channel(uint16_t* rom, int top) {
+    struct pic14_insn insn, next;
+    int addr, site = -1;
+
+    for (addr = 0; addr+2 < top; addr++) {
+        pic14_decode(rom[addr], &insn);
+        if (insn.op == OP_BSF && insn.f == REG_GPIO && insn.b == GPIO_POWER) {
+            if (site >= 0)
+                PRINT_RETURN("Could not locate the channel number\n", -1);
+            site = addr+1;
+        }
+    }
+    if (site < 0)
+        PRINT_RETURN("Could not locate the channel number\n", -1);
+
+    pic14_decode(rom[site], &insn);
+    pic14_decode(rom[site+1], &next);
+    if (insn.op == OP_MOVLW && next.op == OP_MOVWF) {
+        layout.chan_addr = site;
+        return 0;
+    }
+    if (insn.op != OP_CLRF || site < 3)
+        PRINT_RETURN("Could not locate the channel number\n", -1);
+
+    // The prologue must be exactly BCF STATUS,RP1 and BCF STATUS,RP0
+    struct pic14_insn rp1, rp0;
+    pic14_decode(rom[site-3], &rp1);
+    pic14_decode(rom[site-2], &rp0);
+    if (rp1.op != OP_BCF || rp1.f != REG_STATUS || rp1.b != STATUS_RP1 ||
+        rp0.op != OP_BCF || rp0.f != REG_STATUS || rp0.b != STATUS_RP0)
+        PRINT_RETURN("Channel number is stored in an unknown way\n", -1);
+
+    // W must be written before it is read or control flow leaves the block
+    for (addr = site+1; addr < top; addr++) {
+        struct pic14_insn prev;
+        pic14_decode(rom[addr], &next);
+        pic14_decode(rom[addr-1], &prev);
+        if (reads_w(&next) || next.op == OP_CALL || next.op == OP_GOTO ||
+            next.op == OP_RETURN || next.op == OP_RETLW || next.op == OP_RETFIE)
+            PRINT_RETURN("Channel number is stored in an unknown way\n", -1);
+        if (writes_w(&next) && !pic14_is_skip(&prev))
+            break;
+    }
+
+    rom[site-3] = rom[site-2];
+    rom[site-2] = rom[site-1];
+    rom[site-1] = 0x3000;                   // MOVLW 0x00
+    rom[site-0] = 0x0080 | insn.f;          // MOVWF f
+    layout.chan_addr = site-1;
+    return 0;
+}
+
+
+// Patch the subkeys, round keys, channel number, rolling code and serial
+// number of the fob into the image.
+void stamp(const struct fob* fob, const struct fob_keys* keys, struct ihex_image* img) {
+    const uint16_t* tables[5] = {keys->bf.p, keys->bf.s1, keys->bf.s2, keys->bf.s3, keys->bf.s4};
+    int idx;
+
+    for (idx = 0; idx < 5 && layout.tables[0]; idx++)
+        stamp_table(img, layout.tables[idx], tables[idx], (idx == 0) ? LEN_P/2 : LEN_S/2);
+    if (layout.speck_keys)
+        stamp_table(img, layout.speck_keys, keys->rk, LEN_RK/2);
+    if (layout.mac_keys)
+        stamp_table(img, layout.mac_keys, keys->mk, LEN_MK/2);
+    ihex_set_word(img, layout.chan_addr, chan_byte(fob));
+    for (idx = 0; idx < 4; idx++) {
+        ihex_set_word(img, IHEX_ADDR_EEPROM/2 + EEPROM_CODE + idx, (fob->counter >> (8*idx)) & 0xFF);
+        ihex_set_word(img, IHEX_ADDR_EEPROM/2 + EEPROM_SERIAL + idx, (fob->serial >> (8*idx)) & 0xFF);
+    }
+}
+
+
+// Patch words into a table of RETLW instructions, in little endian order.
+void stamp_table(struct ihex_image* img, int addr, const uint16_t* words, int num) {
+    int idx;
+
+    for (idx = 0; idx < num; idx++) {
+        ihex_set_word(img, addr + 2*idx + 0, 0x3400 | ((words[idx] >> 0) & 0xFF));
+        ihex_set_word(img, addr + 2*idx + 1, 0x3400 | ((words[idx] >> 8) & 0xFF));
+    }
+}
+
+
+// Run the stamped image in the simulator from power on until the button press
+// starts a transmission. The whole message, with the encrypted rolling code and
+// either the CRC8 or the serial number and MAC, must be in memory, and the
+// channel must be stored where the image was patched.
+int verify(const struct fob* fob, const struct fob_keys* keys, const struct ihex_image* img) {
+    static __thread struct pic14_sim sim;
+    static __thread uint16_t rom[MAX_ROM];
+    struct pic14_insn insn;
+    uint32_t code = fob->counter, block;
+    uint8_t msg[10];
+    int idx, num, ret = SIM_RETURN;
+
+    ihex_rom(img, rom, MAX_ROM);
+    sim_reset(&sim, pic14_find_device("12f683"), rom);
+    for (idx = 0; idx < 256; idx++)
+        if (img->used[IHEX_ADDR_EEPROM + idx*2])
+            sim.eeprom[idx] = img->data[IHEX_ADDR_EEPROM + idx*2];
+
+    // Run until the firmware sleeps waiting for the button
+    while (ret == SIM_RETURN && sim.cycles < 4000000)
+        ret = sim_step(&sim);
+    if (ret != SIM_SLEEP)
+        return -1;
+
+    // Press the button and run until the first bit is sent
+    sim.ram[REG_GPIO] |= 1 << GPIO_BUTTON;
+    while (sim_step(&sim) == SIM_RETURN && sim.cycles < 8000000)
+        if (sim.ram[REG_GPIO] & (1 << GPIO_DATA))
+            break;
+    if (!(sim.ram[REG_GPIO] & (1 << GPIO_DATA)))
+        return -1;
+
+    // Compute the expected message as transmit_code() forms it, with the cipher
+    // named by the frame version, skipping codes whose message contains the
+    // marker. The MAC is only checked if the image has MAC round keys, since
+    // the message of an image without them only has the encrypted rolling code
+    // in common with the frame.
+    msg[4] = chan_byte(fob) | (layout.mac_keys ? FRAME_MAC : 0);
+    num = layout.mac_keys ? 10 : 4;
+    do {
+        code++;
+        if (msg[4] & FRAME_SPECK)
+            block = key_speck_encrypt(keys->rk, code);
+        else
+            block = key_encrypt(&keys->bf, code);
+        for (idx = 0; idx < 4; idx++) {
+            msg[idx] = block >> (8*idx);
+            msg[5+idx] = fob->serial >> (8*idx);
+        }
+        if (layout.mac_keys) {
+            uint32_t m1 = msg[4] | msg[5] << 8 | msg[6] << 16 | (uint32_t)msg[7] << 24;
+            uint16_t tag = key_mac_tag(keys->mk, block, m1);
+            msg[8] = tag;
+            msg[9] = tag >> 8;
+        }
+    } while (memchr(msg, FRAME_MARK, num) != NULL);
+
+    pic14_decode(rom[layout.chan_addr+1], &insn);
+    if (sim.ram[insn.f] != msg[4])
+        return -1;
+    for (idx = 0; idx+num <= (int)sizeof(sim.ram); idx++)
+        if (!memcmp(&sim.ram[idx], msg, num))
+            return 0;
+    return -1;
+}
+
+
+// Stamp images until every fob has been processed.
+void* worker(void* arg) {
+    static __thread struct ihex_image img;
+    struct fob_keys keys;
+    char path[1024];
+
+    (void)arg;
+    memcpy(&img, &base, sizeof(img));
+    while (1) {
+        int idx = __sync_fetch_and_add(&next_fob, 1);
+        if (idx >= num_fobs)
+            break;
+
+        struct fob* fob = &fobs[idx];
+        key_schedule(fob->key, &keys.bf);
+        key_speck_schedule(fob->key, keys.rk);
+        key_mac_schedule(fob->key, keys.mk);
+        stamp(fob, &keys, &img);
+
+        snprintf(path, sizeof(path), "%s/%s.hex", out_dir, fob->name);
+        if (ihex_save(path, &img)) {
+            __sync_fetch_and_add(&num_errors, 1);
+            continue;
+        }
+        if (sample_rate > 0 && idx % sample_rate == 0) {
+            if (verify(fob, &keys, &img)) {
+                fprintf(stderr, "%s: image failed verification\n", path);
+                __sync_fetch_and_add(&num_errors, 1);
+            }
+            __sync_fetch_and_add(&num_verified, 1);
+        }
+    }
+    return NULL;
+}
+
+
+// Return the MOVLW that loads the channel byte of the fob. The frame version in
+// the upper nibble is kept from the reference image.
+uint16_t chan_byte(const struct fob* fob) {
+    return (ihex_word(&base, layout.chan_addr) & 0x3FF0) | fob->chan;
+}
+
+
+// Report whether the instruction uses the value of W.
+int reads_w(const struct pic14_insn* insn) {
+    switch (insn->op) {
+    case OP_ADDWF: case OP_ANDWF: case OP_IORWF: case OP_SUBWF: case OP_XORWF:
+    case OP_MOVWF: case OP_ADDLW: case OP_ANDLW: case OP_IORLW: case OP_SUBLW:
+    case OP_XORLW:
+        return 1;
+    }
+    return 0;
+}
+
+
+// Report whether the instruction overwrites W without using its value.
+int writes_w(const struct pic14_insn* insn) {
+    switch (insn->op) {
+    case OP_MOVLW: case OP_CLRW:
+        return 1;
+    case OP_COMF: case OP_DECF: case OP_DECFSZ: case OP_INCF: case OP_INCFSZ:
+    case OP_MOVF: case OP_RLF: case OP_RRF: case OP_SWAPF:
+        return !insn->d;
+    }
+    return 0;
+}
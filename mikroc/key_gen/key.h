@@ -1,3 +1,5 @@
+#include "../crypto/types.h"
+
 // The BlowFish32 cipher subkeys
 const uint16_t arr_p[18] = {
     0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
@@ -19,3 +21,15 @@ const uint16_t arr_s4[16] = {
     0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
     0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
 };
+
+// The Speck32/64 cipher round keys
+const uint16_t arr_rk[22] = {
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+};
+
+// The frame MAC round keys
+const uint16_t arr_mk[6] = {
+    0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000,
+};
@@ -0,0 +1,276 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _KEY_GEN_SCHEDULE_H
+#define _KEY_GEN_SCHEDULE_H
+
+#include <stdint.h>
+#include <ctype.h>
+#include <string.h>
+
+
+// This is the host-side BlowFish32 and Speck32/64 key schedule shared by the
+// programs that generate subkeys. The MikroC projects use crypto/blowfish.h and
+// crypto/speck.h instead.
+
+/* Helper macros */
+#define KEY_BIT16_LO(x) (((x) >>  0) & 0xFFFF)
+#define KEY_BIT16_HI(x) (((x) >> 16) & 0xFFFF)
+#define KEY_HEX2BIN(x) (isalpha(x) ? 10+tolower(x)-'a' : (x)-'0')
+#define KEY_ROL16(x, n) ((uint16_t)(((x) << (n)) | ((x) >> (16-(n)))))
+#define KEY_ROR16(x, n) ((uint16_t)(((x) >> (n)) | ((x) << (16-(n)))))
+
+/* The number of 16-bit words in the seed key */
+#define KEY_WORDS  18
+
+/* The number of rounds of Speck32/64, each of which uses one round key */
+#define SPECK_ROUNDS  22
+
+/* The number of Speck rounds per block of the frame MAC */
+#define MAC_ROUNDS    6
+
+
+/* A complete set of BlowFish32 subkeys */
+struct blowfish_keys {
+    uint16_t p[18];
+    uint16_t s1[16];
+    uint16_t s2[16];
+    uint16_t s3[16];
+    uint16_t s4[16];
+};
+
+/* The initial subkeys - preloaded with the hex-digits of PI */
+const struct blowfish_keys blowfish_pi = {
+    {
+        0x243F, 0x6A88, 0x85A3, 0x08D3, 0x1319, 0x8A2E, 0x0370, 0x7344, 0xA409,
+        0x3822, 0x299F, 0x31D0, 0x082E, 0xFA98, 0xEC4E, 0x6C89, 0x4528, 0x21E6,
+    }, {
+        0x38D0, 0x1377, 0xBE54, 0x66CF, 0x34E9, 0x0C6C, 0xC0AC, 0x29B7,
+        0xC97C, 0x50DD, 0x3F84, 0xD5B5, 0xB547, 0x0917, 0x9216, 0xD5D9,
+    }, {
+        0x8979, 0xD131, 0x0BA6, 0x98DF, 0xB5AC, 0x2FFD, 0x72DB, 0xD01A,
+        0xDFB7, 0xB8E1, 0xAFED, 0x6A26, 0x7E96, 0xBA7C, 0x9045, 0xF12C,
+    }, {
+        0x7F99, 0x24A1, 0x9947, 0xB391, 0x6CF7, 0x0801, 0xF2E2, 0x858E,
+        0xFC16, 0x6369, 0x20D8, 0x7157, 0x4E69, 0xA458, 0xFEA3, 0xF493,
+    }, {
+        0x3D7E, 0x0D95, 0x748F, 0x728E, 0xB658, 0x718B, 0xCD58, 0x8215,
+        0x4AEE, 0x7B54, 0xA41D, 0xC25A, 0x59B5, 0x9C30, 0xD539, 0x2AF2,
+    },
+};
+
+/* The tweak of the seed words of the frame MAC - the hex-digits of E */
+const uint16_t mac_tweak[4] = {0xB7E1, 0x5162, 0x8AED, 0x2A6A};
+
+
+int key_parse(const char* hex, uint16_t* key);
+void key_schedule(const uint16_t* key, struct blowfish_keys* keys);
+uint32_t key_encrypt(const struct blowfish_keys* keys, uint32_t data);
+uint32_t key_decrypt(const struct blowfish_keys* keys, uint32_t data);
+uint16_t key_feistel(const struct blowfish_keys* keys, uint16_t data);
+void key_speck_schedule(const uint16_t* key, uint16_t* rk);
+uint32_t key_speck_encrypt(const uint16_t* rk, uint32_t data);
+uint32_t key_speck_decrypt(const uint16_t* rk, uint32_t data);
+void key_mac_schedule(const uint16_t* key, uint16_t* mk);
+uint16_t key_mac_tag(const uint16_t* mk, uint32_t m0, uint32_t m1);
+
+
+// Parse a hexadecimal string into the KEY_WORDS seed key. If the hex-string is
+// less than 72 bytes, then the input key will be extended to fill the full key
+// length. If the length is greater than 72 bytes, then the key will be
+// compacted by XORing the remaining bytes with the existing bytes in a
+// round-robin approach. Returns -1 if the string is not valid hexadecimal.
+int key_parse(const char* hex, uint16_t* key) {
+    int idx;
+    int clen = strlen(hex);
+    int klen = KEY_WORDS*sizeof(uint16_t);
+    uint8_t* _key = (uint8_t*)key;
+
+    // Verify that the key is okay
+    if (clen == 0)
+        return -1;
+    for (idx = 0; idx < clen; idx++)
+        if (!isxdigit(hex[idx]))
+            return -1;
+
+    // Parse the key (handles key extending and compacting)
+    memset(key, '\0', klen);
+    for (idx = 0; idx < clen || idx < klen*2; idx++) {
+        int shift = (idx%2) ? 0 : 4;
+        _key[(idx/2) % klen] ^= KEY_HEX2BIN(hex[idx % clen]) << shift;
+    }
+    return 0;
+}
+
+
+// Perform the key schedule for BlowFish32. This is esentially the encryption of
+// a zero-block and using the result for successive values of the P and S
+// subkeys until all subkeys have been filled out. The initial P keys are seeded
+// with the given key.
+void key_schedule(const uint16_t* key, struct blowfish_keys* keys) {
+    size_t idx, sidx;
+    uint32_t block = 0x00000000;
+    uint16_t* arr_sx[4] = {keys->s1, keys->s2, keys->s3, keys->s4};
+
+    // XOR the key with the P subkey to get the first permutation
+    *keys = blowfish_pi;
+    for (idx = 0; idx < 18; idx++)
+        keys->p[idx] ^= key[idx];
+
+    // Complete the generation of the P subkey
+    for (idx = 0; idx < 18; idx += 2) {
+        block = key_encrypt(keys, block);
+        keys->p[idx+0] = KEY_BIT16_HI(block);
+        keys->p[idx+1] = KEY_BIT16_LO(block);
+    }
+
+    // Complete the generation of the S subkeys
+    for (sidx = 0; sidx < 4; sidx++) {
+        for (idx = 0; idx < 16; idx += 2) {
+            block = key_encrypt(keys, block);
+            arr_sx[sidx][idx+0] = KEY_BIT16_HI(block);
+            arr_sx[sidx][idx+1] = KEY_BIT16_LO(block);
+        }
+    }
+}
+
+
+// Run BlowFish32 encryption for a single 4-byte block.
+uint32_t key_encrypt(const struct blowfish_keys* keys, uint32_t data) {
+    uint16_t data_hi = KEY_BIT16_HI(data);
+    uint16_t data_lo = KEY_BIT16_LO(data);
+    uint16_t tmp;
+    int idx;
+
+    for (idx = 0; idx < 16; idx++) {
+        data_hi ^= keys->p[idx];
+        data_lo ^= key_feistel(keys, data_hi);
+        tmp = data_hi; data_hi = data_lo; data_lo = tmp;
+    }
+    tmp = data_hi; data_hi = data_lo; data_lo = tmp;
+    data_hi ^= keys->p[16];
+    data_lo ^= keys->p[17];
+
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+// Run BlowFish32 decryption for a single 4-byte block.
+uint32_t key_decrypt(const struct blowfish_keys* keys, uint32_t data) {
+    uint16_t data_hi = KEY_BIT16_HI(data);
+    uint16_t data_lo = KEY_BIT16_LO(data);
+    uint16_t tmp;
+    int idx;
+
+    data_hi ^= keys->p[16];
+    data_lo ^= keys->p[17];
+    tmp = data_hi; data_hi = data_lo; data_lo = tmp;
+    for (idx = 15; idx >= 0; idx--) {
+        tmp = data_hi; data_hi = data_lo; data_lo = tmp;
+        data_lo ^= key_feistel(keys, data_hi);
+        data_hi ^= keys->p[idx];
+    }
+
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+// Compute the value of the Feistel function for BlowFish32.
+uint16_t key_feistel(const struct blowfish_keys* keys, uint16_t data) {
+    uint8_t d1 = (data >> 0)  & 0x0F;
+    uint8_t d2 = (data >> 4)  & 0x0F;
+    uint8_t d3 = (data >> 8)  & 0x0F;
+    uint8_t d4 = (data >> 12) & 0x0F;
+    return ((keys->s1[d1] + keys->s2[d2]) ^ keys->s3[d3]) + keys->s4[d4];
+}
+
+
+
+// Perform the key schedule for Speck32/64. The 64-bit key is taken from the
+// first four words of the seed key, where key[0] is the first round key and
+// key[1..3] seed the schedule. Unlike BlowFish32, the schedule only uses the
+// round function itself, so every round key is derived in a single pass.
+void key_speck_schedule(const uint16_t* key, uint16_t* rk) {
+    uint16_t l[SPECK_ROUNDS+2];
+    int idx;
+
+    rk[0] = key[0];
+    l[0] = key[1];
+    l[1] = key[2];
+    l[2] = key[3];
+    for (idx = 0; idx < SPECK_ROUNDS-1; idx++) {
+        l[idx+3] = (rk[idx] + KEY_ROR16(l[idx], 7)) ^ idx;
+        rk[idx+1] = KEY_ROL16(rk[idx], 2) ^ l[idx+3];
+    }
+}
+
+
+// Run Speck32/64 encryption for a single 4-byte block.
+uint32_t key_speck_encrypt(const uint16_t* rk, uint32_t data) {
+    uint16_t data_hi = KEY_BIT16_HI(data);
+    uint16_t data_lo = KEY_BIT16_LO(data);
+    int idx;
+
+    for (idx = 0; idx < SPECK_ROUNDS; idx++) {
+        data_hi = (KEY_ROR16(data_hi, 7) + data_lo) ^ rk[idx];
+        data_lo = KEY_ROL16(data_lo, 2) ^ data_hi;
+    }
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+// Run Speck32/64 decryption for a single 4-byte block.
+uint32_t key_speck_decrypt(const uint16_t* rk, uint32_t data) {
+    uint16_t data_hi = KEY_BIT16_HI(data);
+    uint16_t data_lo = KEY_BIT16_LO(data);
+    int idx;
+
+    for (idx = SPECK_ROUNDS-1; idx >= 0; idx--) {
+        data_lo = KEY_ROR16(data_lo ^ data_hi, 2);
+        data_hi = KEY_ROL16((uint16_t)((data_hi ^ rk[idx]) - data_lo), 7);
+    }
+    return ((uint32_t)data_hi << 16) | data_lo;
+}
+
+
+
+// Perform the key schedule for the frame MAC. The MAC uses the first round keys
+// of a Speck32/64 schedule seeded with words 4 to 7 of the seed key XORed with
+// the hex-digits of E. Seeds of 8 bytes or less repeat, so that those words
+// equal the first four, and the tweak keeps the MAC keys apart from the keys
+// that encrypt the rolling code.
+void key_mac_schedule(const uint16_t* key, uint16_t* mk) {
+    uint16_t rk[SPECK_ROUNDS];
+    uint16_t tweaked[4];
+    int idx;
+
+    for (idx = 0; idx < 4; idx++)
+        tweaked[idx] = key[4+idx] ^ mac_tweak[idx];
+    key_speck_schedule(tweaked, rk);
+    memcpy(mk, rk, MAC_ROUNDS*sizeof(uint16_t));
+}
+
+
+// Compute the 16-bit truncated MAC over two 32-bit message words. This is a
+// CBC-MAC over a reduced round Speck32/64, which is cheap enough to check on
+// every frame before any other work is done.
+uint16_t key_mac_tag(const uint16_t* mk, uint32_t m0, uint32_t m1) {
+    uint32_t data = m0;
+    int pass, idx;
+
+    for (pass = 0; pass < 2; pass++) {
+        uint16_t data_hi = KEY_BIT16_HI(data);
+        uint16_t data_lo = KEY_BIT16_LO(data);
+        for (idx = 0; idx < MAC_ROUNDS; idx++) {
+            data_hi = (KEY_ROR16(data_hi, 7) + data_lo) ^ mk[idx];
+            data_lo = KEY_ROL16(data_lo, 2) ^ data_hi;
+        }
+        data = (((uint32_t)data_hi << 16) | data_lo) ^ m1;
+        m1 = 0;
+    }
+    return KEY_BIT16_HI(data) ^ KEY_BIT16_LO(data);
+}
+
+
+#endif /* _KEY_GEN_SCHEDULE_H */
@@ -0,0 +1,192 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _PIC14_IHEX_H
+#define _PIC14_IHEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// The Intel HEX files produced by MikroC for the mid-range PIC devices use
+// byte addresses that are twice the word address. Program memory starts at 0,
+// the configuration word lives at word 0x2007 and the data EEPROM is mapped at
+// word 0x2100, where each EEPROM byte occupies the low byte of a word.
+#define IHEX_SIZE         0x4400
+#define IHEX_ADDR_CONFIG  (0x2007*2)
+#define IHEX_ADDR_EEPROM  (0x2100*2)
+#define IHEX_REC_DATA     0x00
+#define IHEX_REC_EOF      0x01
+#define IHEX_REC_EXTADDR  0x04
+
+
+/* An in-memory image of a hex file */
+struct ihex_image {
+    uint8_t data[IHEX_SIZE];
+    uint8_t used[IHEX_SIZE];
+};
+
+
+int ihex_load(const char* path, struct ihex_image* img);
+int ihex_save(const char* path, const struct ihex_image* img);
+uint8_t ihex_checksum(const uint8_t* rec, int num);
+uint16_t ihex_word(const struct ihex_image* img, uint16_t addr);
+void ihex_set_word(struct ihex_image* img, uint16_t addr, uint16_t word);
+int ihex_rom(const struct ihex_image* img, uint16_t* rom, int num);
+
+
+// Load an Intel HEX file into the image. Every record checksum is verified and
+// any data outside of the PIC address space is rejected.
+int ihex_load(const char* path, struct ihex_image* img) {
+    char line[600];
+    uint8_t rec[260];
+    uint32_t base = 0;
+    int lnum = 0;
+
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "%s: could not open file\n", path);
+        return -1;
+    }
+    memset(img, 0, sizeof(*img));
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        int idx, len;
+        lnum++;
+        strtok(line, "\r\n");
+        if (line[0] != ':')
+            continue;
+
+        // Decode the hexadecimal digits of the record
+        len = strlen(line+1) / 2;
+        for (idx = 0; idx < len; idx++) {
+            unsigned int val;
+            if (sscanf(line+1+idx*2, "%2x", &val) != 1)
+                break;
+            rec[idx] = val;
+        }
+        if (idx != len || len < 5 || len != rec[0]+5 || ihex_checksum(rec, len-1) != rec[len-1]) {
+            fprintf(stderr, "%s:%d: malformed record\n", path, lnum);
+            fclose(in);
+            return -1;
+        }
+
+        // Process the record
+        uint32_t addr = base + ((rec[1] << 8) | rec[2]);
+        if (rec[3] == IHEX_REC_EOF)
+            break;
+        if (rec[3] == IHEX_REC_EXTADDR) {
+            base = ((rec[4] << 8) | rec[5]) << 16;
+        } else if (rec[3] == IHEX_REC_DATA) {
+            if (addr + rec[0] > IHEX_SIZE) {
+                fprintf(stderr, "%s:%d: address out of range\n", path, lnum);
+                fclose(in);
+                return -1;
+            }
+            memcpy(img->data+addr, rec+4, rec[0]);
+            memset(img->used+addr, 1, rec[0]);
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
+
+
+// Write out the image in the same record layout that MikroC emits, namely
+// 16-byte data records aligned to 16-byte boundaries.
+int ihex_save(const char* path, const struct ihex_image* img) {
+    static const char digits[] = "0123456789ABCDEF";
+    int addr, idx, err = 0;
+    uint8_t rec[21];
+    char line[48];
+
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "%s: could not open file\n", path);
+        return -1;
+    }
+
+    for (addr = 0; addr < IHEX_SIZE; addr += 16) {
+        int lo = 16, hi = 0;
+        for (idx = 0; idx < 16; idx++) {
+            if (img->used[addr+idx]) {
+                lo = (idx < lo) ? idx : lo;
+                hi = idx+1;
+            }
+        }
+        if (lo >= hi)
+            continue;
+
+        rec[0] = hi-lo;
+        rec[1] = ((addr+lo) >> 8) & 0xFF;
+        rec[2] = ((addr+lo) >> 0) & 0xFF;
+        rec[3] = IHEX_REC_DATA;
+        memcpy(rec+4, img->data+addr+lo, hi-lo);
+        rec[4+hi-lo] = ihex_checksum(rec, 4+hi-lo);
+
+        // Format the record in one go since images are written in bulk
+        line[0] = ':';
+        for (idx = 0; idx < 5+hi-lo; idx++) {
+            line[1+idx*2] = digits[rec[idx] >> 4];
+            line[2+idx*2] = digits[rec[idx] & 0x0F];
+        }
+        line[1+idx*2] = '\n';
+        line[2+idx*2] = '\0';
+        err |= (fputs(line, out) == EOF);
+    }
+    err |= (fputs(":00000001FF\n", out) == EOF);
+    err |= (fclose(out) != 0);
+
+    if (err) {
+        fprintf(stderr, "%s: failure to write file\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Compute the two's complement checksum over the num bytes of a record.
+uint8_t ihex_checksum(const uint8_t* rec, int num) {
+    uint8_t sum = 0;
+    for (; num > 0; num--)
+        sum += *(rec++);
+    return -sum;
+}
+
+
+// Read the 14-bit program word at the given word address.
+uint16_t ihex_word(const struct ihex_image* img, uint16_t addr) {
+    return img->data[addr*2] | (img->data[addr*2+1] << 8);
+}
+
+
+// Write the program word at the given word address and mark it as used.
+void ihex_set_word(struct ihex_image* img, uint16_t addr, uint16_t word) {
+    img->data[addr*2+0] = (word >> 0) & 0xFF;
+    img->data[addr*2+1] = (word >> 8) & 0x3F;
+    img->used[addr*2+0] = 1;
+    img->used[addr*2+1] = 1;
+}
+
+
+// Extract the first num words of program memory. Unprogrammed words read back
+// as 0x3FFF just like erased flash. Returns the number of the highest used
+// word plus one.
+int ihex_rom(const struct ihex_image* img, uint16_t* rom, int num) {
+    int addr, top = 0;
+    for (addr = 0; addr < num; addr++) {
+        if (img->used[addr*2]) {
+            rom[addr] = ihex_word(img, addr) & 0x3FFF;
+            top = addr+1;
+        } else {
+            rom[addr] = 0x3FFF;
+        }
+    }
+    return top;
+}
+
+
+#endif /* _PIC14_IHEX_H */
@@ -0,0 +1,251 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _PIC14_PIC14_H
+#define _PIC14_PIC14_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+
+/* Special function registers common to every bank */
+#define REG_INDF    0x00
+#define REG_PCL     0x02
+#define REG_STATUS  0x03
+#define REG_FSR     0x04
+#define REG_PCLATH  0x0A
+#define REG_INTCON  0x0B
+
+/* STATUS register bits */
+#define STATUS_C    0
+#define STATUS_DC   1
+#define STATUS_Z    2
+#define STATUS_RP0  5
+#define STATUS_RP1  6
+#define STATUS_IRP  7
+
+
+/* The 35 instructions of the mid-range core */
+enum pic14_op {
+    OP_ADDWF, OP_ANDWF, OP_CLRF, OP_CLRW, OP_COMF, OP_DECF, OP_DECFSZ,
+    OP_INCF, OP_INCFSZ, OP_IORWF, OP_MOVF, OP_MOVWF, OP_NOP, OP_RLF, OP_RRF,
+    OP_SUBWF, OP_SWAPF, OP_XORWF, OP_BCF, OP_BSF, OP_BTFSC, OP_BTFSS,
+    OP_ADDLW, OP_ANDLW, OP_CALL, OP_CLRWDT, OP_GOTO, OP_IORLW, OP_MOVLW,
+    OP_RETFIE, OP_RETLW, OP_RETURN, OP_SLEEP, OP_SUBLW, OP_XORLW, OP_INVALID,
+};
+
+/* A decoded instruction */
+struct pic14_insn {
+    uint8_t op;
+    uint8_t f;  // File register address (7 bits)
+    uint8_t d;  // Destination: 0 for W, 1 for F
+    uint8_t b;  // Bit number
+    uint16_t k; // Literal or branch target (8 or 11 bits)
+};
+
+/* Device parameters relevant to code analysis and simulation */
+struct pic14_device {
+    const char* name;
+    uint16_t rom_words;
+    uint16_t eeprom_bytes;
+    uint16_t reg_eedata;
+    uint16_t reg_eeadr;
+    uint16_t reg_eecon1;
+    uint16_t reg_eecon2;
+};
+
+const struct pic14_device pic14_devices[] = {
+    {"12f683",  0x0800, 256, 0x9A,  0x9B,  0x9C,  0x9D},
+    {"16f877a", 0x2000, 256, 0x10C, 0x10D, 0x18C, 0x18D},
+};
+
+
+void pic14_decode(uint16_t word, struct pic14_insn* insn);
+uint16_t pic14_encode(const struct pic14_insn* insn);
+int pic14_is_skip(const struct pic14_insn* insn);
+int pic14_writes_pcl(const struct pic14_insn* insn);
+int pic14_cycles(const struct pic14_insn* insn);
+int pic14_format(const struct pic14_insn* insn, char* buf, int num);
+const struct pic14_device* pic14_find_device(const char* name);
+
+
+// Decode a 14-bit program word into its opcode and operand fields.
+void pic14_decode(uint16_t word, struct pic14_insn* insn) {
+    static const uint8_t byte_ops[16] = {
+        OP_INVALID, OP_INVALID, OP_SUBWF, OP_DECF, OP_IORWF, OP_ANDWF,
+        OP_XORWF, OP_ADDWF, OP_MOVF, OP_COMF, OP_INCF, OP_DECFSZ, OP_RRF,
+        OP_RLF, OP_SWAPF, OP_INCFSZ,
+    };
+
+    memset(insn, 0, sizeof(*insn));
+    insn->op = OP_INVALID;
+    insn->f = word & 0x7F;
+    insn->d = (word >> 7) & 0x01;
+    insn->b = (word >> 7) & 0x07;
+    word &= 0x3FFF;
+
+    switch (word >> 12) {
+    case 0x0:
+        if ((word & 0x0F00) == 0x0000) {
+            if (word & 0x0080)
+                insn->op = OP_MOVWF;
+            else if (word == 0x0008)
+                insn->op = OP_RETURN;
+            else if (word == 0x0009)
+                insn->op = OP_RETFIE;
+            else if (word == 0x0063)
+                insn->op = OP_SLEEP;
+            else if (word == 0x0064)
+                insn->op = OP_CLRWDT;
+            else if ((word & 0x009F) == 0x0000)
+                insn->op = OP_NOP;
+        } else if ((word & 0x0F00) == 0x0100) {
+            insn->op = (word & 0x0080) ? OP_CLRF : OP_CLRW;
+        } else {
+            insn->op = byte_ops[(word >> 8) & 0x0F];
+        }
+        break;
+    case 0x1:
+        insn->op = OP_BCF + ((word >> 10) & 0x03);
+        break;
+    case 0x2:
+        insn->op = (word & 0x0800) ? OP_GOTO : OP_CALL;
+        insn->k = word & 0x07FF;
+        break;
+    case 0x3:
+        insn->k = word & 0x00FF;
+        switch ((word >> 8) & 0x0F) {
+        case 0x0: case 0x1: case 0x2: case 0x3: insn->op = OP_MOVLW; break;
+        case 0x4: case 0x5: case 0x6: case 0x7: insn->op = OP_RETLW; break;
+        case 0x8: insn->op = OP_IORLW; break;
+        case 0x9: insn->op = OP_ANDLW; break;
+        case 0xA: insn->op = OP_XORLW; break;
+        case 0xC: case 0xD: insn->op = OP_SUBLW; break;
+        case 0xE: case 0xF: insn->op = OP_ADDLW; break;
+        }
+        break;
+    }
+}
+
+
+// Encode an instruction into its 14-bit program word. This is the inverse of
+// pic14_decode() and is used to assemble small routines for the simulator.
+uint16_t pic14_encode(const struct pic14_insn* insn) {
+    static const uint16_t byte_ops[] = {
+        [OP_ADDWF] = 0x0700, [OP_ANDWF] = 0x0500, [OP_CLRF] = 0x0180,
+        [OP_COMF] = 0x0900, [OP_DECF] = 0x0300, [OP_DECFSZ] = 0x0B00,
+        [OP_INCF] = 0x0A00, [OP_INCFSZ] = 0x0F00, [OP_IORWF] = 0x0400,
+        [OP_MOVF] = 0x0800, [OP_MOVWF] = 0x0080, [OP_RLF] = 0x0D00,
+        [OP_RRF] = 0x0C00, [OP_SUBWF] = 0x0200, [OP_SWAPF] = 0x0E00,
+        [OP_XORWF] = 0x0600,
+    };
+    uint16_t f = insn->f & 0x7F, k = insn->k;
+
+    switch (insn->op) {
+    case OP_CLRF: case OP_MOVWF:
+        return byte_ops[insn->op] | f;
+    case OP_ADDWF: case OP_ANDWF: case OP_COMF: case OP_DECF: case OP_DECFSZ:
+    case OP_INCF: case OP_INCFSZ: case OP_IORWF: case OP_MOVF: case OP_RLF:
+    case OP_RRF: case OP_SUBWF: case OP_SWAPF: case OP_XORWF:
+        return byte_ops[insn->op] | (insn->d ? 0x80 : 0) | f;
+    case OP_BCF: case OP_BSF: case OP_BTFSC: case OP_BTFSS:
+        return 0x1000 | (insn->op - OP_BCF) << 10 | (insn->b & 0x07) << 7 | f;
+    case OP_CALL:   return 0x2000 | (k & 0x07FF);
+    case OP_GOTO:   return 0x2800 | (k & 0x07FF);
+    case OP_MOVLW:  return 0x3000 | (k & 0xFF);
+    case OP_RETLW:  return 0x3400 | (k & 0xFF);
+    case OP_IORLW:  return 0x3800 | (k & 0xFF);
+    case OP_ANDLW:  return 0x3900 | (k & 0xFF);
+    case OP_XORLW:  return 0x3A00 | (k & 0xFF);
+    case OP_SUBLW:  return 0x3C00 | (k & 0xFF);
+    case OP_ADDLW:  return 0x3E00 | (k & 0xFF);
+    case OP_CLRW:   return 0x0103;
+    case OP_RETURN: return 0x0008;
+    case OP_RETFIE: return 0x0009;
+    case OP_SLEEP:  return 0x0063;
+    case OP_CLRWDT: return 0x0064;
+    }
+    return 0x0000; // NOP
+}
+
+
+// Report whether the instruction conditionally skips the next instruction.
+int pic14_is_skip(const struct pic14_insn* insn) {
+    return (
+        insn->op == OP_DECFSZ || insn->op == OP_INCFSZ ||
+        insn->op == OP_BTFSC || insn->op == OP_BTFSS
+    );
+}
+
+
+// Report whether the instruction modifies the program counter through PCL,
+// which is how computed jumps and ROM table lookups are performed.
+int pic14_writes_pcl(const struct pic14_insn* insn) {
+    if (insn->f != REG_PCL)
+        return 0;
+    switch (insn->op) {
+    case OP_MOVWF: case OP_CLRF: case OP_BCF: case OP_BSF:
+        return 1;
+    case OP_ADDWF: case OP_ANDWF: case OP_COMF: case OP_DECF: case OP_INCF:
+    case OP_IORWF: case OP_MOVF: case OP_RLF: case OP_RRF: case OP_SUBWF:
+    case OP_SWAPF: case OP_XORWF:
+        return insn->d;
+    }
+    return 0;
+}
+
+
+// Return the number of instruction cycles taken by the instruction, assuming
+// that a skip instruction does not skip. A taken skip costs one more cycle.
+int pic14_cycles(const struct pic14_insn* insn) {
+    switch (insn->op) {
+    case OP_CALL: case OP_GOTO: case OP_RETFIE: case OP_RETLW: case OP_RETURN:
+        return 2;
+    }
+    return pic14_writes_pcl(insn) ? 2 : 1;
+}
+
+
+// Print the instruction in MPASM syntax into the buffer.
+int pic14_format(const struct pic14_insn* insn, char* buf, int num) {
+    static const char* names[] = {
+        "ADDWF", "ANDWF", "CLRF", "CLRW", "COMF", "DECF", "DECFSZ", "INCF",
+        "INCFSZ", "IORWF", "MOVF", "MOVWF", "NOP", "RLF", "RRF", "SUBWF",
+        "SWAPF", "XORWF", "BCF", "BSF", "BTFSC", "BTFSS", "ADDLW", "ANDLW",
+        "CALL", "CLRWDT", "GOTO", "IORLW", "MOVLW", "RETFIE", "RETLW",
+        "RETURN", "SLEEP", "SUBLW", "XORLW", "???",
+    };
+    const char* name = names[insn->op];
+
+    switch (insn->op) {
+    case OP_CLRF: case OP_MOVWF:
+        return snprintf(buf, num, "%-7s 0x%02X", name, insn->f);
+    case OP_BCF: case OP_BSF: case OP_BTFSC: case OP_BTFSS:
+        return snprintf(buf, num, "%-7s 0x%02X,%d", name, insn->f, insn->b);
+    case OP_CALL: case OP_GOTO:
+        return snprintf(buf, num, "%-7s 0x%03X", name, insn->k);
+    case OP_ADDLW: case OP_ANDLW: case OP_IORLW: case OP_MOVLW: case OP_RETLW:
+    case OP_SUBLW: case OP_XORLW:
+        return snprintf(buf, num, "%-7s 0x%02X", name, insn->k);
+    case OP_CLRW: case OP_CLRWDT: case OP_NOP: case OP_RETFIE: case OP_RETURN:
+    case OP_SLEEP: case OP_INVALID:
+        return snprintf(buf, num, "%s", name);
+    }
+    return snprintf(buf, num, "%-7s 0x%02X,%c", name, insn->f, insn->d ? 'F' : 'W');
+}
+
+
+// Look up a device by its part name, such as "16f877a".
+const struct pic14_device* pic14_find_device(const char* name) {
+    size_t idx;
+    for (idx = 0; idx < sizeof(pic14_devices)/sizeof(pic14_devices[0]); idx++)
+        if (strcasecmp(name, pic14_devices[idx].name) == 0)
+            return &pic14_devices[idx];
+    return NULL;
+}
+
+
+#endif /* _PIC14_PIC14_H */
@@ -0,0 +1,295 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _PIC14_SIM_H
+#define _PIC14_SIM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pic14.h"
+
+
+// This is a small instruction-level simulator for the mid-range PIC core. It
+// models the banked register file, the 8-level hardware stack, PCLATH paging,
+// the STATUS flags and the data EEPROM. Other peripherals are plain memory,
+// which is sufficient for timing the compute-bound parts of the firmware.
+
+#define SIM_RETURN   0  // The called function returned
+#define SIM_TIMEOUT  1  // The cycle budget was exhausted
+#define SIM_SLEEP    2  // The SLEEP instruction was executed
+#define SIM_INVALID  3  // An invalid instruction was executed
+
+/* EECON1 register bits */
+#define EECON1_RD    0
+#define EECON1_WR    1
+#define EECON1_WREN  2
+
+/* The return address used to detect when a simulated call has finished */
+#define SIM_SENTINEL 0x1FFF
+
+
+/* The state of a simulated microcontroller */
+struct pic14_sim {
+    const struct pic14_device* dev;
+    const uint16_t* rom;
+    uint8_t ram[512];
+    uint8_t eeprom[256];
+    uint16_t stack[8];
+    uint16_t pc;
+    uint8_t w;
+    int depth;
+    uint64_t cycles;
+};
+
+
+void sim_reset(struct pic14_sim* sim, const struct pic14_device* dev, const uint16_t* rom);
+int sim_step(struct pic14_sim* sim);
+int sim_call(struct pic14_sim* sim, uint16_t entry, uint64_t max_cycles);
+uint16_t sim_map(const struct pic14_sim* sim, uint16_t addr);
+uint8_t sim_read(struct pic14_sim* sim, uint8_t f);
+void sim_write(struct pic14_sim* sim, uint8_t f, uint8_t val);
+
+
+// Reset the processor state. The program memory must be at least as large as
+// the program memory of the device.
+void sim_reset(struct pic14_sim* sim, const struct pic14_device* dev, const uint16_t* rom) {
+    memset(sim, 0, sizeof(*sim));
+    sim->dev = dev;
+    sim->rom = rom;
+    sim->ram[REG_STATUS] = 0x18;
+    memset(sim->eeprom, 0xFF, sizeof(sim->eeprom));
+}
+
+
+// Map a 9-bit banked register address to its location in the register file.
+// The core registers and the top 16 bytes of each bank are shared by all banks.
+uint16_t sim_map(const struct pic14_sim* sim, uint16_t addr) {
+    uint8_t reg = addr & 0x7F;
+    switch (reg) {
+    case REG_INDF: case REG_PCL: case REG_STATUS: case REG_FSR:
+    case REG_PCLATH: case REG_INTCON:
+        return reg;
+    }
+    return (reg >= 0x70) ? reg : addr;
+}
+
+
+// Read a file register using the current bank selection.
+uint8_t sim_read(struct pic14_sim* sim, uint8_t f) {
+    uint8_t status = sim->ram[REG_STATUS];
+    uint16_t addr = ((status >> STATUS_RP0) & 0x03) << 7 | f;
+
+    if (f == REG_INDF) {
+        addr = ((status >> STATUS_IRP) & 0x01) << 8 | sim->ram[REG_FSR];
+        if ((addr & 0x7F) == REG_INDF)
+            return 0;
+    }
+    addr = sim_map(sim, addr);
+    if (addr == REG_PCL)
+        return sim->pc & 0xFF;
+    return sim->ram[addr];
+}
+
+
+// Write a file register using the current bank selection. Writes to PCL jump
+// and writes to the EEPROM control register perform the EEPROM access.
+void sim_write(struct pic14_sim* sim, uint8_t f, uint8_t val) {
+    uint8_t status = sim->ram[REG_STATUS];
+    uint16_t addr = ((status >> STATUS_RP0) & 0x03) << 7 | f;
+    const struct pic14_device* dev = sim->dev;
+
+    if (f == REG_INDF) {
+        addr = ((status >> STATUS_IRP) & 0x01) << 8 | sim->ram[REG_FSR];
+        if ((addr & 0x7F) == REG_INDF)
+            return;
+    }
+    addr = sim_map(sim, addr);
+    sim->ram[addr] = val;
+
+    if (addr == REG_PCL) {
+        sim->pc = ((sim->ram[REG_PCLATH] & 0x1F) << 8) | val;
+    } else if (addr == dev->reg_eecon1) {
+        uint8_t eeadr = sim->ram[dev->reg_eeadr] % dev->eeprom_bytes;
+        if (val & (1 << EECON1_RD))
+            sim->ram[dev->reg_eedata] = sim->eeprom[eeadr];
+        if ((val & (1 << EECON1_WR)) && (val & (1 << EECON1_WREN)))
+            sim->eeprom[eeadr] = sim->ram[dev->reg_eedata];
+        sim->ram[addr] &= ~((1 << EECON1_RD) | (1 << EECON1_WR));
+    }
+}
+
+
+// Execute a single instruction and account for the cycles that it takes.
+int sim_step(struct pic14_sim* sim) {
+    struct pic14_insn insn;
+    uint8_t* status = &sim->ram[REG_STATUS];
+    uint16_t pc = sim->pc;
+    uint8_t val = 0, res = 0;
+    int flags = 0; // Bit mask of the STATUS flags updated by the instruction
+    int store = 0; // Whether the result is stored according to the d bit
+    int tmp;
+
+    pic14_decode(sim->rom[pc % sim->dev->rom_words], &insn);
+    sim->pc = (pc + 1) & 0x1FFF;
+    sim->cycles += 1;
+
+    // Fetch the file register operand
+    switch (insn.op) {
+    case OP_ADDWF: case OP_ANDWF: case OP_COMF: case OP_DECF: case OP_DECFSZ:
+    case OP_INCF: case OP_INCFSZ: case OP_IORWF: case OP_MOVF: case OP_RLF:
+    case OP_RRF: case OP_SUBWF: case OP_SWAPF: case OP_XORWF: case OP_BCF:
+    case OP_BSF: case OP_BTFSC: case OP_BTFSS:
+        val = sim_read(sim, insn.f);
+    }
+
+    switch (insn.op) {
+    case OP_ADDWF:
+    case OP_ADDLW:
+        if (insn.op == OP_ADDLW)
+            val = insn.k;
+        tmp = val + sim->w;
+        res = tmp & 0xFF;
+        *status = (*status & ~0x03) | (tmp > 0xFF) << STATUS_C |
+            (((val & 0x0F) + (sim->w & 0x0F)) > 0x0F) << STATUS_DC;
+        flags = 1 << STATUS_Z;
+        store = (insn.op == OP_ADDWF);
+        if (insn.op == OP_ADDLW)
+            sim->w = res;
+        break;
+    case OP_SUBWF:
+    case OP_SUBLW:
+        if (insn.op == OP_SUBLW)
+            val = insn.k;
+        res = val - sim->w;
+        *status = (*status & ~0x03) | (val >= sim->w) << STATUS_C |
+            ((val & 0x0F) >= (sim->w & 0x0F)) << STATUS_DC;
+        flags = 1 << STATUS_Z;
+        store = (insn.op == OP_SUBWF);
+        if (insn.op == OP_SUBLW)
+            sim->w = res;
+        break;
+    case OP_ANDWF: res = val & sim->w; flags = 1 << STATUS_Z; store = 1; break;
+    case OP_IORWF: res = val | sim->w; flags = 1 << STATUS_Z; store = 1; break;
+    case OP_XORWF: res = val ^ sim->w; flags = 1 << STATUS_Z; store = 1; break;
+    case OP_COMF:  res = ~val;         flags = 1 << STATUS_Z; store = 1; break;
+    case OP_DECF:  res = val - 1;      flags = 1 << STATUS_Z; store = 1; break;
+    case OP_INCF:  res = val + 1;      flags = 1 << STATUS_Z; store = 1; break;
+    case OP_MOVF:  res = val;          flags = 1 << STATUS_Z; store = 1; break;
+    case OP_SWAPF: res = (val << 4) | (val >> 4);             store = 1; break;
+    case OP_RLF:
+        res = (val << 1) | ((*status >> STATUS_C) & 1);
+        *status = (*status & ~(1 << STATUS_C)) | (val >> 7) << STATUS_C;
+        store = 1;
+        break;
+    case OP_RRF:
+        res = (val >> 1) | ((*status >> STATUS_C) & 1) << 7;
+        *status = (*status & ~(1 << STATUS_C)) | (val & 1) << STATUS_C;
+        store = 1;
+        break;
+    case OP_DECFSZ:
+    case OP_INCFSZ:
+        res = (insn.op == OP_DECFSZ) ? val - 1 : val + 1;
+        store = 1;
+        if (res == 0) {
+            sim->pc = (sim->pc + 1) & 0x1FFF;
+            sim->cycles += 1;
+        }
+        break;
+    case OP_CLRF:
+        sim_write(sim, insn.f, 0);
+        *status |= 1 << STATUS_Z;
+        break;
+    case OP_CLRW:
+        sim->w = 0;
+        *status |= 1 << STATUS_Z;
+        break;
+    case OP_MOVWF:
+        sim_write(sim, insn.f, sim->w);
+        break;
+    case OP_BCF:
+        sim_write(sim, insn.f, val & ~(1 << insn.b));
+        break;
+    case OP_BSF:
+        sim_write(sim, insn.f, val | (1 << insn.b));
+        break;
+    case OP_BTFSC:
+    case OP_BTFSS:
+        if (((val >> insn.b) & 1) == (insn.op == OP_BTFSS)) {
+            sim->pc = (sim->pc + 1) & 0x1FFF;
+            sim->cycles += 1;
+        }
+        break;
+    case OP_ANDLW: sim->w &= insn.k; res = sim->w; flags = 1 << STATUS_Z; break;
+    case OP_IORLW: sim->w |= insn.k; res = sim->w; flags = 1 << STATUS_Z; break;
+    case OP_XORLW: sim->w ^= insn.k; res = sim->w; flags = 1 << STATUS_Z; break;
+    case OP_MOVLW: sim->w = insn.k; break;
+    case OP_CALL:
+        sim->stack[sim->depth++ % 8] = sim->pc;
+        // Fall through
+    case OP_GOTO:
+        sim->pc = ((sim->ram[REG_PCLATH] & 0x18) << 8) | insn.k;
+        sim->cycles += 1;
+        break;
+    case OP_RETLW:
+        sim->w = insn.k;
+        // Fall through
+    case OP_RETURN:
+    case OP_RETFIE:
+        if (insn.op == OP_RETFIE)
+            sim->ram[REG_INTCON] |= 0x80;
+        sim->pc = sim->stack[--sim->depth % 8];
+        sim->cycles += 1;
+        break;
+    case OP_SLEEP:
+        return SIM_SLEEP;
+    case OP_NOP:
+    case OP_CLRWDT:
+        break;
+    default:
+        return SIM_INVALID;
+    }
+
+    // Store the result and update the zero flag
+    if (store) {
+        if (insn.d) {
+            sim_write(sim, insn.f, res);
+            if (pic14_writes_pcl(&insn))
+                sim->cycles += 1;
+        } else {
+            sim->w = res;
+        }
+    }
+    if (flags & (1 << STATUS_Z))
+        *status = (*status & ~(1 << STATUS_Z)) | (res == 0) << STATUS_Z;
+    if ((insn.op == OP_MOVWF || insn.op == OP_CLRF || insn.op == OP_BCF ||
+         insn.op == OP_BSF) && pic14_writes_pcl(&insn))
+        sim->cycles += 1;
+    return SIM_RETURN;
+}
+
+
+// Call the function at the given entry address as if by a CALL instruction
+// and run until it returns. The CALL itself is not included in the cycles
+// accounted, but the final RETURN or RETLW is.
+int sim_call(struct pic14_sim* sim, uint16_t entry, uint64_t max_cycles) {
+    int depth = sim->depth;
+    uint64_t limit = sim->cycles + max_cycles;
+
+    sim->stack[sim->depth++ % 8] = SIM_SENTINEL;
+    sim->ram[REG_PCLATH] = (entry >> 8) & 0x18;
+    sim->pc = entry;
+
+    while (sim->cycles < limit) {
+        int ret = sim_step(sim);
+        if (ret != SIM_RETURN)
+            return ret;
+        if (sim->depth == depth && sim->pc == SIM_SENTINEL)
+            return SIM_RETURN;
+    }
+    return SIM_TIMEOUT;
+}
+
+
+#endif /* _PIC14_SIM_H */
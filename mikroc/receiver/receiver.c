@@ -8,10 +8,11 @@ Project name:
 Description:
     This is the receiver part of the remote keyless system project. The receiver
     continuously waits for a signal from the transmitter. The messages need to
-    be encrypted with BlowFish32 and verified using a CRC8 checksum. The system
-    supports up to 16 channels, each of which have their own associated rolling
-    codes. However, all 16 channels share the same encryption key. Thus, it is
-    not secure to simply invalidate a channel in the event of a lost remote.
+    be encrypted with BlowFish32 or Speck32/64 and verified using a CRC8
+    checksum or a truncated MAC. The system supports up to 16 channels, each of
+    which have their own associated rolling codes. However, all 16 channels
+    share the same encryption key. Thus, it is not secure to simply invalidate a
+    channel in the event of a lost remote.
     For easier debugging of operations, data and commands received by the device
     are displayed on a 4x20 character LCD module.
 Configuration:
@@ -26,9 +27,13 @@ Notes:
  */
 
 #include "../crypto/crc.h"
-#include "../crypto/blowfish.h"
 #include "../key_gen/key.h"
 
+// Accept remotes using either cipher, as named by the frame version.
+#define CIPHER CIPHER_ALL
+#include "../crypto/cipher.h"
+#include "../crypto/mac.h"
+
 
 /* Global constants */
 const char text_cmd1[] = "Command";
@@ -57,6 +62,12 @@ const short SYNC_HACK = 1;
 //  byte 0b10010110 as the start marker.
 const uint8_t FRAME_MARK = 0b10010110;
 
+// The upper nibble of the channel byte is the frame version. The FRAME_MAC bit
+// marks messages that carry a serial number and MAC in place of the CRC8, and
+// the other bits name the cipher. See transmit_code() in transmitter.c.
+const uint8_t FRAME_MAC = 0x20;
+const short MAX_FRAME = 10;
+
 // The rolling code maintains a moving window that protects against replay
 // attacks. However, there is the possibility that the transmitter and receiver
 // can get out of sync if the remote increments its rolling code too often
@@ -72,6 +83,8 @@ const uint8_t ADDRESS_STATE = MAX_CHANS*4;
 
 void manchester_synchronize();
 void receive_code(uint8_t* data);
+short frame_length(uint8_t chan);
+short frame_check(uint8_t* data);
 void process_code(uint8_t* data);
 void process_load(uint8_t* data, uint32_t code, short chan);
 void process_store(uint8_t* data, uint32_t code, short chan);
@@ -87,7 +100,7 @@ void lcd_hexdump(short row, short col, uint8_t* data, short num);
 
 
 void main() {
-    uint8_t data[6];
+    uint8_t data[MAX_FRAME];
 
     // Define inputs and outputs
     PORTC = 0x00;
@@ -101,8 +114,9 @@ void main() {
     lcd_cmd(LCD_CURSOR_OFF);
     lcd_cmd(LCD_TURN_OFF);
 
-    // Configure the BlowFish32 cipher
-    blowfish_setkeys(arr_p, arr_s1, arr_s2, arr_s3, arr_s4);
+    // Configure the ciphers and the frame MAC
+    cipher_setkeys();
+    mac_setkeys(arr_mk);
 
     // Configure the Manchester decoder
     man_receive_config(&PORTB, 0);
@@ -133,28 +147,31 @@ void main() {
 // needs to be synchronized by receiving messages from the transmitters.
 // This is achieved by simply broadcasting a valid message repeatedly from the
 // remotes until synchronization occurs. This function attempts to collect the
-// 6-byte messages that the transmitters send and verify that the CRC is valid.
+// messages that the transmitters send and verify that the CRC or MAC is valid.
 void manchester_synchronize() {
     const short MAX_ERR_CNT = 8;
-    short idx, ok;
+    short idx, num, ok;
     unsigned short err, err_cnt;
-    uint8_t data[6];
+    uint8_t data[MAX_FRAME];
 
     while (1) {
         if ((man_receive(&err) == FRAME_MARK) && !err) {
-            // Get the 6 byte data message
+            // Get the data message
             ok = 1;
-            for (idx = 0; idx < 6; idx++) {
+            num = MAX_FRAME;
+            for (idx = 0; idx < num; idx++) {
                 data[idx] = man_receive(&err);
                 if (err) {
                     err_cnt++;
                     ok = 0;
                     break;
                 }
+                if (idx == 4)
+                    num = frame_length(data[4]);
             }
 
             // If no transmission error, then break
-            if (ok == 1 && (crc_ccitt(data, 5) == data[5]))
+            if (ok == 1 && frame_check(data))
                 break;
         } else {
             // If too many errors, try to synchronize again
@@ -168,12 +185,13 @@ void manchester_synchronize() {
 }
 
 
-// This function blocks until a valid 6-byte message from a transmitter is
-// received. When this function returns, the payload in the data pointer is
-// guaranteed to have passed the CRC check. The data pointer must point to a
-// block of memory that is at least 6-bytes long.
+// This function blocks until a valid message from a transmitter is received.
+// When this function returns, the payload in the data pointer is guaranteed to
+// have passed the CRC or MAC check. Forged messages are dropped here, before
+// any decryption or channel state access. The data pointer must point to a
+// block of memory that is at least MAX_FRAME bytes long.
 void receive_code(uint8_t* data) {
-    short idx, ok;
+    short idx, num, ok;
     unsigned short err;
 
     // Blocking receive
@@ -181,36 +199,54 @@ void receive_code(uint8_t* data) {
         // Poll for frame marker
         while (man_receive(&err) != FRAME_MARK || err) {}
 
-        // Get the 6 byte data message
+        // Get the data message, whose length depends on the channel byte
         ok = 1;
-        for (idx = 0; idx < 6; idx++) {
+        num = MAX_FRAME;
+        for (idx = 0; idx < num; idx++) {
             data[idx] = man_receive(&err);
             if (err) {
                 ok = 0;
                 break;
             }
+            if (idx == 4)
+                num = frame_length(data[4]);
         }
 
-        // Ensure no transmission error
-        if (ok && (crc_ccitt(data, 5) == data[5]))
+        // Ensure no transmission error or forgery
+        if (ok && frame_check(data))
             return;
     }
 }
 
 
+// Return the length of a message given its channel byte.
+short frame_length(uint8_t chan) {
+    return (chan & FRAME_MAC) ? 10 : 6;
+}
+
+
+// Check the CRC8 or the MAC at the end of a message.
+short frame_check(uint8_t* data) {
+    if (data[4] & FRAME_MAC)
+        return mac_tag(data) == *((uint16_t*)(data+8));
+    return crc_ccitt(data, 5) == data[5];
+}
+
+
 // Based on the pin configurations, determine the type of command to run.
 // Parse out the code and channel values and decrypt the rolling code.
 void process_code(uint8_t* data) {
     uint8_t cmd = CMD_NORMAL;
     uint32_t code = *((uint32_t*)data);
     short chan = data[4] % MAX_CHANS;
+    short ver = (data[4] & ~FRAME_MAC) >> 4;
 
     // Display LCD message
     lcd_cmd(LCD_TURN_ON);
     lcd_cmd(LCD_RETURN_HOME);
 
     // Decrypt the rolling code
-    code = blowfish_decrypt(code);
+    code = cipher_decrypt(ver, code);
 
     // Get command input
     if (!PORTD.F0 && PORTD.F1) {
@@ -244,6 +280,7 @@ void process_load(uint8_t* data, uint32_t code, short chan) {
     short invalid = 0;
 
     // Check that the code is legit
+    invalid |= !cipher_valid((data[4] & ~FRAME_MAC) >> 4);
     invalid |= (read_channel_state(chan) != 0xFF);
     invalid |= (code - read_channel_code(chan) >= ROLLING_WINDOW);
 
@@ -8,10 +8,11 @@ Project name:
 Description:
     This implements the remote transmitter part of the remote keyless system.
     The transmitter sends an encrypted rolling code through the RF module using
-    Manchester encoding. The message is protected by BlowFish32 encryption and
-    verified using CRC8-CCITT checksums. The system supports up to 16 different
-    channels that maintain their own rolling codes. The channel of the remote
-    must be programmed in at flash time.
+    Manchester encoding. The message is protected by BlowFish32 or Speck32/64
+    encryption and verified using either CRC8-CCITT checksums or a truncated
+    MAC that also identifies the remote by its serial number. The system
+    supports up to 16 different channels that maintain their own rolling codes.
+    The channel of the remote must be programmed in at flash time.
 Configuration:
     Microcontroller:   PIC12F683
     Oscillator:        INT_RC, 8.00 MHz
@@ -24,30 +25,51 @@ Notes:
 */
 
 #include "../crypto/crc.h"
-#include "../crypto/blowfish.h"
+#include "../crypto/cipher.h"
+#include "../crypto/mac.h"
 #include "../key_gen/key.h"
 
 
 // The hard-coded channel number for this transmitter. The receiver keeps track
 // of the rolling codes for each transmitter on a per-channel basis. The valid
-// values for the channel number are from 0x00 to 0x0F inclusive.
+// values for the channel number are from 0x00 to 0x0F inclusive. The fob_stamp
+// program patches this value into the compiled image for each fob.
 const uint8_t CHAN_NUM = 0x00;
 
+// The serial number of this remote, which identifies it to a host verifier
+// that serves more remotes than there are channels. It is kept in EEPROM after
+// the rolling code, where the fob_stamp program writes it for each fob, since
+// MikroC stores a constant of zero with CLRF, which cannot be patched. Only the
+// low 24 bits are sent, and none of those bytes may be the frame marker.
+const uint8_t EEPROM_SERIAL = 4;
+
+// The frame version is sent in the upper nibble of the channel byte. The low
+// bit names the cipher that encrypted the rolling code, which is selected with
+// the CIPHER macro as described in cipher.h. The FRAME_MAC bit marks messages
+// that end in the serial number and a MAC instead of a CRC8.
+const uint8_t FRAME_VERSION = CIPHER << 4;
+const uint8_t FRAME_MAC = 0x20;
+
+// Whether to send MAC authenticated messages. These let the receiver discard
+// forged messages before decrypting them or reading any channel state.
+const short MAC_FRAMES = 1;
+
 // HACK(jtsai): The Manchester library provides no framing. Thus, each byte is
 //  received individually. In order to hack in our own framing, we reserve the
 //  byte 0b10010110 as the start marker.
 const uint8_t FRAME_MARK = 0b10010110;
 
 
-uint32_t transmit_code(uint32_t code, short cnt);
+uint32_t transmit_code(uint32_t code, uint32_t serial, short cnt);
 short valid_message(uint8_t* data, short num);
 uint32_t read_code();
+uint32_t read_serial();
 void write_code(uint32_t code);
 
 
 //The main function
 void main() {
-    uint32_t code;
+    uint32_t code, serial;
 
     // Half second delay as an extended power up timer
     delay_ms(500);
@@ -65,11 +87,13 @@ void main() {
     // Configure the Manchester encoder
     man_send_config(&GPIO, 5);
 
-    // Configure the BlowFish32 cipher
-    blowfish_setkeys(arr_p, arr_s1, arr_s2, arr_s3, arr_s4);
+    // Configure the cipher and the frame MAC
+    cipher_setkeys();
+    mac_setkeys(arr_mk);
 
-    // Load the rolling code
+    // Load the rolling code and the serial number
     code = read_code();
+    serial = read_serial();
 
     // Enable external interrupts
     INTCON.INTE = 1;
@@ -83,7 +107,7 @@ void main() {
         delay_ms(25);
 
         if (GPIO.F2 == 1) {
-            code = transmit_code(code, 16);
+            code = transmit_code(code, serial, 16);
             write_code(code);
         }
 
@@ -95,18 +119,24 @@ void main() {
 
 // Generate the message to transmit over the air. This function will
 // automatically increment the rolling code and transmit the message cnt times.
-uint32_t transmit_code(uint32_t code, short cnt) {
+uint32_t transmit_code(uint32_t code, uint32_t serial, short cnt) {
     int idx;
-    uint8_t data[6];
+    short num;
+    uint8_t data[10];
     uint32_t block;
 
-    // The message transmitted is the following 6-byte segment:
-    //  +---+---+---+---+----------+-----+
-    //  | rolling_code  | chan_num | crc |
-    //  +---+---+---+---+----------+-----+
+    // The message transmitted is one of the following segments:
+    //  +---+---+---+---+-----+------+-----+
+    //  | rolling_code  | ver | chan | crc |
+    //  +---+---+---+---+-----+------+-----+
+    //  +---+---+---+---+-----+------+---+---+---+---+---+
+    //  | rolling_code  | ver | chan |  serial   |  mac  |
+    //  +---+---+---+---+-----+------+---+---+---+---+---+
     //
-    // It is essentially the encrypted rolling code, the channel number, and
-    // the CRC8 value computed over the rolling_code and chan_num fields.
+    // It is essentially the encrypted rolling code, the frame version and the
+    // channel number sharing a byte, and either the CRC8 value computed over
+    // the rolling_code, ver and chan fields or the serial number followed by
+    // the MAC computed over all of the preceding fields.
     // The endianness of the rolling_code field is the default endianness of the
     // MikroC compiler and must the same for both transmitter and receiver.
     // The segment above does not show the preceeding frame marker.
@@ -115,18 +145,27 @@ uint32_t transmit_code(uint32_t code, short cnt) {
     GPIO.F4 = 1;
 
     // Form the transmission message
-    data[5] = CHAN_NUM;
+    data[4] = FRAME_VERSION | CHAN_NUM;
+    num = 6;
+    if (MAC_FRAMES) {
+        data[4] |= FRAME_MAC;
+        *((uint32_t*)(data+5)) = serial;
+        num = 10;
+    }
     do {
         code++; // Increment the code
-        *((uint32_t*)data) = blowfish_encrypt(code); // Encrypt the code
-        data[6] = crc_ccitt(data, 5); // Compute the CRC8
-    } while (!valid_message(data, 6));
+        *((uint32_t*)data) = cipher_encrypt(CIPHER, code); // Encrypt the code
+        if (MAC_FRAMES)
+            *((uint16_t*)(data+8)) = mac_tag(data); // Compute the MAC
+        else
+            data[5] = crc_ccitt(data, 5); // Compute the CRC8
+    } while (!valid_message(data, num));
 
     // Send burst fire of transmission signals
     for (; cnt > 0; cnt--) {
         man_send(FRAME_MARK);
         delay_ms(5);
-        for (idx = 0; idx < 6; idx++) {
+        for (idx = 0; idx < num; idx++) {
             man_send(data[idx]);
             delay_ms(5);
         }
@@ -162,6 +201,20 @@ uint32_t read_code() {
 }
 
 
+// Read the 24-bit serial number from EEPROM in native endianness.
+uint32_t read_serial() {
+    short idx;
+    uint32_t serial = 0;
+    uint8_t* _serial = (uint8_t*)(&serial);
+
+    for (idx = 0; idx < 3; idx++) {
+        delay_ms(20);
+        _serial[idx] = eeprom_read(EEPROM_SERIAL + idx);
+    }
+    return serial;
+}
+
+
 // Write the given rolling code to EPPROM in native endianness.
 void write_code(uint32_t code) {
     short idx;
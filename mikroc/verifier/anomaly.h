@@ -0,0 +1,356 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_ANOMALY_H
+#define _VERIFIER_ANOMALY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "verifier.h"
+
+
+// This watches the verdicts of the verifier for bursts of rejected messages,
+// which the receiver only answers with "Invalid PassCode" and a stall of five
+// seconds. Rejects are counted by reason for every door and every remote:
+//
+//  window:    The rolling code is outside of the window or was accepted
+//             before, as when a remote was pressed far from the door many
+//             times or a code was guessed or replayed
+//  disabled:  The remote is disabled but still being used
+//  forged:    The message is well formed but its MAC does not match, so it
+//             cannot be from the remote that it claims to be
+//  unknown:   The serial is not enrolled, as when serials are being scanned
+//
+// Every count decays by half every half-life, so that it follows the recent
+// rate of rejects rather than their total. The counts are kept with forward
+// decay: a reject at time t adds 2^((t - landmark)/half-life) rather than 1,
+// and a count is read by dividing by the weight of now, so nothing needs to
+// be decayed as time goes on. Once the weight grows large, every count is
+// divided by it and the landmark moved up, once every ANOMALY_RESCALE
+// half-lives. The weight is only worked out again once per ANOMALY_STEPS of a
+// half-life.
+//
+// The doors are few enough to be counted exactly. The remotes are counted in
+// a count-min sketch over the serial and reason, in which every key has one
+// counter in each of ANOMALY_DEPTH rows and is read as the least of them, so
+// a count is never too low and only too high by the rejects of the keys that
+// share all of its counters. The rows of a key all lie in one cache line,
+// which its hash picks, so that counting a reject costs one miss, and every
+// counter is only raised as far as the new least, which keeps the counts of
+// the other keys in it from growing. The memory is fixed once set up.
+//
+// An event is raised when the count of a door or remote rises past its limit
+// for the reason, and not again until it has fallen below half of it, so once
+// per burst. The remotes that raised events are kept for this in a small table
+// by hash, and one that is pushed out of it by another may raise again early.
+// The events wait in a ring until they are taken, and those raised while it is
+// full are counted and dropped.
+
+#define ANOMALY_DOORS    4096      // Doors counted exactly, beyond which they
+                                   // share counts
+#define ANOMALY_LINES    (1 << 16) // Cache lines of the sketch
+#define ANOMALY_DEPTH    4         // Rows of the sketch in every line
+#define ANOMALY_WIDTH    4         // Counters of a row in every line
+#define ANOMALY_STEPS    256       // Steps of the weight per half-life
+#define ANOMALY_RESCALE  32        // Half-lives between rescales
+#define ANOMALY_EVENTS   4096      // Events kept until taken
+#define ANOMALY_RAISED   4096      // Remotes kept that raised events
+#define ANOMALY_NONE     0xFFFFFFFF
+
+
+/* Reasons for rejects that are counted */
+enum anomaly_reason {
+    REASON_WINDOW,
+    REASON_DISABLED,
+    REASON_FORGED,
+    REASON_UNKNOWN,
+    NUM_REASONS,
+};
+
+/* What an event is about */
+enum anomaly_kind {
+    ANOMALY_DOOR,
+    ANOMALY_FOB,
+};
+
+/* A line of the sketch */
+struct anomaly_line {
+    float counts[ANOMALY_DEPTH*ANOMALY_WIDTH];
+} __attribute__((aligned(64)));
+
+/* A count that rose past its limit */
+struct anomaly_event {
+    uint64_t time;
+    uint32_t key;    // The door or serial
+    uint8_t kind;
+    uint8_t reason;
+    float count;     // The decayed count once past the limit
+};
+
+/* A detector of bursts of rejects */
+struct anomaly {
+    uint64_t half_life;  // In nanoseconds
+    uint64_t step;       // A step of the weight in nanoseconds
+    uint64_t landmark;   // When the weight was one
+    uint64_t step_end;   // Until when the weight holds
+    float weight;
+    float door_limits[NUM_REASONS];
+    float fob_limits[NUM_REASONS];
+    struct anomaly_line* lines;
+    float (*doors)[NUM_REASONS];
+    uint8_t* door_raised;   // Bit N is set if reason N raised an event
+    uint32_t* fob_raised;   // The serial and reason of every remote that
+                            // raised an event, by hash
+    struct anomaly_event* events;
+    uint32_t head;       // The next event to take
+    uint32_t tail;       // The next event to raise
+
+    // Statistics
+    uint64_t rejects;
+    uint64_t raised;
+    uint64_t dropped;
+    uint64_t rescales;
+};
+
+
+int anomaly_init(struct anomaly* an, uint64_t half_life, const float* door_limits, const float* fob_limits);
+void anomaly_free(struct anomaly* an);
+int anomaly_reason(int verdict);
+int anomaly_note(struct anomaly* an, uint32_t door, uint32_t serial, int verdict, uint64_t now);
+int anomaly_note_batch(struct anomaly* an, const uint32_t* doors, const uint32_t* serials, const int* verdicts, int num, uint64_t now);
+float anomaly_door(struct anomaly* an, uint32_t door, int reason, uint64_t now);
+float anomaly_fob(struct anomaly* an, uint32_t serial, int reason, uint64_t now);
+int anomaly_take(struct anomaly* an, struct anomaly_event* ev);
+void anomaly_advance(struct anomaly* an, uint64_t now);
+void anomaly_raise(struct anomaly* an, int kind, uint32_t key, int reason, float count, uint64_t now);
+uint64_t anomaly_hash(uint32_t serial, int reason);
+
+
+// Set up a detector whose counts halve every half_life nanoseconds, with the
+// decayed counts of every reason past which a door or remote raises an event.
+// Returns -1 if out of memory.
+int anomaly_init(struct anomaly* an, uint64_t half_life, const float* door_limits, const float* fob_limits) {
+    memset(an, 0, sizeof(*an));
+    an->half_life = (half_life < ANOMALY_STEPS) ? ANOMALY_STEPS : half_life;
+    an->step = an->half_life / ANOMALY_STEPS;
+    an->weight = 1;
+    memcpy(an->door_limits, door_limits, sizeof(an->door_limits));
+    memcpy(an->fob_limits, fob_limits, sizeof(an->fob_limits));
+    an->lines = aligned_alloc(64, ANOMALY_LINES*sizeof(*an->lines));
+    an->doors = calloc(ANOMALY_DOORS, sizeof(*an->doors));
+    an->door_raised = calloc(ANOMALY_DOORS, 1);
+    an->fob_raised = malloc(ANOMALY_RAISED*sizeof(*an->fob_raised));
+    an->events = malloc(ANOMALY_EVENTS*sizeof(*an->events));
+    if (an->lines == NULL || an->doors == NULL || an->door_raised == NULL || an->fob_raised == NULL || an->events == NULL) {
+        anomaly_free(an);
+        fprintf(stderr, "Could not allocate the detector\n");
+        return -1;
+    }
+    memset(an->lines, 0, ANOMALY_LINES*sizeof(*an->lines));
+    memset(an->fob_raised, 0xFF, ANOMALY_RAISED*sizeof(*an->fob_raised));
+    return 0;
+}
+
+
+// Release the memory of a detector.
+void anomaly_free(struct anomaly* an) {
+    free(an->lines);
+    free(an->doors);
+    free(an->door_raised);
+    free(an->fob_raised);
+    free(an->events);
+    memset(an, 0, sizeof(*an));
+}
+
+
+// Return the reason that a verdict is counted under, or -1 if it is not.
+// Malformed messages are not counted, as most are garbled by collisions.
+int anomaly_reason(int verdict) {
+    switch (verdict) {
+    case VERDICT_WINDOW:   return REASON_WINDOW;
+    case VERDICT_REPLAY:   return REASON_WINDOW;
+    case VERDICT_DISABLED: return REASON_DISABLED;
+    case VERDICT_FORGED:   return REASON_FORGED;
+    case VERDICT_UNKNOWN:  return REASON_UNKNOWN;
+    }
+    return -1;
+}
+
+
+// Count the verdict on a message from the remote with the given serial, or
+// the channel of a message without a MAC, that arrived at a door at now in
+// nanoseconds. Returns the number of events raised.
+int anomaly_note(struct anomaly* an, uint32_t door, uint32_t serial, int verdict, uint64_t now) {
+    struct anomaly_line* line;
+    float *cnt, least, limit, add;
+    uint64_t hash;
+    uint32_t *key;
+    uint8_t* flags;
+    int reason = anomaly_reason(verdict), row, raised = 0;
+
+    if (reason < 0)
+        return 0;
+    if (now >= an->step_end)
+        anomaly_advance(an, now);
+    an->rejects++;
+    add = an->weight;
+
+    // The door is counted exactly
+    cnt = &an->doors[door % ANOMALY_DOORS][reason];
+    flags = &an->door_raised[door % ANOMALY_DOORS];
+    limit = an->door_limits[reason] * add;
+    *cnt += add;
+    if (*cnt < limit/2)
+        *flags &= ~(1 << reason);
+    else if (*cnt >= limit && !(*flags >> reason & 1)) {
+        *flags |= 1 << reason;
+        anomaly_raise(an, ANOMALY_DOOR, door, reason, *cnt / add, now);
+        raised++;
+    }
+
+    // The remote is counted by the least of its counters, and only those at
+    // the least are raised
+    hash = anomaly_hash(serial, reason);
+    line = &an->lines[hash % ANOMALY_LINES];
+    hash >>= 32;
+    least = INFINITY;
+    for (row = 0; row < ANOMALY_DEPTH; row++) {
+        cnt = &line->counts[row*ANOMALY_WIDTH + (hash >> 2*row) % ANOMALY_WIDTH];
+        least = (*cnt < least) ? *cnt : least;
+    }
+    for (row = 0; row < ANOMALY_DEPTH; row++) {
+        cnt = &line->counts[row*ANOMALY_WIDTH + (hash >> 2*row) % ANOMALY_WIDTH];
+        if (*cnt < least + add)
+            *cnt = least + add;
+    }
+    least += add;
+    limit = an->fob_limits[reason] * add;
+    key = &an->fob_raised[(hash >> 16) % ANOMALY_RAISED];
+    if (*key == (serial << 8 | reason) && least < limit/2)
+        *key = ANOMALY_NONE;
+    else if (least >= limit && *key != (serial << 8 | reason)) {
+        *key = serial << 8 | reason;
+        anomaly_raise(an, ANOMALY_FOB, serial, reason, least / add, now);
+        raised++;
+    }
+    return raised;
+}
+
+
+// Count the verdicts on a batch of messages that arrived at now, like
+// anomaly_note(). The lines of the rejected messages are loaded before any is
+// counted, so that the misses overlap. Returns the number of events raised.
+int anomaly_note_batch(struct anomaly* an, const uint32_t* doors, const uint32_t* serials, const int* verdicts, int num, uint64_t now) {
+    int idx, raised = 0;
+
+    for (idx = 0; idx < num; idx++) {
+        int reason = anomaly_reason(verdicts[idx]);
+        if (reason >= 0)
+            __builtin_prefetch(&an->lines[anomaly_hash(serials[idx], reason) % ANOMALY_LINES], 1);
+    }
+    for (idx = 0; idx < num; idx++)
+        if (anomaly_reason(verdicts[idx]) >= 0)
+            raised += anomaly_note(an, doors[idx], serials[idx], verdicts[idx], now);
+    return raised;
+}
+
+
+// Return the decayed count of rejects at a door for a reason.
+float anomaly_door(struct anomaly* an, uint32_t door, int reason, uint64_t now) {
+    if (now >= an->step_end)
+        anomaly_advance(an, now);
+    return an->doors[door % ANOMALY_DOORS][reason] / an->weight;
+}
+
+
+// Return the decayed count of rejects of a remote for a reason, which is never
+// below the true count.
+float anomaly_fob(struct anomaly* an, uint32_t serial, int reason, uint64_t now) {
+    struct anomaly_line* line;
+    uint64_t hash = anomaly_hash(serial, reason);
+    float least = INFINITY;
+    int row;
+
+    if (now >= an->step_end)
+        anomaly_advance(an, now);
+    line = &an->lines[hash % ANOMALY_LINES];
+    hash >>= 32;
+    for (row = 0; row < ANOMALY_DEPTH; row++) {
+        float cnt = line->counts[row*ANOMALY_WIDTH + (hash >> 2*row) % ANOMALY_WIDTH];
+        least = (cnt < least) ? cnt : least;
+    }
+    return least / an->weight;
+}
+
+
+// Take the oldest event that was raised. Returns 0 if there is none.
+int anomaly_take(struct anomaly* an, struct anomaly_event* ev) {
+    if (an->head == an->tail)
+        return 0;
+    *ev = an->events[an->head++ % ANOMALY_EVENTS];
+    return 1;
+}
+
+
+// Work out the weight of the step that now is in, rescaling every count once
+// the landmark is ANOMALY_RESCALE half-lives behind. Time that goes backwards
+// is taken to be the start of the current step.
+void anomaly_advance(struct anomaly* an, uint64_t now) {
+    uint64_t steps;
+    float scale;
+    int idx, reason;
+
+    if (now < an->landmark)
+        now = an->landmark;
+    steps = (now - an->landmark) / an->step;
+    if (steps >= ANOMALY_RESCALE*ANOMALY_STEPS) {
+        scale = exp2f(-(float)steps / ANOMALY_STEPS);
+        for (idx = 0; idx < ANOMALY_LINES; idx++)
+            for (reason = 0; reason < ANOMALY_DEPTH*ANOMALY_WIDTH; reason++)
+                an->lines[idx].counts[reason] *= scale;
+        for (idx = 0; idx < ANOMALY_DOORS; idx++)
+            for (reason = 0; reason < NUM_REASONS; reason++)
+                an->doors[idx][reason] *= scale;
+        an->landmark += steps * an->step;
+        an->rescales++;
+        steps = 0;
+    }
+    an->weight = exp2f((float)steps / ANOMALY_STEPS);
+    an->step_end = an->landmark + (steps+1) * an->step;
+}
+
+
+// Add an event to the ring, or drop it if the ring is full.
+void anomaly_raise(struct anomaly* an, int kind, uint32_t key, int reason, float count, uint64_t now) {
+    struct anomaly_event* ev;
+
+    if (an->tail - an->head == ANOMALY_EVENTS) {
+        an->dropped++;
+        return;
+    }
+    ev = &an->events[an->tail++ % ANOMALY_EVENTS];
+    ev->time = now;
+    ev->key = key;
+    ev->kind = kind;
+    ev->reason = reason;
+    ev->count = count;
+    an->raised++;
+}
+
+
+// Hash a serial and reason into the line of the sketch in the lower half, and
+// the counters in it in the upper half.
+uint64_t anomaly_hash(uint32_t serial, int reason) {
+    uint64_t x = (uint64_t)serial << 8 | reason;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+    return x ^ (x >> 31);
+}
+
+
+#endif /* _VERIFIER_ANOMALY_H */
@@ -0,0 +1,150 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_ARENA_H
+#define _VERIFIER_ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// These are the two allocators of a verification core, which take all of their
+// memory up front so that the steady state never calls malloc():
+//
+//  arena:  A bump allocator for the objects of one batch, which are all
+//          released at once by resetting it when the batch is done
+//  slab:   A pool of objects of one size, such as the buffers that messages
+//          are received into, which are taken and returned one at a time
+//
+// Neither is thread safe, as every core has its own. Their memory is aligned
+// to cache lines so that the allocators of two cores never share one, and is
+// written once when it is allocated so that no page faults are left for the
+// steady state.
+
+#define ARENA_ALIGN  64
+
+
+/* A bump allocator */
+struct arena {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    size_t peak; // The most that was ever used
+};
+
+/* A pool of fixed size objects */
+struct slab {
+    uint8_t* base;
+    size_t size;   // The size of every object, rounded up to a pointer
+    uint32_t num;  // The number of objects
+    uint32_t used; // The number of objects taken
+    void* free;    // The first free object, which holds the next one
+};
+
+
+int arena_init(struct arena* ar, size_t size);
+void arena_free(struct arena* ar);
+void* arena_alloc(struct arena* ar, size_t size);
+void arena_reset(struct arena* ar);
+int slab_init(struct slab* sl, size_t size, uint32_t num);
+void slab_free(struct slab* sl);
+void* slab_get(struct slab* sl);
+void slab_put(struct slab* sl, void* obj);
+
+
+// Allocate an empty arena of the given number of bytes. Returns -1 if out of
+// memory.
+int arena_init(struct arena* ar, size_t size) {
+    memset(ar, 0, sizeof(*ar));
+    size = (size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+    if ((ar->base = aligned_alloc(ARENA_ALIGN, size)) == NULL) {
+        fprintf(stderr, "Could not allocate the arena\n");
+        return -1;
+    }
+    memset(ar->base, 0, size);
+    ar->size = size;
+    return 0;
+}
+
+
+// Release the memory of an arena.
+void arena_free(struct arena* ar) {
+    free(ar->base);
+    memset(ar, 0, sizeof(*ar));
+}
+
+
+// Take the given number of bytes from an arena, aligned to a cache line.
+// Returns NULL if the arena is full.
+void* arena_alloc(struct arena* ar, size_t size) {
+    size_t used = ar->used + ((size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1));
+    void* ptr;
+
+    if (used > ar->size)
+        return NULL;
+    ptr = ar->base + ar->used;
+    ar->used = used;
+    if (used > ar->peak)
+        ar->peak = used;
+    return ptr;
+}
+
+
+// Release everything that was taken from an arena.
+void arena_reset(struct arena* ar) {
+    ar->used = 0;
+}
+
+
+// Allocate a pool of num objects of the given size. Returns -1 if out of
+// memory.
+int slab_init(struct slab* sl, size_t size, uint32_t num) {
+    uint32_t idx;
+
+    memset(sl, 0, sizeof(*sl));
+    size = (size + sizeof(void*)-1) & ~(sizeof(void*)-1);
+    if ((sl->base = aligned_alloc(ARENA_ALIGN, (size*num + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))) == NULL) {
+        fprintf(stderr, "Could not allocate the slab\n");
+        return -1;
+    }
+    memset(sl->base, 0, size*num);
+    sl->size = size;
+    sl->num = num;
+    for (idx = num; idx > 0; idx--)
+        slab_put(sl, sl->base + (idx-1)*size);
+    sl->used = 0;
+    return 0;
+}
+
+
+// Release the memory of a pool.
+void slab_free(struct slab* sl) {
+    free(sl->base);
+    memset(sl, 0, sizeof(*sl));
+}
+
+
+// Take an object from a pool. Returns NULL if every object is taken.
+void* slab_get(struct slab* sl) {
+    void* obj = sl->free;
+
+    if (obj != NULL) {
+        sl->free = *(void**)obj;
+        sl->used++;
+    }
+    return obj;
+}
+
+
+// Return an object to the pool that it was taken from.
+void slab_put(struct slab* sl, void* obj) {
+    *(void**)obj = sl->free;
+    sl->free = obj;
+    sl->used--;
+}
+
+
+#endif /* _VERIFIER_ARENA_H */
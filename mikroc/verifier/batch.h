@@ -0,0 +1,203 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_BATCH_H
+#define _VERIFIER_BATCH_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+// This is a batcher that collects messages for verifier_check_batch() under a
+// deadline. Larger batches verify more messages per second, but every message
+// waits for the batch to fill. The batcher therefore picks the batch size and
+// how long to wait from the arrival rate and a p99 latency target:
+//
+//  size:      The smallest batch that verifies messages faster than they
+//             arrive with some headroom, as long as filling and verifying it
+//             fits within the latency target, or else the largest that fits
+//  deadline:  The batch is flushed early once its oldest message would
+//             otherwise miss the latency target
+//
+// The time to verify a batch is learnt as it runs, as the time per message
+// for each power of two batch size. Sizes that were never run are assumed to
+// be as fast as the next larger size that was, so the controller tries smaller
+// batches and settles on the smallest that keeps up. All times are in seconds,
+// and the arrival times may come from any clock, as long as it is the one that
+// now is given in.
+
+#define BATCH_SIZES     7    // Batches of 1, 2, 4, ... VERIFIER_BATCH
+#define BATCH_LOAD      0.7  // Fraction of the time that may be spent verifying
+#define BATCH_SLACK     0.5  // Fraction of the latency target that may be spent waiting
+#define BATCH_SMOOTHING 0.05 // Weight of a new sample in the moving averages
+
+
+/* A batcher of messages in front of a verifier */
+struct batcher {
+    struct verifier* vf;
+    double slo;   // The p99 latency target
+    int fixed;    // Fixed batch size, or 0 to pick it on the fly
+
+    // The messages waiting to be verified
+    uint8_t data[VERIFIER_BATCH][FRAME_MAX];
+    uint8_t lens[VERIFIER_BATCH];
+    double arrivals[VERIFIER_BATCH];
+    int num;
+
+    // The state of the controller
+    int size;               // The number of messages to flush at
+    double wait;            // The longest that the oldest message may wait
+    double gap;             // Moving average of the time between arrivals
+    double last;            // Arrival time of the last message, or -1
+    double cost[BATCH_SIZES]; // Moving average of the time per message, or 0
+};
+
+
+void batcher_init(struct batcher* bt, struct verifier* vf, double slo, int fixed);
+int batcher_add(struct batcher* bt, const uint8_t* data, int len, double now);
+int batcher_ready(const struct batcher* bt, double now);
+double batcher_deadline(const struct batcher* bt);
+double batcher_flush(struct batcher* bt, int* verdicts, int* slots);
+void batcher_control(struct batcher* bt);
+double batcher_cost(const struct batcher* bt, int size);
+int batcher_bucket(int size);
+double batcher_clock();
+
+
+// Set up a batcher for the given latency target. The batch size is fixed if
+// fixed is not zero, with the oldest message waiting at most half the target.
+void batcher_init(struct batcher* bt, struct verifier* vf, double slo, int fixed) {
+    memset(bt, 0, sizeof(*bt));
+    bt->vf = vf;
+    bt->slo = slo;
+    bt->fixed = fixed;
+    bt->size = fixed ? fixed : 1;
+    bt->wait = slo * BATCH_SLACK;
+    bt->last = -1;
+}
+
+
+// Add a message that arrived at now. A message longer than FRAME_MAX keeps
+// only FRAME_MAX bytes but a length one more, so that it is rejected as
+// malformed. Returns -1 if the batch is already full and must be flushed
+// first.
+int batcher_add(struct batcher* bt, const uint8_t* data, int len, double now) {
+    if (bt->num >= VERIFIER_BATCH)
+        return -1;
+    if (bt->gap > 0)
+        bt->gap += BATCH_SMOOTHING * ((now - bt->last) - bt->gap);
+    else if (bt->last >= 0)
+        bt->gap = now - bt->last;
+    bt->last = now;
+    if (len > FRAME_MAX)
+        len = FRAME_MAX + 1;
+    memcpy(bt->data[bt->num], data, (len > FRAME_MAX) ? FRAME_MAX : len);
+    bt->lens[bt->num] = len;
+    bt->arrivals[bt->num++] = now;
+    return 0;
+}
+
+
+// Report whether the waiting messages should be verified at now.
+int batcher_ready(const struct batcher* bt, double now) {
+    return bt->num > 0 && (bt->num >= bt->size || now >= batcher_deadline(bt));
+}
+
+
+// Return the time by which the waiting messages must be verified, which is
+// infinite if there are none.
+double batcher_deadline(const struct batcher* bt) {
+    return bt->num ? bt->arrivals[0] + bt->wait : 1.0/0.0;
+}
+
+
+// Verify the waiting messages, storing the verdict and slot of each in the
+// order that they arrived, and retune the controller. The arrival times are
+// left in the batcher until the next message is added. Returns the time that
+// the verification took.
+double batcher_flush(struct batcher* bt, int* verdicts, int* slots) {
+    const uint8_t* data[VERIFIER_BATCH];
+    double secs, *cost;
+    int idx, num = bt->num;
+
+    for (idx = 0; idx < num; idx++)
+        data[idx] = bt->data[idx];
+    secs = batcher_clock();
+    verifier_check_batch(bt->vf, data, bt->lens, num, verdicts, slots);
+    secs = batcher_clock() - secs;
+    bt->num = 0;
+
+    // A batch that lost the processor part way through would otherwise keep
+    // its size from being picked for a long time, so the samples are clipped
+    cost = &bt->cost[batcher_bucket(num)];
+    if (*cost > 0)
+        *cost += BATCH_SMOOTHING * (fmin(secs/num, 2 * *cost) - *cost);
+    else
+        *cost = secs/num;
+    if (!bt->fixed)
+        batcher_control(bt);
+    return secs;
+}
+
+
+// Pick the batch size and the longest wait from the arrival rate and the cost
+// of verifying, as described above.
+void batcher_control(struct batcher* bt) {
+    int size, best = 1;
+
+    for (size = 1; size <= VERIFIER_BATCH; size <<= 1) {
+        double cost = batcher_cost(bt, size);
+        if (size > 1 && (size-1) * bt->gap + size * cost > bt->slo * BATCH_SLACK)
+            break;
+        best = size;
+        if (cost <= BATCH_LOAD * bt->gap)
+            break;
+    }
+    bt->size = best;
+    bt->wait = bt->slo * BATCH_SLACK - best * batcher_cost(bt, best);
+    if (bt->wait < 0)
+        bt->wait = 0;
+}
+
+
+// Return the expected time per message for a batch size. A size that has not
+// been run is assumed to cost the same as the next larger size that has, so
+// that the controller tries it, or else the next smaller one. A batch never
+// costs more per message than a smaller one.
+double batcher_cost(const struct batcher* bt, int size) {
+    int bkt = batcher_bucket(size), idx;
+    double cost = 0;
+
+    for (idx = bkt; idx < BATCH_SIZES && cost == 0; idx++)
+        cost = bt->cost[idx];
+    for (idx = bkt; idx >= 0; idx--)
+        if (bt->cost[idx] > 0 && (cost == 0 || bt->cost[idx] < cost))
+            cost = bt->cost[idx];
+    return cost;
+}
+
+
+// Return the power of two bucket of a batch size.
+int batcher_bucket(int size) {
+    int bkt = 0;
+
+    while (bkt < BATCH_SIZES-1 && (2 << bkt) <= size)
+        bkt++;
+    return bkt;
+}
+
+
+// Return the current monotonic time in seconds.
+double batcher_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+#endif /* _VERIFIER_BATCH_H */
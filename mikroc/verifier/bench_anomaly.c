@@ -0,0 +1,292 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "anomaly.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The most attacks to inject */
+#define MAX_ATTACKS  256
+
+/* Kinds of attacks */
+enum attack_kind {
+    ATTACK_FORGE,  // Forged messages for one remote at one door
+    ATTACK_SCAN,   // Messages for random serials at one door
+    ATTACK_STUCK,  // A remote pressed again and again out of range
+    NUM_ATTACKS,
+};
+
+/* An attack injected into the messages */
+struct attack {
+    int kind;
+    uint32_t door;
+    uint32_t serial;
+    int start;      // The first message that it replaces
+    int found;      // Whether the event that it must raise was raised
+};
+
+
+/* Global variables */
+int num_frames = 10000000;
+int num_fobs = 1000000;
+int num_doors = 1000;
+int rate = 1000000;
+int reject_pct = 5;
+int half_life_ms = 1000;
+int num_attacks = 16;
+int attack_len = 500;
+uint32_t* doors;
+uint32_t* serials;
+int* verdicts;
+uint32_t* fleet;
+struct attack attacks[MAX_ATTACKS];
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_anomaly [-n frames] [-f fobs] [-d doors] [-r rate] [-p pct]\n"
+    "                     [-l half-life] [-a attacks] [-b burst]\n\n"
+    "Feeds the verdicts on messages from random remotes at random doors to the\n"
+    "detector of bursts of rejects, at a fixed rate of messages on the clock of\n"
+    "the messages. A share of them are rejected for random reasons, and the\n"
+    "rest are accepted. Reports the time that the detector takes per message\n"
+    "with no rejects, the given share of rejects and only rejects, both one\n"
+    "message at a time and in batches. Then injects bursts of forged messages\n"
+    "for one remote, of scanned serials and of a remote stuck out of range at\n"
+    "random doors, and reports how many raised the events that they must and\n"
+    "how many events were raised that no attack explains.\n\n"
+    "    -n frames   Number of messages (default: 10000000)\n"
+    "    -f fobs     Number of remotes (default: 1000000)\n"
+    "    -d doors    Number of doors (default: 1000)\n"
+    "    -r rate     Messages per second (default: 1000000)\n"
+    "    -p pct      Percent of messages rejected (default: 5)\n"
+    "    -l half     Half-life of the counts in milliseconds (default: 1000)\n"
+    "    -a attacks  Number of attacks (default: 16)\n"
+    "    -b burst    Messages per attack, over half a second (default: 500)\n"
+);
+
+const float door_limits[NUM_REASONS] = {200, 50, 100, 100};
+const float fob_limits[NUM_REASONS] = {50, 20, 20, 20};
+const int reject_verdicts[NUM_REASONS] = {VERDICT_WINDOW, VERDICT_DISABLED, VERDICT_FORGED, VERDICT_UNKNOWN};
+
+
+void make_verdicts(int pct);
+void inject_attacks();
+double run_detector(struct anomaly* an, int batched, int check);
+int explain(const struct anomaly_event* ev, uint64_t spacing);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    struct anomaly an;
+    double single, batch;
+    int opt, idx, found = 0, raised, pcts[3], num_pcts = 3;
+
+    while ((opt = getopt(argc, argv, "n:f:d:r:p:l:a:b:h")) != -1) {
+        switch (opt) {
+        case 'n': num_frames = atoi(optarg); break;
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'd': num_doors = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'p': reject_pct = atoi(optarg); break;
+        case 'l': half_life_ms = atoi(optarg); break;
+        case 'a': num_attacks = atoi(optarg); break;
+        case 'b': attack_len = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_frames < 1 || num_fobs < 1 || num_fobs > 1 << 23 || num_doors < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (rate < 1 || reject_pct < 0 || reject_pct > 100 || half_life_ms < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (num_attacks < 0 || num_attacks > MAX_ATTACKS || attack_len < 1 || attack_len > rate / 2 ||
+        (num_attacks > 0 && num_frames / num_attacks <= rate / 2))
+        PRINT_RETURN(help_msg, -1);
+
+    doors = malloc(num_frames*sizeof(*doors));
+    serials = malloc(num_frames*sizeof(*serials));
+    verdicts = malloc(num_frames*sizeof(*verdicts));
+    fleet = malloc(num_fobs*sizeof(*fleet));
+    if (doors == NULL || serials == NULL || verdicts == NULL || fleet == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < num_fobs; idx++)
+        fleet[idx] = (2*idx + 1) & 0xFFFFFF;
+    for (idx = 0; idx < num_frames; idx++) {
+        doors[idx] = rand64() % num_doors;
+        serials[idx] = fleet[rand64() % num_fobs];
+    }
+
+    printf("Detector of rejects over %d messages from %d remotes at %d doors, at %d msg/s,\n",
+        num_frames, num_fobs, num_doors, rate);
+    printf("with a half-life of %d ms in %.2f MiB:\n", half_life_ms,
+        (ANOMALY_LINES*sizeof(struct anomaly_line) + ANOMALY_DOORS*NUM_REASONS*sizeof(float) +
+        ANOMALY_EVENTS*sizeof(struct anomaly_event)) / 1048576.0);
+    printf("    %8s %14s %14s %8s\n", "rejects", "note ns/msg", "batch ns/msg", "events");
+    pcts[0] = 0;
+    pcts[1] = reject_pct;
+    pcts[2] = 100;
+    if (reject_pct == 0 || reject_pct == 100)
+        pcts[1] = pcts[2], num_pcts = 2;
+    for (idx = 0; idx < num_pcts; idx++) {
+        make_verdicts(pcts[idx]);
+        if (anomaly_init(&an, half_life_ms * 1000000ull, door_limits, fob_limits))
+            return -1;
+        single = run_detector(&an, 0, 0);
+        anomaly_free(&an);
+        if (anomaly_init(&an, half_life_ms * 1000000ull, door_limits, fob_limits))
+            return -1;
+        batch = run_detector(&an, 1, 0);
+        printf("    %7d%% %14.1f %14.1f %8lu\n", pcts[idx], single, batch, (unsigned long)an.raised);
+        anomaly_free(&an);
+    }
+
+    // Inject the attacks into the given share of rejects, and match the
+    // events against them
+    make_verdicts(reject_pct);
+    inject_attacks();
+    if (anomaly_init(&an, half_life_ms * 1000000ull, door_limits, fob_limits))
+        return -1;
+    raised = run_detector(&an, 1, 1);
+    for (idx = 0; idx < num_attacks; idx++)
+        found += attacks[idx].found;
+    printf("\nAttacks of %d messages each, with %d%% of the other messages rejected:\n", attack_len, reject_pct);
+    printf("    Detected:      %d/%d\n", found, num_attacks);
+    printf("    Unexplained:   %d of %lu events\n", raised, (unsigned long)an.raised);
+    printf("    Dropped:       %lu events\n", (unsigned long)an.dropped);
+    printf("    Rescales:      %lu\n", (unsigned long)an.rescales);
+    anomaly_free(&an);
+
+    free(doors);
+    free(serials);
+    free(verdicts);
+    free(fleet);
+    return 0;
+}
+
+
+// Reject the given percent of the messages for random reasons, and accept the
+// rest.
+void make_verdicts(int pct) {
+    int idx;
+
+    for (idx = 0; idx < num_frames; idx++) {
+        if ((int)(rand64() % 100) < pct)
+            verdicts[idx] = reject_verdicts[rand64() % NUM_REASONS];
+        else
+            verdicts[idx] = VERDICT_ACCEPT;
+    }
+}
+
+
+// Replace runs of messages with the attacks, each spread over half a second
+// at a random door and time, so that no two overlap.
+void inject_attacks() {
+    int span = rate / 2, stride = span / attack_len, slot = num_frames / (num_attacks ? num_attacks : 1);
+    int idx, jdx, pos;
+
+    stride = (stride < 1) ? 1 : stride;
+    for (idx = 0; idx < num_attacks; idx++) {
+        struct attack* at = &attacks[idx];
+        at->kind = idx % NUM_ATTACKS;
+        at->door = rand64() % num_doors;
+        at->serial = fleet[rand64() % num_fobs];
+        at->start = idx*slot + rand64() % (slot - attack_len*stride);
+        at->found = 0;
+        for (jdx = 0; jdx < attack_len; jdx++) {
+            pos = at->start + jdx*stride;
+            doors[pos] = at->door;
+            switch (at->kind) {
+            case ATTACK_FORGE:
+                serials[pos] = at->serial;
+                verdicts[pos] = VERDICT_FORGED;
+                break;
+            case ATTACK_SCAN:
+                serials[pos] = rand64() & 0xFFFFFF;
+                verdicts[pos] = VERDICT_UNKNOWN;
+                break;
+            case ATTACK_STUCK:
+                serials[pos] = at->serial;
+                verdicts[pos] = VERDICT_WINDOW;
+                break;
+            }
+        }
+    }
+}
+
+
+// Feed every verdict to the detector, one at a time or in batches, on the
+// clock of the messages. If check is set, every event is matched against the
+// attacks and the number of events that none explains is returned, otherwise
+// the nanoseconds per message.
+double run_detector(struct anomaly* an, int batched, int check) {
+    struct anomaly_event ev;
+    uint64_t spacing = 1000000000ull / rate, start, elapsed;
+    int idx, jdx, num, unexplained = 0;
+
+    start = now_ns();
+    for (idx = 0; idx < num_frames; idx += VERIFIER_BATCH) {
+        num = (num_frames - idx < VERIFIER_BATCH) ? num_frames - idx : VERIFIER_BATCH;
+        if (batched) {
+            anomaly_note_batch(an, doors + idx, serials + idx, verdicts + idx, num, (idx + num) * spacing);
+        } else {
+            for (jdx = idx; jdx < idx + num; jdx++)
+                anomaly_note(an, doors[jdx], serials[jdx], verdicts[jdx], jdx * spacing);
+        }
+        while (anomaly_take(an, &ev))
+            if (check)
+                unexplained += !explain(&ev, spacing);
+    }
+    elapsed = now_ns() - start;
+    return check ? unexplained : (double)elapsed / num_frames;
+}
+
+
+// Mark the attack that explains an event as found. Returns 0 if none does.
+int explain(const struct anomaly_event* ev, uint64_t spacing) {
+    int idx, end;
+
+    for (idx = 0; idx < num_attacks; idx++) {
+        struct attack* at = &attacks[idx];
+        end = at->start + rate;
+        if (ev->time < at->start * spacing || ev->time > end * spacing)
+            continue;
+        if (ev->kind == ANOMALY_DOOR && ev->key == at->door) {
+            at->found |= (at->kind == ATTACK_SCAN);
+            return 1;
+        }
+        if (ev->kind == ANOMALY_FOB && ev->key == at->serial && at->kind != ATTACK_SCAN) {
+            at->found = 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,204 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "batch.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The number of runs of each measurement, of which the best is kept */
+#define NUM_RUNS 3
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 200000;
+double slo = 1e-3;
+int cipher_ver = FRAME_BLOWFISH;
+struct verifier vf;
+struct fob_state* init_states;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+double* arrivals;
+double* latencies;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_batch [-f fobs] [-n frames] [-l slo_us] [-s]\n\n"
+    "Sweeps the arrival rate of messages and measures the p99 latency of\n"
+    "verifying them in batches of a fixed size against the adaptive batcher.\n"
+    "The messages arrive at random as a Poisson process in simulated time,\n"
+    "while the time taken to verify each batch is measured for real. The rates\n"
+    "are multiples of the rate at which messages can be verified one by one.\n"
+    "Each measurement is the best of a few runs, since a single run may lose\n"
+    "the processor to other work for longer than the latency target.\n\n"
+    "    -f fobs     Number of remotes (default: 1000000)\n"
+    "    -n frames   Number of messages per measurement (default: 200000)\n"
+    "    -l slo_us   The p99 latency target in microseconds (default: 1000)\n"
+    "    -s          Encrypt the rolling codes with Speck32/64\n"
+);
+
+
+double run_batcher(double rate, int fixed, double* p99);
+int cmp_latency(const void* a, const void* b);
+uint32_t rand32();
+
+
+int main(int argc, char* argv[]) {
+    const double loads[] = {0.1, 0.5, 0.8, 1.0, 1.2, 1.5, 2.0};
+    const int sizes[] = {1, 8, 64, 0};
+    const int num_sizes = sizeof(sizes)/sizeof(sizes[0]);
+    uint32_t* tx_codes;
+    double single, p99;
+    int opt, idx, jdx, run;
+
+    while ((opt = getopt(argc, argv, "f:n:l:sh")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'l': slo = atof(optarg) / 1e6; break;
+        case 's': cipher_ver = FRAME_SPECK; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_frames < 1 || slo <= 0)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet and record the messages in the order they were sent
+    srand(1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        while (verifier_enroll(&vf, rand32() & 0xFFFFFF, seed, 0) < 0)
+            ;
+    }
+    init_states = malloc(num_fobs*sizeof(*init_states));
+    tx_codes = calloc(num_fobs, sizeof(*tx_codes));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    arrivals = malloc(num_frames*sizeof(*arrivals));
+    latencies = malloc(num_frames*sizeof(*latencies));
+    if (!init_states || !tx_codes || !frames || !lengths || !arrivals || !latencies)
+        PRINT_RETURN("Out of memory\n", -1);
+    memcpy(init_states, vf.states, num_fobs*sizeof(*init_states));
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand32() % num_fobs;
+        uint8_t ver = cipher_ver | FRAME_MAC;
+        while ((lengths[idx] = verifier_frame(&vf, slot, ver, ++tx_codes[slot], frames[idx])) == 0)
+            ;
+    }
+
+    // Find the rate at which messages can be verified one by one
+    single = run_batcher(1e12, 1, &p99);
+    printf("Latency of %s messages from %d remotes, p99 target %.0f us:\n",
+        ciphers[cipher_ver].name, num_fobs, slo*1e6);
+    printf("    one by one at most %.2f Mframes/s\n\n", single/1e6);
+    printf("    %-7s %9s", "load", "Mframes/s");
+    for (jdx = 0; jdx < num_sizes; jdx++) {
+        char name[16] = "adaptive";
+        if (sizes[jdx])
+            sprintf(name, "batch %d", sizes[jdx]);
+        printf(" %10s", name);
+    }
+    printf("\n");
+
+    for (idx = 0; idx < (int)(sizeof(loads)/sizeof(loads[0])); idx++) {
+        printf("    %6.1fx %9.2f", loads[idx], loads[idx]*single/1e6);
+        for (jdx = 0; jdx < num_sizes; jdx++) {
+            double best = 1.0/0.0;
+            for (run = 0; run < NUM_RUNS; run++) {
+                run_batcher(loads[idx]*single, sizes[jdx], &p99);
+                if (p99 < best)
+                    best = p99;
+            }
+            if (best > 10*slo)
+                printf(" %10s", "overload");
+            else
+                printf(" %7.0f us", best*1e6);
+        }
+        printf("\n");
+    }
+    printf("\nEach entry is the best p99 latency of %d runs, or overload if the queue\n"
+        "kept growing.\n", NUM_RUNS);
+
+    verifier_free(&vf);
+    free(init_states);
+    free(tx_codes);
+    free(frames);
+    free(lengths);
+    free(arrivals);
+    free(latencies);
+    return 0;
+}
+
+
+// Simulate messages arriving at the given rate in front of a batcher with a
+// fixed batch size, or an adaptive one if fixed is zero. The verifier takes
+// the next batch as soon as it is free and the batcher is ready. Stores the
+// p99 latency in p99 and returns the achieved rate in messages per second.
+double run_batcher(double rate, int fixed, double* p99) {
+    static struct batcher bt;
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    double clock = 0;
+    int idx, jdx, next = 0, done = 0;
+
+    for (idx = 0; idx < num_frames; idx++) {
+        clock += -log(1.0 - (double)rand32() / 4294967296.0) / rate;
+        arrivals[idx] = clock;
+    }
+    memcpy(vf.states, init_states, num_fobs*sizeof(*init_states));
+    batcher_init(&bt, &vf, slo, fixed);
+
+    clock = 0;
+    while (done < num_frames) {
+        // Hand the batcher every message that arrived while it was busy
+        while (next < num_frames && arrivals[next] <= clock && !batcher_ready(&bt, clock)) {
+            batcher_add(&bt, frames[next], lengths[next], arrivals[next]);
+            next++;
+        }
+
+        if (batcher_ready(&bt, clock)) {
+            int num = bt.num;
+            clock += batcher_flush(&bt, verdicts, slots);
+            for (jdx = 0; jdx < num; jdx++)
+                latencies[done++] = clock - bt.arrivals[jdx];
+            continue;
+        }
+
+        // Wait for the next message or the deadline of the batch
+        double until = batcher_deadline(&bt);
+        if (next < num_frames && arrivals[next] < until)
+            until = arrivals[next];
+        clock = until;
+    }
+
+    qsort(latencies, num_frames, sizeof(*latencies), cmp_latency);
+    *p99 = latencies[(int)(num_frames * 0.99)];
+    return num_frames / (clock - arrivals[0]);
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a random 32-bit number.
+uint32_t rand32() {
+    return (uint32_t)rand() << 16 ^ rand();
+}
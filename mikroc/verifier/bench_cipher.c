@@ -0,0 +1,349 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cipher.h"
+#include "../pic14/ihex.h"
+#include "../pic14/pic14.h"
+#include "../pic14/sim.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The locations of blowfish_encrypt() in transmitter.hex (see transmitter.wcet) */
+#define BF_ENTRY     0x004
+#define BF_ARG       0x40   // Little endian block argument
+#define BF_RESULT    0x70   // Little endian return value
+#define BF_PTR_P     0x2C   // Key pointers stored by blowfish_setkeys()
+#define BF_PTR_S1    0x23
+#define BF_PTR_S2    0x25
+#define BF_PTR_S3    0x27
+#define BF_PTR_S4    0x29
+
+/* Registers and addresses of the hand assembled Speck32/64 routines */
+#define SP_XL    0x20
+#define SP_XH    0x21
+#define SP_YL    0x22
+#define SP_YH    0x23
+#define SP_CNT   0x24
+#define SP_IDX   0x25
+#define SP_TMP   0x26
+#define SP_TABLE 0x010
+#define SP_ENC   0x040
+#define SP_DEC   0x080
+
+#define MAX_ROM  0x800
+
+
+/* Global variables */
+int num_blocks = 1 << 20;
+int num_fobs = 1024;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_cipher [-n blocks] [-f fobs] transmitter.hex\n\n"
+    "Compares BlowFish32 and Speck32/64 on both targets. The PIC cycles of\n"
+    "BlowFish32 are measured by simulating blowfish_encrypt() in the given\n"
+    "image, while Speck32/64 is measured with hand assembled routines that\n"
+    "keep the round keys in a RETLW table like the BlowFish32 subkeys. The host\n"
+    "throughput is measured for the scalar code and the batch kernels.\n\n"
+    "    -n blocks   Number of blocks per host measurement (default: 1048576)\n"
+    "    -f fobs     Number of distinct keys for per-block decryption\n"
+    "                (default: 1024)\n"
+);
+
+
+int pic_blowfish(const char* path, uint64_t* cycles);
+int pic_speck(uint64_t* enc_cycles, uint64_t* dec_cycles);
+int assemble_speck(const uint16_t* rk, uint16_t* rom);
+double host_rate(const struct cipher* cph, int mode, const struct fob_keys* keys, const struct fob_keys* const* each, const uint32_t* in, uint32_t* out);
+double now();
+
+
+int main(int argc, char* argv[]) {
+    uint64_t bf_cycles, sp_enc, sp_dec;
+    int opt, idx;
+
+    while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+        switch (opt) {
+        case 'n': num_blocks = atoi(optarg); break;
+        case 'f': num_fobs = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind+1 != argc || num_blocks < 1 || num_fobs < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    // Measure the PIC cycles of a single block
+    if (pic_blowfish(argv[optind], &bf_cycles) || pic_speck(&sp_enc, &sp_dec))
+        return -1;
+
+    // Generate random keys and blocks for the host measurements
+    struct fob_keys* keys = malloc(num_fobs*sizeof(*keys));
+    const struct fob_keys** each = malloc(num_blocks*sizeof(*each));
+    uint32_t* in = malloc(num_blocks*sizeof(*in));
+    uint32_t* out = malloc(num_blocks*sizeof(*out));
+    if (keys == NULL || each == NULL || in == NULL || out == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    srand(1);
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        int jdx;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        fob_keys_init(&keys[idx], seed);
+    }
+    for (idx = 0; idx < num_blocks; idx++) {
+        in[idx] = (uint32_t)rand() << 16 ^ rand();
+        each[idx] = &keys[rand() % num_fobs];
+    }
+
+    printf("PIC cycles per block (8 MHz, 4 clocks per cycle):\n");
+    printf("    %-12s encrypt %6lu (%.3f ms, compiled by MikroC)\n", "blowfish32",
+        (unsigned long)bf_cycles, bf_cycles / 2000.0);
+    printf("    %-12s encrypt %6lu (%.3f ms, hand assembled)\n", "speck32",
+        (unsigned long)sp_enc, sp_enc / 2000.0);
+    printf("    %-12s decrypt %6lu (%.3f ms, hand assembled)\n", "speck32",
+        (unsigned long)sp_dec, sp_dec / 2000.0);
+
+    printf("\nHost throughput in Mblocks/s (%d lanes per batch):\n", CIPHER_LANES);
+    printf("    %-12s %10s %10s %10s %10s\n", "cipher", "scalar", "enc batch", "dec batch", "dec each");
+    for (idx = 0; idx < (int)(sizeof(ciphers)/sizeof(ciphers[0])); idx++) {
+        const struct cipher* cph = &ciphers[idx];
+        double rates[4];
+        int mode;
+        for (mode = 0; mode < 4; mode++) {
+            rates[mode] = host_rate(cph, mode, &keys[0], each, in, out);
+            if (rates[mode] < 0)
+                return -1;
+        }
+        printf("    %-12s %10.1f %10.1f %10.1f %10.1f\n",
+            cph->name, rates[0], rates[1], rates[2], rates[3]);
+    }
+
+    free(keys);
+    free(each);
+    free(in);
+    free(out);
+    return 0;
+}
+
+
+// Measure blowfish_encrypt() in the transmitter image. The firmware is run from
+// reset until it sleeps, so that blowfish_setkeys() has stored the key table
+// pointers, and the result is checked against the host implementation using
+// the tables read back from the image.
+int pic_blowfish(const char* path, uint64_t* cycles) {
+    static struct ihex_image img;
+    static struct pic14_sim sim;
+    static uint16_t rom[MAX_ROM];
+    const uint8_t ptrs[5] = {BF_PTR_P, BF_PTR_S1, BF_PTR_S2, BF_PTR_S3, BF_PTR_S4};
+    struct blowfish_keys bf;
+    uint16_t* tables[5] = {bf.p, bf.s1, bf.s2, bf.s3, bf.s4};
+    uint32_t data = 0x01234567, res;
+    int idx, jdx, ret = SIM_RETURN;
+
+    if (ihex_load(path, &img))
+        return -1;
+    ihex_rom(&img, rom, MAX_ROM);
+    sim_reset(&sim, pic14_find_device("12f683"), rom);
+    while (ret == SIM_RETURN && sim.cycles < 4000000)
+        ret = sim_step(&sim);
+    if (ret != SIM_SLEEP)
+        PRINT_RETURN("Transmitter did not reach sleep\n", -1);
+
+    for (idx = 0; idx < 5; idx++) {
+        uint16_t ptr = sim.ram[ptrs[idx]] | sim.ram[ptrs[idx]+1] << 8;
+        for (jdx = 0; jdx < ((idx == 0) ? 18 : 16); jdx++)
+            tables[idx][jdx] = (rom[(ptr+2*jdx) % MAX_ROM] & 0xFF) | (rom[(ptr+2*jdx+1) % MAX_ROM] & 0xFF) << 8;
+    }
+
+    for (idx = 0; idx < 4; idx++)
+        sim.ram[BF_ARG+idx] = data >> (8*idx);
+    uint64_t start = sim.cycles;
+    if (sim_call(&sim, BF_ENTRY, 1000000) != SIM_RETURN)
+        PRINT_RETURN("Simulation of blowfish_encrypt() failed\n", -1);
+    *cycles = sim.cycles - start;
+
+    res = 0;
+    for (idx = 0; idx < 4; idx++)
+        res |= (uint32_t)sim.ram[BF_RESULT+idx] << (8*idx);
+    if (res != key_encrypt(&bf, data))
+        PRINT_RETURN("Simulated blowfish_encrypt() does not match the host\n", -1);
+    return 0;
+}
+
+
+// Measure the hand assembled Speck32/64 routines and check both directions
+// against the host implementation.
+int pic_speck(uint64_t* enc_cycles, uint64_t* dec_cycles) {
+    static struct pic14_sim sim;
+    static uint16_t rom[MAX_ROM];
+    uint16_t key[4] = {0x0100, 0x0908, 0x1110, 0x1918}, rk[SPECK_ROUNDS];
+    uint32_t data = 0x6574694C, enc, dec;
+    uint64_t start;
+
+    key_speck_schedule(key, rk);
+    assemble_speck(rk, rom);
+    sim_reset(&sim, pic14_find_device("12f683"), rom);
+
+    sim.ram[SP_XH] = data >> 24; sim.ram[SP_XL] = data >> 16;
+    sim.ram[SP_YH] = data >> 8;  sim.ram[SP_YL] = data >> 0;
+    start = sim.cycles;
+    if (sim_call(&sim, SP_ENC, 100000) != SIM_RETURN)
+        PRINT_RETURN("Simulation of the Speck32/64 encryption failed\n", -1);
+    *enc_cycles = sim.cycles - start;
+    enc = sim.ram[SP_XH] << 24 | sim.ram[SP_XL] << 16 | sim.ram[SP_YH] << 8 | sim.ram[SP_YL];
+
+    start = sim.cycles;
+    if (sim_call(&sim, SP_DEC, 100000) != SIM_RETURN)
+        PRINT_RETURN("Simulation of the Speck32/64 decryption failed\n", -1);
+    *dec_cycles = sim.cycles - start;
+    dec = sim.ram[SP_XH] << 24 | sim.ram[SP_XL] << 16 | sim.ram[SP_YH] << 8 | sim.ram[SP_YL];
+
+    if (enc != key_speck_encrypt(rk, data) || enc != 0xA86842F2 || dec != data)
+        PRINT_RETURN("Simulated Speck32/64 does not match the host\n", -1);
+    return 0;
+}
+
+
+// Assemble the Speck32/64 routines. The round keys are a RETLW table indexed by
+// byte like the MikroC ROM tables. Each rotate by 7 or 9 is a byte swap and a
+// 1-bit rotate through carry, and the rotates by 2 are two 1-bit rotates.
+int assemble_speck(const uint16_t* rk, uint16_t* rom) {
+    struct pic14_insn insn;
+    int addr, idx, loop;
+
+    #define _EMIT(_op, _f, _d, _k) {                                           \
+        memset(&insn, 0, sizeof(insn));                                        \
+        insn.op = _op; insn.f = _f; insn.d = _d; insn.b = _d; insn.k = _k;     \
+        rom[addr++] = pic14_encode(&insn);                                     \
+    }
+    #define _SWAP_X() {                                                        \
+        _EMIT(OP_MOVF, SP_XL, 0, 0); _EMIT(OP_MOVWF, SP_TMP, 0, 0);            \
+        _EMIT(OP_MOVF, SP_XH, 0, 0); _EMIT(OP_MOVWF, SP_XL, 0, 0);             \
+        _EMIT(OP_MOVF, SP_TMP, 0, 0); _EMIT(OP_MOVWF, SP_XH, 0, 0);            \
+    }
+    #define _KEY_BYTE(_reg, _step) {                                           \
+        _EMIT(OP_MOVF, SP_IDX, 0, 0); _EMIT(OP_CALL, 0, 0, SP_TABLE);          \
+        _EMIT(OP_XORWF, _reg, 1, 0); _EMIT(_step, SP_IDX, 1, 0);               \
+    }
+
+    memset(rom, 0, MAX_ROM*sizeof(uint16_t));
+
+    // Round key table
+    addr = SP_TABLE;
+    _EMIT(OP_ADDWF, REG_PCL, 1, 0);
+    for (idx = 0; idx < SPECK_ROUNDS; idx++) {
+        _EMIT(OP_RETLW, 0, 0, rk[idx] & 0xFF);
+        _EMIT(OP_RETLW, 0, 0, rk[idx] >> 8);
+    }
+
+    // Encryption
+    addr = SP_ENC;
+    _EMIT(OP_MOVLW, 0, 0, SPECK_ROUNDS); _EMIT(OP_MOVWF, SP_CNT, 0, 0);
+    _EMIT(OP_CLRF, SP_IDX, 0, 0);
+    loop = addr;
+    _SWAP_X();
+    _EMIT(OP_RLF, SP_XH, 0, 0); _EMIT(OP_RLF, SP_XL, 1, 0); _EMIT(OP_RLF, SP_XH, 1, 0);
+    _EMIT(OP_MOVF, SP_YL, 0, 0); _EMIT(OP_ADDWF, SP_XL, 1, 0);
+    _EMIT(OP_BTFSC, REG_STATUS, STATUS_C, 0); _EMIT(OP_INCF, SP_XH, 1, 0);
+    _EMIT(OP_MOVF, SP_YH, 0, 0); _EMIT(OP_ADDWF, SP_XH, 1, 0);
+    _KEY_BYTE(SP_XL, OP_INCF);
+    _KEY_BYTE(SP_XH, OP_INCF);
+    for (idx = 0; idx < 2; idx++) {
+        _EMIT(OP_RLF, SP_YH, 0, 0); _EMIT(OP_RLF, SP_YL, 1, 0); _EMIT(OP_RLF, SP_YH, 1, 0);
+    }
+    _EMIT(OP_MOVF, SP_XL, 0, 0); _EMIT(OP_XORWF, SP_YL, 1, 0);
+    _EMIT(OP_MOVF, SP_XH, 0, 0); _EMIT(OP_XORWF, SP_YH, 1, 0);
+    _EMIT(OP_DECFSZ, SP_CNT, 1, 0); _EMIT(OP_GOTO, 0, 0, loop);
+    _EMIT(OP_RETURN, 0, 0, 0);
+
+    // Decryption
+    addr = SP_DEC;
+    _EMIT(OP_MOVLW, 0, 0, SPECK_ROUNDS); _EMIT(OP_MOVWF, SP_CNT, 0, 0);
+    _EMIT(OP_MOVLW, 0, 0, 2*SPECK_ROUNDS-1); _EMIT(OP_MOVWF, SP_IDX, 0, 0);
+    loop = addr;
+    _EMIT(OP_MOVF, SP_XL, 0, 0); _EMIT(OP_XORWF, SP_YL, 1, 0);
+    _EMIT(OP_MOVF, SP_XH, 0, 0); _EMIT(OP_XORWF, SP_YH, 1, 0);
+    for (idx = 0; idx < 2; idx++) {
+        _EMIT(OP_RRF, SP_YL, 0, 0); _EMIT(OP_RRF, SP_YH, 1, 0); _EMIT(OP_RRF, SP_YL, 1, 0);
+    }
+    _KEY_BYTE(SP_XH, OP_DECF);
+    _KEY_BYTE(SP_XL, OP_DECF);
+    _EMIT(OP_MOVF, SP_YL, 0, 0); _EMIT(OP_SUBWF, SP_XL, 1, 0);
+    _EMIT(OP_BTFSS, REG_STATUS, STATUS_C, 0); _EMIT(OP_DECF, SP_XH, 1, 0);
+    _EMIT(OP_MOVF, SP_YH, 0, 0); _EMIT(OP_SUBWF, SP_XH, 1, 0);
+    _SWAP_X();
+    _EMIT(OP_RRF, SP_XL, 0, 0); _EMIT(OP_RRF, SP_XH, 1, 0); _EMIT(OP_RRF, SP_XL, 1, 0);
+    _EMIT(OP_DECFSZ, SP_CNT, 1, 0); _EMIT(OP_GOTO, 0, 0, loop);
+    _EMIT(OP_RETURN, 0, 0, 0);
+
+    // Clean-up macro usage
+    #undef _KEY_BYTE
+    #undef _SWAP_X
+    #undef _EMIT
+    return 0;
+}
+
+
+// Measure the host throughput of a cipher in millions of blocks per second.
+// The modes are the scalar code, the batch encryption and decryption under a
+// single key, and the batch decryption with a key per block.
+double host_rate(const struct cipher* cph, int mode, const struct fob_keys* keys, const struct fob_keys* const* each, const uint32_t* in, uint32_t* out) {
+    int idx;
+    double start = now();
+
+    switch (mode) {
+    case 0:
+        for (idx = 0; idx < num_blocks; idx++) {
+            if (cph->ver == FRAME_SPECK)
+                out[idx] = key_speck_encrypt(keys->rk, in[idx]);
+            else
+                out[idx] = key_encrypt(&keys->bf, in[idx]);
+        }
+        break;
+    case 1: cph->encrypt(keys, in, out, num_blocks); break;
+    case 2: cph->decrypt(keys, in, out, num_blocks); break;
+    case 3: cph->decrypt_each(each, in, out, num_blocks); break;
+    }
+    double secs = now() - start;
+
+    // Check the batch results against the scalar code
+    for (idx = 0; idx < num_blocks; idx++) {
+        uint32_t want = in[idx];
+        if (cph->ver == FRAME_SPECK) {
+            if (mode == 0 || mode == 1)
+                want = key_speck_encrypt(keys->rk, in[idx]);
+            if (mode == 2 || mode == 3)
+                want = key_speck_decrypt((mode == 2) ? keys->rk : each[idx]->rk, in[idx]);
+        } else {
+            if (mode == 0 || mode == 1)
+                want = key_encrypt(&keys->bf, in[idx]);
+            if (mode == 2 || mode == 3)
+                want = key_decrypt((mode == 2) ? &keys->bf : &each[idx]->bf, in[idx]);
+        }
+        if (out[idx] != want) {
+            fprintf(stderr, "%s: batch result does not match the scalar code\n", cph->name);
+            return -1;
+        }
+    }
+    return num_blocks / secs / 1e6;
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,395 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "verifier.h"
+#include "clone.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The side of the campus in metres */
+#define CAMPUS  2000.0f
+
+/* How far from its building a door may be along either axis, in metres, so
+   that every door of a building is within three times of the others */
+#define BUILDING  40.0f
+
+/* How fast people walk between buildings, in metres per second */
+#define WALK  1.4f
+
+/* A message that arrived at a door */
+struct arrival {
+    uint32_t time;    // In milliseconds
+    uint32_t fob;
+    uint32_t code;
+    uint16_t door;
+    uint8_t clone;    // Whether it was sent by a clone
+};
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_doors = 1000;
+int num_buildings = 50;
+int num_hours = 1;
+int presses = 20;
+int num_clones = 1000;
+int reorder_pct = 1;
+int miss_pct = 10;
+float speed = 3;
+int bucket_ms = 60000;
+float (*buildings)[2];
+float (*doors)[2];
+struct arrival* arrivals;
+int num_arrivals;
+int max_arrivals;
+uint32_t* cloned;     // When a code of the clone of every remote was first
+                      // accepted, or 0
+uint32_t* flagged;    // When every remote was first flagged, or 0
+uint64_t kinds[3];    // Events of every kind
+uint32_t *serials, *door_ids, *codes, *times;
+int num_accepts;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_clone [-f fobs] [-d doors] [-b buildings] [-t hours]\n"
+    "                   [-p presses] [-c clones] [-r reorder] [-m missed]\n"
+    "                   [-s speed] [-w bucket]\n\n"
+    "Simulates the presses of a fleet of remotes at the doors of buildings\n"
+    "spread over a campus, with people walking between buildings and some\n"
+    "presses reordered on their way to the verifier or not heard at all. A\n"
+    "number of remotes are cloned at a random time, and the clone is used at a\n"
+    "distant building from then on with its own copy of the rolling code. The\n"
+    "messages go through the replay window of the verifier, and the accepts\n"
+    "are joined by remote to find impossible sequences. Reports the accepts\n"
+    "joined per second, one at a time and in batches, how many clones were\n"
+    "found of those that had a code accepted, how long after that first\n"
+    "accept, and how many remotes were flagged that were not cloned.\n\n"
+    "    -f fobs      Number of remotes (default: 1000000)\n"
+    "    -d doors     Number of doors (default: 1000)\n"
+    "    -b builds    Number of buildings (default: 50)\n"
+    "    -t hours     Hours to simulate (default: 1)\n"
+    "    -p presses   Presses per remote per hour (default: 20)\n"
+    "    -c clones    Number of cloned remotes (default: 1000)\n"
+    "    -r reorder   Percent of presses followed by another that overtakes\n"
+    "                 it on the way to the verifier (default: 1)\n"
+    "    -m missed    Percent of presses not heard (default: 10)\n"
+    "    -s speed     Fastest that a remote is carried in m/s (default: 3)\n"
+    "    -w bucket    Milliseconds per bucket of time (default: 60000)\n"
+);
+
+
+int simulate();
+int arrive(uint32_t time, uint32_t fob, uint32_t code, int door);
+int pick_door(int building);
+float building_distance(int a, int b);
+double run_join(struct clone* cl, int batched);
+int cmp_arrival(const void* a, const void* b);
+int cmp_uint32(const void* a, const void* b);
+uint64_t now_ns();
+uint64_t rand64();
+double rand_exp(double mean);
+
+
+int main(int argc, char* argv[]) {
+    struct clone cl;
+    uint64_t* states;
+    uint32_t* latencies;
+    double single, batch;
+    int opt, idx, found = 0, wrong = 0, used = 0;
+
+    while ((opt = getopt(argc, argv, "f:d:b:t:p:c:r:m:s:w:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'd': num_doors = atoi(optarg); break;
+        case 'b': num_buildings = atoi(optarg); break;
+        case 't': num_hours = atoi(optarg); break;
+        case 'p': presses = atoi(optarg); break;
+        case 'c': num_clones = atoi(optarg); break;
+        case 'r': reorder_pct = atoi(optarg); break;
+        case 'm': miss_pct = atoi(optarg); break;
+        case 's': speed = atof(optarg); break;
+        case 'w': bucket_ms = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs >= 1 << 24 || num_doors < 1 || num_doors > CLONE_DOORS)
+        PRINT_RETURN(help_msg, -1);
+    if (num_buildings < 2 || num_buildings > num_doors || num_hours < 1 || num_hours > 24*7 || presses < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (num_clones < 0 || num_clones > num_fobs || reorder_pct < 0 || reorder_pct > 100 ||
+        miss_pct < 0 || miss_pct > 100 || speed <= 0 || bucket_ms < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    // Simulate the presses, and keep the messages that the verifier accepts
+    // in the order that they arrived
+    if (simulate())
+        return -1;
+    states = malloc(num_fobs*sizeof(*states));
+    serials = malloc(num_arrivals*sizeof(*serials));
+    door_ids = malloc(num_arrivals*sizeof(*door_ids));
+    codes = malloc(num_arrivals*sizeof(*codes));
+    times = malloc(num_arrivals*sizeof(*times));
+    if (states == NULL || serials == NULL || door_ids == NULL || codes == NULL || times == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < num_fobs; idx++)
+        states[idx] = (uint64_t)0xFFFFFFFF << 32 | 1;
+    for (idx = 0; idx < num_arrivals; idx++) {
+        struct arrival* ar = &arrivals[idx];
+        if (replay_update(&states[ar->fob], ar->code, VERIFIER_WINDOW, VERIFIER_REPLAY) != VERDICT_ACCEPT)
+            continue;
+        if (ar->clone && cloned[ar->fob] == 0)
+            cloned[ar->fob] = ar->time;
+        serials[num_accepts] = ar->fob + 1;
+        door_ids[num_accepts] = ar->door;
+        codes[num_accepts] = ar->code;
+        times[num_accepts++] = ar->time;
+    }
+    free(states);
+    free(arrivals);
+
+    flagged = calloc(num_fobs, sizeof(*flagged));
+    latencies = malloc((num_clones + 1)*sizeof(*latencies));
+    if (flagged == NULL || latencies == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (clone_init(&cl, num_fobs, bucket_ms, speed, 3*BUILDING, 2000))
+        return -1;
+    printf("Join of %d accepts of %d messages from %d remotes at %d doors in %d buildings\n",
+        num_accepts, num_arrivals, num_fobs, num_doors, num_buildings);
+    printf("over %d hours, with %d cloned remotes and %.1f MiB of entries:\n", num_hours, num_clones,
+        (cl.set_mask + 1.0) * sizeof(struct clone_set) / 1048576);
+    single = run_join(&cl, 0);
+    clone_free(&cl);
+    memset(flagged, 0, num_fobs*sizeof(*flagged));
+    memset(kinds, 0, sizeof(kinds));
+    if (clone_init(&cl, num_fobs, bucket_ms, speed, 3*BUILDING, 2000))
+        return -1;
+    batch = run_join(&cl, 1);
+    printf("    One at a time: %10.0f accepts/s\n", single);
+    printf("    In batches:    %10.0f accepts/s\n", batch);
+
+    // Match the remotes that were flagged against the clones
+    for (idx = 0; idx < num_fobs; idx++) {
+        used += (cloned[idx] != 0);
+        if (flagged[idx] == 0)
+            continue;
+        if (cloned[idx] == 0)
+            wrong++;
+        else if (flagged[idx] >= cloned[idx])
+            latencies[found++] = flagged[idx] - cloned[idx];
+    }
+    qsort(latencies, found, sizeof(*latencies), cmp_uint32);
+    printf("    Found:         %d/%d clones with a code accepted, of %d\n", found, used, num_clones);
+    if (found > 0)
+        printf("    After accept:  %.1f s p50, %.1f s p90\n", latencies[found/2] / 1e3, latencies[found*9/10] / 1e3);
+    printf("    Wrongly:       %d remotes flagged that were not cloned\n", wrong);
+    printf("    Events:        %lu regress, %lu travel, %lu dropped\n",
+        (unsigned long)kinds[CLONE_REGRESS], (unsigned long)kinds[CLONE_TRAVEL], (unsigned long)cl.dropped);
+    printf("    Evicted:       %lu live entries\n", (unsigned long)cl.evicted);
+    clone_free(&cl);
+
+    free(buildings);
+    free(doors);
+    free(cloned);
+    free(flagged);
+    free(latencies);
+    free(serials);
+    free(door_ids);
+    free(codes);
+    free(times);
+    return 0;
+}
+
+
+// Simulate every press of the fleet, and sort the messages by arrival.
+// Returns -1 if out of memory.
+int simulate() {
+    uint32_t end = num_hours * 3600000u, time, last, code;
+    double mean = 3600000.0 / presses;
+    uint32_t clone_time, clone_code;
+    int idx, fob, building, next, clone_at, stride = num_clones ? num_fobs / num_clones : 0;
+
+    buildings = malloc(num_buildings*sizeof(*buildings));
+    doors = malloc(num_doors*sizeof(*doors));
+    cloned = calloc(num_fobs, sizeof(*cloned));
+    max_arrivals = num_fobs * (presses * num_hours * 5 / 4 + 8);
+    arrivals = malloc(max_arrivals*sizeof(*arrivals));
+    if (buildings == NULL || doors == NULL || cloned == NULL || arrivals == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+
+    // The doors of every building are around it
+    for (idx = 0; idx < num_buildings; idx++) {
+        buildings[idx][0] = rand64() % (uint32_t)CAMPUS;
+        buildings[idx][1] = rand64() % (uint32_t)CAMPUS;
+    }
+    for (idx = 0; idx < num_doors; idx++) {
+        doors[idx][0] = buildings[idx % num_buildings][0] + (int)(rand64() % (2*(int)BUILDING + 1)) - BUILDING;
+        doors[idx][1] = buildings[idx % num_buildings][1] + (int)(rand64() % (2*(int)BUILDING + 1)) - BUILDING;
+    }
+
+    // A remote that is cloned is copied at a random time in the first half
+    for (fob = 0; fob < num_fobs; fob++) {
+        int is_cloned = (stride > 0 && fob % stride == 0 && fob / stride < num_clones);
+        clone_time = is_cloned ? rand64() % (end / 2) : end;
+        clone_code = 0;
+        building = rand64() % num_buildings;
+        last = 0;
+        code = 0;
+        for (time = rand_exp(mean); time < end; time += rand_exp(mean)) {
+            if (time > clone_time && clone_code == 0)
+                clone_code = code + 1;
+
+            // People mostly stay in one building, and only go to another once
+            // they could have walked there
+            next = (rand64() % 10 == 0) ? (int)(rand64() % num_buildings) : building;
+            if (next != building && (time - last) / 1000.0 * WALK >= building_distance(building, next))
+                building = next;
+            last = time;
+            if ((int)(rand64() % 100) < miss_pct) {
+                code++;
+                continue;
+            }
+            if (arrive(time, fob, ++code, pick_door(building)))
+                return -1;
+
+            // Another press right after may overtake this one
+            if ((int)(rand64() % 100) < reorder_pct) {
+                arrivals[num_arrivals-1].time += 350;
+                if (arrive(time + 300, fob, ++code, arrivals[num_arrivals-1].door))
+                    return -1;
+            }
+        }
+
+        // The clone goes on from the code of the remote when it was copied,
+        // and is used at the building farthest from where the remote ended up
+        if (!is_cloned)
+            continue;
+        code = (clone_code > 0) ? clone_code - 1 : code;
+        for (idx = 1, clone_at = 0; idx < num_buildings; idx++)
+            if (building_distance(idx, building) > building_distance(clone_at, building))
+                clone_at = idx;
+        for (time = clone_time + rand_exp(mean); time < end; time += rand_exp(mean)) {
+            if ((int)(rand64() % 100) < miss_pct) {
+                code++;
+                continue;
+            }
+            if (arrive(time, fob, ++code, pick_door(clone_at)))
+                return -1;
+            arrivals[num_arrivals-1].clone = 1;
+        }
+    }
+    qsort(arrivals, num_arrivals, sizeof(*arrivals), cmp_arrival);
+    return 0;
+}
+
+
+// Add a message to the arrivals. Returns -1 if there is no room.
+int arrive(uint32_t time, uint32_t fob, uint32_t code, int door) {
+    struct arrival* ar;
+
+    if (num_arrivals == max_arrivals)
+        PRINT_RETURN("Too many messages\n", -1);
+    ar = &arrivals[num_arrivals++];
+    ar->time = time;
+    ar->fob = fob;
+    ar->code = code;
+    ar->door = door;
+    ar->clone = 0;
+    return 0;
+}
+
+
+// Return a random door of a building.
+int pick_door(int building) {
+    int per = (num_doors - building + num_buildings - 1) / num_buildings;
+    return building + (rand64() % per) * num_buildings;
+}
+
+
+// Return the distance between two buildings in metres.
+float building_distance(int a, int b) {
+    float dx = buildings[a][0] - buildings[b][0];
+    float dy = buildings[a][1] - buildings[b][1];
+    return sqrtf(dx*dx + dy*dy);
+}
+
+
+// Join every accept, one at a time or in batches, taking the events after
+// every batch and noting when each remote was first flagged. Returns the
+// accepts per second.
+double run_join(struct clone* cl, int batched) {
+    struct clone_event ev;
+    uint64_t start;
+    int idx, num;
+
+    for (idx = 0; idx < num_doors; idx++)
+        clone_place(cl, idx, doors[idx][0], doors[idx][1]);
+    start = now_ns();
+    for (idx = 0; idx < num_accepts; idx += VERIFIER_BATCH) {
+        num = (num_accepts - idx < VERIFIER_BATCH) ? num_accepts - idx : VERIFIER_BATCH;
+        if (batched) {
+            clone_note_batch(cl, serials + idx, door_ids + idx, codes + idx, times + idx, num);
+        } else {
+            int jdx;
+            for (jdx = idx; jdx < idx + num; jdx++)
+                clone_note(cl, serials[jdx], door_ids[jdx], codes[jdx], times[jdx]);
+        }
+        while (clone_take(cl, &ev)) {
+            kinds[ev.kind]++;
+            if (flagged[ev.serial - 1] == 0)
+                flagged[ev.serial - 1] = ev.time;
+        }
+    }
+    return num_accepts / ((now_ns() - start) / 1e9);
+}
+
+
+// Compare two messages for qsort(), by arrival and then by remote.
+int cmp_arrival(const void* a, const void* b) {
+    const struct arrival *x = a, *y = b;
+    if (x->time != y->time)
+        return (x->time > y->time) - (x->time < y->time);
+    return (x->fob > y->fob) - (x->fob < y->fob);
+}
+
+
+// Compare two times for qsort().
+int cmp_uint32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+
+// Return a random time with an exponential distribution of the given mean.
+double rand_exp(double mean) {
+    return -mean * log((rand64() % 1000000 + 1) / 1000001.0);
+}
@@ -0,0 +1,424 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "cluster.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* What a node reports to the parent */
+struct node_report {
+    uint64_t verified;
+    uint64_t verdicts[NUM_VERDICTS];
+    uint64_t forwarded;
+    uint64_t held;
+    uint64_t moved_in;
+    uint64_t moved_out;
+    uint64_t handoff_ns;
+};
+
+/* What a front-end reports to the parent */
+struct front_report {
+    uint64_t sent;
+    uint64_t dups;   // Messages also sent to the owner by the last ring
+    int done;
+};
+
+/* Memory shared between the parent and the processes of a cluster */
+struct shared {
+    int ready;
+    int start;
+    struct node_report nodes[CLUSTER_NODES];
+    struct front_report fronts[CLUSTER_FRONTS];
+};
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 4000000;
+int max_nodes = 16;
+int num_fronts = 2;
+int dup_window = 100000;
+int base_nodes = 4;
+struct verifier vf;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+struct shared* shared;
+char cluster_name[48];
+uint8_t data[CLUSTER_DATAGRAM];
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_cluster [-f fobs] [-n frames] [-c nodes] [-e fronts]\n"
+    "                     [-d dups] [-m nodes]\n\n"
+    "Runs a cluster of verifier nodes and front-ends, each in a process of its\n"
+    "own, that talk over datagram sockets on this host. The front-ends route\n"
+    "the messages of the remotes to their owner on a ring of consistent\n"
+    "hashing. Reports the throughput of 1, 2, 4 and so on up to the given\n"
+    "number of nodes, and the spread of remotes over the nodes. Then adds a\n"
+    "node to a cluster while the messages flow, so that the remotes it takes\n"
+    "are handed over to it, and reports how long that took, how many messages\n"
+    "were forwarded or held, and that every message was accepted exactly once\n"
+    "even though the front-ends send the messages of moved remotes to both of\n"
+    "their owners for a while after the change.\n\n"
+    "    -f fobs   Number of remotes (default: 1000000)\n"
+    "    -n frames Number of messages (default: 4000000)\n"
+    "    -c nodes  Most nodes to scale to (default: 16)\n"
+    "    -e fronts Number of front-ends (default: 2)\n"
+    "    -d dups   Messages per front-end after the change that are also sent\n"
+    "              to the last owner (default: 100000)\n"
+    "    -m nodes  Nodes to add a node to (default: 4)\n"
+);
+
+
+int run_cluster(int num_nodes, int migrate, double* rate, double* spread);
+int run_node(int id, int num_nodes);
+int run_front(int front, int num_nodes);
+void publish(struct cluster_node* nd);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    uint32_t* codes;
+    uint16_t seed[KEY_WORDS];
+    uint8_t* used;
+    double rate, spread, base = 0;
+    int opt, idx, jdx, num_nodes;
+
+    while ((opt = getopt(argc, argv, "f:n:c:e:d:m:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'c': max_nodes = atoi(optarg); break;
+        case 'e': num_fronts = atoi(optarg); break;
+        case 'd': dup_window = atoi(optarg); break;
+        case 'm': base_nodes = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (max_nodes < 1 || max_nodes > CLUSTER_NODES || num_fronts < 1 || num_fronts > CLUSTER_FRONTS)
+        PRINT_RETURN(help_msg, -1);
+    if (dup_window < 0 || base_nodes < 1 || base_nodes >= CLUSTER_NODES)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet, which every node takes its remotes from, and form
+    // messages from random remotes
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    codes = calloc(num_fobs, sizeof(*codes));
+    used = calloc(1 << 24, 1);
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (frames == NULL || lengths == NULL || codes == NULL || used == NULL || shared == MAP_FAILED)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint32_t serial;
+        do {
+            serial = rand64() & 0xFFFFFF;
+        } while (used[serial] || !frame_serial_valid(serial));
+        used[serial] = 1;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand64();
+        if (verifier_enroll(&vf, serial, seed, 0) != idx)
+            PRINT_RETURN("Could not enroll\n", -1);
+    }
+    free(used);
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand64() % num_fobs;
+        while ((lengths[idx] = verifier_frame(&vf, slot, FRAME_BLOWFISH | FRAME_MAC, ++codes[slot], frames[idx])) == 0)
+            ;
+    }
+    free(codes);
+
+    printf("Cluster of %d remotes, with %d messages from %d front-ends:\n", num_fobs, num_frames, num_fronts);
+    printf("    %5s %10s %9s %9s %11s\n", "nodes", "msg/s", "speedup", "time ms", "most/mean");
+    for (num_nodes = 1; ; num_nodes = (num_nodes*2 < max_nodes) ? num_nodes*2 : max_nodes) {
+        if (run_cluster(num_nodes, 0, &rate, &spread))
+            return -1;
+        if (num_nodes == 1)
+            base = rate;
+        printf("    %5d %10.0f %8.2fx %9.1f %11.2f\n", num_nodes, rate, rate / base, num_frames / rate * 1e3, spread);
+        if (num_nodes == max_nodes)
+            break;
+    }
+
+    printf("\nAdding node %d to %d nodes after a third of the messages:\n", base_nodes, base_nodes);
+    if (run_cluster(base_nodes, 1, &rate, &spread))
+        return -1;
+
+    verifier_free(&vf);
+    free(frames);
+    free(lengths);
+    munmap(shared, sizeof(*shared));
+    return 0;
+}
+
+
+// Fork the nodes and front-ends of a cluster, add a node once a third of the
+// messages were sent if migrate is set, and wait until every message has been
+// verified. Sets the messages per second and the most remotes on a node over
+// the mean, and prints the handoff if migrate is set. Returns -1 if a process
+// failed or the verdicts are not the ones expected.
+int run_cluster(int num_nodes, int migrate, double* rate, double* spread) {
+    static int run;
+    struct cluster_link coord;
+    uint64_t verdicts[NUM_VERDICTS] = {0}, start, handoff = 0, total, dups = 0, sent;
+    uint64_t forwarded = 0, held = 0, moved = 0, node_handoff = 0;
+    uint32_t members = (1u << (num_nodes + migrate)) - 1;
+    int idx, status, failed = 0, acks = 0, given = 0, pending, num, num_procs = num_nodes + migrate + num_fronts;
+    int counts[CLUSTER_NODES] = {0}, most = 0;
+    struct cluster_ring ring;
+
+    memset(shared, 0, sizeof(*shared));
+    snprintf(cluster_name, sizeof(cluster_name), "bench_cluster.%d.%d", (int)getpid(), run++);
+    if (cluster_open(&coord, cluster_name, CLUSTER_COORD))
+        return -1;
+    fflush(stdout);
+    for (idx = 0; idx < num_nodes + migrate + num_fronts; idx++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PRINT_RETURN("Could not fork\n", -1);
+        if (pid == 0 && idx < num_nodes + migrate)
+            exit(run_node(idx, num_nodes) ? 1 : 0);
+        if (pid == 0)
+            exit(run_front(idx - num_nodes - migrate, num_nodes) ? 1 : 0);
+    }
+    while (__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) < num_procs)
+        usleep(1000);
+    start = now_ns();
+    __atomic_store_n(&shared->start, 1, __ATOMIC_RELEASE);
+
+    // Offer the new ring to every node, taking their acknowledgements as it
+    // goes, and give it to the front-ends as soon as every node has it queued,
+    // so that they may route to a new owner before it has the remotes
+    if (migrate) {
+        do {
+            for (idx = 0, sent = 0; idx < num_fronts; idx++)
+                sent += __atomic_load_n(&shared->fronts[idx].sent, __ATOMIC_ACQUIRE);
+            usleep(100);
+        } while (sent < (uint64_t)num_frames / 3);
+        handoff = now_ns();
+        for (idx = 0; idx <= num_nodes; idx++)
+            cluster_append(&coord, idx, CLUSTER_RING, 2, &members, 4);
+        while (acks <= num_nodes) {
+            for (idx = 0, pending = 0; idx <= num_nodes; idx++) {
+                if ((num = cluster_offer(&coord, idx)) < 0)
+                    return -1;
+                pending += num;
+            }
+            while ((num = cluster_recv(&coord, data, 0)) > 0)
+                acks += (data[0] == CLUSTER_ACK);
+            if (num < 0)
+                return -1;
+            for (idx = 0; idx < num_fronts && pending == 0 && !given; idx++)
+                if (cluster_post(&coord, CLUSTER_NODES + idx, CLUSTER_RING, 2, &members, 4))
+                    return -1;
+            given |= (pending == 0);
+            if (acks <= num_nodes)
+                usleep(pending ? 10 : 100);
+        }
+        handoff = now_ns() - handoff;
+    }
+
+    // Wait until every message and duplicate has been verified somewhere,
+    // giving up after a minute
+    do {
+        usleep(200);
+        for (idx = 0, dups = 0, sent = 0; idx < num_fronts; idx++) {
+            sent += __atomic_load_n(&shared->fronts[idx].done, __ATOMIC_ACQUIRE);
+            dups += __atomic_load_n(&shared->fronts[idx].dups, __ATOMIC_ACQUIRE);
+        }
+        for (idx = 0, total = 0; idx < num_nodes + migrate; idx++)
+            total += __atomic_load_n(&shared->nodes[idx].verified, __ATOMIC_ACQUIRE);
+    } while ((sent < (uint64_t)num_fronts || total < num_frames + dups) && now_ns() - start < 60000000000ull);
+    *rate = num_frames / ((now_ns() - start) / 1e9);
+    for (idx = 0; idx < num_nodes + migrate; idx++)
+        if (cluster_post(&coord, idx, CLUSTER_STOP, 0, NULL, 0))
+            return -1;
+    for (idx = 0; idx < num_procs; idx++) {
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    cluster_close(&coord);
+    if (failed)
+        PRINT_RETURN("A process failed\n", -1);
+
+    for (idx = 0; idx < num_nodes + migrate; idx++) {
+        struct node_report* rp = &shared->nodes[idx];
+        for (num = 0; num < NUM_VERDICTS; num++)
+            verdicts[num] += rp->verdicts[num];
+        forwarded += rp->forwarded;
+        held += rp->held;
+        moved += rp->moved_in;
+        if (rp->handoff_ns > node_handoff)
+            node_handoff = rp->handoff_ns;
+    }
+    ring_build(&ring, 1 + migrate, members);
+    for (idx = 0; idx < num_fobs; idx++)
+        counts[ring_owner(&ring, vf.serials[idx])]++;
+    for (idx = 0; idx < num_nodes + migrate; idx++)
+        most = (counts[idx] > most) ? counts[idx] : most;
+    *spread = (double)most * (num_nodes + migrate) / num_fobs;
+    if (!migrate) {
+        if (verdicts[VERDICT_ACCEPT] != (uint64_t)num_frames)
+            PRINT_RETURN("Not every message was accepted\n", -1);
+        return 0;
+    }
+
+    printf("    Handoff:          %.2f ms until every node acknowledged, %.2f ms in the slowest node\n",
+        handoff / 1e6, node_handoff / 1e6);
+    printf("    Moved remotes:    %lu (%.1f%%)\n", (unsigned long)moved, 100.0 * moved / num_fobs);
+    printf("    Forwarded:        %lu messages\n", (unsigned long)forwarded);
+    printf("    Held:             %lu messages\n", (unsigned long)held);
+    printf("    Accepted:         %lu/%d messages\n", (unsigned long)verdicts[VERDICT_ACCEPT], num_frames);
+    printf("    Replays:          %lu/%lu duplicates rejected\n", (unsigned long)verdicts[VERDICT_REPLAY], (unsigned long)dups);
+    printf("    Throughput:       %.0f msg/s\n", *rate);
+    if (verdicts[VERDICT_ACCEPT] != (uint64_t)num_frames || verdicts[VERDICT_REPLAY] != dups)
+        PRINT_RETURN("A message was lost or accepted twice\n", -1);
+    return 0;
+}
+
+
+// Run a node with the remotes that it owns on the first ring, until the parent
+// stops it. Returns -1 if the node failed.
+int run_node(int id, int num_nodes) {
+    struct cluster_node nd;
+    int idx, num, rc, slot;
+
+    if (cluster_node_init(&nd, cluster_name, id, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    ring_build(&nd.ring, 1, (1u << num_nodes) - 1);
+    nd.last = nd.ring;
+
+    // Take the keys and state of the remotes that it owns, as a node would
+    // load them from the keystore
+    for (idx = 0; idx < num_fobs; idx++) {
+        if (ring_owner(&nd.ring, vf.serials[idx]) != id)
+            continue;
+        slot = nd.vf.num_fobs++;
+        if (verifier_place(&nd.vf, slot, vf.serials[idx], NULL))
+            PRINT_RETURN("Could not place a remote\n", -1);
+        nd.vf.keys[slot] = vf.keys[idx];
+        nd.vf.states[slot] = vf.states[idx];
+    }
+
+    __atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+    do {
+        if ((num = cluster_recv(&nd.link, data, 1)) < 0)
+            return -1;
+        if ((rc = cluster_node_handle(&nd, data, num)) < 0)
+            return -1;
+        publish(&nd);
+    } while (rc == 0);
+    cluster_node_free(&nd);
+    return 0;
+}
+
+
+// Route every message of a front-end to its owner, switching to a new ring
+// when the parent gives one. For a while after a switch, the messages of
+// remotes that moved are also sent to their last owner. Returns -1 if the
+// front-end failed.
+int run_front(int front, int num_nodes) {
+    struct front_report* rp = &shared->fronts[front];
+    static struct cluster_ring ring, last;
+    struct cluster_link ln;
+    uint8_t rec[1 + FRAME_MAX];
+    uint32_t serial, members;
+    int idx, owner, num, dup_left = 0;
+
+    if (cluster_open(&ln, cluster_name, CLUSTER_NODES + front))
+        return -1;
+    ring_build(&ring, 1, (1u << num_nodes) - 1);
+
+    __atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&shared->start, __ATOMIC_ACQUIRE))
+        usleep(100);
+    for (idx = front; idx < num_frames; idx += num_fronts) {
+        rec[0] = lengths[idx];
+        memcpy(rec + 1, frames[idx], lengths[idx]);
+        serial = cluster_serial(frames[idx], lengths[idx]);
+        owner = ring_owner(&ring, serial);
+        if (cluster_append(&ln, owner, CLUSTER_FRAMES, ring.version, rec, 1 + rec[0]))
+            return -1;
+        if (dup_left > 0) {
+            dup_left--;
+            if ((owner = ring_owner(&last, serial)) != ring_owner(&ring, serial)) {
+                if (cluster_append(&ln, owner, CLUSTER_FRAMES, ring.version, rec, 1 + rec[0]))
+                    return -1;
+                rp->dups++;
+            }
+        }
+        if ((++rp->sent & 255) != 0)
+            continue;
+        __atomic_store_n(&rp->sent, rp->sent, __ATOMIC_RELEASE);
+        if ((num = cluster_recv(&ln, data, 0)) < 0)
+            return -1;
+        if (num >= CLUSTER_HEADER + 4 && data[0] == CLUSTER_RING) {
+            memcpy(&members, data + CLUSTER_HEADER, 4);
+            last = ring;
+            ring_build(&ring, ring.version + 1, members);
+            dup_left = dup_window;
+        }
+    }
+    if (cluster_flush_all(&ln))
+        return -1;
+    __atomic_store_n(&rp->dups, rp->dups, __ATOMIC_RELEASE);
+    __atomic_store_n(&rp->done, 1, __ATOMIC_RELEASE);
+    cluster_close(&ln);
+    return 0;
+}
+
+
+// Copy the statistics of a node to its report.
+void publish(struct cluster_node* nd) {
+    struct node_report* rp = &shared->nodes[nd->link.id];
+    uint64_t verified = 0;
+    int idx;
+
+    for (idx = 0; idx < NUM_VERDICTS; idx++) {
+        rp->verdicts[idx] = nd->verdicts[idx];
+        verified += nd->verdicts[idx];
+    }
+    rp->forwarded = nd->forwarded;
+    rp->held = nd->total_held;
+    rp->moved_in = nd->moved_in;
+    rp->moved_out = nd->moved_out;
+    rp->handoff_ns = nd->handoff_ns;
+    __atomic_store_n(&rp->verified, verified, __ATOMIC_RELEASE);
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,261 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include <lzma.h>
+
+#include "verifier.h"
+#include "codec.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Passes that the codec is decoded in, keeping the fastest */
+#define DECODE_PASSES  3
+
+/* General purpose compressors */
+enum compressor {
+    COMP_ZLIB_FAST,
+    COMP_ZLIB,
+    COMP_BZIP2,
+    COMP_XZ,
+    NUM_COMPRESSORS,
+};
+
+
+/* Global variables */
+int num_records = 4000000;
+int num_fobs = 100000;
+int num_doors = 1000;
+int rate = 2000;
+int reject_pct = 3;
+int tick = 1000;
+struct codec_record* records;
+struct codec_record* decoded;
+uint8_t* packed;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_codec [-n records] [-f fobs] [-d doors] [-r rate] [-p pct]\n"
+    "                   [-t tick]\n\n"
+    "Makes an audit trail of the traffic of a fleet, in which some remotes are\n"
+    "used far more than others, each mostly at the two doors near its owner,\n"
+    "and its code advances by one with every press or a few more when presses\n"
+    "are missed. A share of the messages are rejected for random reasons, with\n"
+    "random serials for those that are unknown. Encodes the trail as blocks of\n"
+    "the audit codec and with general purpose compressors, and reports the\n"
+    "ratio of each and the speed that each encodes and decodes records at, in\n"
+    "bytes of records per second. The codec is decoded a block at a time, as a\n"
+    "stream, in the fastest of a few passes, and the others in one piece.\n\n"
+    "    -n records  Number of records (default: 4000000)\n"
+    "    -f fobs     Number of remotes (default: 100000)\n"
+    "    -d doors    Number of doors (default: 1000)\n"
+    "    -r rate     Messages per second (default: 2000)\n"
+    "    -p pct      Percent of messages rejected (default: 3)\n"
+    "    -t tick     Nanoseconds that times are kept to (default: 1000)\n"
+);
+
+const char* compressor_names[NUM_COMPRESSORS] = {"zlib -1", "zlib -6", "bzip2 -9", "xz -1"};
+
+
+void make_records();
+int run_codec(double* enc, double* dec, uint64_t* size);
+int run_compressor(int comp, double* enc, double* dec, uint64_t* size);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    uint64_t raw, size;
+    double enc, dec;
+    int opt, comp;
+
+    while ((opt = getopt(argc, argv, "n:f:d:r:p:t:h")) != -1) {
+        switch (opt) {
+        case 'n': num_records = atoi(optarg); break;
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'd': num_doors = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'p': reject_pct = atoi(optarg); break;
+        case 't': tick = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_records < 1 || num_fobs < 1 || num_fobs > 1 << 23 || num_doors < 1 || num_doors > 65536)
+        PRINT_RETURN(help_msg, -1);
+    if (rate < 1 || reject_pct < 0 || reject_pct > 100 || tick < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    raw = (uint64_t)num_records*sizeof(*records);
+    records = malloc(raw);
+    decoded = malloc(raw);
+    packed = malloc(raw + raw/2 + 1048576);
+    if (records == NULL || decoded == NULL || packed == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    make_records();
+
+    printf("Audit trail of %d records from %d remotes at %d doors, at %d msg/s with %d%% rejected,\n",
+        num_records, num_fobs, num_doors, rate, reject_pct);
+    printf("in %.1f MiB of %d-byte records:\n", raw / 1048576.0, (int)sizeof(*records));
+    printf("    %-10s %10s %8s %10s %14s %14s\n", "", "MiB", "ratio", "bytes/rec", "encode MB/s", "decode MB/s");
+    if (run_codec(&enc, &dec, &size))
+        return -1;
+    printf("    %-10s %10.2f %7.1fx %10.2f %14.0f %14.0f\n", "codec", size / 1048576.0, (double)raw / size,
+        (double)size / num_records, raw / enc / 1e6, raw / dec / 1e6);
+    for (comp = 0; comp < NUM_COMPRESSORS; comp++) {
+        if (run_compressor(comp, &enc, &dec, &size))
+            return -1;
+        printf("    %-10s %10.2f %7.1fx %10.2f %14.0f %14.0f\n", compressor_names[comp], size / 1048576.0,
+            (double)raw / size, (double)size / num_records, raw / enc / 1e6, raw / dec / 1e6);
+    }
+
+    free(records);
+    free(decoded);
+    free(packed);
+    return 0;
+}
+
+
+// Fill the trail with the traffic of the fleet, at times kept to the tick.
+void make_records() {
+    uint32_t* codes = malloc(num_fobs*sizeof(*codes));
+    uint64_t time = 0;
+    double unit;
+    int idx, fob, pick;
+
+    for (fob = 0; fob < num_fobs; fob++)
+        codes[fob] = rand64();
+    for (idx = 0; idx < num_records; idx++) {
+        struct codec_record* rec = &records[idx];
+        unit = (rand64() >> 11) * (1.0 / 9007199254740992.0);
+        time += -log(1 - unit) * 1e9 / rate;
+        unit = (rand64() >> 11) * (1.0 / 9007199254740992.0);
+        fob = unit * unit * num_fobs;
+        pick = rand64() % 10;
+        memset(rec, 0, sizeof(*rec));
+        rec->time = time / tick * tick;
+        rec->serial = (2*fob + 1) & 0xFFFFFF;
+        rec->door = (pick < 7) ? (fob * 2654435761u) % num_doors :
+            (pick < 9) ? (fob * 40503u + 1) % num_doors : rand64() % num_doors;
+        codes[fob] += 1 + ((rand64() % 10 == 0) ? rand64() % 3 + 1 : 0);
+        rec->code = codes[fob];
+        rec->verdict = VERDICT_ACCEPT;
+        if ((int)(rand64() % 100) < reject_pct) {
+            rec->verdict = VERDICT_MALFORMED + rand64() % (NUM_VERDICTS - 1);
+            if (rec->verdict == VERDICT_UNKNOWN) {
+                rec->serial = rand64() & 0xFFFFFF;
+                rec->code = rand64();
+            }
+        }
+    }
+    free(codes);
+}
+
+
+// Encode the trail with the codec and decode it a block at a time, storing
+// the seconds taken by each and the bytes. Returns -1 if the trail does not
+// decode to itself.
+int run_codec(double* enc, double* dec, uint64_t* size) {
+    struct codec cd;
+    struct codec_record* block = aligned_alloc(64, CODEC_BLOCK*sizeof(*block));
+    uint64_t start, pos = 0;
+    int idx, num, len, pass;
+
+    if (block == NULL || codec_init(&cd, tick))
+        PRINT_RETURN("Out of memory\n", -1);
+    start = now_ns();
+    for (idx = 0; idx < num_records; idx += num) {
+        if ((num = codec_encode(&cd, records + idx, num_records - idx, packed + pos, &len)) < 0)
+            return -1;
+        pos += len;
+    }
+    *enc = (now_ns() - start) / 1e9;
+    *size = pos;
+    codec_free(&cd);
+
+    // Decode into one block as a stream would, keeping the best of a few
+    // passes, then into the whole trail to check it
+    *dec = 0;
+    for (pass = 0; pass <= DECODE_PASSES; pass++) {
+        if (codec_init(&cd, tick))
+            return -1;
+        start = now_ns();
+        for (idx = 0, pos = 0; idx < num_records; idx += num) {
+            if ((num = codec_decode(&cd, packed + pos, *size - pos, (pass == DECODE_PASSES) ? decoded + idx : block)) < 0)
+                PRINT_RETURN("Corrupt block\n", -1);
+            pos += ((struct codec_header*)(packed + pos))->size;
+        }
+        if (pass < DECODE_PASSES && (*dec == 0 || (now_ns() - start) / 1e9 < *dec))
+            *dec = (now_ns() - start) / 1e9;
+        codec_free(&cd);
+    }
+    free(block);
+    if (memcmp(records, decoded, (uint64_t)num_records*sizeof(*records)))
+        PRINT_RETURN("The codec does not decode the trail\n", -1);
+    return 0;
+}
+
+
+// Compress the trail in one piece and decompress it, storing the seconds
+// taken by each and the bytes. Returns -1 if the trail does not decompress
+// to itself.
+int run_compressor(int comp, double* enc, double* dec, uint64_t* size) {
+    uint64_t raw = (uint64_t)num_records*sizeof(*records), start, cap = raw + raw/2 + 1048576;
+    uLongf zlen = cap, zraw = raw;
+    unsigned int blen = cap, braw = raw;
+    size_t xlen = 0, xin = 0, xraw = 0;
+    uint64_t memlimit = UINT64_MAX;
+    int ret = 0;
+
+    start = now_ns();
+    switch (comp) {
+    case COMP_ZLIB_FAST: ret = compress2(packed, &zlen, (uint8_t*)records, raw, 1) != Z_OK; *size = zlen; break;
+    case COMP_ZLIB: ret = compress2(packed, &zlen, (uint8_t*)records, raw, 6) != Z_OK; *size = zlen; break;
+    case COMP_BZIP2: ret = BZ2_bzBuffToBuffCompress((char*)packed, &blen, (char*)records, raw, 9, 0, 0) != BZ_OK; *size = blen; break;
+    case COMP_XZ: ret = lzma_easy_buffer_encode(1, LZMA_CHECK_NONE, NULL, (uint8_t*)records, raw, packed, &xlen, cap) != LZMA_OK; *size = xlen; break;
+    }
+    *enc = (now_ns() - start) / 1e9;
+    if (ret)
+        PRINT_RETURN("Could not compress the trail\n", -1);
+
+    start = now_ns();
+    switch (comp) {
+    case COMP_ZLIB_FAST:
+    case COMP_ZLIB: ret = uncompress((uint8_t*)decoded, &zraw, packed, *size) != Z_OK; break;
+    case COMP_BZIP2: ret = BZ2_bzBuffToBuffDecompress((char*)decoded, &braw, (char*)packed, *size, 0, 0) != BZ_OK; break;
+    case COMP_XZ: ret = lzma_stream_buffer_decode(&memlimit, 0, NULL, packed, &xin, *size, (uint8_t*)decoded, &xraw, raw) != LZMA_OK; break;
+    }
+    *dec = (now_ns() - start) / 1e9;
+    if (ret || memcmp(records, decoded, raw))
+        PRINT_RETURN("Could not decompress the trail\n", -1);
+    return 0;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
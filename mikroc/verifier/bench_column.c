@@ -0,0 +1,226 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "column.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Time constants in nanoseconds */
+#define HOUR_NS  3600000000000ull
+#define DAY_NS   (24*HOUR_NS)
+
+/* The most matches kept of a query */
+#define MAX_MATCHES  (1 << 20)
+
+/* A record of the row-oriented log, as the audit log with the door in place
+ * of the length */
+struct log_row {
+    uint64_t time;
+    uint32_t serial;
+    uint16_t door;
+    uint8_t verdict;
+    uint8_t ver;
+};
+
+/* A question asked of the audit trail */
+struct question {
+    const char* name;
+    struct column_query q;
+};
+
+
+/* Global variables */
+int num_rows = 20000000;
+int num_fobs = 100000;
+int num_doors = 1000;
+int num_days = 28;
+int reject_pct = 3;
+int reps = 3;
+struct log_row* rows;
+uint64_t* row_matches;
+uint64_t* col_matches;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_column [-n rows] [-f fobs] [-d doors] [-t days] [-p pct]\n"
+    "                    [-r reps]\n\n"
+    "Fills an audit trail with the verdicts on messages from random remotes at\n"
+    "random doors, spread evenly over the given days, both as a row-oriented log\n"
+    "and as a store in columns. A share of them are rejected for random reasons,\n"
+    "and the rest are accepted. Then asks both the questions that are typical of\n"
+    "an investigation, and reports the records scanned per second by each, the\n"
+    "chunks that the zone maps skip, and whether both found the same records.\n\n"
+    "    -n rows     Number of records (default: 20000000)\n"
+    "    -f fobs     Number of remotes (default: 100000)\n"
+    "    -d doors    Number of doors (default: 1000)\n"
+    "    -t days     Days that the records span (default: 28)\n"
+    "    -p pct      Percent of messages rejected (default: 3)\n"
+    "    -r reps     Times each question is asked, keeping the best (default: 3)\n"
+);
+
+
+uint64_t scan_log(const struct column_query* q, uint64_t* matches, uint64_t max_matches);
+double best_of(struct column_store* st, const struct column_query* q, int columns, uint64_t* found);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    struct column_store st;
+    struct audit_record ar;
+    struct question qs[5];
+    uint64_t span, row_found, col_found, kept;
+    uint32_t rejects = ((1u << NUM_VERDICTS) - 1) & ~(1u << VERDICT_ACCEPT);
+    double row_time, col_time;
+    int opt, idx;
+
+    while ((opt = getopt(argc, argv, "n:f:d:t:p:r:h")) != -1) {
+        switch (opt) {
+        case 'n': num_rows = atoi(optarg); break;
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'd': num_doors = atoi(optarg); break;
+        case 't': num_days = atoi(optarg); break;
+        case 'p': reject_pct = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_rows < 1 || num_fobs < 1 || num_fobs > 1 << 23 || num_doors < 1 || num_doors > 65535)
+        PRINT_RETURN(help_msg, -1);
+    if (num_days < 7 || reject_pct < 0 || reject_pct > 100 || reps < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    rows = malloc(num_rows*sizeof(*rows));
+    row_matches = malloc(MAX_MATCHES*sizeof(*row_matches));
+    col_matches = malloc(MAX_MATCHES*sizeof(*col_matches));
+    if (rows == NULL || row_matches == NULL || col_matches == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (column_init(&st))
+        return -1;
+
+    // Fill both with the same records
+    span = num_days * DAY_NS;
+    for (idx = 0; idx < num_rows; idx++) {
+        rows[idx].time = span / num_rows * idx + rand64() % (span / num_rows);
+        rows[idx].serial = (2*(rand64() % num_fobs) + 1) & 0xFFFFFF;
+        rows[idx].door = rand64() % num_doors;
+        rows[idx].verdict = VERDICT_ACCEPT;
+        if ((int)(rand64() % 100) < reject_pct)
+            rows[idx].verdict = VERDICT_MALFORMED + rand64() % (NUM_VERDICTS - 1);
+        rows[idx].ver = 0;
+    }
+    for (idx = 0; idx < num_rows; idx++) {
+        ar.time = rows[idx].time;
+        ar.serial = rows[idx].serial;
+        ar.verdict = rows[idx].verdict;
+        ar.ver = rows[idx].ver;
+        ar.len = FRAME_LEN_MAC;
+        if (column_append(&st, &ar, rows[idx].door))
+            return -1;
+    }
+    if (column_seal(&st))
+        return -1;
+
+    printf("Audit trail of %d records from %d remotes at %d doors over %d days, %d%% rejected,\n",
+        num_rows, num_fobs, num_doors, num_days, reject_pct);
+    printf("as a log of %.1f MiB and in %d chunks of %d records:\n\n",
+        (double)num_rows*sizeof(*rows) / 1048576.0, st.num_chunks, COLUMN_ROWS);
+
+    // The questions, with the door and remote of the first record
+    qs[0] = (struct question){"rejects at a door this week",
+        {span - 7*DAY_NS, span, COLUMN_ANY, rows[0].door, rejects}};
+    qs[1] = (struct question){"a remote over every day",
+        {0, span, rows[0].serial, COLUMN_ANY, (1u << NUM_VERDICTS) - 1}};
+    qs[2] = (struct question){"forgeries at a door ever",
+        {0, span, COLUMN_ANY, rows[0].door, 1u << VERDICT_FORGED}};
+    qs[3] = (struct question){"every reject in the last hour",
+        {span - HOUR_NS, span, COLUMN_ANY, COLUMN_ANY, rejects}};
+    qs[4] = (struct question){"accepts at a door today",
+        {span - DAY_NS, span, COLUMN_ANY, rows[0].door, 1u << VERDICT_ACCEPT}};
+
+    printf("    %-30s %8s %12s %12s %8s %8s %6s\n",
+        "question", "matches", "log rows/s", "col rows/s", "speedup", "skipped", "same");
+    for (idx = 0; idx < 5; idx++) {
+        row_time = best_of(&st, &qs[idx].q, 0, &row_found);
+        col_time = best_of(&st, &qs[idx].q, 1, &col_found);
+        kept = (row_found < MAX_MATCHES) ? row_found : MAX_MATCHES;
+        printf("    %-30s %8lu %12.3g %12.3g %7.1fx %3lu/%-4d %6s\n", qs[idx].name, (unsigned long)col_found,
+            num_rows / row_time, num_rows / col_time, row_time / col_time,
+            (unsigned long)st.chunks_skipped, st.num_chunks,
+            (row_found == col_found && !memcmp(row_matches, col_matches, kept*sizeof(*row_matches))) ? "yes" : "NO");
+    }
+
+    column_free(&st);
+    free(rows);
+    free(row_matches);
+    free(col_matches);
+    return 0;
+}
+
+
+// Find every record of the log that matches a query, as column_scan() does.
+// Returns the number of matches.
+uint64_t scan_log(const struct column_query* q, uint64_t* matches, uint64_t max_matches) {
+    uint64_t found = 0;
+    int idx;
+
+    for (idx = 0; idx < num_rows; idx++) {
+        const struct log_row* rw = &rows[idx];
+        if (rw->time < q->time_lo || rw->time > q->time_hi || !(q->verdicts >> rw->verdict & 1))
+            continue;
+        if ((q->serial != COLUMN_ANY && rw->serial != q->serial) || (q->door != COLUMN_ANY && rw->door != q->door))
+            continue;
+        if (found < max_matches)
+            matches[found] = idx;
+        found++;
+    }
+    return found;
+}
+
+
+// Ask a question of the log or the columns reps times. Returns the least
+// seconds taken.
+double best_of(struct column_store* st, const struct column_query* q, int columns, uint64_t* found) {
+    uint64_t start, elapsed, best = UINT64_MAX;
+    int idx;
+
+    for (idx = 0; idx < reps; idx++) {
+        start = now_ns();
+        if (columns)
+            *found = column_scan(st, q, col_matches, MAX_MATCHES);
+        else
+            *found = scan_log(q, row_matches, MAX_MATCHES);
+        elapsed = now_ns() - start;
+        best = (elapsed < best) ? elapsed : best;
+    }
+    return (best ? best : 1) / 1e9;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
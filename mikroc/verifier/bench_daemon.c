@@ -0,0 +1,284 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "core.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of cores to run */
+#define MAX_THREADS 64
+
+
+/* A core of the daemon on a thread of its own */
+struct worker {
+    pthread_t thread;
+    int id;
+    int general;
+    struct core core;
+    uint8_t (*frames)[FRAME_MAX];
+    uint8_t* lengths;
+    uint32_t* latencies; // Of every message
+    int failed;
+};
+
+
+/* Global variables */
+int num_fobs = 65536;
+int num_frames = 1000000;
+int num_warmup = 100000;
+int num_threads = 1;
+int batch_size = 16;
+int check_only = 0;
+int log_fd;
+struct verifier vf;
+struct fob_state* init_states;
+struct worker workers[MAX_THREADS];
+uint64_t num_allocs;
+__thread int counting;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_daemon [-f fobs] [-n frames] [-w warmup] [-t threads]\n"
+    "                    [-b batch] [-o path] [-c]\n\n"
+    "Runs the path of a message through the verification daemon, from the\n"
+    "receiver through verify, journal and audit log, on one pinned thread per\n"
+    "core. The cores take their buffers from per-core arenas and slabs, and\n"
+    "reuse their journal buffers, which is compared against allocating all of\n"
+    "them with malloc() as it goes. Every call to malloc() after the warmup is\n"
+    "counted, and the latency of each message from its arrival until it is\n"
+    "logged is reported up to the 99.9th percentile.\n\n"
+    "    -f fobs     Number of remotes (default: 65536)\n"
+    "    -n frames   Number of messages per thread (default: 1000000)\n"
+    "    -w warmup   Messages per thread before counting (default: 100000)\n"
+    "    -t threads  Number of cores (default: 1)\n"
+    "    -b batch    Messages per batch (default: 16)\n"
+    "    -o path     Where to write the logs (default: /dev/null)\n"
+    "    -c          Only check that the arenas never allocate after the\n"
+    "                warmup, and fail if they do\n"
+);
+
+
+double run_workers(int general, uint64_t* allocs);
+void* run_worker(void* arg);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+void* malloc(size_t size);
+void* calloc(size_t num, size_t size);
+void* realloc(void* ptr, size_t size);
+void* aligned_alloc(size_t align, size_t size);
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t num, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t align, size_t size);
+
+
+int main(int argc, char* argv[]) {
+    const char* path = "/dev/null";
+    uint32_t* tx_codes;
+    uint32_t* sorted;
+    uint64_t allocs;
+    int opt, idx, jdx, general, num_kept;
+
+    while ((opt = getopt(argc, argv, "f:n:w:t:b:o:ch")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'w': num_warmup = atoi(optarg); break;
+        case 't': num_threads = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        case 'o': path = optarg; break;
+        case 'c': check_only = 1; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_frames < 1 || num_warmup < 0 || num_warmup >= num_frames)
+        PRINT_RETURN(help_msg, -1);
+    if (num_threads < 1 || num_threads > MAX_THREADS || num_fobs < num_threads)
+        PRINT_RETURN(help_msg, -1);
+    if (batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+    if ((log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        PRINT_RETURN("Could not open the logs\n", -1);
+
+    // Enroll the fleet and record the messages of each core in the order they
+    // were sent, with every remote heard by a single core
+    srand(1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        while (verifier_enroll(&vf, ((uint32_t)rand() << 8 ^ rand()) & 0xFFFFFF, seed, 0) < 0)
+            ;
+    }
+    init_states = malloc(num_fobs*sizeof(*init_states));
+    tx_codes = calloc(num_fobs, sizeof(*tx_codes));
+    sorted = malloc((size_t)num_threads*num_frames*sizeof(*sorted));
+    if (init_states == NULL || tx_codes == NULL || sorted == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    memcpy(init_states, vf.states, num_fobs*sizeof(*init_states));
+    for (idx = 0; idx < num_threads; idx++) {
+        struct worker* wk = &workers[idx];
+        wk->id = idx;
+        wk->frames = malloc(num_frames*sizeof(*wk->frames));
+        wk->lengths = malloc(num_frames);
+        wk->latencies = malloc(num_frames*sizeof(*wk->latencies));
+        if (wk->frames == NULL || wk->lengths == NULL || wk->latencies == NULL)
+            PRINT_RETURN("Out of memory\n", -1);
+        for (jdx = 0; jdx < num_frames; jdx++) {
+            int slot = idx + num_threads * (rand() % (num_fobs / num_threads));
+            uint8_t ver = FRAME_BLOWFISH | FRAME_MAC;
+            while ((wk->lengths[jdx] = verifier_frame(&vf, slot, ver, ++tx_codes[slot], wk->frames[jdx])) == 0)
+                ;
+        }
+    }
+
+    if (check_only) {
+        run_workers(0, &allocs);
+        printf("%lu allocations after the warmup: %s\n", (unsigned long)allocs, allocs ? "FAIL" : "ok");
+        return allocs ? -1 : 0;
+    }
+
+    printf("Latency of %d threads in batches of %d (%d remotes, %d messages after warmup):\n",
+        num_threads, batch_size, num_fobs, num_threads * (num_frames - num_warmup));
+    printf("    %-9s %10s %10s %10s %10s %10s %10s\n",
+        "buffers", "Mmsg/s", "p50 ns", "p99 ns", "p999 ns", "max ns", "mallocs");
+    for (general = 1; general >= 0; general--) {
+        double secs = run_workers(general, &allocs);
+        if (secs < 0)
+            return -1;
+        num_kept = 0;
+        for (idx = 0; idx < num_threads; idx++) {
+            memcpy(sorted + num_kept, workers[idx].latencies + num_warmup, (num_frames - num_warmup)*sizeof(*sorted));
+            num_kept += num_frames - num_warmup;
+        }
+        qsort(sorted, num_kept, sizeof(*sorted), cmp_latency);
+        printf("    %-9s %10.2f %10u %10u %10u %10u %10lu\n", general ? "malloc" : "arena",
+            (double)num_threads*num_frames/secs/1e6, percentile(sorted, num_kept, 0.5),
+            percentile(sorted, num_kept, 0.99), percentile(sorted, num_kept, 0.999),
+            sorted[num_kept-1], (unsigned long)allocs);
+    }
+
+    verifier_free(&vf);
+    for (idx = 0; idx < num_threads; idx++) {
+        free(workers[idx].frames);
+        free(workers[idx].lengths);
+        free(workers[idx].latencies);
+    }
+    free(init_states);
+    free(tx_codes);
+    free(sorted);
+    close(log_fd);
+    return 0;
+}
+
+
+// Run every core from the initial channel store, storing the number of
+// allocations after the warmup in allocs. Returns the time taken in seconds,
+// or -1 if a core failed.
+double run_workers(int general, uint64_t* allocs) {
+    int idx, failed = 0;
+
+    memcpy(vf.states, init_states, num_fobs*sizeof(*init_states));
+    num_allocs = 0;
+    uint64_t start = core_clock();
+    for (idx = 0; idx < num_threads; idx++) {
+        workers[idx].general = general;
+        pthread_create(&workers[idx].thread, NULL, run_worker, &workers[idx]);
+    }
+    for (idx = 0; idx < num_threads; idx++) {
+        pthread_join(workers[idx].thread, NULL);
+        failed |= workers[idx].failed;
+    }
+    double secs = (core_clock() - start) / 1e9;
+    *allocs = num_allocs;
+    if (failed)
+        PRINT_RETURN("A core failed\n", -1);
+    return secs;
+}
+
+
+// Run a core pinned to its processor over its messages, counting allocations
+// and keeping the latencies once the warmup is over.
+void* run_worker(void* arg) {
+    struct worker* wk = arg;
+    cpu_set_t cpus;
+    int idx, num;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(wk->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    wk->failed = 1;
+    if (core_init(&wk->core, &vf, batch_size, log_fd, log_fd, wk->general))
+        return NULL;
+
+    for (idx = 0; idx < num_frames; idx++) {
+        if (idx == num_warmup)
+            counting = 1;
+        if ((num = core_receive(&wk->core, wk->frames[idx], wk->lengths[idx], core_clock())) < 0)
+            goto done;
+        if ((num > 0 || idx == num_frames-1) && core_flush(&wk->core, wk->latencies + idx+1 - wk->core.num) < 0)
+            goto done;
+    }
+    wk->failed = 0;
+done:
+    counting = 0;
+    core_free(&wk->core);
+    return NULL;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// The allocator of the C library, counting every call on a thread that has
+// finished its warmup.
+void* malloc(size_t size) {
+    if (counting)
+        __atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) {
+    if (counting)
+        __atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (counting)
+        __atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+    if (counting)
+        __atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(align, size);
+}
@@ -0,0 +1,430 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "gossip.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The most sites to run */
+#define MAX_SITES  GOSSIP_PEERS
+
+/* The lags kept by a site */
+#define MAX_LAGS  (1 << 20)
+
+/* Ways for the sites to gossip */
+enum gossip_mode {
+    MODE_NONE,   // The sites do not gossip at all
+    MODE_DELTA,  // Deltas and anti-entropy
+    MODE_LOSSY,  // Deltas and anti-entropy, with datagrams lost
+    MODE_SPLIT,  // The first site is cut off until it is done, and is then
+                 // repaired by anti-entropy
+    NUM_MODES,
+};
+
+/* What a site reports to the parent */
+struct site_report {
+    uint64_t root;
+    int finished;
+    uint64_t finish_ns;
+    uint64_t accepted;
+    uint64_t delta_bytes;
+    uint64_t sync_bytes;
+    uint32_t lag_p50;
+    uint32_t lag_p99;
+    int checked;
+    int replays;   // Messages of other sites that were accepted again here
+};
+
+/* Memory shared between the parent and the sites */
+struct shared {
+    int ready;
+    uint64_t start;
+    int stop;
+    struct site_report sites[MAX_SITES];
+};
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 2000000;
+int num_sites = 3;
+int rate = 100000;
+int flush_us = 1000;
+int sync_ms = 20;
+int loss_pct = 5;
+int batch_size = 16;
+int base_port = 47200;
+struct verifier vf;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint8_t* owners;       // The site that every message arrives at
+int32_t* order;        // The messages of every site, in order of arrival
+int site_start[MAX_SITES+1];
+struct shared* shared;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_gossip [-f fobs] [-n frames] [-s sites] [-r rate] [-i flush]\n"
+    "                    [-a sync] [-l loss] [-b batch] [-p port]\n\n"
+    "Runs every site in a process of its own with a copy of the fleet, and\n"
+    "sends the messages of the remotes to random sites at a fixed rate, while\n"
+    "the sites gossip over UDP on the loopback address. Once every site has\n"
+    "verified its messages, the time until the digests of all sites match is\n"
+    "the convergence time. Every site then replays a sample of the messages\n"
+    "that were accepted at the others, which must all be rejected. This is\n"
+    "done without gossip, with deltas, with deltas that are lost, and with the\n"
+    "first site cut off from the others until it is done, so that it is only\n"
+    "brought in step by anti-entropy. Reports the bytes sent per million\n"
+    "remotes, and the lag of the deltas from the time a code was accepted until\n"
+    "a peer merged it.\n\n"
+    "    -f fobs   Number of remotes (default: 1000000)\n"
+    "    -n frames Number of messages over all sites (default: 2000000)\n"
+    "    -s sites  Number of sites (default: 3)\n"
+    "    -r rate   Messages per second at each site (default: 100000)\n"
+    "    -i flush  Microseconds between flushes of deltas (default: 1000)\n"
+    "    -a sync   Milliseconds between rounds of anti-entropy (default: 20)\n"
+    "    -l loss   Percent of datagrams lost when lossy (default: 5)\n"
+    "    -b batch  Messages per batch (default: 16)\n"
+    "    -p port   The first port of the sites (default: 47200)\n"
+);
+
+const char* mode_names[NUM_MODES] = {"none", "delta", "lossy", "split"};
+
+
+int run_mode(int mode);
+int run_site(int site, int mode);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    uint32_t* codes;
+    uint16_t seed[KEY_WORDS];
+    uint8_t* used;
+    int opt, idx, jdx, mode;
+
+    while ((opt = getopt(argc, argv, "f:n:s:r:i:a:l:b:p:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 's': num_sites = atoi(optarg); break;
+        case 'r': rate = atoi(optarg); break;
+        case 'i': flush_us = atoi(optarg); break;
+        case 'a': sync_ms = atoi(optarg); break;
+        case 'l': loss_pct = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        case 'p': base_port = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (num_sites < 2 || num_sites > MAX_SITES || rate < 1 || flush_us < 1 || sync_ms < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (loss_pct < 0 || loss_pct > 100 || batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+    if (base_port < 1024 || base_port + num_sites > 65536)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet, which every site takes a copy of, and form messages
+    // from random remotes for random sites
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    owners = malloc(num_frames);
+    order = malloc(num_frames*sizeof(*order));
+    codes = calloc(num_fobs, sizeof(*codes));
+    used = calloc(1 << 24, 1);
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (frames == NULL || lengths == NULL || owners == NULL || order == NULL || codes == NULL || used == NULL || shared == MAP_FAILED)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint32_t serial;
+        do {
+            serial = rand64() & 0xFFFFFF;
+        } while (used[serial] || !frame_serial_valid(serial));
+        used[serial] = 1;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand64();
+        if (verifier_enroll(&vf, serial, seed, 0) != idx)
+            PRINT_RETURN("Could not enroll\n", -1);
+    }
+    free(used);
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand64() % num_fobs;
+        while ((lengths[idx] = verifier_frame(&vf, slot, FRAME_BLOWFISH | FRAME_MAC, ++codes[slot], frames[idx])) == 0)
+            ;
+        owners[idx] = rand64() % num_sites;
+        site_start[owners[idx] + 1]++;
+    }
+    free(codes);
+    for (idx = 0; idx < num_sites; idx++)
+        site_start[idx+1] += site_start[idx];
+    for (idx = 0; idx < num_frames; idx++)
+        order[site_start[owners[idx]]++] = idx;
+    for (idx = num_sites; idx > 0; idx--)
+        site_start[idx] = site_start[idx-1];
+    site_start[0] = 0;
+
+    printf("Gossip of %d remotes between %d sites, with %d messages at %d msg/s per site:\n",
+        num_fobs, num_sites, num_frames, rate);
+    printf("    %-6s %9s %12s %10s %10s %12s %11s %11s %9s\n", "gossip", "accepted",
+        "converge ms", "delta MB", "sync MB", "MB/1M fobs", "lag p50 us", "lag p99 us", "replays");
+    for (mode = 0; mode < NUM_MODES; mode++)
+        if (run_mode(mode))
+            return -1;
+
+    verifier_free(&vf);
+    free(frames);
+    free(lengths);
+    free(owners);
+    free(order);
+    munmap(shared, sizeof(*shared));
+    return 0;
+}
+
+
+// Fork the sites, wait for them to converge after their last message, and
+// print a row of results. Returns -1 if a site failed.
+int run_mode(int mode) {
+    uint64_t last = 0, bytes = 0, delta = 0, sync = 0, accepted = 0;
+    uint32_t lag_p50 = 0, lag_p99 = 0;
+    int idx, status, failed = 0, replays = 0, checked = 0;
+    double converge = -1;
+
+    memset(shared, 0, sizeof(*shared));
+    fflush(stdout);
+    for (idx = 0; idx < num_sites; idx++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PRINT_RETURN("Could not fork\n", -1);
+        if (pid == 0)
+            exit(run_site(idx, mode) ? 1 : 0);
+    }
+    while (__atomic_load_n(&shared->ready, __ATOMIC_ACQUIRE) < num_sites)
+        usleep(1000);
+    __atomic_store_n(&shared->start, now_ns() + 10000000, __ATOMIC_RELEASE);
+
+    // Wait until every site is done with its messages, and then until their
+    // digests match, giving up after a few seconds
+    for (idx = 0; idx < num_sites; idx++) {
+        while (!__atomic_load_n(&shared->sites[idx].finished, __ATOMIC_ACQUIRE))
+            usleep(1000);
+        if (shared->sites[idx].finish_ns > last)
+            last = shared->sites[idx].finish_ns;
+    }
+    while (mode != MODE_NONE && now_ns() - last < 5000000000ull) {
+        uint64_t root = __atomic_load_n(&shared->sites[0].root, __ATOMIC_ACQUIRE);
+        for (idx = 1; idx < num_sites; idx++)
+            if (__atomic_load_n(&shared->sites[idx].root, __ATOMIC_ACQUIRE) != root)
+                break;
+        if (idx == num_sites) {
+            converge = (now_ns() - last) / 1e6;
+            break;
+        }
+        usleep(200);
+    }
+    __atomic_store_n(&shared->stop, 1, __ATOMIC_RELEASE);
+    for (idx = 0; idx < num_sites; idx++) {
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    if (failed)
+        PRINT_RETURN("A site failed\n", -1);
+
+    for (idx = 0; idx < num_sites; idx++) {
+        struct site_report* rp = &shared->sites[idx];
+        accepted += rp->accepted;
+        delta += rp->delta_bytes;
+        sync += rp->sync_bytes;
+        replays += rp->replays;
+        checked += rp->checked;
+        if (rp->lag_p50 > lag_p50)
+            lag_p50 = rp->lag_p50;
+        if (rp->lag_p99 > lag_p99)
+            lag_p99 = rp->lag_p99;
+    }
+    bytes = delta + sync;
+    printf("    %-6s %8.2f%%", mode_names[mode], 100.0 * accepted / num_frames);
+    if (converge >= 0)
+        printf(" %12.1f", converge);
+    else
+        printf(" %12s", "never");
+    printf(" %10.2f %10.2f %12.2f", delta / 1e6, sync / 1e6, bytes / 1e6 / (num_fobs / 1e6));
+    if (lag_p99 > 0)
+        printf(" %11.1f %11.1f", lag_p50 / 1e3, lag_p99 / 1e3);
+    else
+        printf(" %11s %11s", "-", "-");
+    printf(" %4d/%-4d\n", replays, checked);
+    return 0;
+}
+
+
+// Run a site over its messages, gossiping with the others until the parent
+// stops it, and then replay a sample of the messages of the other sites.
+// Returns -1 if the site failed.
+int run_site(int site, int mode) {
+    struct site_report* rp = &shared->sites[site];
+    struct gossip gs;
+    const uint8_t* data[VERIFIER_BATCH];
+    uint8_t lens[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    struct pollfd pfd;
+    struct timespec ts;
+    uint64_t start, now, wake, next_flush, next_sync, flush_ns = flush_us * 1000ull, sync_ns = sync_ms * 1000000ull;
+    double spacing = 1e9 / ((double)rate * num_sites);
+    uint8_t drop[GOSSIP_DATAGRAM];
+    int idx = site_start[site], end = site_start[site+1], num, jdx, peer, stride, slot;
+    int split = (mode == MODE_SPLIT && site == 0);
+
+    if (gossip_init(&gs, &vf, site, base_port + site))
+        return -1;
+    for (peer = 0; peer < num_sites && mode != MODE_NONE; peer++)
+        if (peer != site && gossip_peer(&gs, base_port + peer))
+            return -1;
+    gs.loss = (mode == MODE_LOSSY) ? loss_pct : split ? 100 : 0;
+    gs.max_lags = MAX_LAGS;
+    if ((gs.lags = malloc(MAX_LAGS*sizeof(*gs.lags))) == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    pfd.fd = gs.fd;
+    pfd.events = POLLIN;
+
+    // Message k of all the sites arrives at start + k*spacing, so that the
+    // messages of a remote arrive in the order they were sent
+    __atomic_add_fetch(&shared->ready, 1, __ATOMIC_RELEASE);
+    while ((start = __atomic_load_n(&shared->start, __ATOMIC_ACQUIRE)) == 0)
+        usleep(100);
+    next_flush = start + flush_ns;
+    next_sync = start + sync_ns;
+    while (!__atomic_load_n(&shared->stop, __ATOMIC_ACQUIRE)) {
+        now = now_ns();
+        for (num = 0; idx < end && num < batch_size && start + order[idx]*spacing <= now; idx++, num++) {
+            data[num] = frames[order[idx]];
+            lens[num] = lengths[order[idx]];
+        }
+        if (num > 0) {
+            verifier_check_batch(&vf, data, lens, num, verdicts, slots);
+            for (jdx = 0; jdx < num; jdx++) {
+                if (verdicts[jdx] != VERDICT_ACCEPT)
+                    continue;
+                rp->accepted++;
+                gossip_note(&gs, slots[jdx], now);
+            }
+        }
+        if (idx == end && !rp->finished) {
+            gossip_flush(&gs);
+            split = gs.loss = 0;
+            rp->finish_ns = now_ns();
+            __atomic_store_n(&rp->finished, 1, __ATOMIC_RELEASE);
+        }
+
+        // Flush the deltas, handle what the peers sent, and start a round of
+        // anti-entropy when it is due
+        if (mode != MODE_NONE) {
+            if (now >= next_flush) {
+                gossip_flush(&gs);
+                next_flush = now + flush_ns;
+            }
+            if (split)
+                while (recv(gs.fd, drop, sizeof(drop), MSG_DONTWAIT) > 0)
+                    ;
+            else if (gossip_poll(&gs) < 0)
+                return -1;
+            if (now >= next_sync) {
+                gossip_flush(&gs);
+                gossip_sync(&gs);
+                next_sync = now + sync_ns;
+            }
+        } else {
+            gossip_flush(&gs);
+        }
+        __atomic_store_n(&rp->root, gossip_root(&gs), __ATOMIC_RELEASE);
+        if (num == batch_size)
+            continue;
+
+        // Sleep until the next message, flush or round, or a datagram
+        wake = now + 1000000;
+        if (idx < end && start + order[idx]*spacing < wake)
+            wake = start + order[idx]*spacing;
+        if (mode != MODE_NONE && next_flush < wake && gs.num_pending > 0)
+            wake = next_flush;
+        if (mode != MODE_NONE && next_sync < wake)
+            wake = next_sync;
+        if ((now = now_ns()) < wake) {
+            ts.tv_sec = (wake - now) / 1000000000;
+            ts.tv_nsec = (wake - now) % 1000000000;
+            ppoll(&pfd, 1, &ts, NULL);
+        }
+    }
+
+    // None of the messages that arrived at the other sites may be accepted
+    // again here
+    stride = (num_frames > 65536) ? num_frames / 65536 : 1;
+    for (jdx = 0; jdx < num_frames; jdx += stride) {
+        if (owners[jdx] == site)
+            continue;
+        rp->checked++;
+        rp->replays += (verifier_check(&vf, frames[jdx], lengths[jdx], &slot) == VERDICT_ACCEPT);
+    }
+
+    qsort(gs.lags, gs.num_lags, sizeof(*gs.lags), cmp_latency);
+    if (gs.num_lags > 0) {
+        rp->lag_p50 = percentile(gs.lags, gs.num_lags, 0.5);
+        rp->lag_p99 = percentile(gs.lags, gs.num_lags, 0.99);
+    }
+    rp->delta_bytes = gs.delta_bytes;
+    rp->sync_bytes = gs.sync_bytes;
+    free(gs.lags);
+    gossip_free(&gs);
+    return 0;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
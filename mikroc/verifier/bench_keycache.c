@@ -0,0 +1,268 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 1000000;
+int daily_pct = 5;
+int share_pct = 90;
+int batch_size = 16;
+uint32_t* serials;
+uint16_t (*seeds)[KEY_WORDS];
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint32_t* lats;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_keycache [-f fobs] [-n frames] [-d daily] [-p share]\n"
+    "                      [-b batch]\n\n"
+    "Verifies messages where a few remotes that are used every day send most\n"
+    "of them, and the rest come from a long tail, with every key expanded and\n"
+    "then with only the seed keys kept and caches of expanded keys of several\n"
+    "sizes. Reports the memory of the keystore against the share of messages\n"
+    "whose keys had to be expanded, the latency of messages verified one at a\n"
+    "time, and the rate of messages verified in batches. The rate of the key\n"
+    "schedule is reported first, one remote at a time and in batches.\n\n"
+    "    -f fobs    Number of remotes (default: 1000000)\n"
+    "    -n frames  Number of messages (default: 1000000)\n"
+    "    -d daily   Percentage of remotes used every day (default: 5)\n"
+    "    -p share   Percentage of messages from those remotes (default: 90)\n"
+    "    -b batch   Messages per batch (default: 16)\n"
+);
+
+/* The sizes of the cache, in thousandths of the fleet */
+const int cache_sizes[] = {1000, 500, 200, 100, 50, 20, 10, 5, 1};
+
+
+int run_config(int num_lines);
+int enroll(struct verifier* vf);
+double time_schedule(int batched);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    struct verifier vf;
+    uint32_t* codes;
+    int opt, idx, jdx, num_daily;
+
+    while ((opt = getopt(argc, argv, "f:n:d:p:b:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'd': daily_pct = atoi(optarg); break;
+        case 'p': share_pct = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (daily_pct < 1 || daily_pct > 100 || share_pct < 0 || share_pct > 100)
+        PRINT_RETURN(help_msg, -1);
+    if (batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+
+    serials = malloc(num_fobs*sizeof(*serials));
+    seeds = malloc(num_fobs*sizeof(*seeds));
+    codes = calloc(num_fobs, sizeof(*codes));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    lats = malloc(num_frames*sizeof(*lats));
+    if (serials == NULL || seeds == NULL || codes == NULL || frames == NULL || lengths == NULL || lats == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+
+    printf("Key schedule in ns per remote: %.0f one at a time, %.0f in batches\n",
+        time_schedule(0), time_schedule(1));
+
+    // Pick the fleet, and form the messages with every key expanded, most of
+    // them from the daily remotes
+    for (idx = 0; idx < num_fobs; idx++) {
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seeds[idx][jdx] = rand64();
+        serials[idx] = rand64() & 0xFFFFFF;
+    }
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW) || enroll(&vf))
+        return -1;
+    num_daily = (int64_t)num_fobs * daily_pct / 100;
+    if (num_daily < 1)
+        num_daily = 1;
+    for (idx = 0; idx < num_frames; idx++) {
+        int fob = (rand64() % 100 < (uint64_t)share_pct || num_daily == num_fobs) ?
+            rand64() % num_daily : num_daily + rand64() % (num_fobs - num_daily);
+        while ((lengths[idx] = verifier_frame(&vf, fob, FRAME_BLOWFISH | FRAME_MAC, ++codes[fob], frames[idx])) == 0)
+            ;
+    }
+    verifier_free(&vf);
+
+    printf("\nKeystore of %d remotes, %d messages (%d%% from %d%% of the remotes):\n",
+        num_fobs, num_frames, share_pct, daily_pct);
+    printf("    %-10s %10s %10s %10s %10s %10s %10s\n",
+        "lines", "MiB", "expanded", "p50 ns", "p99 ns", "p999 ns", "Mmsg/s");
+    if (run_config(0))
+        return -1;
+    for (idx = 0; idx < (int)(sizeof(cache_sizes)/sizeof(cache_sizes[0])); idx++) {
+        int num_lines = (int64_t)num_fobs * cache_sizes[idx] / 1000;
+        if (num_lines > KEYCACHE_BATCH && run_config(num_lines))
+            return -1;
+    }
+
+    free(serials);
+    free(seeds);
+    free(codes);
+    free(frames);
+    free(lengths);
+    free(lats);
+    return 0;
+}
+
+
+// Verify every message one at a time and then in batches, each time with a
+// fresh verifier with num_lines of cache, or every key expanded if it is 0, and
+// print a row of results. Returns -1 if a message was not accepted.
+int run_config(int num_lines) {
+    const uint8_t* data[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    struct verifier vf;
+    uint64_t misses = 0, start;
+    double bytes, secs;
+    int idx, jdx, num, slot;
+
+    // One at a time, timing each message
+    if (verifier_init_cached(&vf, num_fobs, VERIFIER_WINDOW, num_lines) || enroll(&vf))
+        return -1;
+    bytes = num_lines ? keycache_bytes(vf.cache) : (double)num_fobs * sizeof(*vf.keys);
+    for (idx = 0; idx < num_frames; idx++) {
+        start = now_ns();
+        int ret = verifier_check(&vf, frames[idx], lengths[idx], &slot);
+        lats[idx] = now_ns() - start;
+        if (ret != VERDICT_ACCEPT)
+            PRINT_RETURN("A message was not accepted\n", -1);
+    }
+    if (num_lines)
+        misses = vf.cache->misses;
+    verifier_free(&vf);
+
+    // In batches, timing the whole run
+    if (verifier_init_cached(&vf, num_fobs, VERIFIER_WINDOW, num_lines) || enroll(&vf))
+        return -1;
+    start = now_ns();
+    for (idx = 0; idx < num_frames; idx += num) {
+        num = (num_frames - idx < batch_size) ? num_frames - idx : batch_size;
+        for (jdx = 0; jdx < num; jdx++)
+            data[jdx] = frames[idx+jdx];
+        verifier_check_batch(&vf, data, lengths + idx, num, verdicts, slots);
+        for (jdx = 0; jdx < num; jdx++)
+            if (verdicts[jdx] != VERDICT_ACCEPT)
+                PRINT_RETURN("A message was not accepted\n", -1);
+    }
+    secs = (now_ns() - start) / 1e9;
+    verifier_free(&vf);
+
+    qsort(lats, num_frames, sizeof(*lats), cmp_latency);
+    if (num_lines)
+        printf("    %-10d", num_lines);
+    else
+        printf("    %-10s", "all");
+    printf(" %10.1f %9.2f%% %10u %10u %10u %10.2f\n", bytes / (1 << 20), 100.0*misses/num_frames,
+        percentile(lats, num_frames, 0.5), percentile(lats, num_frames, 0.99),
+        percentile(lats, num_frames, 0.999), num_frames/secs/1e6);
+    return 0;
+}
+
+
+// Enroll the fleet into a verifier in order, so that remote N is in slot N,
+// picking a new serial for a remote whose serial is invalid or taken. Returns
+// -1 if the verifier is full.
+int enroll(struct verifier* vf) {
+    int idx;
+
+    for (idx = 0; idx < num_fobs; idx++) {
+        while (verifier_enroll(vf, serials[idx], seeds[idx], 0) != idx) {
+            if (vf->num_fobs != idx)
+                PRINT_RETURN("Could not enroll the fleet\n", -1);
+            serials[idx] = rand64() & 0xFFFFFF;
+        }
+    }
+    return 0;
+}
+
+
+// Expand the keys of random seeds one at a time or in batches. Returns the time
+// taken per remote in nanoseconds.
+double time_schedule(int batched) {
+    enum { NUM_SEEDS = 1 << 16 };
+    static uint16_t rand_seeds[NUM_SEEDS][KEY_WORDS];
+    static struct fob_keys keys[KEYCACHE_BATCH];
+    struct fob_keys* each[KEYCACHE_BATCH];
+    const uint16_t* in[KEYCACHE_BATCH];
+    uint64_t start;
+    int idx, jdx;
+
+    for (idx = 0; idx < NUM_SEEDS; idx++)
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            rand_seeds[idx][jdx] = rand64();
+    start = now_ns();
+    for (idx = 0; idx < NUM_SEEDS; idx += KEYCACHE_BATCH) {
+        for (jdx = 0; jdx < KEYCACHE_BATCH; jdx++) {
+            each[jdx] = &keys[jdx];
+            in[jdx] = rand_seeds[idx+jdx];
+            if (!batched)
+                fob_keys_init(each[jdx], in[jdx]);
+        }
+        if (batched)
+            fob_keys_init_each(each, in, KEYCACHE_BATCH);
+    }
+    return (double)(now_ns() - start) / NUM_SEEDS;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
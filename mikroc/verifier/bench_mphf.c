@@ -0,0 +1,180 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+
+/* Global variables */
+int num_fobs = 10000000;
+int added_pct = 1;
+int num_lookups = 10000000;
+uint64_t rng_state = 1;
+struct verifier vf;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_mphf [-f fobs] [-a added] [-n lookups]\n\n"
+    "Enrolls a fleet into a verifier and looks up serial numbers through the\n"
+    "index of open addressing. The perfect hash is then built over the fleet,\n"
+    "a few more remotes are enrolled into the index, and the lookups are\n"
+    "repeated. Reports the time to build the hash, the bits per remote of\n"
+    "each, and the time per lookup of remotes in each and of unknown ones.\n\n"
+    "    -f fobs     Number of remotes (default: 10000000)\n"
+    "    -a added    Percentage of remotes enrolled after the build (default: 1)\n"
+    "    -n lookups  Number of lookups per measurement (default: 10000000)\n"
+);
+
+
+int enroll(int num, uint32_t* serials);
+double time_lookups(const uint32_t* serials, int num, int* found);
+double now();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    uint32_t *serials, *queries, *unknown;
+    int opt, idx, num_added, found;
+    double secs, build;
+    struct mphf mp;
+
+    while ((opt = getopt(argc, argv, "f:a:n:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'a': added_pct = atoi(optarg); break;
+        case 'n': num_lookups = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || added_pct < 0 || num_lookups < 1)
+        PRINT_RETURN(help_msg, -1);
+    num_added = (int64_t)num_fobs * added_pct / 100;
+    if (num_fobs + num_added > (1 << 24) / 4*3)
+        PRINT_RETURN(help_msg, -1);
+
+    serials = malloc((num_fobs + num_added)*sizeof(*serials));
+    queries = malloc(num_lookups*sizeof(*queries));
+    unknown = malloc(num_lookups*sizeof(*unknown));
+    if (serials == NULL || queries == NULL || unknown == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (verifier_init(&vf, num_fobs + num_added, VERIFIER_WINDOW))
+        return -1;
+    secs = now();
+    enroll(num_fobs, serials);
+    printf("Enrolled %d remotes in %.2f s\n", num_fobs, now() - secs);
+
+    // Look up the remotes at random, and serials that are not enrolled
+    for (idx = 0; idx < num_lookups; idx++) {
+        queries[idx] = serials[rand64() % num_fobs];
+        do {
+            unknown[idx] = rand64() & 0xFFFFFF;
+        } while (verifier_find(&vf, unknown[idx]) >= 0 || !frame_serial_valid(unknown[idx]));
+    }
+    printf("\nTime per lookup in ns, and size of the index in bits per remote:\n");
+    printf("    %-22s %10s %10s %10s\n", "index", "enrolled", "unknown", "bits");
+    secs = time_lookups(queries, num_lookups, &found);
+    if (found != num_lookups)
+        PRINT_RETURN("An enrolled remote was not found\n", -1);
+    printf("    %-22s %10.1f %10.1f %10.1f\n", "open addressing", secs*1e9/num_lookups,
+        time_lookups(unknown, num_lookups, &found)*1e9/num_lookups,
+        (double)(vf.index_mask+1) * 32 / vf.num_fobs);
+
+    // Build the hash alone, then rebuild the verifier over it
+    secs = now();
+    if (mphf_build(&mp, serials, num_fobs))
+        return -1;
+    build = now() - secs;
+    mphf_free(&mp);
+    secs = now();
+    if (verifier_rebuild(&vf))
+        return -1;
+    secs = now() - secs;
+
+    // Enroll more remotes into the index, and check that every remote is found
+    enroll(num_added, serials + num_fobs);
+    for (idx = 0; idx < num_fobs + num_added; idx++)
+        if (verifier_find(&vf, serials[idx]) < 0 || vf.serials[verifier_find(&vf, serials[idx])] != serials[idx])
+            PRINT_RETURN("A remote was lost by the rebuild\n", -1);
+    for (idx = 0; idx < num_lookups; idx++)
+        if (verifier_find(&vf, unknown[idx]) >= 0)
+            unknown[idx] = serials[0] ^ 1;
+    printf("    %-22s %10.1f %10.1f %10.1f\n", "perfect hash", time_lookups(queries, num_lookups, &found)*1e9/num_lookups,
+        time_lookups(unknown, num_lookups, &found)*1e9/num_lookups,
+        (double)(mphf_bits(&vf.perfect) + (uint64_t)(vf.index_mask+1) * 32) / (num_fobs + num_added));
+    if (num_added > 0) {
+        for (idx = 0; idx < num_lookups; idx++)
+            queries[idx] = serials[num_fobs + rand64() % num_added];
+        printf("    %-22s %10.1f %10s %10s\n", "perfect hash, added", time_lookups(queries, num_lookups, &found)*1e9/num_lookups, "-", "-");
+    }
+
+    printf("\nBuilt the perfect hash over %d remotes in %.2f s, and moved the remotes\n"
+        "into their slots in %.2f s in all. It takes %.2f bits per remote, with\n"
+        "pilots of %d bits, and the index of the %d added remotes %.2f more.\n",
+        num_fobs, build, secs, (double)mphf_bits(&vf.perfect) / num_fobs, vf.perfect.width,
+        num_added, (double)(vf.index_mask+1) * 32 / (num_fobs + num_added));
+
+    verifier_free(&vf);
+    free(serials);
+    free(queries);
+    free(unknown);
+    return 0;
+}
+
+
+// Enroll num remotes with random serials and seeds, storing their serials.
+// Returns the number of remotes.
+int enroll(int num, uint32_t* serials) {
+    uint16_t seed[KEY_WORDS];
+    int idx, jdx;
+
+    for (idx = 0; idx < num; idx++) {
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand64();
+        do {
+            serials[idx] = rand64() & 0xFFFFFF;
+        } while (verifier_enroll(&vf, serials[idx], seed, 0) < 0);
+    }
+    return num;
+}
+
+
+// Look up serial numbers, storing how many were found. Returns the time taken
+// in seconds.
+double time_lookups(const uint32_t* serials, int num, int* found) {
+    int idx;
+
+    *found = 0;
+    double start = now();
+    for (idx = 0; idx < num; idx++)
+        *found += (verifier_find(&vf, serials[idx]) >= 0);
+    return now() - start;
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,205 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "stream.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of receivers to interleave */
+#define MAX_STREAMS 1024
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_streams = 64;
+int cipher_ver = FRAME_BLOWFISH;
+struct verifier vf;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint32_t* tx_codes;
+uint32_t* latencies;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_prefetch [-f fobs] [-r receivers] [-s]\n\n"
+    "Measures the latency of accepting a message from a remote whose state is\n"
+    "not in the cache, with and without loading that state speculatively while\n"
+    "the message is arriving. The bytes from a number of receivers are\n"
+    "interleaved, as a host that serves many doors sees them, and every remote\n"
+    "sends one message in a random order. The latency is from the last byte of\n"
+    "a message until its verdict. Lookahead tables are measured after every\n"
+    "remote has been seen often enough to have one.\n\n"
+    "    -f fobs       Number of remotes (default: 1000000)\n"
+    "    -r receivers  Number of interleaved receivers (default: 64)\n"
+    "    -s            Encrypt the rolling codes with Speck32/64\n"
+);
+
+
+void make_round();
+double run_streams(struct lookahead* la, int speculate);
+int cmp_latency(const void* a, const void* b);
+uint32_t rand32();
+double now();
+
+
+int main(int argc, char* argv[]) {
+    struct lookahead la;
+    int opt, idx, jdx, slot;
+
+    while ((opt = getopt(argc, argv, "f:r:sh")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'r': num_streams = atoi(optarg); break;
+        case 's': cipher_ver = FRAME_SPECK; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_streams < 1 || num_streams > MAX_STREAMS)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet
+    srand(1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        while (verifier_enroll(&vf, rand32() & 0xFFFFFF, seed, 0) < 0)
+            ;
+    }
+    tx_codes = calloc(num_fobs, sizeof(*tx_codes));
+    frames = malloc(num_fobs*sizeof(*frames));
+    lengths = malloc(num_fobs);
+    latencies = malloc(num_fobs*sizeof(*latencies));
+    if (tx_codes == NULL || frames == NULL || lengths == NULL || latencies == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+
+    printf("Accept latency of cold remotes (%s, %d remotes, %d receivers):\n",
+        ciphers[cipher_ver].name, num_fobs, num_streams);
+    printf("    %-10s %-11s %10s %10s %10s\n", "check", "speculate", "mean ns", "p99 ns", "Mframes/s");
+
+    // Measure the verifier on the next message of every remote
+    for (jdx = 0; jdx < 2; jdx++) {
+        make_round();
+        run_streams(NULL, jdx);
+    }
+
+    // Give every remote a lookahead table and measure the following messages
+    if (lookahead_init(&la, &vf, LOOKAHEAD_MIN, LOOKAHEAD_MAX))
+        return -1;
+    for (idx = 0; idx < LOOKAHEAD_SEEN; idx++) {
+        make_round();
+        for (jdx = 0; jdx < num_fobs; jdx++)
+            lookahead_check(&la, frames[jdx], lengths[jdx], &slot);
+    }
+    for (jdx = 0; jdx < 2; jdx++) {
+        make_round();
+        run_streams(&la, jdx);
+    }
+
+    lookahead_free(&la);
+    verifier_free(&vf);
+    free(tx_codes);
+    free(frames);
+    free(lengths);
+    free(latencies);
+    return 0;
+}
+
+
+// Generate the next message of every remote in a random order.
+void make_round() {
+    int idx;
+
+    for (idx = 0; idx < num_fobs; idx++) {
+        int slot = idx;
+        uint8_t ver = cipher_ver | FRAME_MAC;
+        while ((lengths[idx] = verifier_frame(&vf, slot, ver, ++tx_codes[slot], frames[idx])) == 0)
+            ;
+    }
+    for (idx = num_fobs-1; idx > 0; idx--) {
+        int jdx = rand32() % (idx+1);
+        uint8_t tmp[FRAME_MAX], len = lengths[idx];
+        memcpy(tmp, frames[idx], FRAME_MAX);
+        memcpy(frames[idx], frames[jdx], FRAME_MAX);
+        memcpy(frames[jdx], tmp, FRAME_MAX);
+        lengths[idx] = lengths[jdx];
+        lengths[jdx] = len;
+    }
+}
+
+
+// Feed the messages to the receivers a byte at a time in turn, where the
+// receivers take every num_streams-th message. Prints the latencies and returns
+// the throughput in Mframes/s.
+double run_streams(struct lookahead* la, int speculate) {
+    struct stream streams[MAX_STREAMS];
+    int pos[MAX_STREAMS]; // The next byte of each receiver, including the marker
+    int idx, done = 0, num = 0, slot;
+    double total = 0;
+
+    for (idx = 0; idx < num_streams; idx++) {
+        stream_init(&streams[idx], &vf, la, speculate);
+        pos[idx] = 0;
+    }
+    double start = now();
+    while (done < num_streams) {
+        done = 0;
+        for (idx = 0; idx < num_streams; idx++) {
+            int frm = idx + (pos[idx] / (FRAME_MAX+1)) * num_streams;
+            int off = pos[idx] % (FRAME_MAX+1);
+            if (frm >= num_fobs) {
+                done++;
+                continue;
+            }
+            pos[idx] += (off == lengths[frm]) ? FRAME_MAX+1 - off : 1;
+            if (stream_feed(&streams[idx], off ? frames[frm][off-1] : FRAME_MARK) == 0)
+                continue;
+
+            // Time the check of the message that was just completed
+            double begin = now();
+            stream_check(&streams[idx], &slot);
+            latencies[num] = (now() - begin) * 1e9;
+            total += latencies[num++];
+        }
+    }
+    double secs = now() - start;
+
+    qsort(latencies, num, sizeof(*latencies), cmp_latency);
+    printf("    %-10s %-11s %10.1f %10u %10.2f\n", la ? "lookahead" : "decrypt",
+        speculate ? "yes" : "no", total / num, latencies[num*99/100], num / secs / 1e6);
+    return num / secs / 1e6;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a random 32-bit number.
+uint32_t rand32() {
+    return (uint32_t)rand() << 16 ^ rand();
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,309 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "reload.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of verifier threads */
+#define MAX_THREADS 16
+
+
+/* A verifier thread with messages from its share of the stable remotes */
+struct worker {
+    pthread_t thread;
+    int id;
+    int reader;
+    uint8_t (*frames)[FRAME_MAX];
+    uint8_t* lengths;
+    uint32_t* lats;   // The latency of every batch
+    uint64_t* ends;   // The time that every batch ended
+    int num_batches;
+    int done;         // Messages verified so far
+    int failed;
+};
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 8000000;
+int change_pct = 1;
+int num_threads = 1;
+int batch_size = 16;
+int reload_nice = 19;
+struct reload_entry* entries;
+struct reload rl;
+struct worker workers[MAX_THREADS];
+uint8_t rotated_msg[FRAME_MAX], revoked_msg[FRAME_MAX];
+int rotated_len, revoked_len;
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_reload [-f fobs] [-n frames] [-c change] [-t threads]\n"
+    "                    [-b batch] [-p nice]\n\n"
+    "Loads a keystore of remotes, and then reloads it while verifier threads\n"
+    "verify messages in batches from the remotes that stay, with a share of\n"
+    "the remotes revoked, as many given new keys and as many added, and the\n"
+    "replay width changed. The reload runs at a lower priority, as the daemon\n"
+    "would run it. Reports how long the build took until the new generation\n"
+    "was published and the grace period until the last one was freed, and the\n"
+    "latency of the batches that ended during the reload against the others.\n"
+    "The new generation is then checked against messages from remotes that\n"
+    "were added, revoked and given new keys.\n\n"
+    "    -f fobs     Number of remotes (default: 1000000)\n"
+    "    -n frames   Number of messages per thread (default: 8000000)\n"
+    "    -c change   Percentage of remotes revoked, rotated and added (default: 1)\n"
+    "    -t threads  Number of verifier threads (default: 1)\n"
+    "    -b batch    Messages per batch (default: 16)\n"
+    "    -p nice     Nice value of the reload (default: 19)\n"
+);
+
+
+int check_changes(int num_changed);
+void* run_worker(void* arg);
+void print_latencies(const char* name, uint64_t from, uint64_t to, int inside);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    struct reload_policy policy = {VERIFIER_WINDOW, VERIFIER_REPLAY};
+    uint32_t* codes;
+    uint8_t* used;
+    uint64_t start, end;
+    int opt, idx, jdx, num_changed, num_stable;
+
+    while ((opt = getopt(argc, argv, "f:n:c:t:b:p:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'c': change_pct = atoi(optarg); break;
+        case 't': num_threads = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        case 'p': reload_nice = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    num_changed = (int64_t)num_fobs * change_pct / 100;
+    num_stable = num_fobs - 2*num_changed;
+    if (optind != argc || num_fobs < 1 || num_fobs + num_changed > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (change_pct < 0 || num_stable < num_threads || num_threads < 1 || num_threads > MAX_THREADS)
+        PRINT_RETURN(help_msg, -1);
+    if (batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+
+    // Pick the fleet and the remotes to add, with distinct valid serials
+    entries = malloc((num_fobs + num_changed)*sizeof(*entries));
+    used = calloc(1 << 24, 1);
+    if (entries == NULL || used == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < num_fobs + num_changed; idx++) {
+        do {
+            entries[idx].serial = rand64() & 0xFFFFFF;
+        } while (used[entries[idx].serial] || !frame_serial_valid(entries[idx].serial));
+        used[entries[idx].serial] = 1;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            entries[idx].seed[jdx] = rand64();
+        entries[idx].code = 0;
+    }
+    free(used);
+
+    // Load the fleet into an empty keystore
+    if (reload_init(&rl, num_fobs + num_changed, &policy))
+        return -1;
+    if (reload_apply(&rl, entries, num_fobs, &policy))
+        return -1;
+    printf("Loading %d remotes into an empty keystore took %.1f ms to publish and %.1f ms to free\n\n",
+        num_fobs, rl.build_ns / 1e6, rl.grace_ns / 1e6);
+
+    // Form the messages of every thread from its share of the stable remotes
+    codes = calloc(num_fobs, sizeof(*codes));
+    if (codes == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < num_threads; idx++) {
+        struct worker* wk = &workers[idx];
+        int per = num_stable / num_threads;
+        wk->id = idx;
+        wk->frames = malloc(num_frames*sizeof(*wk->frames));
+        wk->lengths = malloc(num_frames);
+        wk->lats = malloc((num_frames / batch_size + 1)*sizeof(*wk->lats));
+        wk->ends = malloc((num_frames / batch_size + 1)*sizeof(*wk->ends));
+        if (wk->frames == NULL || wk->lengths == NULL || wk->lats == NULL || wk->ends == NULL)
+            PRINT_RETURN("Out of memory\n", -1);
+        for (jdx = 0; jdx < num_frames; jdx++) {
+            int fob = idx*per + rand64() % per;
+            int slot = verifier_find(reload_current(&rl), entries[fob].serial);
+            while ((wk->lengths[jdx] = verifier_frame(reload_current(&rl), slot, FRAME_BLOWFISH | FRAME_MAC, ++codes[fob], wk->frames[jdx])) == 0)
+                ;
+        }
+    }
+    free(codes);
+    if (num_changed > 0) {
+        struct verifier* vf = reload_current(&rl);
+        rotated_len = verifier_frame(vf, verifier_find(vf, entries[num_stable].serial), FRAME_BLOWFISH | FRAME_MAC, 7, rotated_msg);
+        revoked_len = verifier_frame(vf, verifier_find(vf, entries[num_fobs-1].serial), FRAME_BLOWFISH | FRAME_MAC, 7, revoked_msg);
+    }
+
+    // Revoke the last remotes, give the ones before them new keys, and add
+    // as many, and narrow the replay width
+    for (idx = num_stable; idx < num_stable + num_changed; idx++)
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            entries[idx].seed[jdx] = rand64();
+    memcpy(&entries[num_stable + num_changed], &entries[num_fobs], num_changed*sizeof(*entries));
+    policy.replay = VERIFIER_REPLAY / 2;
+
+    // Reload while the threads verify, once they are well under way
+    for (idx = 0; idx < num_threads; idx++) {
+        workers[idx].reader = rcu_register(&rl.rcu);
+        pthread_create(&workers[idx].thread, NULL, run_worker, &workers[idx]);
+    }
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), reload_nice);
+    while (__atomic_load_n(&workers[0].done, __ATOMIC_RELAXED) < num_frames / 4)
+        usleep(1000);
+    start = reload_clock();
+    if (reload_apply(&rl, entries, num_fobs, &policy))
+        return -1;
+    end = reload_clock();
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 0);
+    for (idx = 0; idx < num_threads; idx++) {
+        pthread_join(workers[idx].thread, NULL);
+        if (workers[idx].failed)
+            PRINT_RETURN("A message was not accepted\n", -1);
+    }
+
+    printf("Reloading %d remotes with %d revoked, %d rotated and %d added while %d threads verify:\n",
+        num_fobs, rl.num_revoked, rl.num_rotated, rl.num_added, num_threads);
+    printf("    %.1f ms to publish, %.1f ms to free the last generation\n\n", rl.build_ns / 1e6, rl.grace_ns / 1e6);
+    printf("Latency of batches of %d messages:\n", batch_size);
+    printf("    %-16s %10s %10s %10s %10s %10s\n", "batches", "count", "p50 ns", "p99 ns", "p999 ns", "max ns");
+    print_latencies("during reload", start, end, 1);
+    print_latencies("otherwise", start, end, 0);
+    if (check_changes(num_changed))
+        return -1;
+
+    for (idx = 0; idx < num_threads; idx++) {
+        free(workers[idx].frames);
+        free(workers[idx].lengths);
+        free(workers[idx].lats);
+        free(workers[idx].ends);
+    }
+    reload_free(&rl);
+    free(entries);
+    return 0;
+}
+
+
+// Check that the new generation accepts a remote that was added, and rejects
+// the messages formed before the reload by a remote that was revoked and one
+// that was given new keys. Returns -1 if it does not.
+int check_changes(int num_changed) {
+    struct verifier* vf = reload_current(&rl);
+    uint8_t data[FRAME_MAX];
+    int len, slot;
+
+    if (num_changed == 0)
+        return 0;
+    slot = verifier_find(vf, entries[num_fobs-1].serial);
+    if (slot < 0 || (len = verifier_frame(vf, slot, FRAME_BLOWFISH | FRAME_MAC, 1, data)) == 0 ||
+        verifier_check(vf, data, len, &slot) != VERDICT_ACCEPT)
+        PRINT_RETURN("An added remote was not accepted\n", -1);
+    if (revoked_len > 0 && verifier_check(vf, revoked_msg, revoked_len, &slot) != VERDICT_UNKNOWN)
+        PRINT_RETURN("A revoked remote was not rejected\n", -1);
+    if (rotated_len > 0 && verifier_check(vf, rotated_msg, rotated_len, &slot) != VERDICT_FORGED)
+        PRINT_RETURN("A rotated remote was accepted with its old keys\n", -1);
+    printf("\nThe added, revoked and rotated remotes were verified as expected\n");
+    return 0;
+}
+
+
+// Verify the messages of a worker in batches, announcing a quiescent state
+// after each, and record the latency of every batch.
+void* run_worker(void* arg) {
+    struct worker* wk = arg;
+    const uint8_t* data[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    uint64_t start, end;
+    int idx, jdx, num;
+
+    for (idx = 0; idx < num_frames; idx += num) {
+        num = (num_frames - idx < batch_size) ? num_frames - idx : batch_size;
+        for (jdx = 0; jdx < num; jdx++)
+            data[jdx] = wk->frames[idx+jdx];
+        start = reload_clock();
+        verifier_check_batch(reload_current(&rl), data, wk->lengths + idx, num, verdicts, slots);
+        rcu_quiescent(&rl.rcu, wk->reader);
+        end = reload_clock();
+        wk->lats[wk->num_batches] = end - start;
+        wk->ends[wk->num_batches++] = end;
+        for (jdx = 0; jdx < num; jdx++)
+            wk->failed |= (verdicts[jdx] != VERDICT_ACCEPT);
+        __atomic_store_n(&wk->done, idx + num, __ATOMIC_RELAXED);
+    }
+    rcu_offline(&rl.rcu, wk->reader);
+    return NULL;
+}
+
+
+// Print the percentiles of the batches that ended inside or outside of a
+// span of time.
+void print_latencies(const char* name, uint64_t from, uint64_t to, int inside) {
+    uint32_t* lats = NULL;
+    int idx, jdx, num = 0;
+
+    for (idx = 0; idx < num_threads; idx++)
+        num += workers[idx].num_batches;
+    if ((lats = malloc((num + 1)*sizeof(*lats))) == NULL)
+        return;
+    for (num = 0, idx = 0; idx < num_threads; idx++)
+        for (jdx = 0; jdx < workers[idx].num_batches; jdx++)
+            if ((workers[idx].ends[jdx] >= from && workers[idx].ends[jdx] <= to) == inside)
+                lats[num++] = workers[idx].lats[jdx];
+    if (num == 0) {
+        printf("    %-16s %10d %10s %10s %10s %10s\n", name, 0, "-", "-", "-", "-");
+    } else {
+        qsort(lats, num, sizeof(*lats), cmp_latency);
+        printf("    %-16s %10d %10u %10u %10u %10u\n", name, num, percentile(lats, num, 0.5),
+            percentile(lats, num, 0.99), percentile(lats, num, 0.999), lats[num-1]);
+    }
+    free(lats);
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
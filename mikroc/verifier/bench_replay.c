@@ -0,0 +1,259 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of threads to measure */
+#define MAX_THREADS 64
+
+
+/* A worker verifying either a whole stream or its share of a shared one */
+struct worker {
+    pthread_t thread;
+    const uint32_t* order; // The order in which this worker hears the messages
+    int shared;            // Take the messages from the shared cursor
+    uint64_t verdicts[NUM_VERDICTS];
+};
+
+
+/* Global variables */
+int num_fobs = 4096;
+int num_frames = 1000000;
+int max_threads = 8;
+int depth = 64;
+int cipher_ver = FRAME_BLOWFISH;
+struct verifier vf;
+struct fob_state* init_states;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint32_t* orders[MAX_THREADS];
+uint32_t* accepts;
+uint32_t cursor;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_replay [-f fobs] [-n frames] [-t threads] [-d depth] [-s]\n\n"
+    "Measures the anti-replay window of the verifier on MAC messages that are\n"
+    "reordered by up to depth positions. The strict window of process_load()\n"
+    "is compared against the bitmap of recently accepted codes. The lock-free\n"
+    "update is then measured with threads that each hear every message, as if\n"
+    "from several receivers, and with threads that each take a share of one\n"
+    "stream, as in a pipeline. No message may be accepted twice, while the\n"
+    "messages that were never accepted are reported, since a thread that is\n"
+    "descheduled while holding a message can delay it past the bitmap.\n\n"
+    "    -f fobs     Number of remotes (default: 4096)\n"
+    "    -n frames   Number of messages per measurement (default: 1000000)\n"
+    "    -t threads  Largest number of threads (default: 8)\n"
+    "    -d depth    Largest reordering of a message (default: 64)\n"
+    "    -s          Encrypt the rolling codes with Speck32/64\n"
+);
+
+
+int make_order(uint32_t* order);
+int cmp_keys(const void* a, const void* b);
+double run_workers(int num, int receivers, uint64_t* verdicts);
+void* run_worker(void* arg);
+int check_accepts(int* missed);
+double now();
+
+
+int main(int argc, char* argv[]) {
+    uint32_t* tx_codes;
+    uint64_t verdicts[NUM_VERDICTS];
+    int opt, idx, num, receivers;
+
+    while ((opt = getopt(argc, argv, "f:n:t:d:sh")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 't': max_threads = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 's': cipher_ver = FRAME_SPECK; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_frames < 1 || depth < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (max_threads < 1 || max_threads > MAX_THREADS)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet and record the messages in the order they were sent
+    srand(1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        int jdx;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        while (verifier_enroll(&vf, ((uint32_t)rand() << 8 ^ rand()) & 0xFFFFFF, seed, 0) < 0)
+            ;
+    }
+    init_states = malloc(num_fobs*sizeof(*init_states));
+    tx_codes = calloc(num_fobs, sizeof(*tx_codes));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    accepts = malloc(num_frames*sizeof(*accepts));
+    if (init_states == NULL || tx_codes == NULL || frames == NULL || lengths == NULL || accepts == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < max_threads; idx++)
+        if ((orders[idx] = malloc(num_frames*sizeof(*orders[idx]))) == NULL)
+            PRINT_RETURN("Out of memory\n", -1);
+    memcpy(init_states, vf.states, num_fobs*sizeof(*init_states));
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand() % num_fobs;
+        uint8_t ver = cipher_ver | FRAME_MAC;
+        while ((lengths[idx] = verifier_frame(&vf, slot, ver, ++tx_codes[slot], frames[idx])) == 0)
+            ;
+    }
+    for (idx = 0; idx < max_threads; idx++)
+        make_order(orders[idx]);
+
+    printf("Accepted in order of arrival (%s, %d remotes, depth %d):\n",
+        ciphers[cipher_ver].name, num_fobs, depth);
+    for (idx = 0; idx < 2; idx++) {
+        vf.replay = idx ? VERIFIER_REPLAY : 0;
+        run_workers(1, 1, verdicts);
+        printf("    %-7s %6.2f%%  ( accept=%lu window=%lu replay=%lu )\n",
+            idx ? "bitmap" : "strict", 100.0*verdicts[VERDICT_ACCEPT]/num_frames,
+            (unsigned long)verdicts[VERDICT_ACCEPT], (unsigned long)verdicts[VERDICT_WINDOW],
+            (unsigned long)verdicts[VERDICT_REPLAY]);
+    }
+
+    printf("\nThroughput in Mframes/s (%ld cores):\n", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("    %-8s %12s %8s %12s %8s\n", "threads", "receivers", "missed", "pipeline", "missed");
+    vf.replay = VERIFIER_REPLAY;
+    for (num = 1; num <= max_threads; num *= 2) {
+        double rates[2];
+        int missed[2];
+        for (receivers = 1; receivers >= 0; receivers--) {
+            double secs = run_workers(num, receivers, verdicts);
+            rates[!receivers] = (receivers ? num : 1) * (double)num_frames / secs / 1e6;
+            if (check_accepts(&missed[!receivers]))
+                PRINT_RETURN("Messages were accepted more than once\n", -1);
+        }
+        printf("    %-8d %12.2f %8d %12.2f %8d\n", num, rates[0], missed[0], rates[1], missed[1]);
+    }
+
+    verifier_free(&vf);
+    for (idx = 0; idx < max_threads; idx++)
+        free(orders[idx]);
+    free(init_states);
+    free(tx_codes);
+    free(frames);
+    free(lengths);
+    free(accepts);
+    return 0;
+}
+
+
+// Generate an order of arrival where every message is delayed by a random
+// number of positions below depth. Returns the number of messages.
+int make_order(uint32_t* order) {
+    uint64_t* keys = malloc(num_frames*sizeof(*keys));
+    int idx;
+
+    // Sort the messages by their delayed arrival, keeping the index as a tie
+    // breaker in the lower bits
+    for (idx = 0; idx < num_frames; idx++)
+        keys[idx] = (uint64_t)(idx + rand() % depth) << 32 | idx;
+    qsort(keys, num_frames, sizeof(*keys), cmp_keys);
+    for (idx = 0; idx < num_frames; idx++)
+        order[idx] = keys[idx];
+    free(keys);
+    return num_frames;
+}
+
+
+// Compare two sort keys for qsort().
+int cmp_keys(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Verify the messages from the initial channel store with a number of threads.
+// As receivers, every thread hears every message in its own order. Otherwise,
+// the threads take the next message of the first receiver in turn, so that
+// messages only get reordered by the threads racing each other.
+// Returns the time taken in seconds.
+double run_workers(int num, int receivers, uint64_t* verdicts) {
+    struct worker workers[MAX_THREADS];
+    int idx, jdx;
+
+    memcpy(vf.states, init_states, num_fobs*sizeof(*init_states));
+    memset(accepts, 0, num_frames*sizeof(*accepts));
+    memset(verdicts, 0, NUM_VERDICTS*sizeof(*verdicts));
+    cursor = 0;
+    double start = now();
+    for (idx = 0; idx < num; idx++) {
+        workers[idx].order = orders[receivers ? idx : 0];
+        workers[idx].shared = !receivers;
+        pthread_create(&workers[idx].thread, NULL, run_worker, &workers[idx]);
+    }
+    for (idx = 0; idx < num; idx++)
+        pthread_join(workers[idx].thread, NULL);
+    double secs = now() - start;
+    for (idx = 0; idx < num; idx++)
+        for (jdx = 0; jdx < NUM_VERDICTS; jdx++)
+            verdicts[jdx] += workers[idx].verdicts[jdx];
+    return secs;
+}
+
+
+// Verify the share of messages of a worker, counting the acceptances of every
+// message.
+void* run_worker(void* arg) {
+    struct worker* wk = arg;
+    uint32_t idx, pos;
+    int slot, ret;
+
+    memset(wk->verdicts, 0, sizeof(wk->verdicts));
+    for (idx = 0; idx < (uint32_t)num_frames; idx++) {
+        if (wk->shared && (idx = __atomic_fetch_add(&cursor, 1, __ATOMIC_RELAXED)) >= (uint32_t)num_frames)
+            break;
+        pos = wk->order[idx];
+        ret = verifier_check(&vf, frames[pos], lengths[pos], &slot);
+        if (ret == VERDICT_ACCEPT)
+            __atomic_fetch_add(&accepts[pos], 1, __ATOMIC_RELAXED);
+        wk->verdicts[ret]++;
+    }
+    return NULL;
+}
+
+
+// Check that no message was accepted more than once, and count the messages
+// that were never accepted into missed. Returns -1 if a message was replayed.
+int check_accepts(int* missed) {
+    int idx;
+
+    *missed = 0;
+    for (idx = 0; idx < num_frames; idx++) {
+        if (accepts[idx] > 1)
+            return -1;
+        *missed += (accepts[idx] == 0);
+    }
+    return 0;
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,294 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of reader threads */
+#define MAX_READERS 16
+
+
+/* A thread that looks up enrolled remotes while the index grows */
+struct reader {
+    pthread_t thread;
+    int id;
+    uint64_t lookups;
+    uint64_t missing;
+};
+
+
+/* Global variables */
+int start_fobs = 2500000;
+int final_fobs = 5000000;
+int num_frames = 1000000;
+int num_readers = 0;
+int frame_rate = 100000;
+uint32_t* serials;
+uint32_t* codes;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint32_t *verify_lats, *enroll_lats;
+struct fob_keys keys;
+struct verifier vf;
+struct epoch ep;
+struct reader readers[MAX_READERS];
+int num_enrolled;
+int stopping;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_resize [-s start] [-f final] [-n frames] [-r rate] [-t readers]\n\n"
+    "Enrolls a fleet into a verifier whose index grows as needed, and then\n"
+    "enrolls as many remotes again while messages from random enrolled remotes\n"
+    "arrive at a steady rate, and verifies both on one thread as the event loop\n"
+    "of a daemon would. The index is grown once with a rehash that stops the\n"
+    "thread and once by moving a few buckets on every write. Reports the latency\n"
+    "of a message from its arrival to its verdict, which includes waiting\n"
+    "behind the enrollments, and the longest enrollment. Reader threads may\n"
+    "look up remotes all along, which checks that none of them is ever missed.\n\n"
+    "    -s start    Number of remotes enrolled first (default: 2500000)\n"
+    "    -f final    Number of remotes in the end (default: 5000000)\n"
+    "    -n frames   Number of messages (default: 1000000)\n"
+    "    -r rate     Messages per second (default: 100000)\n"
+    "    -t readers  Number of reader threads (default: 0)\n"
+);
+
+
+int run_resize(int step);
+int enroll(int fob);
+int make_frame(uint32_t serial, uint32_t code, uint8_t* data);
+int enrolled_by(int frame);
+void* run_reader(void* arg);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+uint64_t now_ns();
+uint64_t rand64(uint64_t* state);
+
+
+int main(int argc, char* argv[]) {
+    uint16_t seed[KEY_WORDS];
+    uint64_t rng_state = 1;
+    uint8_t* taken;
+    int opt, idx;
+
+    while ((opt = getopt(argc, argv, "s:f:n:r:t:h")) != -1) {
+        switch (opt) {
+        case 's': start_fobs = atoi(optarg); break;
+        case 'f': final_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'r': frame_rate = atoi(optarg); break;
+        case 't': num_readers = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || start_fobs < 1 || final_fobs < start_fobs || final_fobs > (1 << 24) / 4*3)
+        PRINT_RETURN(help_msg, -1);
+    if (num_frames < 1 || frame_rate < 1 || num_readers < 0 || num_readers > MAX_READERS)
+        PRINT_RETURN(help_msg, -1);
+
+    // Pick distinct valid serials, and share one key between every remote
+    // since expanding one for each would take longer than the resize
+    serials = malloc(final_fobs*sizeof(*serials));
+    codes = malloc(final_fobs*sizeof(*codes));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    verify_lats = malloc(num_frames*sizeof(*verify_lats));
+    enroll_lats = malloc((final_fobs - start_fobs + 1)*sizeof(*enroll_lats));
+    taken = calloc(1 << 24, 1);
+    if (serials == NULL || codes == NULL || verify_lats == NULL || enroll_lats == NULL || taken == NULL ||
+        frames == NULL || lengths == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < final_fobs; idx++) {
+        do {
+            serials[idx] = rand64(&rng_state) & 0xFFFFFF;
+        } while (taken[serials[idx]] || !frame_serial_valid(serials[idx]));
+        taken[serials[idx]] = 1;
+    }
+    free(taken);
+    for (idx = 0; idx < KEY_WORDS; idx++)
+        seed[idx] = rand64(&rng_state);
+    fob_keys_init(&keys, seed);
+
+    // Form the messages ahead, each from a remote enrolled by the time it
+    // arrives
+    memset(codes, 0, final_fobs*sizeof(*codes));
+    for (idx = 0; idx < num_frames; idx++) {
+        int fob = rand64(&rng_state) % enrolled_by(idx);
+        while ((lengths[idx] = make_frame(serials[fob], ++codes[fob], frames[idx])) == 0)
+            ;
+    }
+
+    printf("Growing a verifier of %d remotes to %d while verifying %d messages at %d/s:\n",
+        start_fobs, final_fobs, num_frames, frame_rate);
+    printf("    %-12s %10s %10s %10s %10s %10s %10s\n", "resize", "p50 ns", "p99 ns",
+        "p999 ns", "max ns", "enroll max", "missed");
+    if (run_resize(0) || run_resize(TABLE_STEP))
+        return -1;
+
+    free(serials);
+    free(codes);
+    free(frames);
+    free(lengths);
+    free(verify_lats);
+    free(enroll_lats);
+    return 0;
+}
+
+
+// Enroll the first remotes into a new verifier, and then enroll the rest while
+// verifying messages, moving step buckets per write, and print a row of
+// results. Returns -1 if a remote was not enrolled or a message accepted.
+int run_resize(int step) {
+    uint64_t start, arrival, begin, missing = 0, lookups = 0;
+    int idx, slot, num_enrolls = 0;
+
+    epoch_init(&ep);
+    if (verifier_init_growing(&vf, final_fobs, VERIFIER_WINDOW, 0, &ep, step))
+        return -1;
+    for (idx = 0; idx < start_fobs; idx++)
+        if (enroll(idx))
+            PRINT_RETURN("A remote was not enrolled\n", -1);
+    __atomic_store_n(&num_enrolled, start_fobs, __ATOMIC_RELEASE);
+    stopping = 0;
+    for (idx = 0; idx < num_readers; idx++) {
+        readers[idx].id = epoch_register(&ep);
+        readers[idx].lookups = readers[idx].missing = 0;
+        pthread_create(&readers[idx].thread, NULL, run_reader, &readers[idx]);
+    }
+
+    // Enroll the next share of the remotes before every message, and wait for
+    // the message to arrive unless the thread is already behind
+    begin = now_ns();
+    for (idx = 0; idx < num_frames; idx++) {
+        arrival = begin + (uint64_t)idx * 1000000000 / frame_rate;
+        while (num_enrolled < enrolled_by(idx)) {
+            int fob = num_enrolled;
+            start = now_ns();
+            if (enroll(fob))
+                PRINT_RETURN("A remote was not enrolled\n", -1);
+            enroll_lats[num_enrolls++] = now_ns() - start;
+            __atomic_store_n(&num_enrolled, fob + 1, __ATOMIC_RELEASE);
+        }
+        while (now_ns() < arrival)
+            ;
+        int ret = verifier_check(&vf, frames[idx], lengths[idx], &slot);
+        verify_lats[idx] = now_ns() - arrival;
+        if (ret != VERDICT_ACCEPT)
+            PRINT_RETURN("A message was not accepted\n", -1);
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    for (idx = 0; idx < num_readers; idx++) {
+        pthread_join(readers[idx].thread, NULL);
+        missing += readers[idx].missing;
+        lookups += readers[idx].lookups;
+    }
+    qsort(verify_lats, num_frames, sizeof(*verify_lats), cmp_latency);
+    qsort(enroll_lats, num_enrolls, sizeof(*enroll_lats), cmp_latency);
+    printf("    %-12s %10u %10u %10u %10u %10u", step ? "incremental" : "rehash",
+        percentile(verify_lats, num_frames, 0.5), percentile(verify_lats, num_frames, 0.99),
+        percentile(verify_lats, num_frames, 0.999), verify_lats[num_frames-1],
+        num_enrolls ? enroll_lats[num_enrolls-1] : 0);
+    if (num_readers)
+        printf(" %5lu/%luM\n", (unsigned long)missing, (unsigned long)(lookups / 1000000));
+    else
+        printf(" %10s\n", "-");
+    verifier_free(&vf);
+    epoch_free(&ep);
+    return 0;
+}
+
+
+// Enroll a remote into the verifier with the shared key, into the slot of the
+// same number, storing the key before the index publishes the slot. Returns -1
+// if it was not enrolled there.
+int enroll(int fob) {
+    vf.keys[fob] = keys;
+    return (verifier_enroll(&vf, serials[fob], NULL, 0) == fob) ? 0 : -1;
+}
+
+
+// Form the MAC message that a remote sends for a rolling code, like
+// verifier_frame(). Returns the length of the message, or 0 if the remote
+// skips the code.
+int make_frame(uint32_t serial, uint32_t code, uint8_t* data) {
+    struct frame frm;
+    uint32_t m0, m1;
+
+    frm.ver = FRAME_BLOWFISH | FRAME_MAC;
+    frm.chan = serial % FRAME_CHANS;
+    frm.serial = serial;
+    frm.mac = 0;
+    cipher_find(frm.ver)->encrypt(&keys, &code, &frm.block, 1);
+    frame_build(&frm, data);
+    frame_mac_words(data, &m0, &m1);
+    frm.mac = key_mac_tag(keys.mk, m0, m1);
+    frame_build(&frm, data);
+    return frame_valid(data, FRAME_LEN_MAC) ? FRAME_LEN_MAC : 0;
+}
+
+
+// Return the number of remotes enrolled before a message is verified.
+int enrolled_by(int frame) {
+    return start_fobs + (int64_t)(final_fobs - start_fobs) * (frame+1) / num_frames;
+}
+
+
+// Look up random enrolled remotes until stopped, counting those not found.
+void* run_reader(void* arg) {
+    struct reader* rd = arg;
+    uint64_t rng_state = rd->id + 2;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        int fob = rand64(&rng_state) % __atomic_load_n(&num_enrolled, __ATOMIC_ACQUIRE);
+        epoch_enter(&ep, rd->id);
+        rd->missing += (verifier_find(&vf, serials[fob]) != fob);
+        epoch_exit(&ep, rd->id);
+        rd->lookups++;
+    }
+    return NULL;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number from a generator.
+uint64_t rand64(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
@@ -0,0 +1,256 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "shard.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* The largest number of shards */
+#define MAX_SHARDS 64
+
+
+/* A shard on a thread of its own, with its part of the fleet */
+struct worker {
+    pthread_t thread;
+    int id;
+    int huge;
+    int remote;
+    struct shard sh;
+    int num_fobs;
+    int* fobs;         // The remotes of the fleet in this shard
+    uint8_t (*frames)[FRAME_MAX];
+    uint8_t* lengths;
+    uint64_t rng_state;
+    double secs;
+    int64_t tlb_misses; // Or -1 if they could not be counted
+    int failed;
+};
+
+
+/* Global variables */
+int num_fobs = 2000000;
+int num_frames = 2000000;
+int num_shards = 1;
+int batch_size = 16;
+int num_cpus;
+int num_nodes;
+uint32_t* serials;
+uint16_t (*seeds)[KEY_WORDS];
+struct worker workers[MAX_SHARDS];
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_shard [-f fobs] [-n frames] [-t shards] [-b batch]\n\n"
+    "Splits a fleet into shards, each set up and verified by a thread pinned\n"
+    "to a processor of its own, and verifies messages from random remotes in\n"
+    "batches. This is done with the arrays of every shard in 4 KiB pages and\n"
+    "in 2 MiB pages, on the node of its thread and, if the host has several\n"
+    "nodes, on another node. Reports the rate of messages, the data TLB misses\n"
+    "per message where the processor can count them, and the memory that was\n"
+    "backed by huge pages.\n\n"
+    "    -f fobs    Number of remotes (default: 2000000)\n"
+    "    -n frames  Number of messages per shard (default: 2000000)\n"
+    "    -t shards  Number of shards (default: 1)\n"
+    "    -b batch   Messages per batch (default: 16)\n"
+);
+
+
+int run_shards(int huge, int remote);
+void* run_worker(void* arg);
+uint64_t now_ns();
+uint64_t rand64(uint64_t* state);
+
+
+int main(int argc, char* argv[]) {
+    uint64_t rng_state = 1;
+    uint8_t* taken;
+    int opt, idx, jdx, huge, remote;
+
+    while ((opt = getopt(argc, argv, "f:n:t:b:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 't': num_shards = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (num_shards < 1 || num_shards > MAX_SHARDS || batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+    num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_nodes = pages_num_nodes();
+
+    // Pick the fleet, with distinct valid serials, and split it into shards
+    serials = malloc(num_fobs*sizeof(*serials));
+    seeds = malloc(num_fobs*sizeof(*seeds));
+    taken = calloc(1 << 24, 1);
+    if (serials == NULL || seeds == NULL || taken == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    for (idx = 0; idx < num_fobs; idx++) {
+        do {
+            serials[idx] = rand64(&rng_state) & 0xFFFFFF;
+        } while (taken[serials[idx]] || !frame_serial_valid(serials[idx]));
+        taken[serials[idx]] = 1;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seeds[idx][jdx] = rand64(&rng_state);
+    }
+    free(taken);
+    for (idx = 0; idx < num_shards; idx++) {
+        workers[idx].id = idx;
+        workers[idx].fobs = malloc(num_fobs*sizeof(*workers[idx].fobs));
+        workers[idx].frames = malloc(num_frames*sizeof(*workers[idx].frames));
+        workers[idx].lengths = malloc(num_frames);
+        if (workers[idx].fobs == NULL || workers[idx].frames == NULL || workers[idx].lengths == NULL)
+            PRINT_RETURN("Out of memory\n", -1);
+    }
+    for (idx = 0; idx < num_fobs; idx++) {
+        struct worker* wk = &workers[shard_of(serials[idx], num_shards)];
+        wk->fobs[wk->num_fobs++] = idx;
+    }
+    for (idx = 0; idx < num_shards; idx++)
+        if (workers[idx].num_fobs == 0)
+            PRINT_RETURN("A shard has no remotes\n", -1);
+
+    printf("Verifying %d messages per shard over %d shards of %d remotes on %d nodes:\n",
+        num_frames, num_shards, num_fobs / num_shards, num_nodes);
+    printf("    %-6s %-7s %10s %12s %10s\n", "pages", "node", "Mmsg/s", "TLB misses", "huge MiB");
+    for (remote = 0; remote < ((num_nodes > 1) ? 2 : 1); remote++)
+        for (huge = 0; huge <= 1; huge++)
+            if (run_shards(huge, remote))
+                return -1;
+
+    for (idx = 0; idx < num_shards; idx++) {
+        free(workers[idx].fobs);
+        free(workers[idx].frames);
+        free(workers[idx].lengths);
+    }
+    free(serials);
+    free(seeds);
+    return 0;
+}
+
+
+// Set up and run every shard, with its arrays in huge pages or not and on the
+// node of its thread or the next one, and print a row of results. Returns -1
+// if a shard failed.
+int run_shards(int huge, int remote) {
+    double rate = 0;
+    int64_t misses = 0;
+    long huge_kib;
+    int idx, failed = 0;
+
+    for (idx = 0; idx < num_shards; idx++) {
+        workers[idx].huge = huge;
+        workers[idx].remote = remote;
+        workers[idx].rng_state = idx + 1;
+        pthread_create(&workers[idx].thread, NULL, run_worker, &workers[idx]);
+    }
+    for (idx = 0; idx < num_shards; idx++) {
+        pthread_join(workers[idx].thread, NULL);
+        failed |= workers[idx].failed;
+    }
+    huge_kib = pages_huge_kib();
+    for (idx = 0; idx < num_shards; idx++) {
+        rate += num_frames / workers[idx].secs;
+        if (misses >= 0 && workers[idx].tlb_misses >= 0)
+            misses += workers[idx].tlb_misses;
+        else
+            misses = -1;
+        shard_free(&workers[idx].sh);
+    }
+    if (failed)
+        PRINT_RETURN("A shard failed\n", -1);
+
+    printf("    %-6s %-7s %10.2f", huge ? "2 MiB" : "4 KiB", remote ? "remote" : "local", rate / 1e6);
+    if (misses >= 0)
+        printf(" %12.2f", (double)misses / num_frames / num_shards);
+    else
+        printf(" %12s", "-");
+    printf(" %10.1f\n", huge_kib / 1024.0);
+    return 0;
+}
+
+
+// Set up a shard on its own processor, enroll its remotes and form messages
+// from them, and then time the verification of the messages in batches.
+void* run_worker(void* arg) {
+    struct worker* wk = arg;
+    struct verifier* vf = &wk->sh.vf;
+    const uint8_t* data[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    uint32_t* codes;
+    uint64_t start;
+    int idx, jdx, num, fd = -1;
+    int64_t misses;
+
+    wk->failed = 1;
+    wk->tlb_misses = -1;
+    if (shard_init(&wk->sh, wk->id % num_cpus, wk->num_fobs, 0, wk->huge))
+        return NULL;
+    if (wk->remote && shard_place(&wk->sh, (wk->sh.node + 1) % num_nodes, wk->huge))
+        return NULL;
+    if ((codes = calloc(wk->num_fobs, sizeof(*codes))) == NULL)
+        return NULL;
+    for (idx = 0; idx < wk->num_fobs; idx++)
+        if (verifier_enroll(vf, serials[wk->fobs[idx]], seeds[wk->fobs[idx]], 0) != idx)
+            goto done;
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand64(&wk->rng_state) % wk->num_fobs;
+        while ((wk->lengths[idx] = verifier_frame(vf, slot, FRAME_BLOWFISH | FRAME_MAC, ++codes[slot], wk->frames[idx])) == 0)
+            ;
+    }
+
+    fd = pages_tlb_open();
+    misses = pages_tlb_read(fd);
+    start = now_ns();
+    for (idx = 0; idx < num_frames; idx += num) {
+        num = (num_frames - idx < batch_size) ? num_frames - idx : batch_size;
+        for (jdx = 0; jdx < num; jdx++)
+            data[jdx] = wk->frames[idx+jdx];
+        verifier_check_batch(vf, data, wk->lengths + idx, num, verdicts, slots);
+        for (jdx = 0; jdx < num; jdx++)
+            if (verdicts[jdx] != VERDICT_ACCEPT)
+                goto done;
+    }
+    wk->secs = (now_ns() - start) / 1e9;
+    if (misses >= 0)
+        wk->tlb_misses = pages_tlb_read(fd) - misses;
+    wk->failed = 0;
+done:
+    if (fd >= 0)
+        close(fd);
+    free(codes);
+    return NULL;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number from a generator.
+uint64_t rand64(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
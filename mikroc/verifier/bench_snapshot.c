@@ -0,0 +1,312 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+/* Ways for the reports to scan the channel store */
+enum scan_mode {
+    SCAN_NONE,     // No report is running
+    SCAN_LOCKED,   // The report holds a lock that the verifier takes per batch
+    SCAN_LIVE,     // The report reads the live channel store without a lock
+    SCAN_SNAPSHOT, // The report reads a snapshot that the verifier takes
+    NUM_SCANS,
+};
+
+/* Slots read by a report at a time */
+#define SCAN_CHUNK  256
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 4000000;
+int batch_size = 16;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+uint64_t* sums;  // The sum of the next codes of the fleet before each message
+struct verifier vf;
+struct snapshots ss;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+int mode;
+int stopping;
+int wanted;                // A report waits for a snapshot
+struct snapshot* taken;    // The snapshot handed to the report
+uint64_t taken_sum;
+uint64_t num_scans;
+uint64_t num_torn;         // Scans whose sum did not match any point in time
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_snapshot [-f fobs] [-n frames] [-b batch]\n\n"
+    "Verifies messages from random remotes in batches on one thread while a\n"
+    "report on another thread keeps scanning the whole channel store for the\n"
+    "remotes that are active and the sum of their rolling codes. The report\n"
+    "either holds a lock over the scan, reads the live store, or reads a\n"
+    "snapshot that is copied on write. Reports the rate of messages over the\n"
+    "time that passed and over the processor time of the verifying thread,\n"
+    "as the report may share its processor, and the longest batch, which\n"
+    "includes waiting for the lock, against verifying with no report at all.\n"
+    "The scans that saw a sum that the store never held at once are counted.\n\n"
+    "    -f fobs    Number of remotes (default: 1000000)\n"
+    "    -n frames  Number of messages (default: 4000000)\n"
+    "    -b batch   Messages per batch (default: 16)\n"
+);
+
+const char* scan_names[NUM_SCANS] = {"none", "locked", "live", "snapshot"};
+
+
+int run_scan(int scan);
+void* run_report(void* arg);
+uint64_t scan_store(struct snapshot* snap);
+uint64_t now_ns();
+uint64_t cpu_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    uint32_t* codes;
+    uint16_t seed[KEY_WORDS];
+    uint8_t* used;
+    uint64_t sum = 0;
+    int opt, idx, jdx, scan;
+
+    while ((opt = getopt(argc, argv, "f:n:b:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'b': batch_size = atoi(optarg); break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > (1 << 24) / 4*3 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (batch_size < 1 || batch_size > VERIFIER_BATCH)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet, and form messages from random remotes along with the
+    // sum of the next codes that the store holds before each one
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    sums = malloc((num_frames + 1)*sizeof(*sums));
+    codes = calloc(num_fobs, sizeof(*codes));
+    used = calloc(1 << 24, 1);
+    if (frames == NULL || lengths == NULL || sums == NULL || codes == NULL || used == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint32_t serial;
+        do {
+            serial = rand64() & 0xFFFFFF;
+        } while (used[serial] || !frame_serial_valid(serial));
+        used[serial] = 1;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand64();
+        if (verifier_enroll(&vf, serial, seed, 0) != idx)
+            PRINT_RETURN("Could not enroll\n", -1);
+    }
+    free(used);
+    for (idx = 0; idx < num_frames; idx++) {
+        int slot = rand64() % num_fobs;
+        uint32_t prev = codes[slot];
+        sums[idx] = sum;
+        while ((lengths[idx] = verifier_frame(&vf, slot, FRAME_BLOWFISH | FRAME_MAC, ++codes[slot], frames[idx])) == 0)
+            ;
+        sum += (codes[slot] + 1) - (prev ? prev + 1 : 0);
+    }
+    sums[num_frames] = sum;
+    free(codes);
+
+    printf("Verifying %d messages from %d remotes while scanning the channel store:\n",
+        num_frames, num_fobs);
+    printf("    %-9s %10s %10s %14s %8s %8s %12s\n", "report", "Mmsg/s", "Mmsg/cpu-s",
+        "max batch us", "scans", "torn", "pages copied");
+    for (scan = 0; scan < NUM_SCANS; scan++)
+        if (run_scan(scan))
+            return -1;
+
+    verifier_free(&vf);
+    free(frames);
+    free(lengths);
+    free(sums);
+    return 0;
+}
+
+
+// Reset the channel store, verify every message with reports scanning it in
+// one way, and print a row of results. Returns -1 if a message was not
+// accepted.
+int run_scan(int scan) {
+    const uint8_t* data[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    uint64_t start, begin, cpu, longest = 0;
+    pthread_t thread;
+    int idx, jdx, num;
+
+    for (idx = 0; idx < num_fobs; idx++)
+        vf.states[idx].replay = (uint64_t)0xFFFFFFFF << 32;
+    snapshot_init(&ss);
+    vf.snaps = NULL;
+    if (scan == SCAN_SNAPSHOT && verifier_snapshots(&vf, &ss))
+        return -1;
+    mode = scan;
+    stopping = wanted = 0;
+    taken = NULL;
+    num_scans = num_torn = 0;
+    if (scan != SCAN_NONE)
+        pthread_create(&thread, NULL, run_report, NULL);
+
+    begin = now_ns();
+    cpu = cpu_ns();
+    for (idx = 0; idx < num_frames; idx += num) {
+        num = (num_frames - idx < batch_size) ? num_frames - idx : batch_size;
+        for (jdx = 0; jdx < num; jdx++)
+            data[jdx] = frames[idx+jdx];
+
+        // Hand a snapshot to the report between batches if it waits for one
+        if (scan == SCAN_SNAPSHOT && __atomic_load_n(&wanted, __ATOMIC_ACQUIRE)) {
+            wanted = 0;
+            taken_sum = sums[idx];
+            __atomic_store_n(&taken, snapshot_take(&ss), __ATOMIC_RELEASE);
+        }
+        start = now_ns();
+        if (scan == SCAN_LOCKED)
+            pthread_mutex_lock(&lock);
+        verifier_check_batch(&vf, data, lengths + idx, num, verdicts, slots);
+        if (scan == SCAN_LOCKED)
+            pthread_mutex_unlock(&lock);
+        if (now_ns() - start > longest)
+            longest = now_ns() - start;
+        for (jdx = 0; jdx < num; jdx++)
+            if (verdicts[jdx] != VERDICT_ACCEPT)
+                PRINT_RETURN("A message was not accepted\n", -1);
+    }
+    begin = now_ns() - begin;
+    cpu = cpu_ns() - cpu;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (scan != SCAN_NONE)
+        pthread_join(thread, NULL);
+    printf("    %-9s %10.2f %10.2f %14.1f", scan_names[scan], num_frames / (begin / 1e3),
+        num_frames / (cpu / 1e3), longest / 1e3);
+    if (scan != SCAN_NONE)
+        printf(" %8lu %8lu", (unsigned long)num_scans, (unsigned long)num_torn);
+    else
+        printf(" %8s %8s", "-", "-");
+    if (scan == SCAN_SNAPSHOT)
+        printf(" %12lu\n", (unsigned long)ss.copies);
+    else
+        printf(" %12s\n", "-");
+    if (taken != NULL)
+        snapshot_release(taken);
+    snapshot_free(&ss);
+    vf.snaps = NULL;
+    return 0;
+}
+
+
+// Scan the channel store until stopped, checking each sum of the next codes
+// against the sums that the store held before every message.
+void* run_report(void* arg) {
+    uint64_t sum;
+    int lo, hi;
+
+    (void)arg;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        if (mode == SCAN_LOCKED) {
+            pthread_mutex_lock(&lock);
+            sum = scan_store(NULL);
+            pthread_mutex_unlock(&lock);
+        } else if (mode == SCAN_LIVE) {
+            sum = scan_store(NULL);
+        } else {
+            struct snapshot* snap;
+            __atomic_store_n(&wanted, 1, __ATOMIC_RELEASE);
+            while ((snap = __atomic_load_n(&taken, __ATOMIC_ACQUIRE)) == NULL)
+                if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+                    return NULL;
+                else
+                    sched_yield();
+            __atomic_store_n(&taken, NULL, __ATOMIC_RELAXED);
+            sum = scan_store(snap);
+            num_torn += (sum != taken_sum);
+            snapshot_release(snap);
+            num_scans++;
+            continue;
+        }
+
+        // A scan without a snapshot is consistent if its sum is one that the
+        // store held at some point, and the sums only grow
+        for (lo = 0, hi = num_frames; lo < hi;) {
+            int mid = lo + (hi - lo) / 2;
+            if (sums[mid] < sum)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        num_torn += (sums[lo] != sum);
+        num_scans++;
+    }
+    return NULL;
+}
+
+
+// Return the sum of the next codes of the enabled remotes in the channel
+// store, or in a snapshot of it if snap is not NULL.
+uint64_t scan_store(struct snapshot* snap) {
+    struct fob_state chunk[SCAN_CHUNK];
+    uint64_t sum = 0;
+    int slot, idx, num;
+
+    for (slot = 0; slot < num_fobs; slot += num) {
+        num = (num_fobs - slot < SCAN_CHUNK) ? num_fobs - slot : SCAN_CHUNK;
+        if (snap != NULL)
+            snapshot_read(&ss, snap, VERIFIER_SNAP_STATES, slot*sizeof(*chunk), num*sizeof(*chunk), chunk);
+        else
+            memcpy(chunk, &vf.states[slot], num*sizeof(*chunk));
+        for (idx = 0; idx < num; idx++)
+            if (chunk[idx].state == FOB_ENABLED)
+                sum += (uint32_t)chunk[idx].replay;
+    }
+    return sum;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return the processor time of the calling thread in nanoseconds.
+uint64_t cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,254 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "tier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+
+/* Global variables */
+int num_fobs = 10000000;
+int max_hot = 1 << 20;
+int num_frames = 2000000;
+int daily_pct = 5;
+int share_pct = 90;
+const char* path = "/tmp/bench_tier.cold";
+uint64_t rng_state = 1;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_tier [-f fobs] [-H hot] [-n frames] [-d daily] [-p share]\n"
+    "                  [-o path]\n\n"
+    "Enrolls a fleet into the cold tier of a two tier store and verifies\n"
+    "messages where a few remotes that are used every day send most of them,\n"
+    "and the rest come from a long tail. Reports the latency of messages from\n"
+    "hot remotes and of those that promoted a cold remote, and the memory that\n"
+    "the store kept resident, against keeping every remote in a verifier. The\n"
+    "cold tier is dropped from memory after enrolling, as after a restart, so\n"
+    "promotions read their records from the file.\n\n"
+    "    -f fobs    Number of remotes (default: 10000000)\n"
+    "    -H hot     Number of remotes in the hot tier (default: 1048576)\n"
+    "    -n frames  Number of messages (default: 2000000)\n"
+    "    -d daily   Percentage of remotes used every day (default: 5)\n"
+    "    -p share   Percentage of messages from those remotes (default: 90)\n"
+    "    -o path    The file of the cold tier (default: /tmp/bench_tier.cold)\n"
+);
+
+
+void seed_of(uint32_t serial, uint16_t* seed);
+int make_frame(uint32_t serial, uint32_t code, uint8_t* data);
+int cmp_latency(const void* a, const void* b);
+uint32_t percentile(const uint32_t* sorted, int num, double pct);
+void print_latency(const char* name, uint32_t* lats, int num);
+void print_memory(const char* when);
+uint64_t now_ns();
+uint64_t rand64();
+
+
+int main(int argc, char* argv[]) {
+    struct tier ts;
+    uint32_t *serials, *codes, *hot_lats, *cold_lats;
+    uint8_t (*frames)[FRAME_MAX];
+    uint8_t* lengths;
+    uint64_t verdicts[NUM_VERDICTS] = {0};
+    int opt, idx, num_daily, num_hot = 0, num_cold = 0, slot;
+
+    while ((opt = getopt(argc, argv, "f:H:n:d:p:o:h")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'H': max_hot = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 'd': daily_pct = atoi(optarg); break;
+        case 'p': share_pct = atoi(optarg); break;
+        case 'o': path = optarg; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_fobs > TIER_SERIALS/4*3 || max_hot < 1 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+    if (daily_pct < 1 || daily_pct > 100 || share_pct < 0 || share_pct > 100)
+        PRINT_RETURN(help_msg, -1);
+
+    serials = malloc(num_fobs*sizeof(*serials));
+    codes = calloc(num_fobs, sizeof(*codes));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    hot_lats = malloc(num_frames*sizeof(*hot_lats));
+    cold_lats = malloc(num_frames*sizeof(*cold_lats));
+    if (serials == NULL || codes == NULL || frames == NULL || lengths == NULL || hot_lats == NULL || cold_lats == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+
+    // Enroll the fleet with seeds derived from the serials, so that the
+    // messages can be formed without keeping the keys of every remote
+    unlink(path);
+    if (tier_open(&ts, path, max_hot))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        do {
+            serials[idx] = rand64() & (TIER_SERIALS-1);
+            seed_of(serials[idx], seed);
+        } while (tier_enroll(&ts, serials[idx], seed, 0) < 0);
+    }
+    printf("Enrolled %d remotes into %s, with %d hot:\n", num_fobs, path, max_hot);
+    print_memory("enrolled");
+
+    // Form the messages, most of them from the daily remotes
+    num_daily = (int64_t)num_fobs * daily_pct / 100;
+    if (num_daily < 1)
+        num_daily = 1;
+    for (idx = 0; idx < num_frames; idx++) {
+        int fob = (rand64() % 100 < (uint64_t)share_pct || num_daily == num_fobs) ?
+            rand64() % num_daily : num_daily + rand64() % (num_fobs - num_daily);
+        while ((lengths[idx] = make_frame(serials[fob], ++codes[fob], frames[idx])) == 0)
+            ;
+    }
+    if (tier_release(&ts))
+        return -1;
+    print_memory("released");
+
+    // Verify the messages, telling hits from promotions
+    for (idx = 0; idx < num_frames; idx++) {
+        uint64_t promotions = ts.promotions;
+        uint64_t start = now_ns();
+        int ret = tier_check(&ts, frames[idx], lengths[idx], &slot);
+        uint32_t lat = now_ns() - start;
+        verdicts[ret]++;
+        if (ts.promotions != promotions)
+            cold_lats[num_cold++] = lat;
+        else
+            hot_lats[num_hot++] = lat;
+    }
+    print_memory("verified");
+
+    printf("\nLatency of %d messages (%.2f%% accepted, %lu demotions):\n", num_frames,
+        100.0*verdicts[VERDICT_ACCEPT]/num_frames, (unsigned long)ts.demotions);
+    printf("    %-6s %10s %10s %10s %10s\n", "tier", "messages", "p50 ns", "p99 ns", "p999 ns");
+    print_latency("hot", hot_lats, num_hot);
+    print_latency("cold", cold_lats, num_cold);
+
+    printf("\nMemory of the hot tier: %.1f MiB of keys and state, %.1f MiB of lookahead\n",
+        (double)max_hot * (sizeof(struct fob_keys) + sizeof(struct fob_state) + 4 + 1) / (1 << 20)
+            + (double)(ts.hot.index_mask+1) * 4 / (1 << 20),
+        (double)ts.la.table_bytes / (1 << 20));
+    printf("Memory of a verifier of every remote: %.1f MiB of keys and state\n",
+        (double)num_fobs * (sizeof(struct fob_keys) + sizeof(struct fob_state) + 4 + 8) / (1 << 20));
+
+    tier_close(&ts);
+    unlink(path);
+    free(serials);
+    free(codes);
+    free(frames);
+    free(lengths);
+    free(hot_lats);
+    free(cold_lats);
+    return 0;
+}
+
+
+// Derive the seed key of a remote from its serial number.
+void seed_of(uint32_t serial, uint16_t* seed) {
+    uint64_t state = serial * 0x9E3779B97F4A7C15ull + 1;
+    int idx;
+
+    for (idx = 0; idx < KEY_WORDS; idx++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        seed[idx] = state;
+    }
+}
+
+
+// Form the MAC message that a remote sends for a rolling code, like
+// verifier_frame(). Returns the length of the message, or 0 if the remote
+// skips the code.
+int make_frame(uint32_t serial, uint32_t code, uint8_t* data) {
+    uint16_t seed[KEY_WORDS];
+    struct fob_keys keys;
+    struct frame frm;
+    uint32_t m0, m1;
+
+    seed_of(serial, seed);
+    fob_keys_init(&keys, seed);
+    frm.ver = FRAME_BLOWFISH | FRAME_MAC;
+    frm.chan = serial % FRAME_CHANS;
+    frm.serial = serial;
+    frm.mac = 0;
+    cipher_find(frm.ver)->encrypt(&keys, &code, &frm.block, 1);
+    frame_build(&frm, data);
+    frame_mac_words(data, &m0, &m1);
+    frm.mac = key_mac_tag(keys.mk, m0, m1);
+    frame_build(&frm, data);
+    return frame_valid(data, FRAME_LEN_MAC) ? FRAME_LEN_MAC : 0;
+}
+
+
+// Compare two latencies for qsort().
+int cmp_latency(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+
+// Return a percentile of sorted latencies.
+uint32_t percentile(const uint32_t* sorted, int num, double pct) {
+    int idx = pct * num;
+    return sorted[(idx < num) ? idx : num-1];
+}
+
+
+// Print the percentiles of some latencies, sorting them.
+void print_latency(const char* name, uint32_t* lats, int num) {
+    if (num == 0) {
+        printf("    %-6s %10d %10s %10s %10s\n", name, 0, "-", "-", "-");
+        return;
+    }
+    qsort(lats, num, sizeof(*lats), cmp_latency);
+    printf("    %-6s %10d %10u %10u %10u\n", name, num, percentile(lats, num, 0.5),
+        percentile(lats, num, 0.99), percentile(lats, num, 0.999));
+}
+
+
+// Print the resident memory of the process, split into the pages of files
+// and the rest.
+void print_memory(const char* when) {
+    long size = 0, resident = 0, shared = 0, page = sysconf(_SC_PAGESIZE);
+    FILE* fp = fopen("/proc/self/statm", "r");
+
+    if (fp != NULL) {
+        if (fscanf(fp, "%ld %ld %ld", &size, &resident, &shared) != 3)
+            resident = shared = 0;
+        fclose(fp);
+    }
+    printf("    resident when %-9s %8.1f MiB (%.1f MiB of files)\n", when,
+        (double)resident * page / (1 << 20), (double)shared * page / (1 << 20));
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Return a random 64-bit number.
+uint64_t rand64() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
@@ -0,0 +1,201 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "verifier.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+
+/* A stream of messages to verify */
+struct traffic {
+    uint8_t (*data)[FRAME_MAX];
+    uint8_t* len;
+    uint8_t* attack;
+    int num;
+};
+
+
+/* Global variables */
+int num_fobs = 100000;
+int num_frames = 1000000;
+int cipher_ver = FRAME_BLOWFISH;
+struct verifier vf;
+struct fob_state* init_states;
+uint32_t* tx_codes;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_verify [-f fobs] [-n frames] [-s]\n\n"
+    "Measures the cost of rejecting forged messages and the verifier throughput\n"
+    "under attack traffic. CRC and MAC messages are compared for the 16 remotes\n"
+    "of a receiver, and MAC messages are also measured for a fleet of remotes.\n"
+    "The forged CRC messages have a valid CRC, since anybody can compute one,\n"
+    "while the forged MAC messages name an enrolled serial number with a random\n"
+    "MAC.\n\n"
+    "    -f fobs     Number of remotes sending MAC messages (default: 100000)\n"
+    "    -n frames   Number of messages per measurement (default: 1000000)\n"
+    "    -s          Encrypt the rolling codes with Speck32/64\n"
+);
+
+
+int make_traffic(struct traffic* tfc, int mac, int fleet, double attack);
+int make_frame(int slot, int mac, uint8_t* data);
+double run_traffic(const struct traffic* tfc, uint64_t* verdicts);
+uint32_t rand32();
+double now();
+
+
+int main(int argc, char* argv[]) {
+    const double attacks[] = {0.0, 0.5, 0.9, 0.99};
+    struct traffic tfc;
+    uint64_t verdicts[NUM_VERDICTS];
+    int opt, idx, mac;
+
+    while ((opt = getopt(argc, argv, "f:n:sh")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 's': cipher_ver = FRAME_SPECK; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the 16 channels followed by the fleet of remotes
+    srand(1);
+    if (verifier_init(&vf, FRAME_CHANS + num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < FRAME_CHANS + num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        uint32_t serial;
+        int jdx;
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        do {
+            serial = (idx < FRAME_CHANS) ? (uint32_t)idx : rand32() & 0xFFFFFF;
+        } while (verifier_enroll(&vf, serial, seed, 0) < 0);
+    }
+    init_states = malloc(vf.num_fobs*sizeof(*init_states));
+    tx_codes = malloc(vf.num_fobs*sizeof(*tx_codes));
+    tfc.data = malloc(num_frames*sizeof(*tfc.data));
+    tfc.len = malloc(num_frames);
+    tfc.attack = malloc(num_frames);
+    if (init_states == NULL || tx_codes == NULL || tfc.data == NULL || tfc.len == NULL || tfc.attack == NULL)
+        PRINT_RETURN("Out of memory\n", -1);
+    memcpy(init_states, vf.states, vf.num_fobs*sizeof(*init_states));
+
+    printf("Cost of a forged message (%s):\n", ciphers[cipher_ver].name);
+    for (mac = 0; mac < 3; mac++) {
+        make_traffic(&tfc, mac > 0, mac > 1, 1.0);
+        double secs = run_traffic(&tfc, verdicts);
+        printf("    %-4s %8d remotes %7.1f ns/frame  (", mac ? "MAC" : "CRC",
+            (mac > 1) ? num_fobs : FRAME_CHANS, secs*1e9/num_frames);
+        for (idx = 0; idx < NUM_VERDICTS; idx++)
+            if (verdicts[idx])
+                printf(" %s=%lu", verdict_names[idx], (unsigned long)verdicts[idx]);
+        printf(" )\n");
+    }
+
+    printf("\nThroughput in Mframes/s under attack:\n");
+    printf("    %-8s %10s %10s %10s\n", "attack", "CRC", "MAC", "MAC fleet");
+    for (idx = 0; idx < (int)(sizeof(attacks)/sizeof(attacks[0])); idx++) {
+        double rates[3];
+        for (mac = 0; mac < 3; mac++) {
+            int legit = make_traffic(&tfc, mac > 0, mac > 1, attacks[idx]);
+            rates[mac] = num_frames / run_traffic(&tfc, verdicts) / 1e6;
+            if (attacks[idx] == 0 && verdicts[VERDICT_ACCEPT] != (uint64_t)legit)
+                PRINT_RETURN("Legitimate messages were rejected\n", -1);
+        }
+        printf("    %7.0f%% %10.2f %10.2f %10.2f\n", attacks[idx]*100, rates[0], rates[1], rates[2]);
+    }
+
+    verifier_free(&vf);
+    free(init_states);
+    free(tx_codes);
+    free(tfc.data);
+    free(tfc.len);
+    free(tfc.attack);
+    return 0;
+}
+
+
+// Generate a stream of messages where the given fraction are forged. The
+// messages come from either the 16 channels or the fleet, and the legitimate
+// ones are in the order that the remotes sent them. Returns the number of
+// legitimate messages.
+int make_traffic(struct traffic* tfc, int mac, int fleet, double attack) {
+    int idx, legit = 0;
+
+    memset(tx_codes, 0, vf.num_fobs*sizeof(*tx_codes));
+    for (idx = 0; idx < num_frames; idx++) {
+        uint8_t* data = tfc->data[idx];
+        int slot = fleet ? FRAME_CHANS + rand() % num_fobs : rand() % FRAME_CHANS;
+
+        tfc->attack[idx] = (rand() < attack * RAND_MAX);
+        if (!tfc->attack[idx]) {
+            tfc->len[idx] = make_frame(slot, mac, data);
+            legit++;
+            continue;
+        }
+
+        struct frame frm = {rand32(), cipher_ver, slot % FRAME_CHANS, vf.serials[slot], rand()};
+        if (mac)
+            frm.ver |= FRAME_MAC;
+        frame_build(&frm, data);
+        tfc->len[idx] = frame_length(data[4]);
+    }
+    tfc->num = num_frames;
+    return legit;
+}
+
+
+// Form the next message of a remote, skipping codes like transmit_code() does.
+// Returns the length of the message.
+int make_frame(int slot, int mac, uint8_t* data) {
+    uint8_t ver = cipher_ver | (mac ? FRAME_MAC : 0);
+    int num;
+
+    while ((num = verifier_frame(&vf, slot, ver, ++tx_codes[slot], data)) == 0)
+        ;
+    return num;
+}
+
+
+// Verify a stream of messages from the initial channel store. Returns the time
+// taken in seconds.
+double run_traffic(const struct traffic* tfc, uint64_t* verdicts) {
+    int idx, slot;
+
+    memcpy(vf.states, init_states, vf.num_fobs*sizeof(*init_states));
+    memset(verdicts, 0, NUM_VERDICTS*sizeof(*verdicts));
+    double start = now();
+    for (idx = 0; idx < tfc->num; idx++)
+        verdicts[verifier_check(&vf, tfc->data[idx], tfc->len[idx], &slot)]++;
+    return now() - start;
+}
+
+
+// Return a random 32-bit number.
+uint32_t rand32() {
+    return (uint32_t)rand() << 16 ^ rand();
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
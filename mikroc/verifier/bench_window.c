@@ -0,0 +1,192 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "lookahead.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+
+
+/* Global variables */
+int num_fobs = 1000000;
+int num_frames = 4000000;
+int cipher_ver = FRAME_BLOWFISH;
+struct verifier vf;
+struct fob_state* init_states;
+uint8_t (*frames)[FRAME_MAX];
+uint8_t* lengths;
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: bench_window [-f fobs] [-n frames] [-s]\n\n"
+    "Compares the fixed window of the verifier against per remote lookahead\n"
+    "tables sized from the skips that each remote was seen to make. Most of the\n"
+    "remotes rarely skip a code, some skip a few codes when pressed out of\n"
+    "range, and a few skip hundreds. How often each remote is used is heavily\n"
+    "skewed, so many of them are rarely seen. Every message is authentic, so\n"
+    "every rejection is a remote that the user has to press again.\n\n"
+    "    -f fobs     Number of remotes (default: 1000000)\n"
+    "    -n frames   Number of messages (default: 4000000)\n"
+    "    -s          Encrypt the rolling codes with Speck32/64\n"
+);
+
+
+int make_traffic();
+uint32_t make_skip(int slot);
+double run_lookahead(struct lookahead* la, uint64_t* accepts);
+double run_verifier(uint64_t* accepts);
+uint32_t rand32();
+double now();
+
+
+int main(int argc, char* argv[]) {
+    const uint32_t max_windows[] = {64, 256, LOOKAHEAD_MAX};
+    uint64_t accepts, hot = 0;
+    int opt, idx, jdx;
+
+    while ((opt = getopt(argc, argv, "f:n:sh")) != -1) {
+        switch (opt) {
+        case 'f': num_fobs = atoi(optarg); break;
+        case 'n': num_frames = atoi(optarg); break;
+        case 's': cipher_ver = FRAME_SPECK; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind != argc || num_fobs < 1 || num_frames < 1)
+        PRINT_RETURN(help_msg, -1);
+
+    // Enroll the fleet and record the messages in the order they were sent
+    srand(1);
+    if (verifier_init(&vf, num_fobs, VERIFIER_WINDOW))
+        return -1;
+    for (idx = 0; idx < num_fobs; idx++) {
+        uint16_t seed[KEY_WORDS];
+        for (jdx = 0; jdx < KEY_WORDS; jdx++)
+            seed[jdx] = rand();
+        while (verifier_enroll(&vf, rand32() & 0xFFFFFF, seed, 0) < 0)
+            ;
+    }
+    init_states = malloc(num_fobs*sizeof(*init_states));
+    frames = malloc(num_frames*sizeof(*frames));
+    lengths = malloc(num_frames);
+    if (init_states == NULL || frames == NULL || lengths == NULL || make_traffic())
+        PRINT_RETURN("Out of memory\n", -1);
+    memcpy(init_states, vf.states, num_fobs*sizeof(*init_states));
+
+    printf("Windows of %d remotes over %d messages (%s):\n", num_fobs, num_frames, ciphers[cipher_ver].name);
+    printf("    %-10s %12s %12s %10s %10s %10s\n",
+        "window", "table MiB", "state MiB", "rejected", "decrypted", "Mframes/s");
+    for (idx = 0; idx < (int)(sizeof(max_windows)/sizeof(max_windows[0])); idx++) {
+        struct lookahead la;
+        if (lookahead_init(&la, &vf, LOOKAHEAD_MIN, max_windows[idx]))
+            return -1;
+        double secs = run_lookahead(&la, &accepts);
+        if (max_windows[idx] == LOOKAHEAD_MAX)
+            for (hot = 0, jdx = 0; jdx < num_fobs; jdx++)
+                hot += (la.fobs[jdx].table != NULL);
+        printf("    %4d-%-5d %12.1f %12.1f %9.3f%% %9.1f%% %10.2f\n", LOOKAHEAD_MIN, max_windows[idx],
+            la.table_bytes / 1048576.0, num_fobs*sizeof(*la.fobs) / 1048576.0,
+            100.0*(num_frames-accepts)/num_frames, 100.0*la.decrypts/num_frames, num_frames/secs/1e6);
+        lookahead_free(&la);
+    }
+    double secs = run_verifier(&accepts);
+    printf("    %4d fixed %12.1f %12s %9.3f%% %9.1f%% %10.2f\n", VERIFIER_WINDOW,
+        hot*VERIFIER_WINDOW*sizeof(uint32_t) / 1048576.0, "-",
+        100.0*(num_frames-accepts)/num_frames, 100.0, num_frames/secs/1e6);
+    printf("\nThe fixed window needs no tables since it decrypts every message. Its\n"
+        "table size is what the %lu remotes with tables would need at that width.\n",
+        (unsigned long)hot);
+
+    verifier_free(&vf);
+    free(init_states);
+    free(frames);
+    free(lengths);
+    return 0;
+}
+
+
+// Generate the messages of the fleet. The remotes are picked with a skewed
+// distribution, and each press may be preceded by presses that were never
+// heard. Returns -1 if out of memory.
+int make_traffic() {
+    uint32_t* tx_codes = calloc(num_fobs, sizeof(*tx_codes));
+    int idx;
+
+    if (tx_codes == NULL)
+        return -1;
+    for (idx = 0; idx < num_frames; idx++) {
+        double pick = (double)rand32() / 4294967296.0;
+        int slot = (int)(pick*pick*pick * num_fobs);
+        uint8_t ver = cipher_ver | FRAME_MAC;
+
+        tx_codes[slot] += make_skip(slot);
+        while ((lengths[idx] = verifier_frame(&vf, slot, ver, ++tx_codes[slot], frames[idx])) == 0)
+            ;
+    }
+    free(tx_codes);
+    return 0;
+}
+
+
+// Return the number of presses that a remote made out of range before the next
+// one. The behaviour of a remote is fixed by a hash of its slot.
+uint32_t make_skip(int slot) {
+    int kind = ((uint32_t)slot * 2654435761u >> 16) % 100;
+    if (kind < 90) // Careful users
+        return (rand() % 100 < 2) ? 1 : 0;
+    if (kind < 99) // Buttons pressed in a pocket
+        return (rand() % 100 < 30) ? 1 + rand() % 15 : 0;
+    return (rand() % 100 < 30) ? rand() % 300 : 0; // Toddlers
+}
+
+
+// Verify every message with lookahead tables, storing the number of accepted
+// messages in accepts. Returns the time taken in seconds.
+double run_lookahead(struct lookahead* la, uint64_t* accepts) {
+    int idx, slot;
+
+    memcpy(vf.states, init_states, num_fobs*sizeof(*init_states));
+    *accepts = 0;
+    double start = now();
+    for (idx = 0; idx < num_frames; idx++)
+        *accepts += (lookahead_check(la, frames[idx], lengths[idx], &slot) == VERDICT_ACCEPT);
+    return now() - start;
+}
+
+
+// Verify every message by decrypting it, storing the number of accepted
+// messages in accepts. Returns the time taken in seconds.
+double run_verifier(uint64_t* accepts) {
+    int idx, slot;
+
+    memcpy(vf.states, init_states, num_fobs*sizeof(*init_states));
+    *accepts = 0;
+    double start = now();
+    for (idx = 0; idx < num_frames; idx++)
+        *accepts += (verifier_check(&vf, frames[idx], lengths[idx], &slot) == VERDICT_ACCEPT);
+    return now() - start;
+}
+
+
+// Return a random 32-bit number.
+uint32_t rand32() {
+    return (uint32_t)rand() << 16 ^ rand();
+}
+
+
+// Return the current monotonic time in seconds.
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
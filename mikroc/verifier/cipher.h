@@ -0,0 +1,335 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_CIPHER_H
+#define _VERIFIER_CIPHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../key_gen/schedule.h"
+#include "frame.h"
+
+
+// These are the batch cipher kernels of the host verifier. Each cipher is
+// reached through a struct cipher looked up by the frame version, so callers
+// never name a cipher directly. The kernels work on CIPHER_LANES blocks at a
+// time using the GCC vector extensions, which compile to SSE or AVX depending
+// on the target flags, and fall back to the scalar code in schedule.h for any
+// remaining blocks.
+//
+// Speck32/64 maps directly onto 16-bit vector lanes. The BlowFish32 S boxes
+// are only 16 entries each, so the lookups are done as byte shuffles of the
+// low and high bytes of every S box entry. This needs at least SSSE3 to beat
+// the scalar code, so the makefile builds for the native target.
+
+#define CIPHER_LANES 16
+
+/* Vector types for the kernels */
+typedef uint16_t cipher_v16 __attribute__((vector_size(2*CIPHER_LANES)));
+typedef uint8_t cipher_v8 __attribute__((vector_size(CIPHER_LANES)));
+
+
+/* The host keys of a fob for the frame MAC and every supported cipher. The MAC
+   keys come first since they are read first when checking a message. */
+struct fob_keys {
+    uint16_t mk[MAC_ROUNDS];
+    uint16_t rk[SPECK_ROUNDS];
+    struct blowfish_keys bf;
+};
+
+/* A block cipher operating on batches of blocks */
+struct cipher {
+    const char* name;
+    uint8_t ver; // Frame version that selects this cipher
+
+    // Encrypt or decrypt num blocks under a single key
+    void (*encrypt)(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+    void (*decrypt)(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+
+    // Decrypt num blocks, each under its own key
+    void (*decrypt_each)(const struct fob_keys* const* keys, const uint32_t* in, uint32_t* out, int num);
+};
+
+
+void fob_keys_init(struct fob_keys* keys, const uint16_t* seed);
+void fob_keys_init_each(struct fob_keys* const* keys, const uint16_t* const* seeds, int num);
+const struct cipher* cipher_find(uint8_t ver);
+void blowfish_encrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+void blowfish_decrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+void blowfish_decrypt_each(const struct fob_keys* const* keys, const uint32_t* in, uint32_t* out, int num);
+void speck_encrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+void speck_decrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num);
+void speck_decrypt_each(const struct fob_keys* const* keys, const uint32_t* in, uint32_t* out, int num);
+
+
+/* The supported ciphers, indexed by the cipher bits of the frame version */
+const struct cipher ciphers[] = {
+    {
+        "blowfish32", FRAME_BLOWFISH,
+        blowfish_encrypt_batch, blowfish_decrypt_batch, blowfish_decrypt_each,
+    }, {
+        "speck32", FRAME_SPECK,
+        speck_encrypt_batch, speck_decrypt_batch, speck_decrypt_each,
+    },
+};
+
+
+// Expand the seed key of a fob into the keys of every cipher and the MAC.
+void fob_keys_init(struct fob_keys* keys, const uint16_t* seed) {
+    key_schedule(seed, &keys->bf);
+    key_speck_schedule(seed, keys->rk);
+    key_mac_schedule(seed, keys->mk);
+}
+
+
+// Expand the seed keys of a batch of fobs like fob_keys_init(). The BlowFish32
+// schedule is a chain of 41 encryptions where each one reads the subkeys that
+// the last one wrote, so a single schedule cannot be vectorized. The schedules
+// of four fobs are interleaved in scalar code instead, as in
+// blowfish_decrypt_each(), so that their chains overlap. The P and S subkeys
+// are filled in order, so they are written as one array of 16-bit words.
+void fob_keys_init_each(struct fob_keys* const* keys, const uint16_t* const* seeds, int num) {
+    const int num_words = sizeof(struct blowfish_keys) / sizeof(uint16_t);
+    int idx, lane, ridx, widx;
+
+    for (idx = 0; idx + 4 <= num; idx += 4) {
+        struct blowfish_keys* bf[4];
+        uint16_t hi[4] = {0}, lo[4] = {0}, tmp;
+        for (lane = 0; lane < 4; lane++) {
+            bf[lane] = &keys[idx+lane]->bf;
+            *bf[lane] = blowfish_pi;
+            for (ridx = 0; ridx < 18; ridx++)
+                bf[lane]->p[ridx] ^= seeds[idx+lane][ridx];
+        }
+        for (widx = 0; widx < num_words; widx += 2) {
+            for (ridx = 0; ridx < 16; ridx++) {
+                for (lane = 0; lane < 4; lane++) {
+                    hi[lane] ^= bf[lane]->p[ridx];
+                    lo[lane] ^= key_feistel(bf[lane], hi[lane]);
+                    tmp = hi[lane]; hi[lane] = lo[lane]; lo[lane] = tmp;
+                }
+            }
+            for (lane = 0; lane < 4; lane++) {
+                uint16_t* words = (uint16_t*)bf[lane];
+                tmp = hi[lane]; hi[lane] = lo[lane] ^ bf[lane]->p[16]; lo[lane] = tmp ^ bf[lane]->p[17];
+                words[widx+0] = hi[lane];
+                words[widx+1] = lo[lane];
+            }
+        }
+        for (lane = 0; lane < 4; lane++) {
+            key_speck_schedule(seeds[idx+lane], keys[idx+lane]->rk);
+            key_mac_schedule(seeds[idx+lane], keys[idx+lane]->mk);
+        }
+    }
+    for (; idx < num; idx++)
+        fob_keys_init(keys[idx], seeds[idx]);
+}
+
+
+// Look up the cipher for a frame version. Returns NULL for unknown versions.
+const struct cipher* cipher_find(uint8_t ver) {
+    if (ver & ~(FRAME_CIPHER | FRAME_MAC))
+        return NULL;
+    if ((ver & FRAME_CIPHER) >= sizeof(ciphers)/sizeof(ciphers[0]))
+        return NULL;
+    return &ciphers[ver & FRAME_CIPHER];
+}
+
+
+/* Helpers to move blocks in and out of the vector lanes */
+#define _CIPHER_LOAD(in, hi, lo) {                                             \
+    int _lane;                                                                 \
+    for (_lane = 0; _lane < CIPHER_LANES; _lane++) {                           \
+        hi[_lane] = KEY_BIT16_HI(in[_lane]);                                   \
+        lo[_lane] = KEY_BIT16_LO(in[_lane]);                                   \
+    }                                                                          \
+}
+#define _CIPHER_STORE(out, hi, lo) {                                           \
+    int _lane;                                                                 \
+    for (_lane = 0; _lane < CIPHER_LANES; _lane++)                             \
+        out[_lane] = ((uint32_t)hi[_lane] << 16) | lo[_lane];                  \
+}
+
+
+// Look up a 16-entry table of 16-bit values in every lane. The table is split
+// into its low and high bytes so that each half is a single byte shuffle.
+static inline cipher_v16 _blowfish_lookup(cipher_v8 tlo, cipher_v8 thi, cipher_v16 idx) {
+    cipher_v8 nib = __builtin_convertvector(idx & 0x0F, cipher_v8);
+    cipher_v16 lo = __builtin_convertvector(__builtin_shuffle(tlo, nib), cipher_v16);
+    cipher_v16 hi = __builtin_convertvector(__builtin_shuffle(thi, nib), cipher_v16);
+    return lo | (hi << 8);
+}
+
+
+/* The S boxes of a key split into byte shuffle tables */
+struct _blowfish_sbox {
+    cipher_v8 lo[4];
+    cipher_v8 hi[4];
+};
+
+static inline void _blowfish_split(const struct blowfish_keys* bf, struct _blowfish_sbox* sb) {
+    const uint16_t* arr_sx[4] = {bf->s1, bf->s2, bf->s3, bf->s4};
+    int sidx, idx;
+    for (sidx = 0; sidx < 4; sidx++) {
+        for (idx = 0; idx < 16; idx++) {
+            sb->lo[sidx][idx] = arr_sx[sidx][idx] & 0xFF;
+            sb->hi[sidx][idx] = arr_sx[sidx][idx] >> 8;
+        }
+    }
+}
+
+static inline cipher_v16 _blowfish_feistel(const struct _blowfish_sbox* sb, cipher_v16 data) {
+    cipher_v16 f1 = _blowfish_lookup(sb->lo[0], sb->hi[0], data >> 0);
+    cipher_v16 f2 = _blowfish_lookup(sb->lo[1], sb->hi[1], data >> 4);
+    cipher_v16 f3 = _blowfish_lookup(sb->lo[2], sb->hi[2], data >> 8);
+    cipher_v16 f4 = _blowfish_lookup(sb->lo[3], sb->hi[3], data >> 12);
+    return ((f1 + f2) ^ f3) + f4;
+}
+
+
+// Run BlowFish32 encryption over a batch of blocks under a single key.
+void blowfish_encrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num) {
+    const struct blowfish_keys* bf = &keys->bf;
+    struct _blowfish_sbox sb;
+    int idx, ridx;
+
+    _blowfish_split(bf, &sb);
+    for (idx = 0; idx + CIPHER_LANES <= num; idx += CIPHER_LANES) {
+        cipher_v16 hi, lo, tmp;
+        _CIPHER_LOAD((in+idx), hi, lo);
+        for (ridx = 0; ridx < 16; ridx++) {
+            hi ^= bf->p[ridx];
+            lo ^= _blowfish_feistel(&sb, hi);
+            tmp = hi; hi = lo; lo = tmp;
+        }
+        tmp = hi; hi = lo; lo = tmp;
+        hi ^= bf->p[16];
+        lo ^= bf->p[17];
+        _CIPHER_STORE((out+idx), hi, lo);
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_encrypt(bf, in[idx]);
+}
+
+
+// Run BlowFish32 decryption over a batch of blocks under a single key.
+void blowfish_decrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num) {
+    const struct blowfish_keys* bf = &keys->bf;
+    struct _blowfish_sbox sb;
+    int idx, ridx;
+
+    _blowfish_split(bf, &sb);
+    for (idx = 0; idx + CIPHER_LANES <= num; idx += CIPHER_LANES) {
+        cipher_v16 hi, lo, tmp;
+        _CIPHER_LOAD((in+idx), hi, lo);
+        hi ^= bf->p[16];
+        lo ^= bf->p[17];
+        for (ridx = 15; ridx >= 0; ridx--) {
+            lo ^= _blowfish_feistel(&sb, hi);
+            hi ^= bf->p[ridx];
+            tmp = hi; hi = lo; lo = tmp;
+        }
+        tmp = hi; hi = lo; lo = tmp;
+        _CIPHER_STORE((out+idx), hi, lo);
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_decrypt(bf, in[idx]);
+}
+
+
+// Run BlowFish32 decryption over a batch of blocks that each have their own
+// key. The S boxes differ per lane, so four blocks are interleaved in scalar
+// code to overlap the latency of the table lookups instead.
+void blowfish_decrypt_each(const struct fob_keys* const* keys, const uint32_t* in, uint32_t* out, int num) {
+    int idx, lane, ridx;
+
+    for (idx = 0; idx + 4 <= num; idx += 4) {
+        const struct blowfish_keys* bf[4];
+        uint16_t hi[4], lo[4], tmp;
+        for (lane = 0; lane < 4; lane++) {
+            bf[lane] = &keys[idx+lane]->bf;
+            hi[lane] = KEY_BIT16_HI(in[idx+lane]) ^ bf[lane]->p[16];
+            lo[lane] = KEY_BIT16_LO(in[idx+lane]) ^ bf[lane]->p[17];
+        }
+        for (ridx = 15; ridx >= 0; ridx--) {
+            for (lane = 0; lane < 4; lane++) {
+                lo[lane] ^= key_feistel(bf[lane], hi[lane]);
+                hi[lane] ^= bf[lane]->p[ridx];
+                tmp = hi[lane]; hi[lane] = lo[lane]; lo[lane] = tmp;
+            }
+        }
+        for (lane = 0; lane < 4; lane++)
+            out[idx+lane] = ((uint32_t)lo[lane] << 16) | hi[lane];
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_decrypt(&keys[idx]->bf, in[idx]);
+}
+
+
+// Run Speck32/64 encryption over a batch of blocks under a single key.
+void speck_encrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num) {
+    int idx, ridx;
+
+    for (idx = 0; idx + CIPHER_LANES <= num; idx += CIPHER_LANES) {
+        cipher_v16 hi, lo;
+        _CIPHER_LOAD((in+idx), hi, lo);
+        for (ridx = 0; ridx < SPECK_ROUNDS; ridx++) {
+            hi = (((hi >> 7) | (hi << 9)) + lo) ^ keys->rk[ridx];
+            lo = ((lo << 2) | (lo >> 14)) ^ hi;
+        }
+        _CIPHER_STORE((out+idx), hi, lo);
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_speck_encrypt(keys->rk, in[idx]);
+}
+
+
+// Run Speck32/64 decryption over a batch of blocks under a single key.
+void speck_decrypt_batch(const struct fob_keys* keys, const uint32_t* in, uint32_t* out, int num) {
+    int idx, ridx;
+
+    for (idx = 0; idx + CIPHER_LANES <= num; idx += CIPHER_LANES) {
+        cipher_v16 hi, lo;
+        _CIPHER_LOAD((in+idx), hi, lo);
+        for (ridx = SPECK_ROUNDS-1; ridx >= 0; ridx--) {
+            lo ^= hi;
+            lo = (lo >> 2) | (lo << 14);
+            hi = (hi ^ keys->rk[ridx]) - lo;
+            hi = (hi << 7) | (hi >> 9);
+        }
+        _CIPHER_STORE((out+idx), hi, lo);
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_speck_decrypt(keys->rk, in[idx]);
+}
+
+
+// Run Speck32/64 decryption over a batch of blocks that each have their own
+// key. The round keys of the lanes are transposed once per batch so that the
+// rounds themselves stay in vector registers.
+void speck_decrypt_each(const struct fob_keys* const* keys, const uint32_t* in, uint32_t* out, int num) {
+    cipher_v16 rk[SPECK_ROUNDS];
+    int idx, lane, ridx;
+
+    for (idx = 0; idx + CIPHER_LANES <= num; idx += CIPHER_LANES) {
+        cipher_v16 hi, lo;
+        for (lane = 0; lane < CIPHER_LANES; lane++)
+            for (ridx = 0; ridx < SPECK_ROUNDS; ridx++)
+                rk[ridx][lane] = keys[idx+lane]->rk[ridx];
+        _CIPHER_LOAD((in+idx), hi, lo);
+        for (ridx = SPECK_ROUNDS-1; ridx >= 0; ridx--) {
+            lo ^= hi;
+            lo = (lo >> 2) | (lo << 14);
+            hi = (hi ^ rk[ridx]) - lo;
+            hi = (hi << 7) | (hi >> 9);
+        }
+        _CIPHER_STORE((out+idx), hi, lo);
+    }
+    for (; idx < num; idx++)
+        out[idx] = key_speck_decrypt(keys[idx]->rk, in[idx]);
+}
+
+
+#endif /* _VERIFIER_CIPHER_H */
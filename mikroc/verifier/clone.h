@@ -0,0 +1,283 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_CLONE_H
+#define _VERIFIER_CLONE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+
+// This looks for remotes that were cloned, from the accepted codes alone. A
+// copy of a remote shares its keys and its rolling code, so once both are in
+// use their codes are accepted from two places, and the verifier accepts the
+// codes of the one that is behind as long as they are within VERIFIER_REPLAY
+// of the other and unused. Every accept is the channel or serial, the code and
+// the door that heard it, which is all that process_load() has, and is joined
+// with the last accept of the same remote:
+//
+//  regress:  The code is behind the highest accepted, and it was heard at a
+//            distant door or long after, which a pipeline that reorders the
+//            messages of one press cannot explain
+//  travel:   The code is ahead, but it was heard at a door too far from the
+//            last one to have been carried there in the time between
+//
+// Both remotes may still be used at the same door with codes that only move
+// forward, which no join over accepts can tell from one remote.
+//
+// The remotes are kept in a table of sets of CLONE_WAYS entries, each set in
+// one cache line that the serial hashes to, so a join costs one miss. An
+// entry is live until its last accept is CLONE_BUCKETS buckets of time old,
+// after which it is free to be taken, so there is nothing to sweep. A remote
+// that finds its set full of live entries takes the one heard the longest ago.
+// A remote raises an event of each kind at most once until its entry is freed.
+
+#define CLONE_WAYS     4
+#define CLONE_BUCKETS  16     // Buckets of time that an entry is live for
+#define CLONE_DOORS    4096   // Doors with a place
+#define CLONE_EVENTS   4096   // Events kept until taken
+
+
+/* Kinds of impossible sequences */
+enum clone_kind {
+    CLONE_REGRESS = 1,
+    CLONE_TRAVEL = 2,
+};
+
+/* The last accept of a remote */
+struct clone_entry {
+    uint32_t serial;
+    uint32_t code;    // The highest accepted
+    uint32_t time;    // In milliseconds
+    uint16_t door;
+    uint8_t flags;    // The kinds of events raised
+    uint8_t live;
+};
+
+/* A set of entries in one cache line */
+struct clone_set {
+    struct clone_entry ways[CLONE_WAYS];
+} __attribute__((aligned(64)));
+
+/* An impossible sequence of accepts of a remote */
+struct clone_event {
+    uint32_t time;
+    uint32_t serial;
+    uint32_t code;
+    uint32_t last_code;
+    uint32_t gap;      // Milliseconds since the last accept
+    uint16_t door;
+    uint16_t last_door;
+    float distance;    // Metres between the doors
+    uint8_t kind;
+};
+
+/* A join over the accepts of a fleet */
+struct clone {
+    struct clone_set* sets;
+    uint32_t set_mask;
+    uint32_t bucket;   // Milliseconds per bucket of time
+    float speed;       // The fastest that a remote is carried, in m/ms
+    float near;        // Metres within which doors are one place
+    uint32_t slack;    // Milliseconds that a pipeline may reorder codes by
+    float (*places)[2];
+    struct clone_event* events;
+    uint32_t head;
+    uint32_t tail;
+
+    // Statistics
+    uint64_t accepts;
+    uint64_t raised;
+    uint64_t dropped;
+    uint64_t evicted;  // Live entries taken by another remote
+};
+
+
+int clone_init(struct clone* cl, int num_fobs, uint32_t bucket, float speed, float near, uint32_t slack);
+void clone_free(struct clone* cl);
+void clone_place(struct clone* cl, uint32_t door, float x, float y);
+int clone_note(struct clone* cl, uint32_t serial, uint32_t door, uint32_t code, uint32_t now);
+int clone_note_batch(struct clone* cl, const uint32_t* serials, const uint32_t* doors, const uint32_t* codes, const uint32_t* times, int num);
+int clone_take(struct clone* cl, struct clone_event* ev);
+void clone_raise(struct clone* cl, int kind, const struct clone_entry* ent, uint32_t door, uint32_t code, uint32_t gap, float distance, uint32_t now);
+float clone_distance(const struct clone* cl, uint32_t a, uint32_t b);
+uint32_t clone_hash(uint32_t serial);
+
+
+// Set up a join with room for about num_fobs live remotes, at a quarter full
+// so that few sets overflow, whose entries are kept for CLONE_BUCKETS buckets
+// of bucket milliseconds. Remotes are carried at most speed metres per second,
+// doors within near metres of each other are taken to be the same place, and a
+// pipeline may reorder the codes of a remote by slack milliseconds. Every door
+// is at the same place until it is placed. Returns -1 if out of memory.
+int clone_init(struct clone* cl, int num_fobs, uint32_t bucket, float speed, float near, uint32_t slack) {
+    uint32_t num_sets = 1;
+
+    memset(cl, 0, sizeof(*cl));
+    while (num_sets*CLONE_WAYS < 4*(uint32_t)num_fobs)
+        num_sets <<= 1;
+    cl->set_mask = num_sets - 1;
+    cl->bucket = (bucket < 1) ? 1 : bucket;
+    cl->speed = speed / 1000;
+    cl->near = near;
+    cl->slack = slack;
+    cl->sets = aligned_alloc(64, num_sets*sizeof(*cl->sets));
+    cl->places = calloc(CLONE_DOORS, sizeof(*cl->places));
+    cl->events = malloc(CLONE_EVENTS*sizeof(*cl->events));
+    if (cl->sets == NULL || cl->places == NULL || cl->events == NULL) {
+        clone_free(cl);
+        fprintf(stderr, "Could not allocate the join\n");
+        return -1;
+    }
+    memset(cl->sets, 0, num_sets*sizeof(*cl->sets));
+    return 0;
+}
+
+
+// Release the memory of a join.
+void clone_free(struct clone* cl) {
+    free(cl->sets);
+    free(cl->places);
+    free(cl->events);
+    memset(cl, 0, sizeof(*cl));
+}
+
+
+// Put a door at a place, in metres.
+void clone_place(struct clone* cl, uint32_t door, float x, float y) {
+    cl->places[door % CLONE_DOORS][0] = x;
+    cl->places[door % CLONE_DOORS][1] = y;
+}
+
+
+// Join an accept of a code of a remote at a door at now in milliseconds with
+// the last accept of the remote. Returns the kind of event raised, or 0.
+int clone_note(struct clone* cl, uint32_t serial, uint32_t door, uint32_t code, uint32_t now) {
+    struct clone_set* set = &cl->sets[clone_hash(serial) & cl->set_mask];
+    struct clone_entry *ent = NULL, *free_ent = NULL, *oldest = NULL;
+    uint32_t bucket = now / cl->bucket, gap;
+    float distance;
+    int way, kind = 0;
+
+    cl->accepts++;
+    for (way = 0; way < CLONE_WAYS; way++) {
+        struct clone_entry* e = &set->ways[way];
+        if (!e->live || (int32_t)(bucket - e->time / cl->bucket) >= CLONE_BUCKETS) {
+            free_ent = (free_ent == NULL) ? e : free_ent;
+            continue;
+        }
+        if (e->serial == serial) {
+            ent = e;
+            break;
+        }
+        if (oldest == NULL || (int32_t)(e->time - oldest->time) < 0)
+            oldest = e;
+    }
+
+    // Take an entry for a remote that was not heard within the buckets
+    if (ent == NULL) {
+        if ((ent = free_ent) == NULL) {
+            ent = oldest;
+            cl->evicted++;
+        }
+        ent->serial = serial;
+        ent->code = code;
+        ent->time = now;
+        ent->door = door;
+        ent->flags = 0;
+        ent->live = 1;
+        return 0;
+    }
+
+    // Messages may arrive slightly out of order, so the gap goes both ways
+    gap = ((int32_t)(now - ent->time) < 0) ? ent->time - now : now - ent->time;
+    distance = clone_distance(cl, door, ent->door);
+    if ((int32_t)(code - ent->code) < 0) {
+        if (distance > cl->near || gap > cl->slack)
+            kind = CLONE_REGRESS;
+    } else if (distance > cl->near && gap * cl->speed < distance) {
+        kind = CLONE_TRAVEL;
+    }
+    if (kind != 0 && !(ent->flags & kind)) {
+        ent->flags |= kind;
+        clone_raise(cl, kind, ent, door, code, gap, distance, now);
+    } else {
+        kind = 0;
+    }
+    if ((int32_t)(code - ent->code) > 0)
+        ent->code = code;
+    if ((int32_t)(now - ent->time) > 0)
+        ent->time = now;
+    ent->door = door;
+    return kind;
+}
+
+
+// Join a batch of accepts like clone_note(), loading every set before any is
+// joined so that the misses overlap. Returns the number of events raised.
+int clone_note_batch(struct clone* cl, const uint32_t* serials, const uint32_t* doors, const uint32_t* codes, const uint32_t* times, int num) {
+    int idx, raised = 0;
+
+    for (idx = 0; idx < num; idx++)
+        __builtin_prefetch(&cl->sets[clone_hash(serials[idx]) & cl->set_mask], 1);
+    for (idx = 0; idx < num; idx++)
+        raised += (clone_note(cl, serials[idx], doors[idx], codes[idx], times[idx]) != 0);
+    return raised;
+}
+
+
+// Take the oldest event that was raised. Returns 0 if there is none.
+int clone_take(struct clone* cl, struct clone_event* ev) {
+    if (cl->head == cl->tail)
+        return 0;
+    *ev = cl->events[cl->head++ % CLONE_EVENTS];
+    return 1;
+}
+
+
+// Add an event to the ring, or drop it if the ring is full.
+void clone_raise(struct clone* cl, int kind, const struct clone_entry* ent, uint32_t door, uint32_t code, uint32_t gap, float distance, uint32_t now) {
+    struct clone_event* ev;
+
+    if (cl->tail - cl->head == CLONE_EVENTS) {
+        cl->dropped++;
+        return;
+    }
+    ev = &cl->events[cl->tail++ % CLONE_EVENTS];
+    ev->time = now;
+    ev->serial = ent->serial;
+    ev->code = code;
+    ev->last_code = ent->code;
+    ev->gap = gap;
+    ev->door = door;
+    ev->last_door = ent->door;
+    ev->distance = distance;
+    ev->kind = kind;
+    cl->raised++;
+}
+
+
+// Return the distance between two doors in metres.
+float clone_distance(const struct clone* cl, uint32_t a, uint32_t b) {
+    float dx = cl->places[a % CLONE_DOORS][0] - cl->places[b % CLONE_DOORS][0];
+    float dy = cl->places[a % CLONE_DOORS][1] - cl->places[b % CLONE_DOORS][1];
+    return sqrtf(dx*dx + dy*dy);
+}
+
+
+// Hash a serial to its set, as the finalizer of MurmurHash3 does.
+uint32_t clone_hash(uint32_t serial) {
+    serial ^= serial >> 16;
+    serial *= 0x85EBCA6B;
+    serial ^= serial >> 13;
+    serial *= 0xC2B2AE35;
+    serial ^= serial >> 16;
+    return serial;
+}
+
+
+#endif /* _VERIFIER_CLONE_H */
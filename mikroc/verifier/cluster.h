@@ -0,0 +1,624 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_CLUSTER_H
+#define _VERIFIER_CLUSTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "verifier.h"
+
+
+// This spreads the fleet over a cluster of verifier processes on one host.
+// Every remote is owned by one node, found by consistent hashing of its serial
+// onto a ring on which every node has CLUSTER_VNODES points, so that a node
+// joining or leaving only moves the remotes on the arcs it gains or loses. The
+// processes talk over datagram sockets in the abstract namespace of the host,
+// which are reliable and keep the order of the datagrams of a sender:
+//
+//  front-end:  Routes every message to the owner of its serial, in batches
+//              per node, by the newest ring that it was given
+//  node:       Verifies the messages of the remotes that it holds, and
+//              forwards the others to their owner by its ring
+//  ring:       A new version of the ring is given to every node and then to
+//              the front-ends, which may route by it before the nodes do
+//
+// When a node is given a new ring, it streams the expanded keys and channel
+// state of every remote that it no longer owns to the new owner, drops them,
+// and then tells every node that it is done, all before it verifies another
+// message. A remote is only ever verified by the one node that holds its
+// state, so no code can be accepted twice. For a moment it has two owners,
+// during which both are sent its messages:
+//
+//  old owner:  Forwards the messages that were routed by the last ring after
+//              the state, which arrives first as the datagrams keep order
+//  new owner:  Holds the messages of remotes that it owns but does not have
+//              yet until their last owner is done handing over
+//
+// Messages with a MAC are routed by serial, and those without by channel,
+// which doubles as the serial. The ring may only change by one node at a
+// time, once every node has acknowledged the last change, so that remotes
+// move one way between any two nodes. A node only sends to the nodes that
+// take remotes from it, so one that is blocked on sending to another is never
+// waited on by it in turn. The coordinator offers the ring to the nodes
+// without blocking, as it must keep taking their acknowledgements.
+
+#define CLUSTER_NODES     16
+#define CLUSTER_VNODES    64     // Points of every node on the ring
+#define CLUSTER_FRONTS    16
+#define CLUSTER_COORD     (CLUSTER_NODES + CLUSTER_FRONTS)  // The id of the
+                                                            // process that
+                                                            // changes the ring
+#define CLUSTER_PROCS     (CLUSTER_COORD + 1)
+#define CLUSTER_DATAGRAM  16384
+#define CLUSTER_HEADER    8
+#define CLUSTER_STATE     (3 + 8 + 1 + (int)sizeof(struct fob_keys))
+
+
+/* Kinds of datagrams */
+enum cluster_kind {
+    CLUSTER_FRAMES = 1,  // Messages to verify, each after its length
+    CLUSTER_STATES,      // Remotes handed over, with their keys and state
+    CLUSTER_DONE,        // A node handed over every remote for a ring
+    CLUSTER_RING,        // A new version of the ring, with its members
+    CLUSTER_ACK,         // A node is done with a ring
+    CLUSTER_STOP,
+};
+
+/* A point of a node on the ring */
+struct cluster_point {
+    uint32_t hash;
+    int node;
+};
+
+/* A version of the ring */
+struct cluster_ring {
+    uint32_t version;
+    uint32_t members;   // Bit N is set if node N is on the ring
+    int num_points;
+    struct cluster_point points[CLUSTER_NODES*CLUSTER_VNODES];
+};
+
+/* A batch of records on its way to one process */
+struct cluster_out {
+    int len;
+    uint8_t data[CLUSTER_DATAGRAM];
+};
+
+/* The socket of a process in the cluster */
+struct cluster_link {
+    int fd;
+    int id;
+    char name[64];
+    struct cluster_out* out;  // A batch for every process
+};
+
+/* A node of the cluster */
+struct cluster_node {
+    struct cluster_link link;
+    struct verifier vf;
+    struct cluster_ring ring;
+    struct cluster_ring last;
+    uint32_t waiting;      // The nodes that have not handed over for the ring
+    uint32_t done[CLUSTER_NODES];  // The newest ring every node is done with
+    int32_t* free_slots;
+    int num_free;
+    uint8_t (*held)[FRAME_MAX];
+    uint8_t* held_lens;
+    int num_held;
+    int max_held;
+
+    // Statistics
+    uint64_t verdicts[NUM_VERDICTS];
+    uint64_t forwarded;
+    uint64_t total_held;
+    uint64_t moved_in;
+    uint64_t moved_out;
+    uint64_t handoff_ns;   // How long the last handoff took
+};
+
+
+void ring_build(struct cluster_ring* rg, uint32_t version, uint32_t members);
+int ring_owner(const struct cluster_ring* rg, uint32_t serial);
+int ring_find(const struct cluster_ring* rg, uint32_t hash);
+uint32_t ring_gains(const struct cluster_ring* last, const struct cluster_ring* rg, int node);
+int ring_compare(const void* a, const void* b);
+uint32_t ring_hash(uint32_t x);
+uint32_t cluster_serial(const uint8_t* data, int num);
+int cluster_open(struct cluster_link* ln, const char* name, int id);
+void cluster_close(struct cluster_link* ln);
+int cluster_recv(struct cluster_link* ln, uint8_t* data, int wait);
+int cluster_append(struct cluster_link* ln, int to, int kind, uint32_t version, const void* rec, int len);
+int cluster_post(struct cluster_link* ln, int to, int kind, uint32_t version, const void* body, int len);
+int cluster_flush(struct cluster_link* ln, int to);
+int cluster_flush_all(struct cluster_link* ln);
+int cluster_offer(struct cluster_link* ln, int to);
+int cluster_send(struct cluster_link* ln, int to, const uint8_t* data, int len, int wait);
+int cluster_node_init(struct cluster_node* nd, const char* name, int id, int max_fobs, uint32_t window);
+void cluster_node_free(struct cluster_node* nd);
+int cluster_node_handle(struct cluster_node* nd, const uint8_t* data, int num);
+int cluster_node_frames(struct cluster_node* nd, const uint8_t* data, int num);
+int cluster_node_ring(struct cluster_node* nd, uint32_t version, uint32_t members);
+int cluster_node_states(struct cluster_node* nd, const uint8_t* data, int num);
+int cluster_node_done(struct cluster_node* nd, int from, uint32_t version);
+uint64_t cluster_clock();
+
+
+// Build a version of the ring with the points of the given members.
+void ring_build(struct cluster_ring* rg, uint32_t version, uint32_t members) {
+    int node, idx;
+
+    rg->version = version;
+    rg->members = members;
+    rg->num_points = 0;
+    for (node = 0; node < CLUSTER_NODES; node++) {
+        if (!(members >> node & 1))
+            continue;
+        for (idx = 0; idx < CLUSTER_VNODES; idx++) {
+            rg->points[rg->num_points].hash = ring_hash(node << 16 | idx);
+            rg->points[rg->num_points++].node = node;
+        }
+    }
+    qsort(rg->points, rg->num_points, sizeof(*rg->points), ring_compare);
+}
+
+
+// Return the node that owns a serial, which is that of the first point at or
+// after its hash, or -1 if the ring is empty.
+int ring_owner(const struct cluster_ring* rg, uint32_t serial) {
+    return ring_find(rg, ring_hash(serial ^ 0x5A5A5A5A));
+}
+
+
+// Return the node of the first point at or after a hash, wrapping around, or
+// -1 if the ring is empty.
+int ring_find(const struct cluster_ring* rg, uint32_t hash) {
+    int lo = 0, hi = rg->num_points;
+
+    if (hi == 0)
+        return -1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (rg->points[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return rg->points[(lo < rg->num_points) ? lo : 0].node;
+}
+
+
+// Return the nodes that take over arcs of the given node from the last ring,
+// as a bitmask. Every arc between two points of either ring has one owner in
+// each, which is found at the point that ends it.
+uint32_t ring_gains(const struct cluster_ring* last, const struct cluster_ring* rg, int node) {
+    uint32_t gains = 0;
+    int idx, owner;
+
+    for (idx = 0; idx < last->num_points; idx++) {
+        if (last->points[idx].node == node && (owner = ring_find(rg, last->points[idx].hash)) != node && owner >= 0)
+            gains |= 1u << owner;
+    }
+    for (idx = 0; idx < rg->num_points; idx++) {
+        if (rg->points[idx].node != node && ring_find(last, rg->points[idx].hash) == node)
+            gains |= 1u << rg->points[idx].node;
+    }
+    return gains;
+}
+
+
+// Compare two points for qsort(), by hash and then by node.
+int ring_compare(const void* a, const void* b) {
+    const struct cluster_point *x = a, *y = b;
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return x->node - y->node;
+}
+
+
+// Mix the bits of a word, as the finalizer of MurmurHash3 does.
+uint32_t ring_hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+
+// Return the serial that a message is routed by.
+uint32_t cluster_serial(const uint8_t* data, int num) {
+    if (num == FRAME_LEN_MAC)
+        return data[5] | data[6] << 8 | data[7] << 16;
+    return data[4] % FRAME_CHANS;
+}
+
+
+// Bind the socket of the process with the given id in a cluster. Returns -1
+// if the name is taken or out of memory.
+int cluster_open(struct cluster_link* ln, const char* name, int id) {
+    struct sockaddr_un addr;
+    int bufsize = 1 << 22;
+
+    memset(ln, 0, sizeof(*ln));
+    ln->id = id;
+    snprintf(ln->name, sizeof(ln->name), "%s", name);
+    ln->out = calloc(CLUSTER_PROCS, sizeof(*ln->out));
+    if (ln->out == NULL || (ln->fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        free(ln->out);
+        fprintf(stderr, "Could not open the socket of process %d\n", id);
+        return -1;
+    }
+    setsockopt(ln->fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(ln->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "%s.%d", name, id);
+    if (bind(ln->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        cluster_close(ln);
+        fprintf(stderr, "Could not bind the socket of process %d\n", id);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Close the socket of a process, without sending what is left in its batches.
+void cluster_close(struct cluster_link* ln) {
+    close(ln->fd);
+    free(ln->out);
+    memset(ln, 0, sizeof(*ln));
+    ln->fd = -1;
+}
+
+
+// Receive a datagram into data, which must hold CLUSTER_DATAGRAM bytes, and
+// return its length. Returns 0 if wait is not set and nothing has arrived, or
+// -1 if the socket failed.
+int cluster_recv(struct cluster_link* ln, uint8_t* data, int wait) {
+    int num = recv(ln->fd, data, CLUSTER_DATAGRAM, wait ? 0 : MSG_DONTWAIT);
+
+    if (num < 0 && !wait)
+        return 0;
+    if (num < CLUSTER_HEADER) {
+        fprintf(stderr, "Could not receive a datagram\n");
+        return -1;
+    }
+    return num;
+}
+
+
+// Add a record to the batch of a process, sending the batch first if it holds
+// another kind of record or is full. Returns -1 if the batch was not sent.
+int cluster_append(struct cluster_link* ln, int to, int kind, uint32_t version, const void* rec, int len) {
+    struct cluster_out* out = &ln->out[to];
+
+    if (out->len > 0 && (out->data[0] != kind || out->len + len > CLUSTER_DATAGRAM))
+        if (cluster_flush(ln, to))
+            return -1;
+    if (out->len == 0) {
+        out->data[0] = kind;
+        out->data[1] = ln->id;
+        out->data[2] = out->data[3] = 0;
+        memcpy(out->data + 4, &version, 4);
+        out->len = CLUSTER_HEADER;
+    }
+    memcpy(out->data + out->len, rec, len);
+    out->len += len;
+    return 0;
+}
+
+
+// Send a datagram of a single record to a process, after its batch. Returns
+// -1 if it was not sent.
+int cluster_post(struct cluster_link* ln, int to, int kind, uint32_t version, const void* body, int len) {
+    return cluster_flush(ln, to) || cluster_append(ln, to, kind, version, body, len) || cluster_flush(ln, to);
+}
+
+
+// Send the batch of a process, if there is one. Returns -1 if it was not sent.
+int cluster_flush(struct cluster_link* ln, int to) {
+    struct cluster_out* out = &ln->out[to];
+    int len = out->len;
+
+    if (len == 0)
+        return 0;
+    out->len = 0;
+    return cluster_send(ln, to, out->data, len, 1);
+}
+
+
+// Send the batches of every process. Returns -1 if one was not sent.
+int cluster_flush_all(struct cluster_link* ln) {
+    int to;
+
+    for (to = 0; to < CLUSTER_PROCS; to++)
+        if (cluster_flush(ln, to))
+            return -1;
+    return 0;
+}
+
+
+// Send the batch of a process if its queue has room, for a process that must
+// keep receiving while it sends. Returns 1 if the batch is still waiting, or
+// -1 if it could not be sent.
+int cluster_offer(struct cluster_link* ln, int to) {
+    struct cluster_out* out = &ln->out[to];
+    int rc;
+
+    if (out->len == 0)
+        return 0;
+    if ((rc = cluster_send(ln, to, out->data, out->len, 0)) == 0)
+        out->len = 0;
+    return rc;
+}
+
+
+// Send a datagram to a process, waiting while its queue is full if wait is
+// set. Returns 1 if the queue is full and wait is not set, or -1 if the
+// datagram was not sent.
+int cluster_send(struct cluster_link* ln, int to, const uint8_t* data, int len, int wait) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "%s.%d", ln->name, to);
+    if (sendto(ln->fd, data, len, wait ? 0 : MSG_DONTWAIT, (struct sockaddr*)&addr, sizeof(addr)) == len)
+        return 0;
+    if (!wait && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 1;
+    fprintf(stderr, "Could not send to process %d\n", to);
+    return -1;
+}
+
+
+// Set up a node with room for max_fobs remotes and no remotes yet, on an empty
+// ring. Returns -1 if its socket could not be bound or out of memory.
+int cluster_node_init(struct cluster_node* nd, const char* name, int id, int max_fobs, uint32_t window) {
+    memset(nd, 0, sizeof(*nd));
+    if (cluster_open(&nd->link, name, id))
+        return -1;
+    nd->max_held = 1024;
+    nd->free_slots = malloc(max_fobs*sizeof(*nd->free_slots));
+    nd->held = malloc(nd->max_held*sizeof(*nd->held));
+    nd->held_lens = malloc(nd->max_held);
+    if (nd->free_slots == NULL || nd->held == NULL || nd->held_lens == NULL ||
+        verifier_init(&nd->vf, max_fobs, window)) {
+        cluster_node_free(nd);
+        fprintf(stderr, "Could not allocate node %d\n", id);
+        return -1;
+    }
+    ring_build(&nd->ring, 0, 0);
+    nd->last = nd->ring;
+    return 0;
+}
+
+
+// Close the socket and release the memory of a node.
+void cluster_node_free(struct cluster_node* nd) {
+    cluster_close(&nd->link);
+    verifier_free(&nd->vf);
+    free(nd->free_slots);
+    free(nd->held);
+    free(nd->held_lens);
+    memset(nd, 0, sizeof(*nd));
+}
+
+
+// Handle a datagram that a node received. Returns 1 once the node is asked to
+// stop, or -1 if a datagram could not be sent or out of memory.
+int cluster_node_handle(struct cluster_node* nd, const uint8_t* data, int num) {
+    uint32_t version, members;
+    int rc = 0;
+
+    memcpy(&version, data + 4, 4);
+    switch (data[0]) {
+    case CLUSTER_FRAMES:
+        rc = cluster_node_frames(nd, data + CLUSTER_HEADER, num - CLUSTER_HEADER);
+        break;
+    case CLUSTER_STATES:
+        rc = cluster_node_states(nd, data + CLUSTER_HEADER, num - CLUSTER_HEADER);
+        break;
+    case CLUSTER_DONE:
+        rc = cluster_node_done(nd, data[1], version);
+        break;
+    case CLUSTER_RING:
+        if (num < CLUSTER_HEADER + 4)
+            return 0;
+        memcpy(&members, data + CLUSTER_HEADER, 4);
+        rc = cluster_node_ring(nd, version, members);
+        break;
+    case CLUSTER_STOP:
+        return 1;
+    }
+    if (rc == 0)
+        rc = cluster_flush_all(&nd->link);
+    return rc;
+}
+
+
+// Verify the messages of the remotes that the node holds, hold those of the
+// remotes it owns but is still waiting for, and forward the rest to their
+// owner. Returns -1 if a batch could not be sent or out of memory.
+int cluster_node_frames(struct cluster_node* nd, const uint8_t* data, int num) {
+    const uint8_t* batch[VERIFIER_BATCH];
+    uint8_t lens[VERIFIER_BATCH];
+    int verdicts[VERIFIER_BATCH], slots[VERIFIER_BATCH];
+    int pos, idx, count = 0;
+
+    for (pos = 0; pos < num && pos + 1 + data[pos] <= num; pos += 1 + data[pos]) {
+        const uint8_t* frame = data + pos + 1;
+        int len = data[pos], held, owner, last;
+        uint32_t serial;
+
+        // A message too short to hold its channel has no owner, so it is
+        // dropped before its serial is read
+        if (len < FRAME_LEN || len > FRAME_MAX)
+            continue;
+        serial = cluster_serial(frame, len);
+        held = verifier_find(&nd->vf, serial) >= 0;
+        owner = ring_owner(&nd->ring, serial);
+        last = ring_owner(&nd->last, serial);
+        if (!held && owner != nd->link.id && owner >= 0) {
+            if (cluster_append(&nd->link, owner, CLUSTER_FRAMES, nd->ring.version, data + pos, 1 + len))
+                return -1;
+            nd->forwarded++;
+            continue;
+        }
+        if (!held && last >= 0 && (nd->waiting >> last & 1)) {
+            if (nd->num_held == nd->max_held) {
+                uint8_t (*held)[FRAME_MAX] = realloc(nd->held, 2*nd->max_held*sizeof(*held));
+                uint8_t* held_lens = realloc(nd->held_lens, 2*nd->max_held);
+                if (held != NULL)
+                    nd->held = held;
+                if (held_lens != NULL)
+                    nd->held_lens = held_lens;
+                if (held == NULL || held_lens == NULL) {
+                    fprintf(stderr, "Could not hold a message\n");
+                    return -1;
+                }
+                nd->max_held *= 2;
+            }
+            memcpy(nd->held[nd->num_held], frame, len);
+            nd->held_lens[nd->num_held++] = len;
+            nd->total_held++;
+            continue;
+        }
+        batch[count] = frame;
+        lens[count++] = len;
+        if (count == VERIFIER_BATCH) {
+            verifier_check_batch(&nd->vf, batch, lens, count, verdicts, slots);
+            for (idx = 0; idx < count; idx++)
+                nd->verdicts[verdicts[idx]]++;
+            count = 0;
+        }
+    }
+    if (count > 0) {
+        verifier_check_batch(&nd->vf, batch, lens, count, verdicts, slots);
+        for (idx = 0; idx < count; idx++)
+            nd->verdicts[verdicts[idx]]++;
+    }
+    return 0;
+}
+
+
+// Move a node onto a new version of the ring, handing over every remote that
+// it no longer owns, and telling the nodes that take them and the coordinator
+// that it is done. An empty ring has no owners, so the node then keeps every
+// remote. Returns -1 if a datagram could not be sent.
+int cluster_node_ring(struct cluster_node* nd, uint32_t version, uint32_t members) {
+    uint8_t entry[CLUSTER_STATE];
+    uint64_t start = cluster_clock();
+    uint32_t gains;
+    int slot, node, id = nd->link.id;
+
+    if (version <= nd->ring.version)
+        return 0;
+    nd->last = nd->ring;
+    ring_build(&nd->ring, version, members);
+    nd->waiting = 0;
+    for (node = 0; node < CLUSTER_NODES; node++)
+        if (node != id && nd->done[node] < version && (ring_gains(&nd->last, &nd->ring, node) >> id & 1))
+            nd->waiting |= 1u << node;
+
+    for (slot = 0; slot < nd->vf.num_fobs; slot++) {
+        uint32_t serial = nd->vf.serials[slot];
+        if (serial == VERIFIER_NONE || (node = ring_owner(&nd->ring, serial)) == id || node < 0)
+            continue;
+        entry[0] = serial;
+        entry[1] = serial >> 8;
+        entry[2] = serial >> 16;
+        memcpy(entry + 3, &nd->vf.states[slot].replay, 8);
+        entry[11] = nd->vf.states[slot].state;
+        memcpy(entry + 12, &nd->vf.keys[slot], sizeof(nd->vf.keys[slot]));
+        if (cluster_append(&nd->link, node, CLUSTER_STATES, version, entry, sizeof(entry)))
+            return -1;
+        verifier_evict(&nd->vf, slot);
+        nd->free_slots[nd->num_free++] = slot;
+        nd->moved_out++;
+    }
+    gains = ring_gains(&nd->last, &nd->ring, id);
+    for (node = 0; node < CLUSTER_NODES; node++)
+        if ((gains >> node & 1) && cluster_post(&nd->link, node, CLUSTER_DONE, version, NULL, 0))
+            return -1;
+    nd->handoff_ns = cluster_clock() - start;
+    return cluster_post(&nd->link, CLUSTER_COORD, CLUSTER_ACK, version, NULL, 0);
+}
+
+
+// Take the remotes that another node handed over. Returns -1 if the node is
+// full.
+int cluster_node_states(struct cluster_node* nd, const uint8_t* data, int num) {
+    int pos, slot;
+
+    for (pos = 0; pos + CLUSTER_STATE <= num; pos += CLUSTER_STATE) {
+        uint32_t serial = data[pos] | data[pos+1] << 8 | data[pos+2] << 16;
+        if (nd->num_free > 0)
+            slot = nd->free_slots[--nd->num_free];
+        else if ((slot = nd->vf.num_fobs) < nd->vf.max_fobs)
+            nd->vf.num_fobs++;
+        else
+            slot = -1;
+        if (slot < 0 || verifier_place(&nd->vf, slot, serial, NULL)) {
+            fprintf(stderr, "Could not take remote %06X\n", serial);
+            return -1;
+        }
+        memcpy(&nd->vf.states[slot].replay, data + pos + 3, 8);
+        nd->vf.states[slot].state = data[pos + 11];
+        nd->vf.states[slot].heard = 0;
+        memcpy(&nd->vf.keys[slot], data + pos + 12, sizeof(nd->vf.keys[slot]));
+        nd->moved_in++;
+    }
+    return 0;
+}
+
+
+// Note that a node is done handing over for a version of the ring, and verify
+// the messages that were held for it. Returns -1 if a batch could not be sent.
+int cluster_node_done(struct cluster_node* nd, int from, uint32_t version) {
+    uint8_t data[CLUSTER_DATAGRAM];
+    int idx, num = 0, held = nd->num_held;
+
+    if (from < 0 || from >= CLUSTER_NODES)
+        return 0;
+    if (version > nd->done[from])
+        nd->done[from] = version;
+    if (version < nd->ring.version || !(nd->waiting >> from & 1))
+        return 0;
+    nd->waiting &= ~(1u << from);
+
+    // Take the held messages out and go over them again in batches
+    nd->num_held = 0;
+    for (idx = 0; idx < held; idx++) {
+        if (num + 1 + nd->held_lens[idx] > CLUSTER_DATAGRAM) {
+            if (cluster_node_frames(nd, data, num))
+                return -1;
+            num = 0;
+        }
+        data[num] = nd->held_lens[idx];
+        memcpy(data + num + 1, nd->held[idx], nd->held_lens[idx]);
+        num += 1 + nd->held_lens[idx];
+    }
+    return cluster_node_frames(nd, data, num);
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t cluster_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#endif /* _VERIFIER_CLUSTER_H */
@@ -0,0 +1,460 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_CODEC_H
+#define _VERIFIER_CODEC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This encodes the audit trail in blocks of up to CODEC_BLOCK records, each a
+// message heard at a door with the serial and rolling code of its remote and
+// the verdict on it. The trail is a stream that is decoded in the order that
+// it was encoded, and every field is turned into a small number by what came
+// before it in the stream:
+//
+//  time:     The change in the time between records, so that a steady rate
+//            of messages is near zero, kept to the tick given
+//  remote:   An id into a dictionary of the serials in the stream, which is
+//            followed by the change in the code since the last record of the
+//            same remote, mostly one
+//  door:     An id into a dictionary of the doors in the stream
+//  verdict:  As is
+//
+// The serials and doors that are new to the dictionaries are listed in the
+// block, with the first code of each remote. Signed numbers are zigzag
+// encoded, and every column is then packed with the fewest bits that hold its
+// greatest number in the block, in groups of 512 that are laid out across 16
+// lanes of words: number N is in lane N%16 at bit N/16 times the width. This
+// lets a vector of 16 lanes unpack a group with a shift and a mask for every
+// 16 numbers, with code for each width that the compiler unrolls, giving them
+// in order. A block ends early before a record whose change in the time
+// does not fit in 32 bits.
+
+#define CODEC_BLOCK    4096    // The most records in a block
+#define CODEC_GROUP    512     // Numbers packed in a group
+#define CODEC_LANES    16
+#define CODEC_COLUMNS  4
+#define CODEC_BOUND    (sizeof(struct codec_header) + 3*4*CODEC_BLOCK + (CODEC_COLUMNS+1)*4*CODEC_BLOCK)
+
+
+/* Vector type for unpacking */
+typedef uint32_t codec_v32 __attribute__((vector_size(4*CODEC_LANES)));
+
+/* Columns of a block */
+enum codec_column {
+    CODEC_TIME,
+    CODEC_CODE,
+    CODEC_FOB,
+    CODEC_DOOR,
+};
+
+/* A message in the audit trail */
+struct codec_record {
+    uint64_t time;      // In nanoseconds
+    uint32_t serial;
+    uint32_t code;
+    uint16_t door;
+    uint8_t verdict;
+    uint8_t pad;
+};
+
+/* The start of a block */
+struct codec_header {
+    uint32_t size;      // Bytes of the block, with the header
+    uint16_t num;       // Records in the block
+    uint16_t new_fobs;  // Serials new to the dictionary
+    uint16_t new_doors; // Doors new to the dictionary
+    uint8_t widths[CODEC_COLUMNS];
+    uint8_t verdicts;   // Bits per verdict
+    uint8_t pad;
+    uint64_t time;      // Ticks of the first record
+    uint64_t delta;     // Ticks since the last record of the block before
+};
+
+/* A dictionary of serials or doors */
+struct codec_dict {
+    uint32_t* keys;     // By id
+    uint32_t* codes;    // The last code by id, for serials
+    uint32_t* slots;    // Open addressing table of ids plus one, to encode
+    uint32_t mask;
+    uint32_t num;
+    uint32_t max;
+};
+
+/* One end of a stream of the audit trail */
+struct codec {
+    uint64_t tick;
+    uint64_t time;      // Ticks of the last record
+    struct codec_dict fobs;
+    struct codec_dict doors;
+    uint32_t* cols[CODEC_COLUMNS+1];
+};
+
+
+int codec_init(struct codec* cd, uint64_t tick);
+void codec_free(struct codec* cd);
+int codec_encode(struct codec* cd, const struct codec_record* recs, int num, uint8_t* out, int* size);
+int codec_decode(struct codec* cd, const uint8_t* in, int len, struct codec_record* recs);
+int codec_add(struct codec_dict* dc, uint32_t key, int* added);
+int codec_grow(struct codec_dict* dc, int num, int hashed);
+void codec_pack(const uint32_t* vals, int num, int width, uint32_t* out);
+void codec_unpack(const uint32_t* in, int num, int width, uint32_t* out);
+int codec_width(const uint32_t* vals, int num);
+uint32_t codec_hash(uint32_t key);
+
+
+// Set up either end of a stream whose times are kept to tick nanoseconds,
+// and are truncated to it. Returns -1 if out of memory.
+int codec_init(struct codec* cd, uint64_t tick) {
+    int col;
+
+    memset(cd, 0, sizeof(*cd));
+    cd->tick = (tick < 1) ? 1 : tick;
+    for (col = 0; col <= CODEC_COLUMNS; col++) {
+        if ((cd->cols[col] = aligned_alloc(64, CODEC_BLOCK*sizeof(uint32_t))) == NULL) {
+            codec_free(cd);
+            fprintf(stderr, "Could not allocate the codec\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// Release the memory of either end of a stream.
+void codec_free(struct codec* cd) {
+    struct codec_dict* dicts[2] = {&cd->fobs, &cd->doors};
+    int idx;
+
+    for (idx = 0; idx < 2; idx++) {
+        free(dicts[idx]->keys);
+        free(dicts[idx]->codes);
+        free(dicts[idx]->slots);
+    }
+    for (idx = 0; idx <= CODEC_COLUMNS; idx++)
+        free(cd->cols[idx]);
+    memset(cd, 0, sizeof(*cd));
+}
+
+
+// Encode up to CODEC_BLOCK records as the next block of a stream into out,
+// which must have room for CODEC_BOUND bytes, and store its bytes in size.
+// Returns the number of records encoded, 0 if there are none, or -1 if out of
+// memory, in which case the stream is left as it was.
+int codec_encode(struct codec* cd, const struct codec_record* recs, int num, uint8_t* out, int* size) {
+    struct codec_header hdr;
+    uint32_t *dods = cd->cols[CODEC_TIME], *deltas = cd->cols[CODEC_CODE];
+    uint32_t *fobs = cd->cols[CODEC_FOB], *doors = cd->cols[CODEC_DOOR], *verdicts = cd->cols[CODEC_COLUMNS];
+    uint64_t time, delta, prev;
+    int64_t dod;
+    int32_t change;
+    int idx, col, id, added, pos;
+
+    if (num < 1) {
+        *size = 0;
+        return 0;
+    }
+
+    // Make room for every record to be new to both dictionaries first, so that
+    // the stream is not changed unless the whole block is encoded
+    num = (num < CODEC_BLOCK) ? num : CODEC_BLOCK;
+    if (codec_grow(&cd->fobs, cd->fobs.num + num, 1) || codec_grow(&cd->doors, cd->doors.num + num, 1))
+        return -1;
+
+    // Cut the block before a change in the time that does not fit
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.time = prev = recs[0].time / cd->tick;
+    hdr.delta = delta = hdr.time - cd->time;
+    dods[0] = 0;
+    for (idx = 1; idx < num; idx++) {
+        time = recs[idx].time / cd->tick;
+        dod = (int64_t)(time - prev - delta);
+        if (dod != (int32_t)dod)
+            break;
+        dods[idx] = ((uint32_t)dod << 1) ^ (uint32_t)(dod >> 63);
+        delta = time - prev;
+        prev = time;
+    }
+    num = idx;
+    hdr.num = num;
+    cd->time = prev;
+
+    // Look up the remotes and doors, listing those that are new
+    pos = sizeof(hdr);
+    for (idx = 0; idx < num; idx++) {
+        if ((id = codec_add(&cd->fobs, recs[idx].serial, &added)) < 0)
+            return -1;
+        if (added) {
+            cd->fobs.codes[id] = recs[idx].code;
+            memcpy(out + pos, &recs[idx].serial, 4);
+            memcpy(out + pos + 4, &recs[idx].code, 4);
+            pos += 8;
+            hdr.new_fobs++;
+        }
+        change = (int32_t)(recs[idx].code - cd->fobs.codes[id]);
+        cd->fobs.codes[id] = recs[idx].code;
+        deltas[idx] = ((uint32_t)change << 1) ^ (uint32_t)(change >> 31);
+        fobs[idx] = id;
+        verdicts[idx] = recs[idx].verdict;
+    }
+    for (idx = 0; idx < num; idx++) {
+        uint32_t door = recs[idx].door;
+        if ((id = codec_add(&cd->doors, door, &added)) < 0)
+            return -1;
+        if (added) {
+            memcpy(out + pos, &door, 4);
+            pos += 4;
+            hdr.new_doors++;
+        }
+        doors[idx] = id;
+    }
+
+    // Pack the columns
+    for (col = 0; col <= CODEC_COLUMNS; col++) {
+        int width = codec_width(cd->cols[col], num);
+        if (col < CODEC_COLUMNS)
+            hdr.widths[col] = width;
+        else
+            hdr.verdicts = width;
+        codec_pack(cd->cols[col], num, width, (uint32_t*)(out + pos));
+        pos += (num + CODEC_GROUP - 1) / CODEC_GROUP * CODEC_GROUP / 8 * width;
+    }
+    hdr.size = pos;
+    memcpy(out, &hdr, sizeof(hdr));
+    *size = pos;
+    return num;
+}
+
+
+// Decode the next block of a stream from in, of len bytes, into recs, which
+// must have room for CODEC_BLOCK records. Returns the number of records, or
+// -1 if the block is cut short or corrupt or out of memory.
+int codec_decode(struct codec* cd, const uint8_t* in, int len, struct codec_record* recs) {
+    struct codec_header hdr;
+    uint32_t *dods = cd->cols[CODEC_TIME], *deltas = cd->cols[CODEC_CODE];
+    uint32_t *fobs = cd->cols[CODEC_FOB], *doors = cd->cols[CODEC_DOOR], *verdicts = cd->cols[CODEC_COLUMNS];
+    uint32_t *codes, *serials, *door_keys;
+    uint32_t num_fobs, num_doors, id, val;
+    uint64_t time, delta, tick;
+    int idx, col, pos, num, groups, width;
+
+    if (len < (int)sizeof(hdr))
+        return -1;
+    memcpy(&hdr, in, sizeof(hdr));
+    num = hdr.num;
+    groups = (num + CODEC_GROUP - 1) / CODEC_GROUP;
+    pos = sizeof(hdr) + 8*hdr.new_fobs + 4*hdr.new_doors;
+    for (col = 0; col <= CODEC_COLUMNS; col++) {
+        width = (col < CODEC_COLUMNS) ? hdr.widths[col] : hdr.verdicts;
+        if (width > 32)
+            return -1;
+        pos += groups * CODEC_GROUP / 8 * width;
+    }
+    if (num < 1 || num > CODEC_BLOCK || hdr.size != (uint32_t)pos || len < pos)
+        return -1;
+
+    // Add the remotes and doors that are new
+    if (codec_grow(&cd->fobs, cd->fobs.num + hdr.new_fobs, 0) || codec_grow(&cd->doors, cd->doors.num + hdr.new_doors, 0))
+        return -1;
+    pos = sizeof(hdr);
+    for (idx = 0; idx < hdr.new_fobs; idx++, pos += 8) {
+        memcpy(&cd->fobs.keys[cd->fobs.num], in + pos, 4);
+        memcpy(&cd->fobs.codes[cd->fobs.num++], in + pos + 4, 4);
+    }
+    for (idx = 0; idx < hdr.new_doors; idx++, pos += 4)
+        memcpy(&cd->doors.keys[cd->doors.num++], in + pos, 4);
+
+    // Unpack the columns
+    for (col = 0; col <= CODEC_COLUMNS; col++) {
+        width = (col < CODEC_COLUMNS) ? hdr.widths[col] : hdr.verdicts;
+        codec_unpack((const uint32_t*)(in + pos), num, width, cd->cols[col]);
+        pos += groups * CODEC_GROUP / 8 * width;
+    }
+
+    // Check the ids all at once, then rebuild the records
+    num_fobs = num_doors = 0;
+    for (idx = 0; idx < num; idx++) {
+        num_fobs = (fobs[idx] > num_fobs) ? fobs[idx] : num_fobs;
+        num_doors = (doors[idx] > num_doors) ? doors[idx] : num_doors;
+    }
+    if (num_fobs >= cd->fobs.num || num_doors >= cd->doors.num)
+        return -1;
+    codes = cd->fobs.codes;
+    serials = cd->fobs.keys;
+    door_keys = cd->doors.keys;
+    tick = cd->tick;
+    delta = hdr.delta;
+    time = hdr.time - delta;
+    for (idx = 0; idx < num; idx++) {
+        delta += (int64_t)(int32_t)((dods[idx] >> 1) ^ -(dods[idx] & 1));
+        time += delta;
+        id = fobs[idx];
+        val = codes[id] + ((deltas[idx] >> 1) ^ -(deltas[idx] & 1));
+        codes[id] = val;
+        recs[idx].time = time * tick;
+        recs[idx].serial = serials[id];
+        recs[idx].code = val;
+        recs[idx].door = door_keys[doors[idx]];
+        recs[idx].verdict = verdicts[idx];
+        recs[idx].pad = 0;
+    }
+    cd->time = time;
+    return num;
+}
+
+
+// Return the id of a key in a dictionary, adding it if it is new and setting
+// added. Returns -1 if out of memory.
+int codec_add(struct codec_dict* dc, uint32_t key, int* added) {
+    uint32_t pos;
+
+    for (pos = codec_hash(key) & dc->mask; dc->slots != NULL && dc->slots[pos] != 0; pos = (pos+1) & dc->mask) {
+        if (dc->keys[dc->slots[pos]-1] == key) {
+            *added = 0;
+            return dc->slots[pos] - 1;
+        }
+    }
+    if (codec_grow(dc, dc->num + 1, 1))
+        return -1;
+    for (pos = codec_hash(key) & dc->mask; dc->slots[pos] != 0; pos = (pos+1) & dc->mask)
+        ;
+    dc->keys[dc->num] = key;
+    dc->slots[pos] = ++dc->num;
+    *added = 1;
+    return dc->num - 1;
+}
+
+
+// Make room in a dictionary for num ids, and if hashed, keep its table at
+// most half full. Returns -1 if out of memory.
+int codec_grow(struct codec_dict* dc, int num, int hashed) {
+    uint32_t max = dc->max ? dc->max : 1024, idx, pos;
+
+    while (max < (uint32_t)num)
+        max <<= 1;
+    if (max != dc->max) {
+        uint32_t* keys = realloc(dc->keys, max*sizeof(*keys));
+        uint32_t* codes = keys ? realloc(dc->codes, max*sizeof(*codes)) : NULL;
+        if (keys)
+            dc->keys = keys;
+        if (codes == NULL) {
+            fprintf(stderr, "Could not grow the dictionary\n");
+            return -1;
+        }
+        dc->codes = codes;
+        dc->max = max;
+    }
+    if (hashed && (dc->slots == NULL || dc->mask + 1 < 2*max)) {
+        free(dc->slots);
+        dc->mask = 2*max - 1;
+        if ((dc->slots = calloc(2*max, sizeof(*dc->slots))) == NULL) {
+            fprintf(stderr, "Could not grow the dictionary\n");
+            return -1;
+        }
+        for (idx = 0; idx < dc->num; idx++) {
+            for (pos = codec_hash(dc->keys[idx]) & dc->mask; dc->slots[pos] != 0; pos = (pos+1) & dc->mask)
+                ;
+            dc->slots[pos] = idx + 1;
+        }
+    }
+    return 0;
+}
+
+
+// Pack num numbers with width bits each into groups across the lanes, with
+// zeros after the last.
+void codec_pack(const uint32_t* vals, int num, int width, uint32_t* out) {
+    int groups = (num + CODEC_GROUP - 1) / CODEC_GROUP, grp, idx, lane, bit;
+    uint32_t val;
+
+    memset(out, 0, groups * CODEC_GROUP / 8 * width);
+    for (grp = 0; grp < groups && width > 0; grp++, out += CODEC_LANES*width) {
+        for (idx = 0; idx < CODEC_GROUP && grp*CODEC_GROUP + idx < num; idx++) {
+            val = vals[grp*CODEC_GROUP + idx];
+            lane = idx % CODEC_LANES;
+            bit = idx / CODEC_LANES * width;
+            out[bit/32*CODEC_LANES + lane] |= val << (bit % 32);
+            if (bit % 32 + width > 32)
+                out[(bit/32 + 1)*CODEC_LANES + lane] |= val >> (32 - bit % 32);
+        }
+    }
+}
+
+
+// Unpack a group of numbers of a width known when compiled. Every row of 16
+// numbers is a shift and a mask of the words of the lanes, or of two of them
+// where a row crosses from one into the next.
+static inline __attribute__((always_inline)) void codec_unpack_group(const uint32_t* in, int width, uint32_t* out) {
+    codec_v32 cur, next, val;
+    uint32_t mask = (width == 32) ? 0xFFFFFFFF : (1u << width) - 1;
+    int row, shift = 0;
+
+    memcpy(&cur, in, sizeof(cur));
+    #pragma GCC unroll 32
+    for (row = 0; row < CODEC_GROUP / CODEC_LANES; row++) {
+        val = cur >> shift;
+        if (shift + width > 32) {
+            in += CODEC_LANES;
+            memcpy(&next, in, sizeof(next));
+            val |= next << (32 - shift);
+            cur = next;
+        } else if (shift + width == 32 && row + 1 < CODEC_GROUP / CODEC_LANES) {
+            in += CODEC_LANES;
+            memcpy(&cur, in, sizeof(cur));
+        }
+        shift = (shift + width) % 32;
+        val &= mask;
+        memcpy(out + CODEC_LANES*row, &val, sizeof(val));
+    }
+}
+
+#define CODEC_UNPACK(w) case w: { for (grp = 0; grp < groups; grp++) \
+    codec_unpack_group(in + grp*CODEC_LANES*w, w, out + grp*CODEC_GROUP); } break;
+
+
+// Unpack the groups that hold num numbers of width bits each.
+void codec_unpack(const uint32_t* in, int num, int width, uint32_t* out) {
+    int groups = (num + CODEC_GROUP - 1) / CODEC_GROUP, grp;
+
+    switch (width) {
+    case 0: memset(out, 0, num*sizeof(*out)); break;
+    CODEC_UNPACK(1)  CODEC_UNPACK(2)  CODEC_UNPACK(3)  CODEC_UNPACK(4)
+    CODEC_UNPACK(5)  CODEC_UNPACK(6)  CODEC_UNPACK(7)  CODEC_UNPACK(8)
+    CODEC_UNPACK(9)  CODEC_UNPACK(10) CODEC_UNPACK(11) CODEC_UNPACK(12)
+    CODEC_UNPACK(13) CODEC_UNPACK(14) CODEC_UNPACK(15) CODEC_UNPACK(16)
+    CODEC_UNPACK(17) CODEC_UNPACK(18) CODEC_UNPACK(19) CODEC_UNPACK(20)
+    CODEC_UNPACK(21) CODEC_UNPACK(22) CODEC_UNPACK(23) CODEC_UNPACK(24)
+    CODEC_UNPACK(25) CODEC_UNPACK(26) CODEC_UNPACK(27) CODEC_UNPACK(28)
+    CODEC_UNPACK(29) CODEC_UNPACK(30) CODEC_UNPACK(31) CODEC_UNPACK(32)
+    }
+}
+
+
+// Return the fewest bits that hold every one of num numbers.
+int codec_width(const uint32_t* vals, int num) {
+    uint32_t all = 0;
+    int idx;
+
+    for (idx = 0; idx < num; idx++)
+        all |= vals[idx];
+    return all ? 32 - __builtin_clz(all) : 0;
+}
+
+
+// Mix the bits of a key, as the finalizer of MurmurHash3 does.
+uint32_t codec_hash(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x85EBCA6B;
+    key ^= key >> 13;
+    key *= 0xC2B2AE35;
+    key ^= key >> 16;
+    return key;
+}
+
+
+#endif /* _VERIFIER_CODEC_H */
@@ -0,0 +1,423 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_COLUMN_H
+#define _VERIFIER_COLUMN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+
+
+// This keeps the audit trail in columns, so that investigations which scan
+// it by time, door, remote and verdict only read what they ask about. The
+// records are gathered into chunks of COLUMN_ROWS, each with a column for
+// every field:
+//
+//  time:     The microseconds since the first record of the chunk, in 32 bits,
+//            so a chunk is also sealed once its records span too long for them,
+//            and the nanoseconds past the microsecond in another column
+//  remote:   A code into a dictionary of the serials in the chunk
+//  door:     A code into a dictionary of the doors in the chunk
+//  verdict:  A bitmap of the records with every verdict
+//
+// Every chunk has a zone map of the least and greatest time, serial and door
+// in it and the verdicts that it has, so that a query skips the chunks that
+// cannot match, and those that do not have the remote or door in their
+// dictionary. The predicates on a chunk are then evaluated on 64 records at a
+// time with the GCC vector extensions, each giving a byte per record that is
+// packed into a word of bits, and the words are anded with each other and
+// with the bitmaps of the verdicts asked for. Only the records in the first
+// and last microsecond of the query have their nanoseconds read, to compare
+// the times in full. The columns are padded to a multiple of 64 records so
+// that the last block can be read whole.
+//
+// The chunk that is being filled is kept as rows, and queries do not see it
+// until it is sealed by column_seal() or by filling up.
+
+#define COLUMN_ROWS   16384        // Records per chunk, a multiple of 64
+#define COLUMN_ANY    0xFFFFFFFF   // Matches every remote or door
+#define COLUMN_SPAN   0xFFFFFFFFull // The most microseconds in a chunk
+
+
+/* Vector types for the predicates */
+typedef uint32_t column_v32 __attribute__((vector_size(64)));
+typedef uint16_t column_v16 __attribute__((vector_size(64)));
+typedef int8_t column_b16 __attribute__((vector_size(16)));
+typedef int8_t column_b32 __attribute__((vector_size(32)));
+
+/* What a chunk can hold */
+struct column_zone {
+    uint64_t time_min;
+    uint64_t time_max;
+    uint32_t serial_min;
+    uint32_t serial_max;
+    uint32_t door_min;
+    uint32_t door_max;
+    uint32_t verdicts;  // Bit N is set if a record has verdict N
+};
+
+/* A sealed chunk of records */
+struct column_chunk {
+    int num_rows;
+    uint64_t base;      // The time of the first record
+    uint32_t* times;
+    uint16_t* nanos;
+    uint16_t* fobs;
+    uint16_t* doors;
+    uint64_t* results[NUM_VERDICTS];
+    uint32_t* fob_dict;
+    uint32_t* door_dict;
+    int num_fobs;
+    int num_doors;
+    struct column_zone zone;
+};
+
+/* A record of the chunk that is being filled */
+struct column_row {
+    struct audit_record rec;
+    uint32_t door;
+};
+
+/* A query, which matches the records that meet every predicate */
+struct column_query {
+    uint64_t time_lo;   // The first time that matches
+    uint64_t time_hi;   // The last time that matches
+    uint32_t serial;    // Or COLUMN_ANY
+    uint32_t door;      // Or COLUMN_ANY
+    uint32_t verdicts;  // Bit N is set to match verdict N
+};
+
+/* A store of audit records in columns */
+struct column_store {
+    struct column_chunk* chunks;
+    int num_chunks;
+    int max_chunks;
+    struct column_row* rows;
+    int num_rows;
+
+    // Open addressing tables from serials and doors to their codes, used to
+    // build the dictionaries of a chunk
+    uint32_t* keys;
+    uint16_t* codes;
+
+    // Statistics of the last scan
+    uint64_t chunks_skipped;
+    uint64_t rows_scanned;
+};
+
+
+int column_init(struct column_store* st);
+void column_free(struct column_store* st);
+int column_append(struct column_store* st, const struct audit_record* ar, uint32_t door);
+int column_seal(struct column_store* st);
+uint64_t column_scan(struct column_store* st, const struct column_query* q, uint64_t* matches, uint64_t max_matches);
+uint64_t column_scan_chunk(const struct column_chunk* ck, const struct column_query* q, uint64_t first, uint64_t* matches, uint64_t max_matches);
+int column_encode(struct column_store* st, uint32_t* dict, uint16_t* codes, int field);
+int column_find(const uint32_t* dict, int num, uint32_t key);
+uint64_t column_range(const uint32_t* vals, uint32_t lo, uint32_t hi);
+uint64_t column_equal(const uint16_t* vals, uint16_t code);
+uint64_t column_pack(const uint8_t* bytes);
+uint32_t column_hash(uint32_t key);
+
+
+// Set up an empty store. Returns -1 if out of memory.
+int column_init(struct column_store* st) {
+    memset(st, 0, sizeof(*st));
+    st->rows = malloc(COLUMN_ROWS*sizeof(*st->rows));
+    st->keys = malloc(2*COLUMN_ROWS*sizeof(*st->keys));
+    st->codes = malloc(2*COLUMN_ROWS*sizeof(*st->codes));
+    if (st->rows == NULL || st->keys == NULL || st->codes == NULL) {
+        column_free(st);
+        fprintf(stderr, "Could not allocate the store\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of a store and every chunk in it.
+void column_free(struct column_store* st) {
+    int idx, ver;
+
+    for (idx = 0; idx < st->num_chunks; idx++) {
+        struct column_chunk* ck = &st->chunks[idx];
+        free(ck->times);
+        free(ck->nanos);
+        free(ck->fobs);
+        free(ck->doors);
+        for (ver = 0; ver < NUM_VERDICTS; ver++)
+            free(ck->results[ver]);
+        free(ck->fob_dict);
+        free(ck->door_dict);
+    }
+    free(st->chunks);
+    free(st->rows);
+    free(st->keys);
+    free(st->codes);
+    memset(st, 0, sizeof(*st));
+}
+
+
+// Append an audit record of a message heard at a door, sealing the chunk
+// first if it is full or the record is too late for it. Records must be
+// appended in order of time. Returns -1 if out of memory.
+int column_append(struct column_store* st, const struct audit_record* ar, uint32_t door) {
+    if (st->num_rows == COLUMN_ROWS ||
+        (st->num_rows > 0 && (ar->time - st->rows[0].rec.time) / 1000 > COLUMN_SPAN))
+        if (column_seal(st))
+            return -1;
+    st->rows[st->num_rows].rec = *ar;
+    st->rows[st->num_rows++].door = door;
+    return 0;
+}
+
+
+// Turn the records that are being filled into a sealed chunk, if there are
+// any. Returns -1 if out of memory.
+int column_seal(struct column_store* st) {
+    struct column_chunk* ck;
+    int idx, ver, num = st->num_rows, pad = (num + 63) / 64 * 64;
+
+    if (num == 0)
+        return 0;
+    if (st->num_chunks == st->max_chunks) {
+        int max = st->max_chunks ? 2*st->max_chunks : 64;
+        struct column_chunk* chunks = realloc(st->chunks, max*sizeof(*chunks));
+        if (chunks == NULL) {
+            fprintf(stderr, "Could not grow the store\n");
+            return -1;
+        }
+        st->chunks = chunks;
+        st->max_chunks = max;
+    }
+    ck = &st->chunks[st->num_chunks];
+    memset(ck, 0, sizeof(*ck));
+    ck->num_rows = num;
+    ck->base = st->rows[0].rec.time;
+    ck->times = aligned_alloc(64, pad*sizeof(*ck->times));
+    ck->nanos = aligned_alloc(64, pad*sizeof(*ck->nanos));
+    ck->fobs = aligned_alloc(64, pad*sizeof(*ck->fobs));
+    ck->doors = aligned_alloc(64, pad*sizeof(*ck->doors));
+    for (ver = 0; ver < NUM_VERDICTS; ver++)
+        ck->results[ver] = calloc(pad / 64, sizeof(uint64_t));
+    ck->fob_dict = malloc(num*sizeof(*ck->fob_dict));
+    ck->door_dict = malloc(num*sizeof(*ck->door_dict));
+    for (ver = 0; ver < NUM_VERDICTS && ck->results[ver] != NULL; ver++)
+        ;
+    if (ck->times == NULL || ck->nanos == NULL || ck->fobs == NULL || ck->doors == NULL || ver < NUM_VERDICTS ||
+        ck->fob_dict == NULL || ck->door_dict == NULL) {
+        st->num_chunks++;
+        fprintf(stderr, "Could not allocate a chunk\n");
+        return -1;
+    }
+    memset(ck->times, 0, pad*sizeof(*ck->times));
+    memset(ck->nanos, 0, pad*sizeof(*ck->nanos));
+    memset(ck->fobs, 0, pad*sizeof(*ck->fobs));
+    memset(ck->doors, 0, pad*sizeof(*ck->doors));
+
+    // Fill the columns and the zone map
+    ck->zone.time_min = ck->base;
+    ck->zone.time_max = st->rows[num-1].rec.time;
+    ck->zone.serial_min = ck->zone.door_min = 0xFFFFFFFF;
+    for (idx = 0; idx < num; idx++) {
+        struct column_row* rw = &st->rows[idx];
+        ck->times[idx] = (rw->rec.time - ck->base) / 1000;
+        ck->nanos[idx] = (rw->rec.time - ck->base) % 1000;
+        ck->results[rw->rec.verdict % NUM_VERDICTS][idx / 64] |= (uint64_t)1 << (idx % 64);
+        ck->zone.verdicts |= 1u << (rw->rec.verdict % NUM_VERDICTS);
+        ck->zone.serial_min = (rw->rec.serial < ck->zone.serial_min) ? rw->rec.serial : ck->zone.serial_min;
+        ck->zone.serial_max = (rw->rec.serial > ck->zone.serial_max) ? rw->rec.serial : ck->zone.serial_max;
+        ck->zone.door_min = (rw->door < ck->zone.door_min) ? rw->door : ck->zone.door_min;
+        ck->zone.door_max = (rw->door > ck->zone.door_max) ? rw->door : ck->zone.door_max;
+    }
+    ck->num_fobs = column_encode(st, ck->fob_dict, ck->fobs, 0);
+    ck->num_doors = column_encode(st, ck->door_dict, ck->doors, 1);
+    st->num_chunks++;
+    st->num_rows = 0;
+    return 0;
+}
+
+
+// Find every record that matches a query, storing up to max_matches of their
+// numbers in order of time in matches if not NULL. Returns the number of
+// matches.
+uint64_t column_scan(struct column_store* st, const struct column_query* q, uint64_t* matches, uint64_t max_matches) {
+    uint64_t found = 0, first = 0;
+    int idx;
+
+    st->chunks_skipped = 0;
+    st->rows_scanned = 0;
+    for (idx = 0; idx < st->num_chunks; first += st->chunks[idx++].num_rows) {
+        const struct column_chunk* ck = &st->chunks[idx];
+        const struct column_zone* zn = &ck->zone;
+        if (zn->time_max < q->time_lo || zn->time_min > q->time_hi || !(zn->verdicts & q->verdicts) ||
+            (q->serial != COLUMN_ANY && (q->serial < zn->serial_min || q->serial > zn->serial_max)) ||
+            (q->door != COLUMN_ANY && (q->door < zn->door_min || q->door > zn->door_max))) {
+            st->chunks_skipped++;
+            continue;
+        }
+        found += column_scan_chunk(ck, q, first, matches ? matches + found : NULL,
+            (found < max_matches) ? max_matches - found : 0);
+        st->rows_scanned += ck->num_rows;
+    }
+    return found;
+}
+
+
+// Find the records of a chunk that match a query, whose first record is
+// number first. Returns the number of matches.
+uint64_t column_scan_chunk(const struct column_chunk* ck, const struct column_query* q, uint64_t first, uint64_t* matches, uint64_t max_matches) {
+    uint32_t lo = 0, hi = 0xFFFFFFFF;
+    uint64_t found = 0, bits, edge;
+    int blk, ver, idx, fob = -1, door = -1, timed = 0, edge_lo = 0, edge_hi = 0;
+
+    // The codes of the remote and door, which the chunk may not have at all
+    if (q->serial != COLUMN_ANY && (fob = column_find(ck->fob_dict, ck->num_fobs, q->serial)) < 0)
+        return 0;
+    if (q->door != COLUMN_ANY && (door = column_find(ck->door_dict, ck->num_doors, q->door)) < 0)
+        return 0;
+
+    // The time range in microseconds since the base, which is only checked
+    // if the chunk is not wholly inside of it. The records in a microsecond
+    // that the range only covers part of are compared in nanoseconds.
+    if (q->time_lo > ck->zone.time_min) {
+        lo = (q->time_lo - ck->base) / 1000;
+        edge_lo = ((q->time_lo - ck->base) % 1000 != 0);
+        timed = 1;
+    }
+    if (q->time_hi < ck->zone.time_max) {
+        hi = (q->time_hi - ck->base) / 1000;
+        edge_hi = ((q->time_hi - ck->base) % 1000 != 999);
+        timed = 1;
+    }
+
+    for (blk = 0; blk < (ck->num_rows + 63) / 64; blk++) {
+        bits = 0;
+        for (ver = 0; ver < NUM_VERDICTS; ver++)
+            if (q->verdicts >> ver & 1)
+                bits |= ck->results[ver][blk];
+        if (bits != 0 && timed)
+            bits &= column_range(ck->times + 64*blk, lo, hi);
+        if (bits != 0 && (edge_lo || edge_hi)) {
+            edge = 0;
+            if (edge_lo)
+                edge |= column_range(ck->times + 64*blk, lo, lo);
+            if (edge_hi)
+                edge |= column_range(ck->times + 64*blk, hi, hi);
+            for (edge &= bits; edge != 0; edge &= edge - 1) {
+                idx = 64*blk + __builtin_ctzll(edge);
+                uint64_t time = ck->base + (uint64_t)ck->times[idx]*1000 + ck->nanos[idx];
+                if (time < q->time_lo || time > q->time_hi)
+                    bits &= ~((uint64_t)1 << (idx % 64));
+            }
+        }
+        if (bits != 0 && door >= 0)
+            bits &= column_equal(ck->doors + 64*blk, door);
+        if (bits != 0 && fob >= 0)
+            bits &= column_equal(ck->fobs + 64*blk, fob);
+        for (; bits != 0; bits &= bits - 1) {
+            if (found < max_matches && matches != NULL)
+                matches[found] = first + 64*blk + __builtin_ctzll(bits);
+            found++;
+        }
+    }
+    return found;
+}
+
+
+// Encode the serials, or the doors if field is set, of the records that are
+// being filled as codes into a dictionary of them, in order of appearance.
+// Returns the size of the dictionary.
+int column_encode(struct column_store* st, uint32_t* dict, uint16_t* codes, int field) {
+    uint32_t mask = 2*COLUMN_ROWS - 1, pos, key;
+    int idx, num = 0;
+
+    memset(st->keys, 0xFF, 2*COLUMN_ROWS*sizeof(*st->keys));
+    for (idx = 0; idx < st->num_rows; idx++) {
+        key = field ? st->rows[idx].door : st->rows[idx].rec.serial;
+        for (pos = column_hash(key) & mask; st->keys[pos] != COLUMN_ANY && st->keys[pos] != key; pos = (pos+1) & mask)
+            ;
+        if (st->keys[pos] == COLUMN_ANY) {
+            st->keys[pos] = key;
+            st->codes[pos] = num;
+            dict[num++] = key;
+        }
+        codes[idx] = st->codes[pos];
+    }
+    return num;
+}
+
+
+// Return the code of a key in a dictionary, or -1 if it is not in it.
+int column_find(const uint32_t* dict, int num, uint32_t key) {
+    int idx;
+
+    for (idx = 0; idx < num; idx++)
+        if (dict[idx] == key)
+            return idx;
+    return -1;
+}
+
+
+// Return the bits of the 64 values that are from lo to hi.
+uint64_t column_range(const uint32_t* vals, uint32_t lo, uint32_t hi) {
+    uint8_t bytes[64];
+    column_v32 v;
+    int idx;
+
+    for (idx = 0; idx < 4; idx++) {
+        memcpy(&v, vals + 16*idx, sizeof(v));
+        column_b16 b = __builtin_convertvector((column_v32)(v - lo <= hi - lo), column_b16);
+        memcpy(bytes + 16*idx, &b, sizeof(b));
+    }
+    return column_pack(bytes);
+}
+
+
+// Return the bits of the 64 values that equal a code.
+uint64_t column_equal(const uint16_t* vals, uint16_t code) {
+    uint8_t bytes[64];
+    column_v16 v;
+    int idx;
+
+    for (idx = 0; idx < 2; idx++) {
+        memcpy(&v, vals + 32*idx, sizeof(v));
+        column_b32 b = __builtin_convertvector((column_v16)(v == code), column_b32);
+        memcpy(bytes + 32*idx, &b, sizeof(b));
+    }
+    return column_pack(bytes);
+}
+
+
+// Pack 64 bytes that are each all ones or all zeros into a word of bits. The
+// top bit of every byte of a group of eight is gathered into the top byte of
+// their product with a constant.
+uint64_t column_pack(const uint8_t* bytes) {
+    uint64_t bits = 0, group;
+    int idx;
+
+    for (idx = 0; idx < 8; idx++) {
+        memcpy(&group, bytes + 8*idx, 8);
+        bits |= (((group & 0x8080808080808080ull) * 0x0002040810204081ull) >> 56) << 8*idx;
+    }
+    return bits;
+}
+
+
+// Mix the bits of a key, as the finalizer of MurmurHash3 does.
+uint32_t column_hash(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x85EBCA6B;
+    key ^= key >> 13;
+    key *= 0xC2B2AE35;
+    key ^= key >> 16;
+    return key;
+}
+
+
+#endif /* _VERIFIER_COLUMN_H */
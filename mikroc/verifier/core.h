@@ -0,0 +1,227 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_CORE_H
+#define _VERIFIER_CORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "verifier.h"
+#include "arena.h"
+#include "journal.h"
+
+
+// This is the path of a message through one core of the verification daemon,
+// from the receiver to the verdict:
+//
+//  receive:  The message is copied into a buffer from the slab of the core
+//  verify:   Full batches go through verifier_check_batch(), with the arrays
+//            of the batch taken from the arena of the core
+//  journal:  The state of every remote that accepted a code is appended to
+//            the journal, and every message to the audit log, and the time
+//            that the remote was last heard is kept in its state
+//
+// Each core of the daemon has its own, sharing only the verifier, so once the
+// buffers are taken and the journals written the first time, a core never
+// allocates memory again. For comparison, a core can instead be opened to
+// allocate everything with malloc() as it goes.
+
+#define CORE_FRAMES  (2*VERIFIER_BATCH)  // Receive buffers per core
+#define CORE_ARENA   (16*1024)           // Bytes of the arena per core
+
+
+/* A message received by a core */
+struct core_frame {
+    void* link;     // The next free buffer while in the slab
+    uint64_t arrival;
+    uint8_t data[FRAME_MAX];
+    uint8_t len;
+};
+
+/* A record of the journal, from which the channel store can be rebuilt */
+struct journal_record {
+    uint32_t serial;
+    uint32_t state;
+    uint64_t replay;
+};
+
+/* A record of the audit log */
+struct audit_record {
+    uint64_t time;   // Arrival in nanoseconds of the monotonic clock
+    uint32_t serial; // The serial number, or 0 if the remote is not known
+    uint8_t verdict;
+    uint8_t ver;
+    uint16_t len;
+};
+
+/* One core of the verification daemon */
+struct core {
+    struct verifier* vf;
+    int general;  // Allocate with malloc() as it goes
+    int size;     // The number of messages per batch
+    struct arena arena;
+    struct slab frames;
+    struct journal journal;
+    struct journal audit;
+    struct core_frame* batch[VERIFIER_BATCH];
+    int num;
+    uint64_t verdicts[NUM_VERDICTS];
+};
+
+
+int core_init(struct core* cr, struct verifier* vf, int size, int journal_fd, int audit_fd, int general);
+void core_free(struct core* cr);
+int core_receive(struct core* cr, const uint8_t* data, int len, uint64_t now);
+int core_flush(struct core* cr, uint32_t* latencies);
+uint64_t core_clock();
+
+
+// Set up a core that verifies messages in batches of size and writes its
+// journal and audit log to the given file descriptors. Returns -1 if out of
+// memory.
+int core_init(struct core* cr, struct verifier* vf, int size, int journal_fd, int audit_fd, int general) {
+    memset(cr, 0, sizeof(*cr));
+    cr->vf = vf;
+    cr->general = general;
+    cr->size = (size < 1) ? 1 : (size > VERIFIER_BATCH) ? VERIFIER_BATCH : size;
+    if (arena_init(&cr->arena, CORE_ARENA) || slab_init(&cr->frames, sizeof(struct core_frame), CORE_FRAMES) ||
+        journal_init(&cr->journal, journal_fd, JOURNAL_BUFFER, !general) ||
+        journal_init(&cr->audit, audit_fd, JOURNAL_BUFFER, !general)) {
+        core_free(cr);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of a core, dropping any messages that were not verified.
+void core_free(struct core* cr) {
+    int idx;
+
+    if (cr->general)
+        for (idx = 0; idx < cr->num; idx++)
+            free(cr->batch[idx]);
+    arena_free(&cr->arena);
+    slab_free(&cr->frames);
+    journal_free(&cr->journal);
+    journal_free(&cr->audit);
+    memset(cr, 0, sizeof(*cr));
+}
+
+
+// Receive a message of len bytes that arrived at now in nanoseconds. A message
+// longer than FRAME_MAX keeps only FRAME_MAX bytes but a length one more, as in
+// batcher_add(), so that it is rejected as malformed. Returns 1 if the batch is
+// now full and must be flushed, 0 if not, or -1 if the length is negative,
+// there was no buffer for the message or the batch was not flushed when it was
+// full.
+int core_receive(struct core* cr, const uint8_t* data, int len, uint64_t now) {
+    struct core_frame* fr;
+
+    if (cr->num >= cr->size || len < 0)
+        return -1;
+    if (len > FRAME_MAX)
+        len = FRAME_MAX + 1;
+    fr = cr->general ? malloc(sizeof(*fr)) : slab_get(&cr->frames);
+    if (fr == NULL)
+        return -1;
+    fr->arrival = now;
+    fr->len = len;
+    memcpy(fr->data, data, (len > FRAME_MAX) ? FRAME_MAX : len);
+    cr->batch[cr->num++] = fr;
+    return cr->num >= cr->size;
+}
+
+
+// Verify the received messages and append them to the journal and audit log.
+// The time from the arrival of each message until it was logged is stored in
+// latencies in nanoseconds, if not NULL. Returns the number of messages, or -1
+// if out of memory or the logs could not be written.
+int core_flush(struct core* cr, uint32_t* latencies) {
+    const uint8_t** data;
+    uint8_t* lens;
+    int *verdicts, *slots, idx, num = cr->num, ret = num;
+    uint64_t done;
+
+    if (num == 0)
+        return 0;
+    if (cr->general) {
+        data = malloc(num*sizeof(*data));
+        lens = malloc(num*sizeof(*lens));
+        verdicts = malloc(num*sizeof(*verdicts));
+        slots = malloc(num*sizeof(*slots));
+    } else {
+        data = arena_alloc(&cr->arena, num*sizeof(*data));
+        lens = arena_alloc(&cr->arena, num*sizeof(*lens));
+        verdicts = arena_alloc(&cr->arena, num*sizeof(*verdicts));
+        slots = arena_alloc(&cr->arena, num*sizeof(*slots));
+    }
+    if (data == NULL || lens == NULL || verdicts == NULL || slots == NULL) {
+        ret = -1;
+        goto release;
+    }
+    for (idx = 0; idx < num; idx++) {
+        data[idx] = cr->batch[idx]->data;
+        lens[idx] = cr->batch[idx]->len;
+    }
+    verifier_check_batch(cr->vf, data, lens, num, verdicts, slots);
+
+    // Log every message, and the new state of every remote that accepted one
+    for (idx = 0; idx < num && ret >= 0; idx++) {
+        struct core_frame* fr = cr->batch[idx];
+        struct audit_record ar = {fr->arrival, 0, verdicts[idx], 0, fr->len};
+        if (slots[idx] >= 0)
+            ar.serial = cr->vf->serials[slots[idx]];
+        if (fr->len > 4)
+            ar.ver = fr->data[4] >> 4;
+        if (journal_append(&cr->audit, &ar, sizeof(ar)))
+            ret = -1;
+        if (verdicts[idx] == VERDICT_ACCEPT) {
+            struct journal_record jr = {ar.serial, cr->vf->states[slots[idx]].state,
+                __atomic_load_n(&cr->vf->states[slots[idx]].replay, __ATOMIC_RELAXED)};
+            verifier_touch(cr->vf, slots[idx], 0);
+            cr->vf->states[slots[idx]].heard = fr->arrival / 1000000000;
+            if (journal_append(&cr->journal, &jr, sizeof(jr)))
+                ret = -1;
+        }
+        cr->verdicts[verdicts[idx]]++;
+    }
+    done = core_clock();
+    if (latencies != NULL)
+        for (idx = 0; idx < num; idx++)
+            latencies[idx] = done - cr->batch[idx]->arrival;
+
+release:
+    for (idx = 0; idx < num; idx++) {
+        if (cr->general)
+            free(cr->batch[idx]);
+        else
+            slab_put(&cr->frames, cr->batch[idx]);
+    }
+    cr->num = 0;
+    if (cr->general) {
+        free(data);
+        free(lens);
+        free(verdicts);
+        free(slots);
+    } else {
+        arena_reset(&cr->arena);
+    }
+    return ret;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t core_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#endif /* _VERIFIER_CORE_H */
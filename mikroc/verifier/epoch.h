@@ -0,0 +1,156 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_EPOCH_H
+#define _VERIFIER_EPOCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This is epoch based reclamation, which frees memory that a writer has
+// unlinked once no reader can still be using it, without readers taking locks
+// or counting references. Readers register once and wrap every access to the
+// shared memory in epoch_enter() and epoch_exit():
+//
+//  enter:    Publish that the reader is active in the current global epoch
+//  retire:   Queue memory that was unlinked in the current epoch to be freed
+//  advance:  Move the global epoch on if every active reader has seen it, and
+//            free the memory that was retired two epochs ago
+//
+// A reader that is active in epoch E can only hold pointers that were still
+// linked in epoch E-1 or later. Once every active reader has seen epoch E, the
+// memory retired in epoch E-1 was unlinked before any of them entered, so it
+// is freed before the epoch moves on to E+1. The retired memory is therefore
+// kept in one list for each of the last three epochs.
+//
+// Only one thread may retire memory and advance the epoch at a time, which is
+// the writer of the structure that is protected.
+
+#define EPOCH_READERS  64
+#define EPOCH_LISTS    3
+
+
+/* Memory waiting to be freed */
+struct epoch_retired {
+    void* ptr;
+    struct epoch_retired* next;
+};
+
+/* The state of a reader, on a cache line of its own */
+struct epoch_reader {
+    uint64_t state; // The epoch it entered shifted up by one, and 1 if active
+} __attribute__((aligned(64)));
+
+/* The epochs of the readers of a shared structure */
+struct epoch {
+    uint64_t global;
+    int num_readers;
+    struct epoch_reader readers[EPOCH_READERS];
+    struct epoch_retired* retired[EPOCH_LISTS];
+    uint64_t pending; // The number of retired pointers not yet freed
+};
+
+
+void epoch_init(struct epoch* ep);
+void epoch_free(struct epoch* ep);
+int epoch_register(struct epoch* ep);
+void epoch_enter(struct epoch* ep, int id);
+void epoch_exit(struct epoch* ep, int id);
+int epoch_retire(struct epoch* ep, void* ptr);
+int epoch_advance(struct epoch* ep);
+
+
+// Set up the epochs with no readers.
+void epoch_init(struct epoch* ep) {
+    memset(ep, 0, sizeof(*ep));
+}
+
+
+// Free all retired memory. No reader may be active.
+void epoch_free(struct epoch* ep) {
+    struct epoch_retired *node, *next;
+    int idx;
+
+    for (idx = 0; idx < EPOCH_LISTS; idx++) {
+        for (node = ep->retired[idx]; node != NULL; node = next) {
+            next = node->next;
+            free(node->ptr);
+            free(node);
+        }
+    }
+    memset(ep, 0, sizeof(*ep));
+}
+
+
+// Register a reader. Returns its id, or -1 if there are too many readers.
+int epoch_register(struct epoch* ep) {
+    int id = __atomic_fetch_add(&ep->num_readers, 1, __ATOMIC_RELAXED);
+
+    if (id >= EPOCH_READERS) {
+        fprintf(stderr, "Too many readers of an epoch\n");
+        return -1;
+    }
+    return id;
+}
+
+
+// Mark a reader as active in the current epoch. The store is sequentially
+// consistent so that it is visible before any of the loads that follow it.
+void epoch_enter(struct epoch* ep, int id) {
+    uint64_t global = __atomic_load_n(&ep->global, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&ep->readers[id].state, global << 1 | 1, __ATOMIC_SEQ_CST);
+}
+
+
+// Mark a reader as no longer active.
+void epoch_exit(struct epoch* ep, int id) {
+    __atomic_store_n(&ep->readers[id].state, 0, __ATOMIC_RELEASE);
+}
+
+
+// Queue memory that was unlinked to be freed once no reader can hold it.
+// Returns -1 if out of memory, in which case it is leaked.
+int epoch_retire(struct epoch* ep, void* ptr) {
+    struct epoch_retired* node = malloc(sizeof(*node));
+    uint64_t global = __atomic_load_n(&ep->global, __ATOMIC_RELAXED);
+
+    if (node == NULL)
+        return -1;
+    node->ptr = ptr;
+    node->next = ep->retired[global % EPOCH_LISTS];
+    ep->retired[global % EPOCH_LISTS] = node;
+    ep->pending++;
+    return 0;
+}
+
+
+// Move the global epoch on if every active reader has entered it, freeing the
+// memory retired in the epoch before. Returns 1 if the epoch moved on.
+int epoch_advance(struct epoch* ep) {
+    uint64_t global = __atomic_load_n(&ep->global, __ATOMIC_RELAXED);
+    struct epoch_retired *node, *next;
+    int idx, num = __atomic_load_n(&ep->num_readers, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (idx = 0; idx < num && idx < EPOCH_READERS; idx++) {
+        uint64_t state = __atomic_load_n(&ep->readers[idx].state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != global)
+            return 0;
+    }
+    for (node = ep->retired[(global + EPOCH_LISTS-1) % EPOCH_LISTS]; node != NULL; node = next) {
+        next = node->next;
+        free(node->ptr);
+        free(node);
+        ep->pending--;
+    }
+    ep->retired[(global + EPOCH_LISTS-1) % EPOCH_LISTS] = NULL;
+    __atomic_store_n(&ep->global, global + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+#endif /* _VERIFIER_EPOCH_H */
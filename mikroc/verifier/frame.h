@@ -0,0 +1,155 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_FRAME_H
+#define _VERIFIER_FRAME_H
+
+#include <stdint.h>
+#include <string.h>
+
+
+// This is the host-side view of the message that follows the frame marker.
+// See transmit_code() in transmitter.c for the two layouts:
+//
+//  +---+---+---+---+-----+------+-----+
+//  | rolling_code  | ver | chan | crc |
+//  +---+---+---+---+-----+------+-----+
+//  +---+---+---+---+-----+------+---+---+---+---+---+
+//  | rolling_code  | ver | chan |  serial   |  mac  |
+//  +---+---+---+---+-----+------+---+---+---+---+---+
+//
+// All multi-byte fields are little endian, as laid out by MikroC. The version
+// and channel share a byte, with the version in the upper nibble. The version
+// names the cipher and whether the message carries a MAC. Messages without a
+// MAC carry no serial number either, so the channel doubles as the serial.
+
+#define FRAME_MARK     0x96
+#define FRAME_LEN      6
+#define FRAME_LEN_MAC  10
+#define FRAME_MAX      10
+#define FRAME_CHANS    16
+
+/* Frame version bits */
+#define FRAME_CIPHER    0x01 // Mask of the cipher bits
+#define FRAME_BLOWFISH  0x00
+#define FRAME_SPECK     0x01
+#define FRAME_MAC       0x02
+
+
+/* A parsed message */
+struct frame {
+    uint32_t block;  // The encrypted rolling code
+    uint8_t ver;
+    uint8_t chan;
+    uint32_t serial; // Identifies the remote, 24 bits
+    uint16_t mac;    // Only valid if the version has FRAME_MAC set
+};
+
+
+uint8_t frame_crc(const uint8_t* data, int num);
+int frame_length(uint8_t chan);
+int frame_parse(const uint8_t* data, int num, struct frame* frm);
+void frame_build(const struct frame* frm, uint8_t* data);
+void frame_mac_words(const uint8_t* data, uint32_t* m0, uint32_t* m1);
+int frame_valid(const uint8_t* data, int num);
+int frame_serial_valid(uint32_t serial);
+
+
+// Compute the CRC-8 according to the CCITT polynomial of 0x8D. This matches
+// crc_ccitt() in crypto/crc.h, including the 8 augmented zero bits.
+uint8_t frame_crc(const uint8_t* data, int num) {
+    uint8_t crc = 0xFF;
+    int idx, bit;
+
+    for (idx = 0; idx < num + 1; idx++) {
+        uint8_t dat = (idx < num) ? data[idx] : 0x00;
+        for (bit = 0; bit < 8; bit++) {
+            uint8_t top = crc & 0x80;
+            crc = (crc << 1) | (dat >> 7);
+            dat <<= 1;
+            if (top)
+                crc ^= 0x8D;
+        }
+    }
+    return crc;
+}
+
+
+// Return the length of a message given its channel byte.
+int frame_length(uint8_t chan) {
+    return ((chan >> 4) & FRAME_MAC) ? FRAME_LEN_MAC : FRAME_LEN;
+}
+
+
+// Parse a message of num bytes into its fields. Returns -1 if the length does
+// not match the version or the CRC does not match. The MAC can only be checked
+// with the key of the remote, so that is left to the caller.
+int frame_parse(const uint8_t* data, int num, struct frame* frm) {
+    if (num < FRAME_LEN || num != frame_length(data[4]))
+        return -1;
+    frm->block = (
+        (uint32_t)data[0] << 0 | (uint32_t)data[1] << 8 |
+        (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24
+    );
+    frm->ver = data[4] >> 4;
+    frm->chan = data[4] % FRAME_CHANS;
+    if (frm->ver & FRAME_MAC) {
+        frm->serial = data[5] | data[6] << 8 | data[7] << 16;
+        frm->mac = data[8] | data[9] << 8;
+    } else {
+        if (frame_crc(data, FRAME_LEN-1) != data[FRAME_LEN-1])
+            return -1;
+        frm->serial = frm->chan;
+        frm->mac = 0;
+    }
+    return 0;
+}
+
+
+// Form the message for the given fields, including the CRC if there is no MAC.
+// The message is frame_length(data[4]) bytes long.
+void frame_build(const struct frame* frm, uint8_t* data) {
+    data[0] = frm->block >> 0;
+    data[1] = frm->block >> 8;
+    data[2] = frm->block >> 16;
+    data[3] = frm->block >> 24;
+    data[4] = (frm->ver << 4) | (frm->chan % FRAME_CHANS);
+    if (frm->ver & FRAME_MAC) {
+        data[5] = frm->serial >> 0;
+        data[6] = frm->serial >> 8;
+        data[7] = frm->serial >> 16;
+        data[8] = frm->mac >> 0;
+        data[9] = frm->mac >> 8;
+    } else {
+        data[5] = frame_crc(data, FRAME_LEN-1);
+    }
+}
+
+
+// Return the two little endian words that the MAC is computed over, which are
+// all of the fields before the MAC.
+void frame_mac_words(const uint8_t* data, uint32_t* m0, uint32_t* m1) {
+    *m0 = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+    *m1 = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t)data[7] << 24;
+}
+
+
+// Report whether the message can be sent, which is when the frame marker does
+// not appear in it. The transmitter skips rolling codes until this holds.
+int frame_valid(const uint8_t* data, int num) {
+    return memchr(data, FRAME_MARK, num) == NULL;
+}
+
+
+// Report whether a serial number can be assigned to a remote. The serial is
+// sent in every message, so none of its bytes may be the frame marker.
+int frame_serial_valid(uint32_t serial) {
+    return (
+        serial < (1 << 24) && ((serial >> 0) & 0xFF) != FRAME_MARK &&
+        ((serial >> 8) & 0xFF) != FRAME_MARK && ((serial >> 16) & 0xFF) != FRAME_MARK
+    );
+}
+
+
+#endif /* _VERIFIER_FRAME_H */
@@ -0,0 +1,518 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_GOSSIP_H
+#define _VERIFIER_GOSSIP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "verifier.h"
+
+
+// This keeps the channel stores of several sites that share a fleet in step,
+// so that a code accepted at one site cannot be replayed at another. The
+// receiver only ever moves a channel forward with write_channel_code(chan,
+// code+1), so the channel state of a remote is a max-register: two states are
+// merged by taking the later next code and lining up both bitmaps behind it,
+// which gives the same result in any order and any number of times. The sites
+// exchange datagrams over UDP:
+//
+//  delta:    The states of the remotes that accepted a code since the last
+//            flush are sent to every peer in batches, stamped with the time
+//            that the oldest of them was accepted
+//  digests:  Anti-entropy walks a tree of digests over ranges of serial
+//            numbers with one peer at a time, each side sending the digests of
+//            the children of the nodes that differ, down to the leaves
+//  repair:   The leaves that differ are sent in full, and the peer merges
+//            them and sends its own states of the same leaves back
+//
+// The digest of a leaf is the xor of a hash of the serial and state of every
+// remote in it, and the digest of a node is the xor of its children, so a
+// change is folded into the tree with one xor per level. The tree covers the
+// states as they were last flushed or merged, so deltas that were lost, or a
+// site that was down, are repaired by anti-entropy alone.
+//
+// A round of anti-entropy may turn up many leaves at once after a site was
+// down, so each site sends at most GOSSIP_BUDGET bytes of digests and repairs
+// per round that it starts, and leaves the rest to the next rounds, rather
+// than flooding the receive buffers of its peers. The states sent back for a
+// repair are not counted, as the repairs are already paced by the peer.
+//
+// The slots of the remotes are taken when the gossip is set up, so it must be
+// set up again after remotes are enrolled, evicted or rebuilt.
+
+#define GOSSIP_PEERS        16
+#define GOSSIP_FANOUT_BITS  4
+#define GOSSIP_FANOUT       (1 << GOSSIP_FANOUT_BITS)
+#define GOSSIP_LEVELS       4     // Levels of the tree below the root
+#define GOSSIP_LEAF_SHIFT   (24 - GOSSIP_LEVELS*GOSSIP_FANOUT_BITS)
+#define GOSSIP_DATAGRAM     1400  // Fits the MTU of an Ethernet link
+#define GOSSIP_HEADER       16
+#define GOSSIP_ENTRY        11    // 24-bit serial and 64-bit channel state
+#define GOSSIP_BUDGET       (512*1024)
+
+
+/* Kinds of datagrams */
+enum gossip_kind {
+    GOSSIP_DELTA = 1,  // Channel states to merge
+    GOSSIP_DIGESTS,    // The digests of the children of a node
+    GOSSIP_REPAIR,     // The channel states of leaves, asking for the peer's
+};
+
+/* The gossip of a site with its peers */
+struct gossip {
+    struct verifier* vf;
+    int site;
+    int fd;
+    int num_peers;
+    struct sockaddr_in peers[GOSSIP_PEERS];
+    int next_peer;      // The peer of the next anti-entropy round
+    int budget;         // Bytes left for anti-entropy until the next round
+    int loss;           // Percent of datagrams dropped on purpose, for testing
+    uint64_t rng;
+
+    uint64_t* last;     // The state of every slot as it was last digested
+    uint8_t* dirty;
+    int32_t* pending;   // The slots noted since the last flush
+    int num_pending;
+    uint64_t oldest;    // When the first of them was noted
+    uint64_t* tree[GOSSIP_LEVELS+1];
+    uint32_t* leaf_start;  // Where the slots of every leaf are in leaf_slots
+    int32_t* leaf_slots;
+
+    uint32_t* lags;     // The lag of every delta batch received, if not NULL
+    int num_lags;
+    int max_lags;
+
+    // Statistics
+    uint64_t delta_bytes;  // Sent in deltas
+    uint64_t sync_bytes;   // Sent for anti-entropy
+    uint64_t datagrams;
+    uint64_t dropped;
+    uint64_t merged;       // States that moved forward by a merge
+    uint64_t unknown;      // States of serials that are not enrolled here
+};
+
+
+int gossip_init(struct gossip* gs, struct verifier* vf, int site, uint16_t port);
+void gossip_free(struct gossip* gs);
+int gossip_peer(struct gossip* gs, uint16_t port);
+void gossip_note(struct gossip* gs, int slot, uint64_t now);
+void gossip_flush(struct gossip* gs);
+int gossip_poll(struct gossip* gs);
+void gossip_sync(struct gossip* gs);
+uint64_t gossip_root(const struct gossip* gs);
+void gossip_handle(struct gossip* gs, const struct sockaddr_in* from, const uint8_t* data, int num, uint64_t now);
+void gossip_merge(struct gossip* gs, const uint8_t* entry);
+void gossip_digest(struct gossip* gs, int slot, uint64_t replay);
+void gossip_send_digests(struct gossip* gs, const struct sockaddr_in* to, int level, uint32_t node);
+void gossip_send_leaves(struct gossip* gs, const struct sockaddr_in* to, int kind, const uint32_t* leaves, int num);
+void gossip_send(struct gossip* gs, const struct sockaddr_in* to, const uint8_t* data, int num, uint64_t* bytes);
+int gossip_header(const struct gossip* gs, uint8_t* data, int kind, int level, uint32_t node, uint64_t stamp);
+int gossip_entry(uint8_t* data, uint32_t serial, uint64_t replay);
+void gossip_put(uint8_t* data, uint64_t val, int num);
+uint64_t gossip_get(const uint8_t* data, int num);
+uint64_t gossip_hash(uint32_t serial, uint64_t replay);
+uint64_t gossip_clock();
+int replay_merge(uint64_t* replay, uint64_t other);
+
+
+// Set up the gossip of a site over the remotes enrolled in a verifier, on a
+// UDP socket bound to the given port of the loopback address. Returns -1 if
+// the socket could not be bound or out of memory.
+int gossip_init(struct gossip* gs, struct verifier* vf, int site, uint16_t port) {
+    struct sockaddr_in addr;
+    uint32_t leaf, num_leaves = 1 << (24 - GOSSIP_LEAF_SHIFT);
+    int level, slot, size = 1, bufsize = 1 << 22;
+
+    memset(gs, 0, sizeof(*gs));
+    gs->vf = vf;
+    gs->site = site;
+    gs->fd = -1;
+    gs->rng = site + 1;
+    gs->budget = GOSSIP_BUDGET;
+    gs->last = malloc(vf->max_fobs*sizeof(*gs->last));
+    gs->dirty = calloc(vf->max_fobs, 1);
+    gs->pending = malloc(vf->max_fobs*sizeof(*gs->pending));
+    gs->leaf_start = calloc(num_leaves + 1, sizeof(*gs->leaf_start));
+    gs->leaf_slots = malloc(vf->max_fobs*sizeof(*gs->leaf_slots));
+    if (gs->last == NULL || gs->dirty == NULL || gs->pending == NULL || gs->leaf_start == NULL || gs->leaf_slots == NULL)
+        goto fail;
+    for (level = 0; level <= GOSSIP_LEVELS; level++, size *= GOSSIP_FANOUT)
+        if ((gs->tree[level] = calloc(size, sizeof(**gs->tree))) == NULL)
+            goto fail;
+
+    // Sort the slots by leaf, and digest their states
+    for (slot = 0; slot < vf->num_fobs; slot++)
+        if (vf->serials[slot] != VERIFIER_NONE)
+            gs->leaf_start[(vf->serials[slot] >> GOSSIP_LEAF_SHIFT) + 1]++;
+    for (leaf = 0; leaf < num_leaves; leaf++)
+        gs->leaf_start[leaf+1] += gs->leaf_start[leaf];
+    for (slot = 0; slot < vf->num_fobs; slot++) {
+        if (vf->serials[slot] == VERIFIER_NONE)
+            continue;
+        leaf = vf->serials[slot] >> GOSSIP_LEAF_SHIFT;
+        gs->leaf_slots[gs->leaf_start[leaf]++] = slot;
+        gs->last[slot] = vf->states[slot].replay;
+        for (level = GOSSIP_LEVELS; level >= 0; level--, leaf >>= GOSSIP_FANOUT_BITS)
+            gs->tree[level][leaf] ^= gossip_hash(vf->serials[slot], gs->last[slot]);
+    }
+    for (leaf = num_leaves; leaf > 0; leaf--)
+        gs->leaf_start[leaf] = gs->leaf_start[leaf-1];
+    gs->leaf_start[0] = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if ((gs->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        goto fail;
+    setsockopt(gs->fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    if (bind(gs->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    fprintf(stderr, "Could not set up the gossip of site %d\n", site);
+    gossip_free(gs);
+    return -1;
+}
+
+
+// Close the socket and release the memory of the gossip.
+void gossip_free(struct gossip* gs) {
+    int level;
+
+    if (gs->fd >= 0)
+        close(gs->fd);
+    free(gs->last);
+    free(gs->dirty);
+    free(gs->pending);
+    free(gs->leaf_start);
+    free(gs->leaf_slots);
+    for (level = 0; level <= GOSSIP_LEVELS; level++)
+        free(gs->tree[level]);
+    memset(gs, 0, sizeof(*gs));
+    gs->fd = -1;
+}
+
+
+// Add the site on the given port of the loopback address as a peer. Returns
+// -1 if there are too many peers.
+int gossip_peer(struct gossip* gs, uint16_t port) {
+    struct sockaddr_in* addr = &gs->peers[gs->num_peers];
+
+    if (gs->num_peers >= GOSSIP_PEERS) {
+        fprintf(stderr, "Too many peers\n");
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr->sin_port = htons(port);
+    gs->num_peers++;
+    return 0;
+}
+
+
+// Note that the remote in a slot accepted a code, so that its state is sent
+// with the next flush.
+void gossip_note(struct gossip* gs, int slot, uint64_t now) {
+    if (gs->dirty[slot])
+        return;
+    gs->dirty[slot] = 1;
+    if (gs->num_pending == 0)
+        gs->oldest = now;
+    gs->pending[gs->num_pending++] = slot;
+}
+
+
+// Digest the states of the noted remotes, and send them to every peer.
+void gossip_flush(struct gossip* gs) {
+    uint8_t data[GOSSIP_DATAGRAM];
+    int idx, peer, num = 0;
+
+    for (idx = 0; idx < gs->num_pending; idx++) {
+        int slot = gs->pending[idx];
+        uint64_t replay = __atomic_load_n(&gs->vf->states[slot].replay, __ATOMIC_RELAXED);
+        gs->dirty[slot] = 0;
+        gossip_digest(gs, slot, replay);
+        if (num == 0)
+            num = gossip_header(gs, data, GOSSIP_DELTA, 0, 0, gs->oldest);
+        num += gossip_entry(data + num, gs->vf->serials[slot], replay);
+        if (num + GOSSIP_ENTRY > GOSSIP_DATAGRAM || idx == gs->num_pending-1) {
+            for (peer = 0; peer < gs->num_peers; peer++)
+                gossip_send(gs, &gs->peers[peer], data, num, &gs->delta_bytes);
+            num = 0;
+        }
+    }
+    gs->num_pending = 0;
+}
+
+
+// Handle every datagram that is waiting on the socket, without blocking.
+// Returns the number handled, or -1 if the socket failed.
+int gossip_poll(struct gossip* gs) {
+    uint8_t data[GOSSIP_DATAGRAM];
+    struct sockaddr_in from;
+    socklen_t len;
+    int num, count = 0;
+
+    for (;;) {
+        len = sizeof(from);
+        num = recvfrom(gs->fd, data, sizeof(data), MSG_DONTWAIT, (struct sockaddr*)&from, &len);
+        if (num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return count;
+        if (num < 0) {
+            fprintf(stderr, "Could not receive gossip\n");
+            return -1;
+        }
+        gossip_handle(gs, &from, data, num, gossip_clock());
+        count++;
+    }
+}
+
+
+// Start a round of anti-entropy with the next peer by sending it the digests
+// below the root. The noted remotes should be flushed first, or they will be
+// repaired as well.
+void gossip_sync(struct gossip* gs) {
+    gs->budget = GOSSIP_BUDGET;
+    if (gs->num_peers == 0)
+        return;
+    gossip_send_digests(gs, &gs->peers[gs->next_peer], 0, 0);
+    gs->next_peer = (gs->next_peer + 1) % gs->num_peers;
+}
+
+
+// Return the digest of every state, which is the same at two sites once they
+// have converged.
+uint64_t gossip_root(const struct gossip* gs) {
+    return gs->tree[0][0];
+}
+
+
+// Handle a datagram from a peer.
+void gossip_handle(struct gossip* gs, const struct sockaddr_in* from, const uint8_t* data, int num, uint64_t now) {
+    uint32_t node, leaves[GOSSIP_DATAGRAM / GOSSIP_ENTRY];
+    uint64_t stamp;
+    int idx, level, num_leaves = 0;
+
+    if (num < GOSSIP_HEADER || data[1] == gs->site)
+        return;
+    level = data[2];
+    node = gossip_get(data + 4, 4);
+    stamp = gossip_get(data + 8, 8);
+    switch (data[0]) {
+    case GOSSIP_DELTA:
+    case GOSSIP_REPAIR:
+        for (idx = GOSSIP_HEADER; idx + GOSSIP_ENTRY <= num; idx += GOSSIP_ENTRY) {
+            uint32_t leaf = gossip_get(data + idx, 3) >> GOSSIP_LEAF_SHIFT;
+            if (num_leaves == 0 || leaves[num_leaves-1] != leaf)
+                leaves[num_leaves++] = leaf;
+            gossip_merge(gs, data + idx);
+        }
+        if (data[0] == GOSSIP_REPAIR)
+            gossip_send_leaves(gs, from, GOSSIP_DELTA, leaves, num_leaves);
+        else if (stamp != 0 && gs->lags != NULL && gs->num_lags < gs->max_lags)
+            gs->lags[gs->num_lags++] = (now > stamp) ? now - stamp : 0;
+        break;
+
+    // Go down into the children that differ, or repair them if they are leaves
+    case GOSSIP_DIGESTS:
+        if (level >= GOSSIP_LEVELS || node >> (level*GOSSIP_FANOUT_BITS) != 0)
+            return;
+        if (num < GOSSIP_HEADER + GOSSIP_FANOUT*8)
+            return;
+        for (idx = 0; idx < GOSSIP_FANOUT && gs->budget > 0; idx++) {
+            uint32_t child = node << GOSSIP_FANOUT_BITS | idx;
+            if (gs->tree[level+1][child] == gossip_get(data + GOSSIP_HEADER + 8*idx, 8))
+                continue;
+            if (level+1 == GOSSIP_LEVELS)
+                leaves[num_leaves++] = child;
+            else
+                gossip_send_digests(gs, from, level+1, child);
+        }
+        gossip_send_leaves(gs, from, GOSSIP_REPAIR, leaves, num_leaves);
+        break;
+    }
+}
+
+
+// Merge the state of a remote from a peer into the channel store.
+void gossip_merge(struct gossip* gs, const uint8_t* entry) {
+    uint32_t serial = gossip_get(entry, 3);
+    uint64_t replay = gossip_get(entry + 3, 8);
+    int slot = verifier_find(gs->vf, serial);
+
+    if (slot < 0) {
+        gs->unknown++;
+        return;
+    }
+    verifier_touch(gs->vf, slot, 0);
+    if (replay_merge(&gs->vf->states[slot].replay, replay)) {
+        gossip_digest(gs, slot, __atomic_load_n(&gs->vf->states[slot].replay, __ATOMIC_RELAXED));
+        gs->merged++;
+    }
+}
+
+
+// Fold a new state of the remote in a slot into the digest tree.
+void gossip_digest(struct gossip* gs, int slot, uint64_t replay) {
+    uint32_t serial = gs->vf->serials[slot], node = serial >> GOSSIP_LEAF_SHIFT;
+    uint64_t diff = gossip_hash(serial, gs->last[slot]) ^ gossip_hash(serial, replay);
+    int level;
+
+    for (level = GOSSIP_LEVELS; level >= 0; level--, node >>= GOSSIP_FANOUT_BITS)
+        gs->tree[level][node] ^= diff;
+    gs->last[slot] = replay;
+}
+
+
+// Send the digests of the children of a node to a peer.
+void gossip_send_digests(struct gossip* gs, const struct sockaddr_in* to, int level, uint32_t node) {
+    uint8_t data[GOSSIP_HEADER + GOSSIP_FANOUT*8];
+    int idx, num = gossip_header(gs, data, GOSSIP_DIGESTS, level, node, 0);
+
+    for (idx = 0; idx < GOSSIP_FANOUT; idx++, num += 8)
+        gossip_put(data + num, gs->tree[level+1][node << GOSSIP_FANOUT_BITS | idx], 8);
+    gossip_send(gs, to, data, num, &gs->sync_bytes);
+}
+
+
+// Send the states of every remote in the given leaves to a peer, packed into
+// as few datagrams as it takes. The peer finds the leaves from the serials, so
+// a leaf without remotes is not sent.
+void gossip_send_leaves(struct gossip* gs, const struct sockaddr_in* to, int kind, const uint32_t* leaves, int num) {
+    uint8_t data[GOSSIP_DATAGRAM];
+    int idx, len = gossip_header(gs, data, kind, GOSSIP_LEVELS, 0, 0);
+    uint32_t pos;
+
+    for (idx = 0; idx < num; idx++) {
+        for (pos = gs->leaf_start[leaves[idx]]; pos < gs->leaf_start[leaves[idx]+1]; pos++) {
+            int slot = gs->leaf_slots[pos];
+            if (len + GOSSIP_ENTRY > GOSSIP_DATAGRAM) {
+                gossip_send(gs, to, data, len, &gs->sync_bytes);
+                len = GOSSIP_HEADER;
+            }
+            len += gossip_entry(data + len, gs->vf->serials[slot],
+                __atomic_load_n(&gs->vf->states[slot].replay, __ATOMIC_RELAXED));
+        }
+    }
+    if (len > GOSSIP_HEADER)
+        gossip_send(gs, to, data, len, &gs->sync_bytes);
+}
+
+
+// Send a datagram to a peer, adding its size to bytes unless it was dropped.
+void gossip_send(struct gossip* gs, const struct sockaddr_in* to, const uint8_t* data, int num, uint64_t* bytes) {
+    gs->rng ^= gs->rng << 13;
+    gs->rng ^= gs->rng >> 7;
+    gs->rng ^= gs->rng << 17;
+    if ((gs->loss > 0 && (int)(gs->rng % 100) < gs->loss) ||
+        sendto(gs->fd, data, num, 0, (const struct sockaddr*)to, sizeof(*to)) != num) {
+        gs->dropped++;
+        return;
+    }
+    *bytes += num;
+    gs->datagrams++;
+    if (data[0] != GOSSIP_DELTA)
+        gs->budget -= num;
+}
+
+
+// Write the header of a datagram, and return its length.
+int gossip_header(const struct gossip* gs, uint8_t* data, int kind, int level, uint32_t node, uint64_t stamp) {
+    data[0] = kind;
+    data[1] = gs->site;
+    data[2] = level;
+    data[3] = 0;
+    gossip_put(data + 4, node, 4);
+    gossip_put(data + 8, stamp, 8);
+    return GOSSIP_HEADER;
+}
+
+
+// Write the state of a remote into a datagram, and return its length.
+int gossip_entry(uint8_t* data, uint32_t serial, uint64_t replay) {
+    gossip_put(data, serial, 3);
+    gossip_put(data + 3, replay, 8);
+    return GOSSIP_ENTRY;
+}
+
+
+// Write the lower num bytes of a value in little endian.
+void gossip_put(uint8_t* data, uint64_t val, int num) {
+    int idx;
+    for (idx = 0; idx < num; idx++)
+        data[idx] = val >> (8*idx);
+}
+
+
+// Read a little endian value of num bytes.
+uint64_t gossip_get(const uint8_t* data, int num) {
+    uint64_t val = 0;
+    int idx;
+    for (idx = 0; idx < num; idx++)
+        val |= (uint64_t)data[idx] << (8*idx);
+    return val;
+}
+
+
+// Hash the state of a remote for the digests.
+uint64_t gossip_hash(uint32_t serial, uint64_t replay) {
+    uint64_t x = replay ^ (uint64_t)serial * 0x9E3779B97F4A7C15;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EB;
+    x ^= x >> 31;
+    return x;
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t gossip_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// Merge the state of a remote from another site into replay: the next code is
+// the later of the two, in serial number arithmetic, and the codes accepted
+// behind it are those accepted behind either. Returns 1 if replay changed.
+int replay_merge(uint64_t* replay, uint64_t other) {
+    uint64_t old = __atomic_load_n(replay, __ATOMIC_RELAXED), new;
+    uint32_t their_next = other, their_seen = other >> 32;
+
+    do {
+        uint32_t next = old;
+        uint32_t seen = old >> 32;
+        uint32_t ahead = their_next - next;
+
+        if ((int32_t)ahead > 0) {
+            seen = ((ahead < 32) ? seen << ahead : 0) | their_seen;
+            next = their_next;
+        } else {
+            seen |= (-ahead < 32) ? their_seen << -ahead : 0;
+        }
+        new = (uint64_t)seen << 32 | next;
+        if (new == old)
+            return 0;
+    } while (!__atomic_compare_exchange_n(replay, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+
+#endif /* _VERIFIER_GOSSIP_H */
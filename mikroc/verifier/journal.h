@@ -0,0 +1,103 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_JOURNAL_H
+#define _VERIFIER_JOURNAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// This is an append-only log of fixed size records, such as the accepted
+// codes from which the channel store can be rebuilt after a crash, or the
+// audit trail of every message. Records are gathered in a buffer that is
+// written to a file descriptor once it is full, so that a write() is made for
+// many records. The buffer is then reused for the next records, unless the
+// journal was opened without recycling, in which case it is freed and a new
+// one allocated, as a general purpose daemon would.
+
+#define JOURNAL_BUFFER  (64*1024)
+
+
+/* A log of records */
+struct journal {
+    int fd;
+    int recycle;      // Reuse the buffer after it is written
+    uint8_t* buf;
+    size_t size;
+    size_t used;
+    uint64_t written; // Bytes written to the file descriptor
+};
+
+
+int journal_init(struct journal* jn, int fd, size_t size, int recycle);
+void journal_free(struct journal* jn);
+int journal_append(struct journal* jn, const void* rec, size_t len);
+int journal_flush(struct journal* jn);
+
+
+// Open a journal that writes to fd in buffers of the given size. Returns -1
+// if out of memory.
+int journal_init(struct journal* jn, int fd, size_t size, int recycle) {
+    memset(jn, 0, sizeof(*jn));
+    jn->fd = fd;
+    jn->recycle = recycle;
+    jn->size = size;
+    if ((jn->buf = malloc(size)) == NULL) {
+        fprintf(stderr, "Could not allocate the journal\n");
+        return -1;
+    }
+    memset(jn->buf, 0, size);
+    return 0;
+}
+
+
+// Release the memory of a journal, without writing what is left in it.
+void journal_free(struct journal* jn) {
+    free(jn->buf);
+    memset(jn, 0, sizeof(*jn));
+}
+
+
+// Append a record to a journal, writing out the buffer first if the record
+// does not fit. Returns -1 if the write failed.
+int journal_append(struct journal* jn, const void* rec, size_t len) {
+    if (jn->used + len > jn->size && journal_flush(jn))
+        return -1;
+    memcpy(jn->buf + jn->used, rec, len);
+    jn->used += len;
+    return 0;
+}
+
+
+// Write out the records in the buffer of a journal. Returns -1 if the write
+// failed or no new buffer could be allocated.
+int journal_flush(struct journal* jn) {
+    size_t done = 0;
+    ssize_t num;
+
+    while (done < jn->used) {
+        if ((num = write(jn->fd, jn->buf + done, jn->used - done)) < 0) {
+            perror("write");
+            return -1;
+        }
+        done += num;
+    }
+    jn->written += done;
+    jn->used = 0;
+    if (!jn->recycle) {
+        free(jn->buf);
+        if ((jn->buf = malloc(jn->size)) == NULL) {
+            fprintf(stderr, "Could not allocate the journal\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+#endif /* _VERIFIER_JOURNAL_H */
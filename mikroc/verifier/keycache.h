@@ -0,0 +1,218 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_KEYCACHE_H
+#define _VERIFIER_KEYCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cipher.h"
+
+
+// This is a keystore that holds only the seed key of every remote, which is 36
+// bytes against the 220 bytes of its expanded keys, and expands the keys of a
+// remote when a message from it is verified. The expanded keys are kept in a
+// fixed number of lines:
+//
+//  seeds:   The seed key of every slot, and the line that holds its keys
+//  lines:   The expanded keys of recently heard slots, and the slot of each
+//
+// The line to reuse on a miss is picked by the clock algorithm, as in tier.h.
+// The misses of a batch are expanded together with fob_keys_init_each(), and
+// the lines of the batch are pinned until it is done so that a later miss of
+// the same batch cannot take them, which is why the cache must have more lines
+// than a batch. The keys returned by a call stay valid until the next call.
+//
+// The cache is not safe for concurrent use.
+
+/* The most slots in a batch, as in VERIFIER_BATCH */
+#define KEYCACHE_BATCH  64
+
+/* The clock bit of a line that is in use by the current batch */
+#define KEYCACHE_PINNED  2
+
+
+/* A keystore of seed keys with a cache of expanded keys */
+struct keycache {
+    int max_fobs;
+    int num_lines;
+    int hand;
+    uint16_t (*seeds)[KEY_WORDS]; // The seed key of every slot
+    int32_t* lines;               // The line of every slot, or -1
+    struct fob_keys* keys;        // The expanded keys of every line
+    int32_t* owners;              // The slot of every line, or -1
+    uint8_t* heard;               // The clock bit of every line
+    uint64_t misses;              // Keys expanded on demand
+};
+
+
+int keycache_init(struct keycache* kc, int max_fobs, int num_lines);
+void keycache_free(struct keycache* kc);
+void keycache_store(struct keycache* kc, int slot, const uint16_t* seed);
+void keycache_drop(struct keycache* kc, int slot);
+void keycache_reset(struct keycache* kc);
+const struct fob_keys* keycache_get(struct keycache* kc, int slot);
+void keycache_get_batch(struct keycache* kc, const int* slots, int num, const struct fob_keys** keys);
+void keycache_prefetch(const struct keycache* kc, int slot);
+int keycache_victim(struct keycache* kc);
+size_t keycache_bytes(const struct keycache* kc);
+
+
+// Allocate a keystore for up to max_fobs remotes with the keys of num_lines of
+// them expanded, which must be more than KEYCACHE_BATCH. Returns -1 if out of
+// memory.
+int keycache_init(struct keycache* kc, int max_fobs, int num_lines) {
+    memset(kc, 0, sizeof(*kc));
+    if (num_lines <= KEYCACHE_BATCH) {
+        fprintf(stderr, "The key cache needs more than %d lines\n", KEYCACHE_BATCH);
+        return -1;
+    }
+    kc->max_fobs = max_fobs;
+    kc->num_lines = num_lines;
+    kc->seeds = malloc(max_fobs*sizeof(*kc->seeds));
+    kc->lines = malloc(max_fobs*sizeof(*kc->lines));
+    kc->keys = malloc(num_lines*sizeof(*kc->keys));
+    kc->owners = malloc(num_lines*sizeof(*kc->owners));
+    kc->heard = calloc(num_lines, 1);
+    if (kc->seeds == NULL || kc->lines == NULL || kc->keys == NULL || kc->owners == NULL || kc->heard == NULL) {
+        keycache_free(kc);
+        fprintf(stderr, "Could not allocate the key cache\n");
+        return -1;
+    }
+    memset(kc->lines, 0xFF, max_fobs*sizeof(*kc->lines));
+    memset(kc->owners, 0xFF, num_lines*sizeof(*kc->owners));
+    return 0;
+}
+
+
+// Release the memory of a keystore.
+void keycache_free(struct keycache* kc) {
+    free(kc->seeds);
+    free(kc->lines);
+    free(kc->keys);
+    free(kc->owners);
+    free(kc->heard);
+    memset(kc, 0, sizeof(*kc));
+}
+
+
+// Store the seed key of a slot, dropping any keys expanded from its old seed.
+void keycache_store(struct keycache* kc, int slot, const uint16_t* seed) {
+    keycache_drop(kc, slot);
+    memcpy(kc->seeds[slot], seed, sizeof(kc->seeds[slot]));
+}
+
+
+// Drop the expanded keys of a slot, if it has any, freeing their line.
+void keycache_drop(struct keycache* kc, int slot) {
+    int32_t line = kc->lines[slot];
+
+    if (line < 0)
+        return;
+    kc->owners[line] = -1;
+    kc->heard[line] = 0;
+    kc->lines[slot] = -1;
+}
+
+
+// Drop the expanded keys of every slot, as after the slots are renumbered.
+void keycache_reset(struct keycache* kc) {
+    memset(kc->lines, 0xFF, kc->max_fobs*sizeof(*kc->lines));
+    memset(kc->owners, 0xFF, kc->num_lines*sizeof(*kc->owners));
+    memset(kc->heard, 0, kc->num_lines);
+}
+
+
+// Return the expanded keys of a slot, expanding them from the seed if they are
+// not cached.
+const struct fob_keys* keycache_get(struct keycache* kc, int slot) {
+    const struct fob_keys* keys;
+    int32_t line = kc->lines[slot];
+
+    if (line >= 0) {
+        kc->heard[line] = 1;
+        return &kc->keys[line];
+    }
+    keycache_get_batch(kc, &slot, 1, &keys);
+    return keys;
+}
+
+
+// Store the expanded keys of a batch of up to KEYCACHE_BATCH slots in keys,
+// expanding all of the ones that are not cached together. A slot may appear
+// more than once.
+void keycache_get_batch(struct keycache* kc, const int* slots, int num, const struct fob_keys** keys) {
+    struct fob_keys* fill[KEYCACHE_BATCH];
+    const uint16_t* seeds[KEYCACHE_BATCH];
+    int32_t line;
+    int idx, num_fill = 0;
+
+    // Take a line for every miss, pinning the lines of the batch
+    for (idx = 0; idx < num; idx++) {
+        if ((line = kc->lines[slots[idx]]) < 0) {
+            line = keycache_victim(kc);
+            if (kc->owners[line] >= 0)
+                kc->lines[kc->owners[line]] = -1;
+            kc->owners[line] = slots[idx];
+            kc->lines[slots[idx]] = line;
+            fill[num_fill] = &kc->keys[line];
+            seeds[num_fill++] = kc->seeds[slots[idx]];
+            kc->misses++;
+        }
+        kc->heard[line] = KEYCACHE_PINNED;
+        keys[idx] = &kc->keys[line];
+    }
+
+    // Expand the misses and unpin the lines
+    if (num_fill > 0)
+        fob_keys_init_each(fill, seeds, num_fill);
+    for (idx = 0; idx < num; idx++)
+        kc->heard[kc->lines[slots[idx]]] = 1;
+}
+
+
+// Load the line index and the seed key of a slot into the cache, and its
+// expanded keys if it has any, like verifier_prefetch().
+void keycache_prefetch(const struct keycache* kc, int slot) {
+    int32_t line = kc->lines[slot];
+    uint32_t sum = kc->seeds[slot][0];
+
+    if (line >= 0) {
+        const uint8_t* keys = (const uint8_t*)&kc->keys[line];
+        size_t off;
+        for (off = 0; off < sizeof(*kc->keys); off += 64)
+            sum += keys[off];
+        sum += keys[sizeof(*kc->keys) - 1];
+    }
+    __asm__ volatile("" :: "r"(sum));
+}
+
+
+// Advance the clock hand to the first line that is neither pinned nor heard
+// since the last sweep, and return it.
+int keycache_victim(struct keycache* kc) {
+    int line;
+
+    while (kc->heard[kc->hand]) {
+        if (kc->heard[kc->hand] != KEYCACHE_PINNED)
+            kc->heard[kc->hand] = 0;
+        kc->hand = (kc->hand + 1) % kc->num_lines;
+    }
+    line = kc->hand;
+    kc->hand = (kc->hand + 1) % kc->num_lines;
+    return line;
+}
+
+
+// Return the memory of a keystore in bytes.
+size_t keycache_bytes(const struct keycache* kc) {
+    return (size_t)kc->max_fobs * (sizeof(*kc->seeds) + sizeof(*kc->lines)) +
+        (size_t)kc->num_lines * (sizeof(*kc->keys) + sizeof(*kc->owners) + 1);
+}
+
+
+#endif /* _VERIFIER_KEYCACHE_H */
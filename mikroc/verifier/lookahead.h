@@ -0,0 +1,255 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_LOOKAHEAD_H
+#define _VERIFIER_LOOKAHEAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "verifier.h"
+
+
+// These are per remote lookahead tables in front of a verifier. The table of a
+// remote holds the encrypted blocks of the codes in its window, so that most
+// messages are matched with a scan instead of a decryption. A message that
+// misses the table is decrypted and checked against the full window of the
+// verifier, as it would be without a table, so a remote that skips further
+// than its table or sends one of its unused codes behind is still accepted.
+//
+// A table as wide as VERIFIER_WINDOW would take 4 KiB for every remote, while
+// most remotes never skip more than a few codes. Each remote therefore keeps a
+// histogram of how far ahead its accepted codes were, and its window is sized
+// to twice the largest skip seen, within the bounds of the lookahead. The
+// histogram is halved whenever a count saturates, so an old burst of skips is
+// eventually forgotten. Remotes that have not been seen often enough have no
+// table and are verified by decrypting, with the full window of the verifier.
+//
+// The skip of a message accepted after a miss is recorded and the table is
+// filled again, so the window grows to cover it and the next press of the
+// button is matched. The tables are not safe for concurrent use.
+
+#define LOOKAHEAD_MIN      4
+#define LOOKAHEAD_MAX      VERIFIER_WINDOW
+#define LOOKAHEAD_BUCKETS  8  // Skips of 0, 1, 2-3, 4-7, ... 64 and up
+#define LOOKAHEAD_SEEN     4  // Accepted messages before a remote gets a table
+
+
+/* The lookahead state of a remote */
+struct fob_lookahead {
+    uint32_t skips;  // Saturating 4-bit count of the accepted skips per bucket
+    uint32_t* table; // Encrypted blocks indexed by code, NULL while cold
+    uint32_t start;  // The first code in the table
+    uint16_t window; // The number of codes in the table, a power of two
+    uint8_t ver;     // The cipher that the table was filled with
+};
+
+/* Lookahead tables for every remote of a verifier */
+struct lookahead {
+    struct verifier* vf;
+    uint32_t min_window;
+    uint32_t max_window;
+    struct fob_lookahead* fobs;
+    uint64_t table_bytes; // The total size of the tables
+    uint64_t decrypts;    // The number of messages that had to be decrypted
+};
+
+
+int lookahead_init(struct lookahead* la, struct verifier* vf, uint32_t min_window, uint32_t max_window);
+void lookahead_free(struct lookahead* la);
+int lookahead_check(struct lookahead* la, const uint8_t* data, int num, int* slot);
+int lookahead_find(const struct fob_lookahead* fl, uint32_t block, uint32_t* code);
+void lookahead_prefetch(const struct lookahead* la, int slot);
+void lookahead_record(struct lookahead* la, int slot, uint32_t skip);
+void lookahead_fill(struct lookahead* la, int slot, uint8_t ver);
+void lookahead_clear(struct lookahead* la, int slot, uint32_t skips);
+uint32_t lookahead_window(const struct lookahead* la, uint32_t skips);
+
+
+// Set up lookahead tables for a verifier with windows between the given powers
+// of two. Returns -1 if the bounds are invalid or out of memory.
+int lookahead_init(struct lookahead* la, struct verifier* vf, uint32_t min_window, uint32_t max_window) {
+    memset(la, 0, sizeof(*la));
+    if (min_window < 1 || max_window > LOOKAHEAD_MAX || min_window > max_window ||
+        (min_window & (min_window-1)) || (max_window & (max_window-1))) {
+        fprintf(stderr, "Invalid lookahead window bounds\n");
+        return -1;
+    }
+    la->vf = vf;
+    la->min_window = min_window;
+    la->max_window = max_window;
+    la->fobs = calloc(vf->max_fobs, sizeof(*la->fobs));
+    if (la->fobs == NULL) {
+        fprintf(stderr, "Could not allocate the lookahead tables\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of the lookahead tables.
+void lookahead_free(struct lookahead* la) {
+    int idx;
+
+    if (la->fobs != NULL)
+        for (idx = 0; idx < la->vf->max_fobs; idx++)
+            free(la->fobs[idx].table);
+    free(la->fobs);
+    memset(la, 0, sizeof(*la));
+}
+
+
+// Verify a message like verifier_check() does, but match the rolling code in
+// the table of the remote when it has one. Returns the verdict on the message.
+int lookahead_check(struct lookahead* la, const uint8_t* data, int num, int* slot) {
+    struct verifier* vf = la->vf;
+    struct fob_lookahead* fl;
+    struct frame frm;
+    uint32_t code, next;
+    int ret;
+
+    if ((ret = verifier_authenticate(vf, data, num, &frm, slot)) != VERDICT_ACCEPT)
+        return ret;
+    if (vf->states[*slot].state != FOB_ENABLED)
+        return VERDICT_DISABLED;
+
+    // Match the block in the table, and only decrypt if it is not there or the
+    // remote is cold
+    fl = &la->fobs[*slot];
+    next = vf->states[*slot].replay;
+    if (fl->table == NULL || fl->ver != (frm.ver & FRAME_CIPHER) || lookahead_find(fl, frm.block, &code) < 0) {
+        cipher_find(frm.ver)->decrypt(verifier_keys(vf, *slot), &frm.block, &code, 1);
+        la->decrypts++;
+    }
+
+    verifier_touch(vf, *slot, 0);
+    ret = replay_update(&vf->states[*slot].replay, code, vf->window, vf->replay);
+    if (ret == VERDICT_ACCEPT) {
+        if (code - next < vf->window)
+            lookahead_record(la, *slot, code - next);
+        lookahead_fill(la, *slot, frm.ver & FRAME_CIPHER);
+    }
+    return ret;
+}
+
+
+// Scan the table of a remote for a block, storing its rolling code in code.
+// Returns -1 if the block is not in the table.
+int lookahead_find(const struct fob_lookahead* fl, uint32_t block, uint32_t* code) {
+    uint32_t idx, mask = fl->window - 1;
+
+    for (idx = 0; idx < fl->window; idx++) {
+        if (fl->table[idx] == block) {
+            *code = fl->start + ((idx - fl->start) & mask);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// Load the lookahead table of a slot into the cache, like verifier_prefetch().
+void lookahead_prefetch(const struct lookahead* la, int slot) {
+    const struct fob_lookahead* fl = &la->fobs[slot];
+    uint32_t idx, sum = 0;
+
+    if (fl->table != NULL)
+        for (idx = 0; idx < fl->window; idx += 16)
+            sum += fl->table[idx];
+    __asm__ volatile("" :: "r"(sum));
+}
+
+
+// Add a skip to the histogram of a remote, halving every count once the count
+// of the bucket would overflow.
+void lookahead_record(struct lookahead* la, int slot, uint32_t skip) {
+    struct fob_lookahead* fl = &la->fobs[slot];
+    int bkt = 0;
+
+    while (skip && bkt < LOOKAHEAD_BUCKETS-1) {
+        skip >>= 1;
+        bkt++;
+    }
+    if (((fl->skips >> 4*bkt) & 0xF) == 0xF)
+        fl->skips = (fl->skips >> 1) & 0x77777777;
+    fl->skips += 1 << 4*bkt;
+}
+
+
+// Bring the table of a remote up to date with its next rolling code, resizing
+// it if its window changed. A remote only gets a table once enough of its
+// messages were accepted.
+void lookahead_fill(struct lookahead* la, int slot, uint8_t ver) {
+    struct fob_lookahead* fl = &la->fobs[slot];
+    const struct cipher* cph = cipher_find(ver);
+    uint32_t codes[LOOKAHEAD_MAX];
+    uint32_t blocks[LOOKAHEAD_MAX];
+    uint32_t next = la->vf->states[slot].replay;
+    uint32_t window, first, num, idx, seen = 0;
+
+    for (idx = 0; idx < LOOKAHEAD_BUCKETS; idx++)
+        seen += (fl->skips >> 4*idx) & 0xF;
+    if (seen < LOOKAHEAD_SEEN && fl->table == NULL)
+        return;
+
+    // Reallocate the table if its window changed
+    window = lookahead_window(la, fl->skips);
+    if (fl->table == NULL || fl->window != window || fl->ver != ver) {
+        uint32_t* table = realloc(fl->table, window*sizeof(*table));
+        if (table == NULL)
+            return;
+        if (fl->table != NULL)
+            la->table_bytes -= fl->window*sizeof(*table);
+        la->table_bytes += window*sizeof(*table);
+        fl->table = table;
+        fl->window = window;
+        fl->ver = ver;
+        fl->start = next - window;
+    }
+
+    // Encrypt the codes that have come into the window since the last fill
+    first = (next - fl->start < window) ? fl->start + window : next;
+    num = next + window - first;
+    for (idx = 0; idx < num; idx++)
+        codes[idx] = first + idx;
+    cph->encrypt(verifier_keys(la->vf, slot), codes, blocks, num);
+    for (idx = 0; idx < num; idx++)
+        fl->table[codes[idx] & (window-1)] = blocks[idx];
+    fl->start = next;
+}
+
+
+// Drop the table of a slot and start it over with a histogram of skips, such
+// as when the slot is given to another remote.
+void lookahead_clear(struct lookahead* la, int slot, uint32_t skips) {
+    struct fob_lookahead* fl = &la->fobs[slot];
+
+    if (fl->table != NULL)
+        la->table_bytes -= fl->window*sizeof(*fl->table);
+    free(fl->table);
+    memset(fl, 0, sizeof(*fl));
+    fl->skips = skips;
+}
+
+
+// Return the window for a histogram of skips, which is twice the largest skip
+// seen rounded up to a power of two, within the bounds of the lookahead.
+uint32_t lookahead_window(const struct lookahead* la, uint32_t skips) {
+    uint32_t window;
+    int bkt = LOOKAHEAD_BUCKETS-1;
+
+    while (bkt > 0 && ((skips >> 4*bkt) & 0xF) == 0)
+        bkt--;
+    window = (bkt == LOOKAHEAD_BUCKETS-1) ? la->max_window : 2u << bkt;
+    if (window < la->min_window)
+        window = la->min_window;
+    if (window > la->max_window)
+        window = la->max_window;
+    return window;
+}
+
+
+#endif /* _VERIFIER_LOOKAHEAD_H */
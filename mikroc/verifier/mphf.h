@@ -0,0 +1,285 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_MPHF_H
+#define _VERIFIER_MPHF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This is a minimal perfect hash function in the style of PTHash, which maps
+// a fixed set of n keys onto 0 to n-1 without collisions. The keys are hashed
+// into buckets, and every bucket gets a pilot, which is a small number that is
+// hashed and mixed into the hashes of its keys to place them in a table:
+//
+//  bucket:    A skewed choice of bucket, where 60% of the keys go into 30% of
+//             the buckets, so that the large buckets are placed first while
+//             the table is still empty
+//  position:  The hash of the key mixed with the hash of the pilot of its
+//             bucket, reduced to the size of the table
+//
+// The pilots are found by trying 0, 1, 2 and so on for each bucket, from the
+// largest bucket to the smallest, until every key of the bucket lands on a
+// free position. The table is slightly larger than n so that the last buckets
+// still find free positions quickly, and the few keys that land beyond n are
+// remapped onto the positions below n that were left free. The pilots are
+// stored with as many bits as the largest one needs, so the function takes a
+// few bits per key, against the tens of bits of an index with empty entries.
+//
+// A key that was not in the set is mapped to some position as well, so the
+// caller must compare the key stored there.
+
+#define MPHF_LOAD     0.99     // Fraction of the table that is filled
+#define MPHF_BUCKETS  5.0      // Buckets per key, times log2 of the keys
+#define MPHF_TRIES    (1 << 20) // Pilots to try before reseeding
+#define MPHF_SEEDS    16       // Seeds to try before giving up
+
+
+/* A minimal perfect hash function over 32-bit keys */
+struct mphf {
+    uint64_t seed;
+    uint32_t num_keys;
+    uint32_t table_size;
+    uint32_t num_buckets;
+    uint32_t dense_buckets; // The buckets that take 60% of the keys
+    int width;              // Bits per pilot
+    uint64_t* pilots;       // Packed pilots of every bucket
+    uint32_t* remap;        // Position below num_keys of each position above
+};
+
+
+int mphf_build(struct mphf* mp, const uint32_t* keys, uint32_t num);
+void mphf_free(struct mphf* mp);
+uint32_t mphf_lookup(const struct mphf* mp, uint32_t key);
+void mphf_prefetch(const struct mphf* mp, uint32_t key);
+uint64_t mphf_bits(const struct mphf* mp);
+int mphf_place(struct mphf* mp, const uint64_t* hashes, uint32_t num);
+uint64_t mphf_hash(uint64_t key, uint64_t seed);
+uint32_t mphf_bucket(const struct mphf* mp, uint64_t hash);
+uint32_t mphf_position(const struct mphf* mp, uint64_t hash, uint64_t pilot);
+uint64_t mphf_pilot(const struct mphf* mp, uint32_t bucket);
+
+
+// Build the function over num distinct keys. Returns -1 if out of memory or no
+// seed led to a function, which only happens if the keys are not distinct.
+int mphf_build(struct mphf* mp, const uint32_t* keys, uint32_t num) {
+    uint64_t* hashes = malloc((num ? num : 1)*sizeof(*hashes));
+    uint32_t idx, log2n = 1;
+    int ret = -1, attempt;
+
+    memset(mp, 0, sizeof(*mp));
+    if (hashes == NULL) {
+        fprintf(stderr, "Could not allocate the perfect hash\n");
+        return -1;
+    }
+    while (log2n < 32 && ((uint64_t)1 << log2n) < num)
+        log2n++;
+    mp->num_keys = num;
+    mp->table_size = num / MPHF_LOAD + 1;
+    mp->num_buckets = MPHF_BUCKETS * num / log2n + 1;
+    mp->dense_buckets = 0.3 * mp->num_buckets + 1;
+    if (mp->dense_buckets >= mp->num_buckets)
+        mp->dense_buckets = mp->num_buckets - 1;
+
+    for (attempt = 0; attempt < MPHF_SEEDS && ret < 0; attempt++) {
+        mp->seed = mphf_hash(attempt, 0x5EED);
+        for (idx = 0; idx < num; idx++)
+            hashes[idx] = mphf_hash(keys[idx], mp->seed);
+        ret = mphf_place(mp, hashes, num);
+    }
+    free(hashes);
+    if (ret < 0)
+        fprintf(stderr, "Could not build the perfect hash\n");
+    return ret;
+}
+
+
+// Release the memory of a function.
+void mphf_free(struct mphf* mp) {
+    free(mp->pilots);
+    free(mp->remap);
+    memset(mp, 0, sizeof(*mp));
+}
+
+
+// Return the position of a key, which is below the number of keys.
+uint32_t mphf_lookup(const struct mphf* mp, uint32_t key) {
+    uint64_t hash = mphf_hash(key, mp->seed);
+    uint32_t pos = mphf_position(mp, hash, mphf_pilot(mp, mphf_bucket(mp, hash)));
+
+    return (pos < mp->num_keys) ? pos : mp->remap[pos - mp->num_keys];
+}
+
+
+// Start loading the pilot of a key into the cache.
+void mphf_prefetch(const struct mphf* mp, uint32_t key) {
+    uint64_t bit = (uint64_t)mphf_bucket(mp, mphf_hash(key, mp->seed)) * mp->width;
+    __builtin_prefetch(&mp->pilots[bit / 64]);
+}
+
+
+// Return the size of a function in bits.
+uint64_t mphf_bits(const struct mphf* mp) {
+    return ((uint64_t)mp->num_buckets * mp->width + 63) / 64 * 64 +
+        (uint64_t)(mp->table_size - mp->num_keys) * 32;
+}
+
+
+// Find the pilot of every bucket for the hashes of the keys, and pack them.
+// Returns -1 if a bucket found no pilot or out of memory.
+int mphf_place(struct mphf* mp, const uint64_t* hashes, uint32_t num) {
+    uint32_t *counts, *starts, *members, *order, *pilots, *sizes;
+    uint64_t* taken;
+    uint32_t idx, jdx, bkt, max_size = 0, max_pilot = 0, pos[256], free_pos;
+    int ret = -1;
+
+    counts = calloc(mp->num_buckets + 1, sizeof(*counts));
+    starts = calloc(mp->num_buckets + 1, sizeof(*starts));
+    members = malloc((num ? num : 1)*sizeof(*members));
+    order = malloc(mp->num_buckets*sizeof(*order));
+    pilots = calloc(mp->num_buckets, sizeof(*pilots));
+    taken = calloc(mp->table_size/64 + 1, sizeof(*taken));
+    sizes = NULL;
+    free(mp->pilots);
+    free(mp->remap);
+    mp->pilots = NULL;
+    mp->remap = NULL;
+    if (counts == NULL || starts == NULL || members == NULL || order == NULL || pilots == NULL || taken == NULL)
+        goto done;
+
+    // Group the keys by bucket, and order the buckets from largest to smallest
+    for (idx = 0; idx < num; idx++)
+        counts[mphf_bucket(mp, hashes[idx])]++;
+    for (bkt = 0; bkt < mp->num_buckets; bkt++) {
+        starts[bkt+1] = starts[bkt] + counts[bkt];
+        if (counts[bkt] > max_size)
+            max_size = counts[bkt];
+    }
+    if (max_size > sizeof(pos)/sizeof(pos[0]))
+        goto done;
+    for (idx = 0; idx < num; idx++) {
+        bkt = mphf_bucket(mp, hashes[idx]);
+        members[starts[bkt] + --counts[bkt]] = idx;
+    }
+    if ((sizes = calloc(max_size + 2, sizeof(*sizes))) == NULL)
+        goto done;
+    for (bkt = 0; bkt < mp->num_buckets; bkt++)
+        sizes[max_size - (starts[bkt+1] - starts[bkt]) + 1]++;
+    for (idx = 1; idx <= max_size + 1; idx++)
+        sizes[idx] += sizes[idx-1];
+    for (bkt = 0; bkt < mp->num_buckets; bkt++)
+        order[sizes[max_size - (starts[bkt+1] - starts[bkt])]++] = bkt;
+
+    // Try pilots for each bucket until all of its keys land on free positions
+    for (idx = 0; idx < mp->num_buckets; idx++) {
+        uint32_t size, pilot;
+        bkt = order[idx];
+        if ((size = starts[bkt+1] - starts[bkt]) == 0)
+            break;
+        for (pilot = 0; pilot < MPHF_TRIES; pilot++) {
+            for (jdx = 0; jdx < size; jdx++) {
+                pos[jdx] = mphf_position(mp, hashes[members[starts[bkt] + jdx]], pilot);
+                if ((taken[pos[jdx] / 64] >> (pos[jdx] % 64)) & 1)
+                    break;
+                taken[pos[jdx] / 64] |= (uint64_t)1 << (pos[jdx] % 64);
+            }
+            if (jdx == size)
+                break;
+            while (jdx-- > 0)
+                taken[pos[jdx] / 64] &= ~((uint64_t)1 << (pos[jdx] % 64));
+        }
+        if (pilot == MPHF_TRIES)
+            goto done;
+        pilots[bkt] = pilot;
+        if (pilot > max_pilot)
+            max_pilot = pilot;
+    }
+
+    // Pack the pilots, and remap the positions beyond the keys onto the free
+    // positions below
+    for (mp->width = 1; mp->width < 32 && (max_pilot >> mp->width); mp->width++)
+        ;
+    mp->pilots = calloc(((uint64_t)mp->num_buckets * mp->width + 63) / 64 + 1, sizeof(*mp->pilots));
+    mp->remap = malloc((mp->table_size - num + 1)*sizeof(*mp->remap));
+    if (mp->pilots == NULL || mp->remap == NULL)
+        goto done;
+    for (bkt = 0; bkt < mp->num_buckets; bkt++) {
+        uint64_t bit = (uint64_t)bkt * mp->width;
+        mp->pilots[bit / 64] |= (uint64_t)pilots[bkt] << (bit % 64);
+        if (bit % 64 + mp->width > 64)
+            mp->pilots[bit / 64 + 1] |= (uint64_t)pilots[bkt] >> (64 - bit % 64);
+    }
+    free_pos = 0;
+    for (idx = num; idx < mp->table_size; idx++) {
+        mp->remap[idx - num] = 0;
+        if (!((taken[idx / 64] >> (idx % 64)) & 1))
+            continue;
+        while ((taken[free_pos / 64] >> (free_pos % 64)) & 1)
+            free_pos++;
+        mp->remap[idx - num] = free_pos++;
+    }
+    ret = 0;
+
+done:
+    if (ret < 0) {
+        free(mp->pilots);
+        free(mp->remap);
+        mp->pilots = NULL;
+        mp->remap = NULL;
+    }
+    free(counts);
+    free(starts);
+    free(members);
+    free(order);
+    free(pilots);
+    free(taken);
+    free(sizes);
+    return ret;
+}
+
+
+// Hash a key with a seed. This is the finalizer of SplitMix64, which is a
+// bijection, so distinct keys never have the same hash.
+uint64_t mphf_hash(uint64_t key, uint64_t seed) {
+    uint64_t x = key ^ seed;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+
+// Return the bucket of a hash, as described above.
+uint32_t mphf_bucket(const struct mphf* mp, uint64_t hash) {
+    uint32_t choice = hash, range = hash >> 32;
+
+    if (choice < (uint32_t)(0.6 * 4294967296.0))
+        return ((uint64_t)range * mp->dense_buckets) >> 32;
+    return mp->dense_buckets + (((uint64_t)range * (mp->num_buckets - mp->dense_buckets)) >> 32);
+}
+
+
+// Return the position in the table of a hash under a pilot. The keys of a
+// bucket share the upper bits of their hashes, so the mix is hashed again
+// before it is reduced to the table.
+uint32_t mphf_position(const struct mphf* mp, uint64_t hash, uint64_t pilot) {
+    uint64_t mixed = mphf_hash(hash ^ mphf_hash(pilot, mp->seed), 0);
+    return ((unsigned __int128)mixed * mp->table_size) >> 64;
+}
+
+
+// Return the pilot of a bucket.
+uint64_t mphf_pilot(const struct mphf* mp, uint32_t bucket) {
+    uint64_t bit = (uint64_t)bucket * mp->width;
+    uint64_t val = mp->pilots[bit / 64] >> (bit % 64);
+
+    if (bit % 64 + mp->width > 64)
+        val |= mp->pilots[bit / 64 + 1] << (64 - bit % 64);
+    return val & (((uint64_t)1 << mp->width) - 1);
+}
+
+
+#endif /* _VERIFIER_MPHF_H */
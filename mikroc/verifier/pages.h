@@ -0,0 +1,178 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_PAGES_H
+#define _VERIFIER_PAGES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+
+// These are helpers to place the arrays of a verifier in memory, for hosts
+// with several NUMA nodes and for fleets whose keys and state span far more
+// memory than the TLB covers with 4 KiB pages:
+//
+//  pin:    Pin the calling thread to a processor and return its node, so that
+//          the pages that it touches first are allocated on that node
+//  place:  Bind a range of memory to a node, moving any pages that were
+//          already touched, and back it with transparent 2 MiB pages or keep
+//          it in 4 KiB pages
+//
+// The arrays are allocated with malloc(), so the huge pages are transparent
+// ones that are asked for with madvise(), and the pages that were touched
+// before the range was placed are collapsed into huge pages right away where
+// the kernel supports it. Pages of 1 GiB are not used, since the kernel only
+// hands them out of a pool of hugetlbfs pages that is reserved at boot and
+// they cannot back memory from malloc().
+//
+// The nodes are read from sysfs and the system calls are made directly, so
+// this does not need libnuma. The program must define _GNU_SOURCE before any
+// include for sched_setaffinity().
+
+#define PAGES_HUGE  (2 << 20)
+
+/* The memory policy and flag of mbind(), as in numaif.h */
+#define PAGES_MPOL_BIND     2
+#define PAGES_MPOL_MF_MOVE  (1 << 1)
+
+/* The advice of madvise() to collapse pages into huge pages, in Linux 6.1 */
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE  25
+#endif
+
+
+int pages_pin(int cpu);
+int pages_node(int cpu);
+int pages_num_nodes();
+int pages_place(void* ptr, size_t size, int node, int huge);
+long pages_huge_kib();
+int pages_tlb_open();
+int64_t pages_tlb_read(int fd);
+
+
+// Pin the calling thread to a processor. Returns the node of the processor, or
+// -1 if the thread could not be pinned.
+int pages_pin(int cpu) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+        perror("sched_setaffinity");
+        return -1;
+    }
+    return pages_node(cpu);
+}
+
+
+// Return the node of a processor, which is 0 if the system has no nodes.
+int pages_node(int cpu) {
+    char path[64];
+    int node;
+
+    for (node = 0; node < 1024; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0)
+            return node;
+    }
+    return 0;
+}
+
+
+// Return the number of nodes that have memory.
+int pages_num_nodes() {
+    char path[64];
+    int node;
+
+    for (node = 0; node < 1024; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", node);
+        if (access(path, F_OK) != 0)
+            break;
+    }
+    return node ? node : 1;
+}
+
+
+// Bind the pages of a range to a node, unless node is -1, and back the range
+// with huge pages or keep it from them. Only the huge pages that fit entirely
+// in the range are used, so the neighbours of the range are not affected.
+// Returns -1 if the range could not be bound.
+int pages_place(void* ptr, size_t size, int node, int huge) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)ptr & ~(page-1), end = ((uintptr_t)ptr + size + page-1) & ~(page-1);
+    uintptr_t hstart = ((uintptr_t)ptr + PAGES_HUGE-1) & ~(uintptr_t)(PAGES_HUGE-1);
+    uintptr_t hend = ((uintptr_t)ptr + size) & ~(uintptr_t)(PAGES_HUGE-1);
+
+    if (ptr == NULL || size == 0)
+        return 0;
+    if (node >= 0 && pages_num_nodes() > 1) {
+        uint64_t mask[16] = {0};
+        mask[node / 64] = (uint64_t)1 << (node % 64);
+        if (syscall(SYS_mbind, start, end - start, PAGES_MPOL_BIND, mask, 1024, PAGES_MPOL_MF_MOVE)) {
+            perror("mbind");
+            return -1;
+        }
+    }
+    if (!huge) {
+        madvise((void*)start, end - start, MADV_NOHUGEPAGE);
+    } else if (hstart < hend) {
+        madvise((void*)hstart, hend - hstart, MADV_HUGEPAGE);
+        madvise((void*)hstart, hend - hstart, MADV_COLLAPSE);
+    }
+    return 0;
+}
+
+
+// Return the memory of the process that is backed by transparent huge pages,
+// in KiB.
+long pages_huge_kib() {
+    char line[256];
+    long kib = 0;
+    FILE* fp = fopen("/proc/self/smaps_rollup", "r");
+
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (strncmp(line, "AnonHugePages:", 14) == 0)
+            kib = atol(line + 14);
+    fclose(fp);
+    return kib;
+}
+
+
+// Start counting the data TLB misses of loads on the calling thread. Returns
+// the counter, or -1 if the processor has no such counter, as in most virtual
+// machines.
+int pages_tlb_open() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+// Return the count of a counter, or -1 if it could not be read.
+int64_t pages_tlb_read(int fd) {
+    int64_t count;
+
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+        return -1;
+    return count;
+}
+
+
+#endif /* _VERIFIER_PAGES_H */
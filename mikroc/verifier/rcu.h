@@ -0,0 +1,121 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_RCU_H
+#define _VERIFIER_RCU_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+
+
+// This is read-copy-update with quiescent states, for structures that many
+// threads read all the time and that are replaced as a whole once in a while.
+// A writer builds a new copy, publishes it by swapping a pointer, and frees
+// the old copy after a grace period, once every reader has passed through a
+// quiescent state in which it holds no pointer into the structure:
+//
+//  quiescent:  A reader copies the global counter into its own slot, which it
+//              does between batches of work
+//  offline:    A reader that goes idle marks its slot so that the writer need
+//              not wait for it, and comes back online before it reads again
+//  wait:       The writer moves the global counter on and waits until every
+//              online reader has copied the new value
+//
+// Unlike epoch_enter() and epoch_exit(), the readers have no fence or atomic
+// read-modify-write at all: a quiescent state is a single store that releases
+// the loads before it, and reading the published pointer is a single load that
+// its uses depend on, which are both plain moves on x86. The cost is moved to
+// the writer, which may wait for as long as the longest batch of any reader.
+//
+// Only one thread may wait for a grace period at a time.
+
+#define RCU_READERS  64
+#define RCU_OFFLINE  0
+
+
+/* The last quiescent state of a reader, on a cache line of its own */
+struct rcu_reader {
+    uint64_t seen; // The global counter it saw, or RCU_OFFLINE
+} __attribute__((aligned(64)));
+
+/* The readers of a structure that is updated by copies */
+struct rcu {
+    uint64_t global;
+    int num_readers;
+    struct rcu_reader readers[RCU_READERS];
+    uint64_t grace_periods;
+};
+
+
+void rcu_init(struct rcu* rc);
+int rcu_register(struct rcu* rc);
+void rcu_quiescent(struct rcu* rc, int id);
+void rcu_offline(struct rcu* rc, int id);
+void rcu_online(struct rcu* rc, int id);
+void rcu_wait(struct rcu* rc);
+
+
+// Set up the counter with no readers.
+void rcu_init(struct rcu* rc) {
+    memset(rc, 0, sizeof(*rc));
+    rc->global = 1;
+}
+
+
+// Register a reader, which starts out online. Returns its id, or -1 if there
+// are too many readers.
+int rcu_register(struct rcu* rc) {
+    int id = __atomic_fetch_add(&rc->num_readers, 1, __ATOMIC_RELAXED);
+
+    if (id >= RCU_READERS) {
+        fprintf(stderr, "Too many readers of an RCU structure\n");
+        return -1;
+    }
+    rcu_online(rc, id);
+    return id;
+}
+
+
+// Announce that a reader holds no pointer into the structure. The counter is
+// loaded with acquire, so that the reader sees whatever the writer published
+// before moving it on.
+void rcu_quiescent(struct rcu* rc, int id) {
+    __atomic_store_n(&rc->readers[id].seen, __atomic_load_n(&rc->global, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+
+// Take a reader offline until it calls rcu_online(), during which it must not
+// read the structure.
+void rcu_offline(struct rcu* rc, int id) {
+    __atomic_store_n(&rc->readers[id].seen, RCU_OFFLINE, __ATOMIC_RELEASE);
+}
+
+
+// Bring a reader back online. This has a full fence, so that the writer either
+// waits for the reader or the reader sees what the writer published.
+void rcu_online(struct rcu* rc, int id) {
+    __atomic_store_n(&rc->readers[id].seen, __atomic_load_n(&rc->global, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+}
+
+
+// Wait for a grace period, after which no reader holds a pointer that was
+// unpublished before the call. The waiting thread yields, so that readers on
+// the same processor can get to a quiescent state.
+void rcu_wait(struct rcu* rc) {
+    uint64_t global = __atomic_add_fetch(&rc->global, 1, __ATOMIC_SEQ_CST);
+    int idx, num = __atomic_load_n(&rc->num_readers, __ATOMIC_RELAXED);
+
+    for (idx = 0; idx < num && idx < RCU_READERS; idx++) {
+        uint64_t seen;
+        while ((seen = __atomic_load_n(&rc->readers[idx].seen, __ATOMIC_ACQUIRE)) != RCU_OFFLINE && seen < global)
+            sched_yield();
+    }
+    rc->grace_periods++;
+}
+
+
+#endif /* _VERIFIER_RCU_H */
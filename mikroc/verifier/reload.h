@@ -0,0 +1,245 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_RELOAD_H
+#define _VERIFIER_RELOAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "verifier.h"
+#include "rcu.h"
+
+
+// This reloads the keystore and policy of a running verifier, so that remotes
+// can be added, revoked or given new keys without restarting it, which the
+// receiver can only do by being flashed with a new key.h. Every reload builds
+// a new generation from the full list of remotes:
+//
+//  generation:  A verifier with the keystore and the policy, which is the
+//               window and the replay width, that is never changed once it
+//               has been published
+//  channel:     The channel store, which every generation shares, so that
+//               the rolling codes of a remote carry over from one to the next
+//
+// A remote keeps its slot from one generation to the next, and its keys are
+// copied rather than expanded again unless its seed changed. The generation is
+// published by swapping a pointer, and the last one is freed after a grace
+// period of rcu.h, so the verifier threads read it with plain loads and
+// announce a quiescent state between batches.
+//
+// The slots of revoked remotes may still be written by readers of the last
+// generation, so they are only reused once its grace period is over. Reloads
+// are not safe for concurrent use with each other.
+
+/* A remote in the list that the keystore is reloaded from */
+struct reload_entry {
+    uint32_t serial;
+    uint16_t seed[KEY_WORDS];
+    uint32_t code;   // The rolling code of a remote that is new to the keystore
+};
+
+/* The policy that messages are verified under */
+struct reload_policy {
+    uint32_t window;
+    uint32_t replay; // Up to VERIFIER_REPLAY
+};
+
+/* A generation of the keystore and policy */
+struct reload_gen {
+    struct verifier vf;            // The channel store is not its own
+    uint16_t (*seeds)[KEY_WORDS];  // The seed key of every slot
+    int num_remotes;
+    uint64_t number;
+};
+
+/* A keystore and policy that are reloaded while they are read */
+struct reload {
+    struct rcu rcu;
+    struct reload_gen* gen;
+    struct fob_state* states;
+    int max_fobs;
+    int32_t* free_slots;
+    int num_free;
+
+    // What the last reload did, and how long it took
+    int num_added;
+    int num_revoked;
+    int num_rotated;
+    uint64_t build_ns;  // Until the generation was published
+    uint64_t grace_ns;  // Until the last generation was freed
+};
+
+
+int reload_init(struct reload* rl, int max_fobs, const struct reload_policy* policy);
+void reload_free(struct reload* rl);
+struct verifier* reload_current(struct reload* rl);
+int reload_apply(struct reload* rl, const struct reload_entry* entries, int num, const struct reload_policy* policy);
+struct reload_gen* reload_build(struct reload* rl, const struct reload_entry* entries, int num, const struct reload_policy* policy);
+void reload_gen_free(struct reload_gen* gen);
+uint64_t reload_clock();
+
+
+// Set up a keystore for up to max_fobs remotes, with no remotes yet. Returns
+// -1 if out of memory.
+int reload_init(struct reload* rl, int max_fobs, const struct reload_policy* policy) {
+    int idx;
+
+    memset(rl, 0, sizeof(*rl));
+    rcu_init(&rl->rcu);
+    rl->max_fobs = max_fobs;
+    rl->states = calloc(max_fobs, sizeof(*rl->states));
+    rl->free_slots = malloc(max_fobs*sizeof(*rl->free_slots));
+    if (rl->states == NULL || rl->free_slots == NULL) {
+        reload_free(rl);
+        fprintf(stderr, "Could not allocate the keystore\n");
+        return -1;
+    }
+    for (idx = max_fobs; idx > 0; idx--)
+        rl->free_slots[rl->num_free++] = idx-1;
+    if ((rl->gen = reload_build(rl, NULL, 0, policy)) == NULL) {
+        reload_free(rl);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of a keystore. No reader may be active.
+void reload_free(struct reload* rl) {
+    if (rl->gen != NULL)
+        reload_gen_free(rl->gen);
+    free(rl->states);
+    free(rl->free_slots);
+    memset(rl, 0, sizeof(*rl));
+}
+
+
+// Return the verifier of the published generation. A reader may use it until
+// its next quiescent state.
+struct verifier* reload_current(struct reload* rl) {
+    return &__atomic_load_n(&rl->gen, __ATOMIC_CONSUME)->vf;
+}
+
+
+// Replace the keystore with the given remotes and the policy, publish it, and
+// free the last generation once no reader can hold it. Remotes that are not
+// in the list are revoked. Returns -1 if a serial is invalid or repeated, the
+// keystore is full or out of memory, in which case the keystore is unchanged.
+int reload_apply(struct reload* rl, const struct reload_entry* entries, int num, const struct reload_policy* policy) {
+    struct reload_gen *gen, *last = rl->gen;
+    uint64_t start = reload_clock();
+    int slot;
+
+    if ((gen = reload_build(rl, entries, num, policy)) == NULL)
+        return -1;
+    __atomic_store_n(&rl->gen, gen, __ATOMIC_RELEASE);
+    rl->build_ns = reload_clock() - start;
+
+    // Free the revoked slots and the last generation after the grace period
+    start = reload_clock();
+    rcu_wait(&rl->rcu);
+    for (slot = 0; slot < last->vf.num_fobs; slot++)
+        if (last->vf.serials[slot] != VERIFIER_NONE && gen->vf.serials[slot] == VERIFIER_NONE)
+            rl->free_slots[rl->num_free++] = slot;
+    reload_gen_free(last);
+    rl->grace_ns = reload_clock() - start;
+    return 0;
+}
+
+
+// Build the next generation from the given remotes, taking slots for new
+// remotes and setting up their channel state. Returns NULL if the list is not
+// valid or out of memory.
+struct reload_gen* reload_build(struct reload* rl, const struct reload_entry* entries, int num, const struct reload_policy* policy) {
+    struct reload_gen *gen = calloc(1, sizeof(*gen)), *last = rl->gen;
+    struct fob_keys* keys[VERIFIER_BATCH];
+    const uint16_t* seeds[VERIFIER_BATCH];
+    int idx, slot, num_keys = 0, num_free = rl->num_free, added = 0, rotated = 0;
+
+    if (gen == NULL || verifier_init(&gen->vf, rl->max_fobs, policy->window)) {
+        free(gen);
+        return NULL;
+    }
+    free(gen->vf.states);
+    gen->vf.states = rl->states;
+    gen->vf.replay = (policy->replay < VERIFIER_REPLAY) ? policy->replay : VERIFIER_REPLAY;
+    gen->num_remotes = num;
+    gen->number = (last != NULL) ? last->number + 1 : 0;
+    memset(gen->vf.serials, 0xFF, rl->max_fobs*sizeof(*gen->vf.serials));
+    if ((gen->seeds = malloc(rl->max_fobs*sizeof(*gen->seeds))) == NULL)
+        goto fail;
+
+    // Keep the slot of every remote that was already in the keystore, and
+    // expand the keys of those with a new seed in batches
+    for (idx = 0; idx < num; idx++) {
+        const struct reload_entry* ent = &entries[idx];
+        int kept = (last != NULL) ? verifier_find(&last->vf, ent->serial) : -1;
+        if (kept < 0 && num_free == 0) {
+            fprintf(stderr, "The keystore is full\n");
+            goto fail;
+        }
+        slot = (kept >= 0) ? kept : rl->free_slots[--num_free];
+        if (verifier_place(&gen->vf, slot, ent->serial, NULL))
+            goto fail;
+        memcpy(gen->seeds[slot], ent->seed, sizeof(ent->seed));
+        if (slot >= gen->vf.num_fobs)
+            gen->vf.num_fobs = slot + 1;
+        if (kept >= 0 && memcmp(last->seeds[slot], ent->seed, sizeof(ent->seed)) == 0) {
+            gen->vf.keys[slot] = last->vf.keys[slot];
+            continue;
+        }
+
+        // The slot of a new remote is held by no reader, so its channel state
+        // can be set up before the generation is published
+        if (kept < 0) {
+            rl->states[slot].replay = (uint64_t)0xFFFFFFFF << 32 | ent->code;
+            rl->states[slot].state = FOB_ENABLED;
+            rl->states[slot].heard = 0;
+            added++;
+        } else {
+            rotated++;
+        }
+        keys[num_keys] = &gen->vf.keys[slot];
+        seeds[num_keys++] = gen->seeds[slot];
+        if (num_keys == VERIFIER_BATCH) {
+            fob_keys_init_each(keys, seeds, num_keys);
+            num_keys = 0;
+        }
+    }
+    if (num_keys > 0)
+        fob_keys_init_each(keys, seeds, num_keys);
+    rl->num_free = num_free;
+    rl->num_added = added;
+    rl->num_rotated = rotated;
+    rl->num_revoked = (last != NULL) ? last->num_remotes - (num - added) : 0;
+    return gen;
+
+fail:
+    reload_gen_free(gen);
+    return NULL;
+}
+
+
+// Release the memory of a generation, apart from the channel store.
+void reload_gen_free(struct reload_gen* gen) {
+    gen->vf.states = NULL;
+    verifier_free(&gen->vf);
+    free(gen->seeds);
+    free(gen);
+}
+
+
+// Return the current monotonic time in nanoseconds.
+uint64_t reload_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+#endif /* _VERIFIER_RELOAD_H */
@@ -0,0 +1,110 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_SHARD_H
+#define _VERIFIER_SHARD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "verifier.h"
+#include "lookahead.h"
+#include "pages.h"
+
+
+// This is a shard of the fleet that is verified by a single thread, with its
+// own verifier and lookahead tables. The fleet is split between the shards by
+// serial number, so a message is handed to the thread of its shard and the
+// shards share no memory at all.
+//
+// A shard is set up on the thread that will use it, which is pinned to its
+// processor first. Every array that a message touches is then placed on the
+// node of that processor and backed by huge pages: the channel store, the
+// keystore or key cache, the index and the lookahead state of every remote.
+// The lookahead tables themselves are small and allocated as remotes are
+// heard, so they are left to the first touch of the pinned thread.
+
+/* A shard of the fleet and the thread that verifies it */
+struct shard {
+    int cpu;
+    int node;
+    struct verifier vf;
+    struct lookahead la;
+};
+
+
+int shard_init(struct shard* sh, int cpu, int max_fobs, int num_lines, int huge);
+void shard_free(struct shard* sh);
+int shard_place(struct shard* sh, int node, int huge);
+int shard_of(uint32_t serial, int num_shards);
+
+
+// Pin the calling thread to a processor and set up a shard for up to max_fobs
+// remotes on it, with num_lines of key cache as in verifier_init_cached(), and
+// place its arrays on the node of the processor. Returns -1 if the thread
+// could not be pinned or out of memory.
+int shard_init(struct shard* sh, int cpu, int max_fobs, int num_lines, int huge) {
+    memset(sh, 0, sizeof(*sh));
+    sh->cpu = cpu;
+    if ((sh->node = pages_pin(cpu)) < 0)
+        return -1;
+    if (verifier_init_cached(&sh->vf, max_fobs, VERIFIER_WINDOW, num_lines))
+        return -1;
+    if (lookahead_init(&sh->la, &sh->vf, LOOKAHEAD_MIN, LOOKAHEAD_MAX)) {
+        verifier_free(&sh->vf);
+        return -1;
+    }
+    if (shard_place(sh, sh->node, huge)) {
+        shard_free(sh);
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of a shard.
+void shard_free(struct shard* sh) {
+    lookahead_free(&sh->la);
+    verifier_free(&sh->vf);
+    memset(sh, 0, sizeof(*sh));
+}
+
+
+// Place the arrays of a shard on a node, with or without huge pages. This must
+// be done again after verifier_rebuild(), which allocates a new index. Returns
+// -1 if an array could not be bound to the node.
+int shard_place(struct shard* sh, int node, int huge) {
+    struct verifier* vf = &sh->vf;
+    struct keycache* kc = vf->cache;
+    size_t max_fobs = vf->max_fobs;
+    int ret = 0;
+
+    ret |= pages_place(vf->serials, max_fobs*sizeof(*vf->serials), node, huge);
+    ret |= pages_place(vf->states, max_fobs*sizeof(*vf->states), node, huge);
+    if (vf->index != NULL)
+        ret |= pages_place(vf->index, ((size_t)vf->index_mask+1)*sizeof(*vf->index), node, huge);
+    ret |= pages_place(sh->la.fobs, max_fobs*sizeof(*sh->la.fobs), node, huge);
+    if (kc == NULL) {
+        ret |= pages_place(vf->keys, max_fobs*sizeof(*vf->keys), node, huge);
+    } else {
+        ret |= pages_place(kc->seeds, max_fobs*sizeof(*kc->seeds), node, huge);
+        ret |= pages_place(kc->lines, max_fobs*sizeof(*kc->lines), node, huge);
+        ret |= pages_place(kc->keys, (size_t)kc->num_lines*sizeof(*kc->keys), node, huge);
+        ret |= pages_place(kc->owners, (size_t)kc->num_lines*sizeof(*kc->owners), node, huge);
+    }
+    return ret ? -1 : 0;
+}
+
+
+// Return the shard of a serial number. This hashes the serial differently
+// from the index of a verifier, so the remotes of a shard still spread over
+// all of its index.
+int shard_of(uint32_t serial, int num_shards) {
+    return ((uint64_t)(uint32_t)mphf_hash(serial, 0x5AAD) * num_shards) >> 32;
+}
+
+
+#endif /* _VERIFIER_SHARD_H */
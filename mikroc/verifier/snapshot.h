@@ -0,0 +1,259 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_SNAPSHOT_H
+#define _VERIFIER_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+// This takes consistent snapshots of arrays that one thread keeps writing, so
+// that other threads can scan them for as long as they like without stopping
+// the writer or seeing a mix of old and new entries. The arrays are split into
+// pages, and every snapshot is stamped with an epoch that counts up:
+//
+//  take:     The writer opens a snapshot in the next epoch, which copies
+//            nothing, as every page still holds the contents it had then
+//  touch:    Before the writer changes a page that the newest snapshot holds
+//            no copy of, it copies the page into that snapshot
+//  read:     A reader of a snapshot takes each page from the first snapshot
+//            of the same epoch or later that holds a copy of it, or from the
+//            live array if none does
+//
+// A page copied into a later snapshot is unchanged since the earlier ones were
+// taken, so it is just as valid for them. A reader copies a live page before
+// looking for a copy of it, and the writer publishes a copy before it changes
+// the page, so a reader that saw a change is sure to find the copy.
+//
+// The pages are much smaller than those of the system, since every message
+// that a remote sends touches a random page of the channel store, and each
+// first touch copies a whole page. The copies of a snapshot are taken one
+// after the other from blocks of SNAPSHOT_BLOCK pages.
+//
+// Snapshots are released by their readers, and freed by the writer from the
+// oldest one on, since a reader of an older snapshot may still take pages from
+// a newer one. Their blocks are kept for later copies, so once warmed up the
+// writer does not allocate memory to copy a page. The writer does not touch
+// the snapshots at all while none is open, apart from checking for one.
+
+#define SNAPSHOT_PAGE    256  // Bytes in a page
+#define SNAPSHOT_BLOCK   256  // Pages in a block of copies
+#define SNAPSHOT_ARRAYS  4    // The most arrays in a store
+
+
+/* Copies of pages taken from one allocation */
+struct snapshot_block {
+    struct snapshot_block* next;
+    uint32_t used;
+    uint8_t data[SNAPSHOT_BLOCK][SNAPSHOT_PAGE];
+};
+
+/* A snapshot of the arrays, open until it is released */
+struct snapshot {
+    uint64_t epoch;
+    struct snapshot* newer;
+    uint8_t** pages;  // The copy of every page changed since, or NULL
+    struct snapshot_block* blocks;
+    int released;
+};
+
+/* An array covered by snapshots */
+struct snapshot_array {
+    uint8_t* base;
+    size_t size;      // Bytes in the array
+    uint32_t first;   // The first page of the array in the store
+};
+
+/* The snapshots of a few arrays */
+struct snapshots {
+    int num_arrays;
+    struct snapshot_array arrays[SNAPSHOT_ARRAYS];
+    uint32_t num_pages;
+    uint64_t epoch;             // The epoch of the newest snapshot
+    struct snapshot* newest;    // NULL if no snapshot is open
+    struct snapshot* oldest;
+    struct snapshot_block* spare;
+    uint64_t copies;
+};
+
+
+void snapshot_init(struct snapshots* ss);
+void snapshot_free(struct snapshots* ss);
+int snapshot_add(struct snapshots* ss, void* base, size_t size);
+struct snapshot* snapshot_take(struct snapshots* ss);
+void snapshot_release(struct snapshot* snap);
+void snapshot_collect(struct snapshots* ss);
+void snapshot_touch(struct snapshots* ss, int id, const void* ptr);
+void snapshot_copy(struct snapshots* ss, uint32_t page);
+void snapshot_read(const struct snapshots* ss, const struct snapshot* snap, int id, size_t off, size_t num, void* out);
+
+
+// Set up a store without any arrays or snapshots.
+void snapshot_init(struct snapshots* ss) {
+    memset(ss, 0, sizeof(*ss));
+}
+
+
+// Release the memory of a store, and every snapshot in it. No reader may be
+// active.
+void snapshot_free(struct snapshots* ss) {
+    struct snapshot_block* block;
+
+    while (ss->oldest != NULL) {
+        snapshot_release(ss->oldest);
+        snapshot_collect(ss);
+    }
+    while ((block = ss->spare) != NULL) {
+        ss->spare = block->next;
+        free(block);
+    }
+    memset(ss, 0, sizeof(*ss));
+}
+
+
+// Add an array of size bytes to the store, which may only be done while no
+// snapshot is open. Returns the id of the array, or -1 if there are too many.
+int snapshot_add(struct snapshots* ss, void* base, size_t size) {
+    if (ss->num_arrays >= SNAPSHOT_ARRAYS || ss->newest != NULL)
+        return -1;
+    ss->arrays[ss->num_arrays].base = base;
+    ss->arrays[ss->num_arrays].size = size;
+    ss->arrays[ss->num_arrays].first = ss->num_pages;
+    ss->num_pages += (size + SNAPSHOT_PAGE-1) / SNAPSHOT_PAGE;
+    return ss->num_arrays++;
+}
+
+
+// Open a snapshot of the arrays as they are now, freeing the snapshots that
+// were released. This must be called by the writer. Returns NULL if out of
+// memory.
+struct snapshot* snapshot_take(struct snapshots* ss) {
+    struct snapshot* snap = malloc(sizeof(*snap));
+
+    snapshot_collect(ss);
+    if (snap == NULL || (snap->pages = calloc(ss->num_pages, sizeof(*snap->pages))) == NULL) {
+        free(snap);
+        fprintf(stderr, "Could not take a snapshot\n");
+        return NULL;
+    }
+    snap->epoch = ss->epoch + 1;
+    snap->newer = NULL;
+    snap->blocks = NULL;
+    snap->released = 0;
+    if (ss->newest != NULL)
+        __atomic_store_n(&ss->newest->newer, snap, __ATOMIC_RELEASE);
+    else
+        ss->oldest = snap;
+    ss->newest = snap;
+    ss->epoch = snap->epoch;
+    return snap;
+}
+
+
+// Release a snapshot that a reader is done with. This may be called by any
+// thread, and the snapshot is freed by the writer later on.
+void snapshot_release(struct snapshot* snap) {
+    __atomic_store_n(&snap->released, 1, __ATOMIC_RELEASE);
+}
+
+
+// Free the oldest snapshots for as long as they are released, keeping their
+// blocks for later copies. This must be called by the writer.
+void snapshot_collect(struct snapshots* ss) {
+    struct snapshot* snap;
+    struct snapshot_block* block;
+
+    while ((snap = ss->oldest) != NULL && __atomic_load_n(&snap->released, __ATOMIC_ACQUIRE)) {
+        while ((block = snap->blocks) != NULL) {
+            snap->blocks = block->next;
+            block->next = ss->spare;
+            ss->spare = block;
+        }
+        ss->oldest = snap->newer;
+        if (ss->oldest == NULL)
+            ss->newest = NULL;
+        free(snap->pages);
+        free(snap);
+    }
+}
+
+
+// Prepare to change the byte at ptr in an array, copying its page into the
+// newest snapshot if it holds no copy of it yet. This must be called by the
+// writer before every change.
+void snapshot_touch(struct snapshots* ss, int id, const void* ptr) {
+    const struct snapshot_array* arr = &ss->arrays[id];
+    uint32_t page;
+
+    if (ss->newest == NULL)
+        return;
+    page = arr->first + ((const uint8_t*)ptr - arr->base) / SNAPSHOT_PAGE;
+    if (ss->newest->pages[page] == NULL)
+        snapshot_copy(ss, page);
+}
+
+
+// Copy a page into the newest snapshot and publish the copy before the page
+// is changed, unless every snapshot has been released by now.
+void snapshot_copy(struct snapshots* ss, uint32_t page) {
+    const struct snapshot_array* arr = ss->arrays;
+    struct snapshot_block* block;
+    uint8_t* copy;
+    size_t off;
+
+    snapshot_collect(ss);
+    if (ss->newest == NULL)
+        return;
+    if ((block = ss->newest->blocks) == NULL || block->used == SNAPSHOT_BLOCK) {
+        if ((block = ss->spare) != NULL)
+            ss->spare = block->next;
+        else if ((block = malloc(sizeof(*block))) == NULL)
+            return; // The snapshot will see the change
+        block->used = 0;
+        block->next = ss->newest->blocks;
+        ss->newest->blocks = block;
+    }
+    while (page >= arr->first + (arr->size + SNAPSHOT_PAGE-1) / SNAPSHOT_PAGE)
+        arr++;
+    copy = block->data[block->used++];
+    off = (size_t)(page - arr->first) * SNAPSHOT_PAGE;
+    memcpy(copy, arr->base + off, (arr->size - off < SNAPSHOT_PAGE) ? arr->size - off : SNAPSHOT_PAGE);
+    __atomic_store_n(&ss->newest->pages[page], copy, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ss->copies++;
+}
+
+
+// Copy num bytes at off in an array, as they were when a snapshot was taken,
+// into out. This may be called by any thread until the snapshot is released.
+void snapshot_read(const struct snapshots* ss, const struct snapshot* snap, int id, size_t off, size_t num, void* out) {
+    const struct snapshot_array* arr = &ss->arrays[id];
+    const struct snapshot* from;
+    const uint8_t* copy;
+    uint8_t* dst = out;
+    size_t len;
+
+    for (; num > 0; off += len, dst += len, num -= len) {
+        uint32_t page = arr->first + off / SNAPSHOT_PAGE;
+        len = SNAPSHOT_PAGE - off % SNAPSHOT_PAGE;
+        if (len > num)
+            len = num;
+
+        // Copy the live page first, and then take a copy of it if there is one
+        memcpy(dst, arr->base + off, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        for (from = snap; from != NULL; from = __atomic_load_n(&from->newer, __ATOMIC_ACQUIRE)) {
+            if ((copy = __atomic_load_n(&from->pages[page], __ATOMIC_ACQUIRE)) != NULL) {
+                memcpy(dst, copy + off % SNAPSHOT_PAGE, len);
+                break;
+            }
+        }
+    }
+}
+
+
+#endif /* _VERIFIER_SNAPSHOT_H */
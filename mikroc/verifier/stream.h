@@ -0,0 +1,112 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_STREAM_H
+#define _VERIFIER_STREAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "verifier.h"
+#include "lookahead.h"
+
+
+// This is the host equivalent of receive_code() in receiver.c, which is fed the
+// bytes from a receiver one at a time as they arrive. The remote is named
+// before the end of the message, so the stream can speculatively load its
+// state while the rest of the message is still on its way:
+//
+//  serial known:  Prefetch the index entry of the serial number
+//  next byte:     Guess the slot from the index entry, and load the keys,
+//                 channel state and lookahead table of that slot
+//
+// A CRC message is named by its channel, so this happens on the channel and
+// CRC bytes. A MAC message is named by its serial, so this happens on the last
+// byte of the serial and the first byte of the MAC. Once the last byte arrives,
+// the check finds everything in the cache. A wrong guess only costs the wasted
+// loads.
+
+/* A stream of bytes from a single receiver */
+struct stream {
+    struct verifier* vf;
+    struct lookahead* la; // Lookahead tables to check with, if not NULL
+    int speculate;
+    uint8_t data[FRAME_MAX];
+    int num; // The number of bytes received, or -1 before a frame marker
+    int len;
+};
+
+
+void stream_init(struct stream* st, struct verifier* vf, struct lookahead* la, int speculate);
+int stream_feed(struct stream* st, uint8_t byte);
+int stream_check(struct stream* st, int* slot);
+void stream_speculate(struct stream* st);
+
+
+// Set up a stream that waits for a frame marker.
+void stream_init(struct stream* st, struct verifier* vf, struct lookahead* la, int speculate) {
+    memset(st, 0, sizeof(*st));
+    st->vf = vf;
+    st->la = la;
+    st->speculate = speculate;
+    st->num = -1;
+}
+
+
+// Add the next byte from the receiver. Returns the length of the message in
+// the stream once it is complete, which should then be passed to
+// stream_check(), or 0 otherwise.
+int stream_feed(struct stream* st, uint8_t byte) {
+    if (byte == FRAME_MARK) {
+        st->num = 0;
+        st->len = FRAME_MAX;
+        return 0;
+    }
+    if (st->num < 0)
+        return 0;
+
+    st->data[st->num++] = byte;
+    if (st->num == 5)
+        st->len = frame_length(st->data[4]);
+    if (st->speculate)
+        stream_speculate(st);
+    if (st->num < st->len)
+        return 0;
+    st->num = -1;
+    return st->len;
+}
+
+
+// Verify the message that was just completed. Returns the verdict on it.
+int stream_check(struct stream* st, int* slot) {
+    if (st->la != NULL)
+        return lookahead_check(st->la, st->data, st->len, slot);
+    return verifier_check(st->vf, st->data, st->len, slot);
+}
+
+
+// Load the state of the remote for the message so far, as described above.
+void stream_speculate(struct stream* st) {
+    int named = (st->len == FRAME_LEN) ? 5 : 8;
+    uint32_t serial;
+    int slot;
+
+    if (st->num < named || st->num > named + 1)
+        return;
+    if (st->len == FRAME_LEN)
+        serial = st->data[4] % FRAME_CHANS;
+    else
+        serial = st->data[5] | st->data[6] << 8 | st->data[7] << 16;
+
+    if (st->num == named) {
+        verifier_prefetch_index(st->vf, serial);
+    } else if ((slot = verifier_guess(st->vf, serial)) >= 0) {
+        verifier_prefetch(st->vf, slot);
+        if (st->la != NULL)
+            lookahead_prefetch(st->la, slot);
+    }
+}
+
+
+#endif /* _VERIFIER_STREAM_H */
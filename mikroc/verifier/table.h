@@ -0,0 +1,329 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_TABLE_H
+#define _VERIFIER_TABLE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "epoch.h"
+
+
+// This is an index from serial numbers to slots that grows without stopping
+// its readers, for fleets where a bulk enrollment can double the number of
+// remotes, and it is the index of a verifier made by verifier_init_growing().
+// It is an array of open addressing like the index of a fixed verifier, but
+// every entry holds both the serial number and the slot in a single 64-bit
+// word, so that readers on other threads see either the whole entry or none of
+// it. Readers take no locks, and only the single writer changes the table.
+//
+// When the table is full enough, a new array of twice the size is allocated
+// and the entries of the old one are moved over a few buckets at a time:
+//
+//  generation:  The current array, where new entries go, and the old array
+//               that is being moved out of, which are published together
+//  step:        Every write moves the next few buckets of the old array into
+//               the current one, TABLE_STEP of them by default
+//  next:        The array that the next resize moves into, which is allocated
+//               ahead and zeroed TABLE_ZERO buckets per write, since faulting
+//               in all of its pages at once would stop the writer just as long
+//               as moving the entries would
+//
+// Entries are copied rather than moved, so a reader that looks in the current
+// array and then in the old one of the same generation always finds an entry.
+// Once every bucket has been moved, a generation without the old array is
+// published, and the old array and generation are retired through the epochs
+// of the readers. A removed entry is left as a tombstone that lookups skip,
+// and tombstones are dropped by the next resize.
+//
+// With a step of 0 the whole array is moved at once when it fills up, as a
+// plain rehash would, which stops the writer and anything waiting on it.
+
+#define TABLE_LOAD     0.5  // Fraction of the array in use before it grows
+#define TABLE_STEP     64   // Buckets of the old array moved per write
+#define TABLE_ZERO     256  // Buckets of the next array zeroed per write
+#define TABLE_PREPARE  0.375 // Fraction in use before the next array is zeroed
+#define TABLE_DELETED  0xFFFFFFFF
+
+
+/* An array of entries, each the serial number plus one in the upper half and
+   the slot in the lower half, or 0 if empty */
+struct table_array {
+    uint32_t mask;
+    uint64_t entries[];
+};
+
+/* The arrays that readers look in */
+struct table_gen {
+    struct table_array* cur;
+    struct table_array* old; // NULL unless a resize is in progress
+};
+
+/* An index that grows incrementally */
+struct table {
+    struct table_gen* gen;
+    struct epoch* ep;
+    struct table_array* next; // NULL unless the next array is being zeroed
+    int step;
+    uint32_t moved;   // The buckets of the old array moved so far
+    uint32_t zeroed;  // The buckets of the next array zeroed so far
+    uint32_t used;    // The entries and tombstones in the current array
+    uint32_t num;     // The entries that are not removed
+    uint64_t resizes;
+};
+
+
+int table_init(struct table* tb, uint32_t size, struct epoch* ep, int step);
+void table_free(struct table* tb);
+int64_t table_find(const struct table* tb, uint32_t serial);
+int table_insert(struct table* tb, uint32_t serial, uint32_t slot);
+int table_remove(struct table* tb, uint32_t serial);
+int table_grow(struct table* tb);
+int table_prepare(struct table* tb, uint32_t num);
+void table_move(struct table* tb, uint32_t num);
+void table_prefetch(const struct table* tb, uint32_t serial);
+struct table_array* table_array_new(uint32_t size);
+int64_t table_array_find(const struct table_array* arr, uint32_t serial, uint32_t* pos);
+void table_array_put(struct table_array* arr, uint64_t entry);
+uint32_t table_hash(uint32_t serial);
+
+
+// Set up an empty index with room for size entries, rounded up to a power of
+// two, whose memory is reclaimed through the readers of ep. Every write moves
+// step buckets during a resize, or all of them if step is 0. Returns -1 if out
+// of memory.
+int table_init(struct table* tb, uint32_t size, struct epoch* ep, int step) {
+    uint32_t cap = 1;
+
+    memset(tb, 0, sizeof(*tb));
+    while (cap < size)
+        cap <<= 1;
+    tb->ep = ep;
+    tb->step = step;
+    if ((tb->gen = calloc(1, sizeof(*tb->gen))) == NULL || (tb->gen->cur = table_array_new(cap)) == NULL) {
+        free(tb->gen);
+        fprintf(stderr, "Could not allocate the table\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of an index. No reader may be active.
+void table_free(struct table* tb) {
+    if (tb->gen != NULL) {
+        free(tb->gen->cur);
+        free(tb->gen->old);
+    }
+    free(tb->gen);
+    free(tb->next);
+    memset(tb, 0, sizeof(*tb));
+}
+
+
+// Return the slot of a serial number, or -1 if it is not in the index. A
+// reader on another thread than the writer must be inside epoch_enter() and
+// epoch_exit().
+int64_t table_find(const struct table* tb, uint32_t serial) {
+    const struct table_gen* gen = __atomic_load_n(&tb->gen, __ATOMIC_ACQUIRE);
+    uint32_t pos;
+    int64_t slot;
+
+    if ((slot = table_array_find(gen->cur, serial, &pos)) < 0 && gen->old != NULL)
+        slot = table_array_find(gen->old, serial, &pos);
+    return (slot == TABLE_DELETED) ? -1 : slot;
+}
+
+
+// Add a serial number with its slot, moving part of a resize in progress,
+// starting one if the index is full enough or else preparing for it. Returns
+// -1 if the serial is already in the index or out of memory.
+int table_insert(struct table* tb, uint32_t serial, uint32_t slot) {
+    uint64_t entry = (uint64_t)(serial + 1) << 32 | slot;
+    struct table_array* cur;
+    uint32_t pos;
+
+    if (table_find(tb, serial) >= 0)
+        return -1;
+    if (tb->gen->old != NULL) {
+        table_move(tb, tb->step);
+    } else if (tb->used + 1 > TABLE_LOAD * (tb->gen->cur->mask + 1)) {
+        if (table_grow(tb))
+            return -1;
+    } else if (tb->step > 0 && tb->used + 1 > TABLE_PREPARE * (tb->gen->cur->mask + 1)) {
+        table_prepare(tb, TABLE_ZERO);
+    }
+
+    // Reuse the tombstone of the serial if it was removed, since lookups stop
+    // at the first entry of a serial
+    cur = tb->gen->cur;
+    if (table_array_find(cur, serial, &pos) == TABLE_DELETED) {
+        __atomic_store_n(&cur->entries[pos], entry, __ATOMIC_RELEASE);
+    } else {
+        table_array_put(cur, entry);
+        tb->used++;
+    }
+    tb->num++;
+    if (tb->ep->pending > 0)
+        epoch_advance(tb->ep);
+    return 0;
+}
+
+
+// Remove a serial number, leaving a tombstone in its place in every array.
+// Returns -1 if it is not in the index.
+int table_remove(struct table* tb, uint32_t serial) {
+    struct table_gen* gen = tb->gen;
+    uint32_t pos;
+    int found = 0;
+
+    if (table_array_find(gen->cur, serial, &pos) >= 0) {
+        __atomic_store_n(&gen->cur->entries[pos], (uint64_t)(serial + 1) << 32 | TABLE_DELETED, __ATOMIC_RELEASE);
+        found = 1;
+    }
+    if (gen->old != NULL && table_array_find(gen->old, serial, &pos) >= 0) {
+        __atomic_store_n(&gen->old->entries[pos], (uint64_t)(serial + 1) << 32 | TABLE_DELETED, __ATOMIC_RELEASE);
+        found = 1;
+    }
+    if (!found)
+        return -1;
+    tb->num--;
+    if (gen->old != NULL)
+        table_move(tb, tb->step);
+    return 0;
+}
+
+
+// Start a resize into the next array, zeroing whatever is left of it, and move
+// all of it at once if the step is 0. Returns -1 if out of memory.
+int table_grow(struct table* tb) {
+    struct table_gen *gen = malloc(sizeof(*gen)), *prev = tb->gen;
+
+    if (gen == NULL || table_prepare(tb, UINT32_MAX)) {
+        free(gen);
+        fprintf(stderr, "Could not grow the table\n");
+        return -1;
+    }
+    gen->cur = tb->next;
+    gen->old = prev->cur;
+    tb->next = NULL;
+    __atomic_store_n(&tb->gen, gen, __ATOMIC_RELEASE);
+    epoch_retire(tb->ep, prev);
+    tb->moved = 0;
+    tb->used = 0;
+    tb->resizes++;
+    table_move(tb, tb->step ? (uint32_t)tb->step : gen->old->mask + 1);
+    return 0;
+}
+
+
+// Allocate the next array if it is not yet, twice as large as the current one
+// or as large if that is mostly tombstones, and zero up to num more of its
+// buckets. Returns -1 if out of memory.
+int table_prepare(struct table* tb, uint32_t num) {
+    uint32_t size = tb->gen->cur->mask + 1;
+
+    if (tb->next == NULL) {
+        if (tb->num + 1 > TABLE_LOAD/2 * size)
+            size *= 2;
+        if ((tb->next = malloc(sizeof(*tb->next) + (size_t)size*sizeof(tb->next->entries[0]))) == NULL)
+            return -1;
+        tb->next->mask = size - 1;
+        tb->zeroed = 0;
+    }
+    size = tb->next->mask + 1;
+    if (num > size - tb->zeroed)
+        num = size - tb->zeroed;
+    memset(&tb->next->entries[tb->zeroed], 0, (size_t)num*sizeof(tb->next->entries[0]));
+    tb->zeroed += num;
+    return 0;
+}
+
+
+// Move up to num buckets of the old array into the current one, and finish
+// the resize once all of them are moved.
+void table_move(struct table* tb, uint32_t num) {
+    struct table_gen *gen = tb->gen, *done;
+    struct table_array* old = gen->old;
+    uint32_t end = tb->moved + num;
+
+    if (end > old->mask + 1 || end < tb->moved)
+        end = old->mask + 1;
+    for (; tb->moved < end; tb->moved++) {
+        uint64_t entry = old->entries[tb->moved];
+        if (entry != 0 && (uint32_t)entry != TABLE_DELETED) {
+            table_array_put(gen->cur, entry);
+            tb->used++;
+        }
+    }
+    if (tb->moved <= old->mask)
+        return;
+
+    // Publish the current array alone, and retire the old one
+    if ((done = malloc(sizeof(*done))) == NULL)
+        return;
+    done->cur = gen->cur;
+    done->old = NULL;
+    __atomic_store_n(&tb->gen, done, __ATOMIC_RELEASE);
+    epoch_retire(tb->ep, gen);
+    epoch_retire(tb->ep, old);
+}
+
+
+// Start loading the entry of a serial number in the current array into the
+// cache, where it usually is.
+void table_prefetch(const struct table* tb, uint32_t serial) {
+    const struct table_array* cur = __atomic_load_n(&tb->gen, __ATOMIC_ACQUIRE)->cur;
+
+    __builtin_prefetch(&cur->entries[table_hash(serial) & cur->mask]);
+}
+
+
+// Allocate an empty array of a power of two entries. Returns NULL if out of
+// memory.
+struct table_array* table_array_new(uint32_t size) {
+    struct table_array* arr = calloc(1, sizeof(*arr) + (size_t)size*sizeof(arr->entries[0]));
+
+    if (arr != NULL)
+        arr->mask = size - 1;
+    return arr;
+}
+
+
+// Return the slot of a serial number in an array, storing the position of its
+// entry, or -1 if it is not there. The slot of a tombstone is TABLE_DELETED.
+int64_t table_array_find(const struct table_array* arr, uint32_t serial, uint32_t* pos) {
+    uint64_t entry, key = (uint64_t)(serial + 1) << 32;
+
+    for (*pos = table_hash(serial); (entry = __atomic_load_n(&arr->entries[*pos & arr->mask], __ATOMIC_ACQUIRE)) != 0; (*pos)++) {
+        if ((entry & 0xFFFFFFFF00000000ull) == key) {
+            *pos &= arr->mask;
+            return (uint32_t)entry;
+        }
+    }
+    return -1;
+}
+
+
+// Put an entry into the first empty position of its probe sequence.
+void table_array_put(struct table_array* arr, uint64_t entry) {
+    uint32_t pos;
+
+    for (pos = table_hash((entry >> 32) - 1); arr->entries[pos & arr->mask] != 0; pos++)
+        ;
+    __atomic_store_n(&arr->entries[pos & arr->mask], entry, __ATOMIC_RELEASE);
+}
+
+
+// Return the start of the probe sequence of a serial number, which is the same
+// hash as verifier_hash() so that entries land where those of an index would.
+uint32_t table_hash(uint32_t serial) {
+    return (serial * 0x9E3779B1u) >> 8;
+}
+
+
+#endif /* _VERIFIER_TABLE_H */
@@ -0,0 +1,286 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_TIER_H
+#define _VERIFIER_TIER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "verifier.h"
+#include "lookahead.h"
+
+
+// This is a store of remotes in two tiers, for fleets where most remotes are
+// used every day but a long tail of spares and visitors is seldom heard:
+//
+//  hot:   A verifier and lookahead tables in memory for a fixed number of
+//         remotes, with their keys fully expanded
+//  cold:  A compact record of every enrolled remote in a file that is mapped
+//         into memory, holding the seed key instead of the expanded keys
+//
+// The cold records are indexed directly by serial number, since serials are
+// only 24 bits, so finding one touches a single page of the file and the file
+// is sparse where no remotes are enrolled. Read ahead is turned off for it, as
+// the records of neighbouring serials are unrelated. A message from a remote
+// that is not hot promotes it, expanding its keys from the seed, once its MAC
+// is checked with keys scheduled from the seed alone. The slot for
+// it is picked by the clock algorithm: every hot remote has a bit that is set
+// when it is heard, and a hand sweeps the slots clearing the bits until it
+// finds a remote that was not heard since the last sweep, which is demoted by
+// writing its state back to its record. The histogram of skips of the
+// lookahead is kept in the record too, so a remote gets a table of the right
+// size when it returns.
+//
+// The state of a hot remote is only written back when it is demoted or the
+// store is synced, so the journal of the daemon is what makes it durable. The
+// store is not safe for concurrent use.
+
+#define TIER_SERIALS  (1 << 24)
+
+
+/* The record of a remote in the cold tier, one cache line */
+struct cold_record {
+    uint64_t replay;
+    uint32_t serial;
+    uint32_t skips;
+    uint16_t seed[KEY_WORDS];
+    uint8_t state;
+    uint8_t used;
+    uint8_t reserved[10];
+};
+
+/* A store of remotes in a hot and a cold tier */
+struct tier {
+    struct verifier hot;
+    struct lookahead la;
+    uint8_t* heard;  // The clock bit of each hot slot
+    int hand;
+    int fd;
+    struct cold_record* cold;
+    uint64_t promotions;
+    uint64_t demotions;
+};
+
+
+int tier_open(struct tier* ts, const char* path, int max_hot);
+void tier_close(struct tier* ts);
+int tier_enroll(struct tier* ts, uint32_t serial, const uint16_t* seed, uint32_t code);
+int tier_check(struct tier* ts, const uint8_t* data, int num, int* slot);
+int tier_promote(struct tier* ts, uint32_t serial);
+void tier_demote(struct tier* ts, int slot);
+int tier_victim(struct tier* ts);
+int tier_sync(struct tier* ts);
+int tier_release(struct tier* ts);
+
+
+// Open the cold tier in the file at path, creating it if needed, with room for
+// max_hot remotes in the hot tier. Returns -1 if the file could not be mapped
+// or out of memory.
+int tier_open(struct tier* ts, const char* path, int max_hot) {
+    size_t size = (size_t)TIER_SERIALS * sizeof(struct cold_record);
+
+    memset(ts, 0, sizeof(*ts));
+    if ((ts->fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+        perror("open");
+        return -1;
+    }
+    if (ftruncate(ts->fd, size)) {
+        perror("ftruncate");
+        close(ts->fd);
+        return -1;
+    }
+    ts->cold = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ts->fd, 0);
+    if (ts->cold == MAP_FAILED) {
+        perror("mmap");
+        close(ts->fd);
+        return -1;
+    }
+    madvise(ts->cold, size, MADV_RANDOM);
+    if (verifier_init(&ts->hot, max_hot, VERIFIER_WINDOW))
+        goto fail;
+    if (lookahead_init(&ts->la, &ts->hot, LOOKAHEAD_MIN, LOOKAHEAD_MAX)) {
+        verifier_free(&ts->hot);
+        goto fail;
+    }
+    if ((ts->heard = calloc(max_hot, 1)) == NULL) {
+        lookahead_free(&ts->la);
+        verifier_free(&ts->hot);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    munmap(ts->cold, size);
+    close(ts->fd);
+    return -1;
+}
+
+
+// Write back the hot tier and close the store.
+void tier_close(struct tier* ts) {
+    tier_sync(ts);
+    munmap(ts->cold, (size_t)TIER_SERIALS * sizeof(struct cold_record));
+    close(ts->fd);
+    lookahead_free(&ts->la);
+    verifier_free(&ts->hot);
+    free(ts->heard);
+    memset(ts, 0, sizeof(*ts));
+}
+
+
+// Enroll a remote into the cold tier like verifier_enroll(). Returns -1 if the
+// serial is invalid or taken.
+int tier_enroll(struct tier* ts, uint32_t serial, const uint16_t* seed, uint32_t code) {
+    struct cold_record* rec = &ts->cold[serial & (TIER_SERIALS-1)];
+
+    if (!frame_serial_valid(serial) || rec->used)
+        return -1;
+    rec->replay = (uint64_t)0xFFFFFFFF << 32 | code;
+    rec->serial = serial;
+    rec->skips = 0;
+    memcpy(rec->seed, seed, sizeof(rec->seed));
+    rec->state = FOB_ENABLED;
+    rec->used = 1;
+    return 0;
+}
+
+
+// Verify a message like lookahead_check(), promoting the remote into the hot
+// tier first if it is cold. A forged MAC message for a cold remote is rejected
+// before the remote is promoted, so that it cannot thrash the hot tier. The
+// slot of the remote in the hot tier is stored in slot. Returns the verdict on
+// the message.
+int tier_check(struct tier* ts, const uint8_t* data, int num, int* slot) {
+    const struct cold_record* rec;
+    struct frame frm;
+
+    *slot = -1;
+    if (frame_parse(data, num, &frm) || cipher_find(frm.ver) == NULL)
+        return VERDICT_MALFORMED;
+    if ((*slot = verifier_find(&ts->hot, frm.serial)) < 0) {
+        rec = &ts->cold[frm.serial & (TIER_SERIALS-1)];
+        if (!rec->used || rec->serial != frm.serial)
+            return VERDICT_UNKNOWN;
+        if (frm.ver & FRAME_MAC) {
+            uint16_t mk[MAC_ROUNDS];
+            uint32_t m0, m1;
+            key_mac_schedule(rec->seed, mk);
+            frame_mac_words(data, &m0, &m1);
+            if (key_mac_tag(mk, m0, m1) != frm.mac)
+                return VERDICT_FORGED;
+        }
+        if ((*slot = tier_promote(ts, frm.serial)) < 0)
+            return VERDICT_UNKNOWN;
+    }
+    ts->heard[*slot] = 1;
+    return lookahead_check(&ts->la, data, num, slot);
+}
+
+
+// Move a remote from the cold tier into the hot tier, demoting another remote
+// if it is full. Returns the slot of the remote, or -1 if it is not enrolled
+// or could not be placed, in which case a demoted slot is left empty.
+int tier_promote(struct tier* ts, uint32_t serial) {
+    const struct cold_record* rec = &ts->cold[serial & (TIER_SERIALS-1)];
+    int slot, added = 0;
+
+    if (!rec->used || rec->serial != serial)
+        return -1;
+    if (ts->hot.num_fobs < ts->hot.max_fobs) {
+        slot = ts->hot.num_fobs++;
+        added = 1;
+    } else {
+        slot = tier_victim(ts);
+        tier_demote(ts, slot);
+    }
+    if (verifier_place(&ts->hot, slot, serial, rec->seed)) {
+        if (added)
+            ts->hot.num_fobs--;
+        else
+            ts->hot.serials[slot] = VERIFIER_NONE;
+        return -1;
+    }
+    ts->hot.states[slot].replay = rec->replay;
+    ts->hot.states[slot].state = rec->state;
+    lookahead_clear(&ts->la, slot, rec->skips);
+    ts->promotions++;
+    return slot;
+}
+
+
+// Write the state of a hot remote back to its record and take it out of the
+// hot tier, leaving its slot free. An empty slot is left as it is.
+void tier_demote(struct tier* ts, int slot) {
+    struct cold_record* rec;
+
+    if (ts->hot.serials[slot] == VERIFIER_NONE)
+        return;
+    rec = &ts->cold[ts->hot.serials[slot]];
+    rec->replay = ts->hot.states[slot].replay;
+    rec->state = ts->hot.states[slot].state;
+    rec->skips = ts->la.fobs[slot].skips;
+    lookahead_clear(&ts->la, slot, 0);
+    verifier_evict(&ts->hot, slot);
+    ts->heard[slot] = 0;
+    ts->demotions++;
+}
+
+
+// Advance the clock hand to the first hot remote that was not heard since the
+// last sweep, and return its slot.
+int tier_victim(struct tier* ts) {
+    int slot;
+
+    while (ts->heard[ts->hand]) {
+        ts->heard[ts->hand] = 0;
+        ts->hand = (ts->hand + 1) % ts->hot.max_fobs;
+    }
+    slot = ts->hand;
+    ts->hand = (ts->hand + 1) % ts->hot.max_fobs;
+    return slot;
+}
+
+
+// Write the state of every hot remote back to its record and flush the cold
+// tier to its file. Returns -1 if the flush failed.
+int tier_sync(struct tier* ts) {
+    int slot;
+
+    for (slot = 0; slot < ts->hot.num_fobs; slot++) {
+        struct cold_record* rec = &ts->cold[ts->hot.serials[slot] & (TIER_SERIALS-1)];
+        if (ts->hot.serials[slot] == VERIFIER_NONE)
+            continue;
+        rec->replay = ts->hot.states[slot].replay;
+        rec->state = ts->hot.states[slot].state;
+        rec->skips = ts->la.fobs[slot].skips;
+    }
+    if (msync(ts->cold, (size_t)TIER_SERIALS * sizeof(struct cold_record), MS_SYNC)) {
+        perror("msync");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Sync the store and drop the pages of the cold tier from memory, so that the
+// next access to every record reads it from the file. Returns -1 if the sync
+// failed.
+int tier_release(struct tier* ts) {
+    size_t size = (size_t)TIER_SERIALS * sizeof(struct cold_record);
+
+    if (tier_sync(ts))
+        return -1;
+    madvise(ts->cold, size, MADV_DONTNEED);
+    posix_fadvise(ts->fd, 0, size, POSIX_FADV_DONTNEED);
+    return 0;
+}
+
+
+#endif /* _VERIFIER_TIER_H */
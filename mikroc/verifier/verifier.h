@@ -0,0 +1,678 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#ifndef _VERIFIER_VERIFIER_H
+#define _VERIFIER_VERIFIER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "frame.h"
+#include "keycache.h"
+#include "mphf.h"
+#include "snapshot.h"
+#include "table.h"
+
+
+// This is the host equivalent of process_load() in receiver.c for a fleet of
+// remotes. Every remote is enrolled under its serial number into a slot, which
+// indexes two separate stores:
+//
+//  keystore:       The serial numbers and keys, which only change on enrollment
+//  channel store:  The rolling code and state, which change on every accept
+//
+// Messages are checked in order of increasing cost, and the channel store is
+// only read once a message has passed every check that needs just the keys.
+// A forged MAC message is therefore rejected without touching the channel
+// store. Remotes that send CRC messages have no serial, so they are enrolled
+// under their channel number instead.
+//
+// Unlike process_load(), which only accepts codes at or ahead of the stored
+// one, the verifier also accepts codes up to VERIFIER_REPLAY behind the highest
+// accepted code, as long as they have not been accepted before. This is the
+// sliding window of IPsec, and lets the same remote be heard by several
+// receivers or have its messages reordered by a pipeline. The next code and the
+// bitmap of recently accepted codes share a single 64-bit word, so threads can
+// verify messages concurrently with a compare and swap and no locks.
+//
+// Serial numbers are found through an index of open addressing at first. Once
+// a batch of remotes has been enrolled, verifier_rebuild() builds a minimal
+// perfect hash over them and moves every remote into the slot that it hashes
+// to, so that those remotes are found without probing and with a few bits per
+// remote. The index then only holds the remotes enrolled since, and shrinks to
+// the room that is left.
+//
+// A verifier made by verifier_init_growing() indexes its remotes with a table
+// instead, which starts small and grows with the fleet without stopping the
+// thread that enrolls, for fleets whose size is not known ahead. Its slot
+// arrays are allocated for max_fobs remotes but left untouched, so they only
+// take memory as slots are placed, and they never move, so max_fobs may be as
+// large as the serial numbers allow. Threads other than the one that enrolls
+// must then verify inside epoch_enter() and epoch_exit() of the epochs that
+// were given, and such a verifier has no perfect hash.
+//
+// A verifier made by verifier_init_cached() keeps only the seed keys in a
+// keycache and expands the keys of a remote when it is heard, for fleets that
+// are too large to keep every key expanded. The keys are then reached through
+// verifier_keys(), and the verifier is not safe for concurrent use.
+//
+// The keystore serials and the channel store can be covered by snapshots with
+// verifier_snapshots(), so that reports can scan them on other threads. Every
+// change to them then goes through verifier_touch() first, and the verifier
+// must only be written by one thread, as the verifier of a shard is.
+
+/* Outcomes of verifying a message */
+enum verdict {
+    VERDICT_ACCEPT,
+    VERDICT_MALFORMED, // Wrong length, CRC or version
+    VERDICT_UNKNOWN,   // The serial number is not enrolled
+    VERDICT_FORGED,    // The MAC does not match
+    VERDICT_DISABLED,  // The remote is disabled
+    VERDICT_WINDOW,    // The rolling code is outside of the window
+    VERDICT_REPLAY,    // The rolling code was already accepted
+    NUM_VERDICTS,
+};
+
+/* The state value of an enabled remote, as in read_channel_state() */
+#define FOB_ENABLED  0xFF
+
+/* The default window of acceptable future codes, as in receiver.c */
+#define VERIFIER_WINDOW  0x0400
+
+/* The most codes behind the highest accepted one that may still be accepted */
+#define VERIFIER_REPLAY  32
+
+/* The most messages that can be verified as a batch */
+#define VERIFIER_BATCH  64
+
+/* The serial number of a slot whose remote was evicted */
+#define VERIFIER_NONE  0xFFFFFFFF
+
+/* The arrays of a verifier in its snapshots */
+#define VERIFIER_SNAP_SERIALS  0
+#define VERIFIER_SNAP_STATES   1
+
+
+/* The state of a remote that changes as messages are accepted */
+struct fob_state {
+    // The lowest rolling code ahead of every accepted code in the lower half,
+    // and the bitmap of accepted codes behind it in the upper half. Bit N is
+    // set if the code N+1 behind has been accepted.
+    uint64_t replay;
+    uint8_t state;
+    uint32_t heard; // When a code was last accepted, in seconds, if kept
+};
+
+/* A verifier for a maximum number of remotes */
+struct verifier {
+    uint32_t window;
+    uint32_t replay; // Codes behind that may be accepted, up to VERIFIER_REPLAY
+    int num_fobs;
+    int max_fobs;
+
+    // The keystore and the index from serial numbers to slots
+    uint32_t* serials;
+    struct fob_keys* keys;   // NULL if the keys are expanded into the cache
+    struct keycache* cache;
+    int32_t* index;          // NULL if the remotes are indexed by the table
+    uint32_t index_mask;
+    struct table* table;     // NULL unless made by verifier_init_growing()
+    struct mphf perfect; // The remotes in slots below num_perfect
+    int num_perfect;
+
+    // The channel store
+    struct fob_state* states;
+    struct snapshots* snaps; // NULL unless the stores are covered by snapshots
+};
+
+
+/* Global constants */
+const char* verdict_names[NUM_VERDICTS] = {
+    "accept", "malformed", "unknown", "forged", "disabled", "window", "replay",
+};
+
+
+int verifier_init(struct verifier* vf, int max_fobs, uint32_t window);
+int verifier_init_cached(struct verifier* vf, int max_fobs, uint32_t window, int num_lines);
+int verifier_init_growing(struct verifier* vf, int max_fobs, uint32_t window, int num_lines, struct epoch* ep, int step);
+int verifier_alloc(struct verifier* vf, int max_fobs, uint32_t window, int num_lines);
+void verifier_free(struct verifier* vf);
+int verifier_enroll(struct verifier* vf, uint32_t serial, const uint16_t* seed, uint32_t code);
+int verifier_place(struct verifier* vf, int slot, uint32_t serial, const uint16_t* seed);
+void verifier_evict(struct verifier* vf, int slot);
+int verifier_snapshots(struct verifier* vf, struct snapshots* ss);
+void verifier_touch(struct verifier* vf, int slot, int serial);
+int verifier_rebuild(struct verifier* vf);
+int verifier_find(const struct verifier* vf, uint32_t serial);
+const struct fob_keys* verifier_keys(const struct verifier* vf, int slot);
+int verifier_guess(const struct verifier* vf, uint32_t serial);
+void verifier_prefetch_index(const struct verifier* vf, uint32_t serial);
+void verifier_prefetch(const struct verifier* vf, int slot);
+int verifier_check(struct verifier* vf, const uint8_t* data, int num, int* slot);
+int verifier_authenticate(const struct verifier* vf, const uint8_t* data, int num, struct frame* frm, int* slot);
+int verifier_identify(const struct verifier* vf, const uint8_t* data, const struct frame* frm, int* slot);
+void verifier_check_batch(struct verifier* vf, const uint8_t* const* data, const uint8_t* lens, int num, int* verdicts, int* slots);
+int verifier_frame(const struct verifier* vf, int slot, uint8_t ver, uint32_t code, uint8_t* data);
+int replay_update(uint64_t* replay, uint32_t code, uint32_t window, uint32_t width);
+uint32_t verifier_hash(uint32_t serial);
+
+
+// Allocate a verifier for up to max_fobs remotes. Returns -1 if out of memory.
+int verifier_init(struct verifier* vf, int max_fobs, uint32_t window) {
+    return verifier_init_cached(vf, max_fobs, window, 0);
+}
+
+
+// Allocate a verifier for up to max_fobs remotes that keeps only their seed
+// keys and the expanded keys of num_lines of them, or every key expanded if
+// num_lines is 0. Returns -1 if out of memory.
+int verifier_init_cached(struct verifier* vf, int max_fobs, uint32_t window, int num_lines) {
+    uint32_t size = 1;
+
+    while (size < 2*(uint32_t)max_fobs)
+        size <<= 1;
+    if (verifier_alloc(vf, max_fobs, window, num_lines))
+        return -1;
+    vf->index_mask = size - 1;
+    if ((vf->index = malloc(size*sizeof(*vf->index))) == NULL) {
+        verifier_free(vf);
+        fprintf(stderr, "Could not allocate the verifier\n");
+        return -1;
+    }
+    memset(vf->index, 0xFF, size*sizeof(*vf->index));
+    return 0;
+}
+
+
+// Allocate a verifier for up to max_fobs remotes like verifier_init_cached(),
+// whose index is a table that grows as remotes are enrolled, moving step
+// buckets per enrollment while it grows or all of them if step is 0. Its
+// memory is reclaimed through the readers of ep. Returns -1 if out of memory.
+int verifier_init_growing(struct verifier* vf, int max_fobs, uint32_t window, int num_lines, struct epoch* ep, int step) {
+    if (verifier_alloc(vf, max_fobs, window, num_lines))
+        return -1;
+    if ((vf->table = malloc(sizeof(*vf->table))) == NULL || table_init(vf->table, VERIFIER_BATCH, ep, step)) {
+        free(vf->table);
+        vf->table = NULL;
+        verifier_free(vf);
+        fprintf(stderr, "Could not allocate the verifier\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Allocate the keystore and the channel store of a verifier, without an
+// index. Returns -1 if out of memory.
+int verifier_alloc(struct verifier* vf, int max_fobs, uint32_t window, int num_lines) {
+    memset(vf, 0, sizeof(*vf));
+    vf->window = window;
+    vf->replay = VERIFIER_REPLAY;
+    vf->max_fobs = max_fobs;
+    vf->serials = malloc(max_fobs*sizeof(*vf->serials));
+    vf->states = calloc(max_fobs, sizeof(*vf->states));
+    if (num_lines == 0)
+        vf->keys = malloc(max_fobs*sizeof(*vf->keys));
+    else if ((vf->cache = malloc(sizeof(*vf->cache))) != NULL && keycache_init(vf->cache, max_fobs, num_lines)) {
+        free(vf->cache);
+        vf->cache = NULL;
+    }
+    if (vf->serials == NULL || (vf->keys == NULL && vf->cache == NULL) || vf->states == NULL) {
+        verifier_free(vf);
+        fprintf(stderr, "Could not allocate the verifier\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Release the memory of a verifier.
+void verifier_free(struct verifier* vf) {
+    free(vf->serials);
+    free(vf->keys);
+    if (vf->cache != NULL)
+        keycache_free(vf->cache);
+    free(vf->cache);
+    free(vf->states);
+    free(vf->index);
+    if (vf->table != NULL)
+        table_free(vf->table);
+    free(vf->table);
+    mphf_free(&vf->perfect);
+    memset(vf, 0, sizeof(*vf));
+}
+
+
+// Enroll a remote with the given serial number, seed key and initial rolling
+// code, enabling it just like process_store() does. Returns the slot of the
+// remote, or -1 if the serial is invalid or taken or the verifier is full.
+int verifier_enroll(struct verifier* vf, uint32_t serial, const uint16_t* seed, uint32_t code) {
+    int slot = vf->num_fobs;
+
+    if (slot >= vf->max_fobs || verifier_place(vf, slot, serial, seed))
+        return -1;
+    vf->num_fobs++;
+    vf->states[slot].replay = (uint64_t)0xFFFFFFFF << 32 | code;
+    vf->states[slot].state = FOB_ENABLED;
+    return slot;
+}
+
+
+// Put a remote with the given serial number and seed key into a free slot,
+// expanding or storing its keys and indexing it. The state of the slot is left
+// to the caller, and so are its keys if seed is NULL. Returns -1 if the serial
+// is invalid or taken, or if the table is out of memory.
+int verifier_place(struct verifier* vf, int slot, uint32_t serial, const uint16_t* seed) {
+    uint32_t pos = 0;
+
+    if (!frame_serial_valid(serial) || verifier_find(vf, serial) >= 0)
+        return -1;
+    if (vf->table == NULL)
+        for (pos = verifier_hash(serial); vf->index[pos & vf->index_mask] >= 0; pos++)
+            ;
+    verifier_touch(vf, slot, 1);
+    vf->serials[slot] = serial;
+    if (seed != NULL && vf->cache != NULL)
+        keycache_store(vf->cache, slot, seed);
+    else if (seed != NULL)
+        fob_keys_init(&vf->keys[slot], seed);
+
+    // The table publishes the slot to other threads, so the keys are stored
+    // before it
+    if (vf->table != NULL)
+        return table_insert(vf->table, serial, slot);
+    vf->index[pos & vf->index_mask] = slot;
+    return 0;
+}
+
+
+// Take the remote in a slot out of the index so that the slot can be placed
+// again. The entries after it in the probe sequence are shifted back into the
+// gap, so that no lookup stops short of them. A remote found by the perfect
+// hash is only dropped from it by the next rebuild, and one in the table is
+// left as a tombstone. The serial number of the slot is cleared in every case.
+void verifier_evict(struct verifier* vf, int slot) {
+    uint32_t gap, pos, home, mask = vf->index_mask, serial = vf->serials[slot];
+
+    verifier_touch(vf, slot, 1);
+    vf->states[slot].state = 0;
+    vf->serials[slot] = VERIFIER_NONE;
+    if (vf->cache != NULL)
+        keycache_drop(vf->cache, slot);
+    if (slot < vf->num_perfect && mphf_lookup(&vf->perfect, serial) == (uint32_t)slot)
+        return;
+    if (vf->table != NULL) {
+        table_remove(vf->table, serial);
+        return;
+    }
+    for (gap = verifier_hash(serial) & mask; vf->index[gap] != slot; gap = (gap+1) & mask)
+        ;
+    for (pos = (gap+1) & mask; vf->index[pos] >= 0; pos = (pos+1) & mask) {
+        home = verifier_hash(vf->serials[vf->index[pos]]) & mask;
+        if (((pos - home) & mask) >= ((pos - gap) & mask)) {
+            vf->index[gap] = vf->index[pos];
+            gap = pos;
+        }
+    }
+    vf->index[gap] = -1;
+}
+
+
+// Cover the serials and the channel store of a verifier with the snapshots of
+// a store that was just set up. Returns -1 if out of memory.
+int verifier_snapshots(struct verifier* vf, struct snapshots* ss) {
+    if (snapshot_add(ss, vf->serials, vf->max_fobs*sizeof(*vf->serials)) != VERIFIER_SNAP_SERIALS ||
+        snapshot_add(ss, vf->states, vf->max_fobs*sizeof(*vf->states)) != VERIFIER_SNAP_STATES) {
+        fprintf(stderr, "Could not cover the verifier with snapshots\n");
+        return -1;
+    }
+    vf->snaps = ss;
+    return 0;
+}
+
+
+// Prepare to change the state of a slot, and its serial number too if serial
+// is set, for the snapshots that are open.
+void verifier_touch(struct verifier* vf, int slot, int serial) {
+    if (vf->snaps == NULL)
+        return;
+    snapshot_touch(vf->snaps, VERIFIER_SNAP_STATES, &vf->states[slot]);
+    if (serial)
+        snapshot_touch(vf->snaps, VERIFIER_SNAP_SERIALS, &vf->serials[slot]);
+}
+
+
+// Build the perfect hash over every enrolled remote and move each remote into
+// the slot that it hashes to, leaving the index empty for remotes enrolled
+// later. Evicted slots are dropped, so the remotes end up in the first slots.
+// This renumbers the slots, so anything kept by slot must be rebuilt as well.
+// Returns -1 if out of memory or the remotes are indexed by a table, in which
+// case the verifier is unchanged.
+int verifier_rebuild(struct verifier* vf) {
+    struct mphf perfect;
+    uint32_t *serials, *dest, size = 1;
+    int32_t* index;
+    int slot, num = 0;
+
+    if (vf->table != NULL) {
+        fprintf(stderr, "A growing verifier has no perfect hash\n");
+        return -1;
+    }
+
+    // Build the hash over the remotes that are left, and a smaller index
+    if ((serials = malloc((vf->num_fobs + 1)*sizeof(*serials))) == NULL)
+        return -1;
+    for (slot = 0; slot < vf->num_fobs; slot++)
+        if (vf->serials[slot] != VERIFIER_NONE)
+            serials[num++] = vf->serials[slot];
+    while (size < 2*(uint32_t)(vf->max_fobs - num))
+        size <<= 1;
+    if (mphf_build(&perfect, serials, num)) {
+        free(serials);
+        return -1;
+    }
+    free(serials);
+    dest = malloc((vf->num_fobs + 1)*sizeof(*dest));
+    index = malloc(size*sizeof(*index));
+    if (dest == NULL || index == NULL) {
+        free(dest);
+        free(index);
+        mphf_free(&perfect);
+        fprintf(stderr, "Could not allocate the verifier\n");
+        return -1;
+    }
+
+    // Move every remote into its slot by following the cycles of the
+    // permutation, and mark the evicted slots as the last ones
+    for (slot = 0; slot < vf->num_fobs; slot++)
+        dest[slot] = (vf->serials[slot] != VERIFIER_NONE) ? mphf_lookup(&perfect, vf->serials[slot]) : VERIFIER_NONE;
+    for (slot = 0; slot < vf->num_fobs; slot++) {
+        while (dest[slot] != VERIFIER_NONE && dest[slot] != (uint32_t)slot) {
+            uint32_t to = dest[slot], serial = vf->serials[to], next = dest[to];
+            struct fob_state state = vf->states[to];
+            verifier_touch(vf, to, 1);
+            verifier_touch(vf, slot, 1);
+            vf->serials[to] = vf->serials[slot];
+            vf->states[to] = vf->states[slot];
+            dest[to] = to;
+            vf->serials[slot] = serial;
+            vf->states[slot] = state;
+            if (vf->cache != NULL) {
+                uint16_t seed[KEY_WORDS];
+                memcpy(seed, vf->cache->seeds[to], sizeof(seed));
+                memcpy(vf->cache->seeds[to], vf->cache->seeds[slot], sizeof(seed));
+                memcpy(vf->cache->seeds[slot], seed, sizeof(seed));
+            } else {
+                struct fob_keys keys = vf->keys[to];
+                vf->keys[to] = vf->keys[slot];
+                vf->keys[slot] = keys;
+            }
+            dest[slot] = next;
+        }
+    }
+    free(dest);
+    if (vf->cache != NULL)
+        keycache_reset(vf->cache);
+
+    mphf_free(&vf->perfect);
+    vf->perfect = perfect;
+    vf->num_perfect = num;
+    vf->num_fobs = num;
+    free(vf->index);
+    vf->index = index;
+    vf->index_mask = size - 1;
+    memset(vf->index, 0xFF, size*sizeof(*vf->index));
+    return 0;
+}
+
+
+// Return the slot of a serial number, or -1 if it is not enrolled.
+int verifier_find(const struct verifier* vf, uint32_t serial) {
+    uint32_t pos;
+    int32_t slot;
+
+    if (vf->num_perfect > 0 && vf->serials[slot = mphf_lookup(&vf->perfect, serial)] == serial)
+        return slot;
+    if (vf->table != NULL)
+        return table_find(vf->table, serial);
+    for (pos = verifier_hash(serial); (slot = vf->index[pos & vf->index_mask]) >= 0; pos++)
+        if (vf->serials[slot] == serial)
+            return slot;
+    return -1;
+}
+
+
+// Return the keys of a slot, expanding them if they are not cached.
+const struct fob_keys* verifier_keys(const struct verifier* vf, int slot) {
+    if (vf->cache != NULL)
+        return keycache_get(vf->cache, slot);
+    return &vf->keys[slot];
+}
+
+
+// Return the slot at the start of the probe sequence of a serial number, which
+// is usually its slot, or -1 if that entry is empty. The serial number is not
+// compared, so this only needs the index or the perfect hash. The table holds
+// the serial numbers, so a verifier with a table finds the slot instead.
+int verifier_guess(const struct verifier* vf, uint32_t serial) {
+    if (vf->num_perfect > 0)
+        return mphf_lookup(&vf->perfect, serial);
+    if (vf->table != NULL)
+        return table_find(vf->table, serial);
+    return vf->index[verifier_hash(serial) & vf->index_mask];
+}
+
+
+// Start loading the index entry of a serial number into the cache.
+void verifier_prefetch_index(const struct verifier* vf, uint32_t serial) {
+    if (vf->num_perfect > 0)
+        mphf_prefetch(&vf->perfect, serial);
+    else if (vf->table != NULL)
+        table_prefetch(vf->table, serial);
+    else
+        __builtin_prefetch(&vf->index[verifier_hash(serial) & vf->index_mask]);
+}
+
+
+// Load the keystore and channel store of a slot into the cache. These are
+// plain loads rather than prefetch hints, which were mostly dropped on the
+// hosts that this was measured on. The loads do not depend on each other, so
+// their misses overlap and the caller stalls for about one miss instead of the
+// chain of misses that verifier_check() would take.
+void verifier_prefetch(const struct verifier* vf, int slot) {
+    const uint8_t* keys = (const uint8_t*)&vf->keys[slot];
+    uint32_t sum = vf->serials[slot] + vf->states[slot].state;
+    size_t off;
+
+    if (vf->cache != NULL) {
+        keycache_prefetch(vf->cache, slot);
+        __asm__ volatile("" :: "r"(sum));
+        return;
+    }
+    for (off = 0; off < sizeof(*vf->keys); off += 64)
+        sum += keys[off];
+    sum += keys[sizeof(*vf->keys) - 1];
+    __asm__ volatile("" :: "r"(sum));
+}
+
+
+// Verify a message of num bytes and, if it is accepted, mark its rolling code
+// as used. The slot of the remote is stored in slot if it is known. Returns the
+// verdict on the message. This may be called from many threads at once.
+int verifier_check(struct verifier* vf, const uint8_t* data, int num, int* slot) {
+    const struct cipher* cph;
+    struct frame frm;
+    uint32_t code;
+    int ret;
+
+    if ((ret = verifier_authenticate(vf, data, num, &frm, slot)) != VERDICT_ACCEPT)
+        return ret;
+
+    // Decrypt and check the rolling code against the channel store
+    cph = cipher_find(frm.ver);
+    cph->decrypt(verifier_keys(vf, *slot), &frm.block, &code, 1);
+    if (vf->states[*slot].state != FOB_ENABLED)
+        return VERDICT_DISABLED;
+    verifier_touch(vf, *slot, 0);
+    return replay_update(&vf->states[*slot].replay, code, vf->window, vf->replay);
+}
+
+
+// Run the checks of a message that need only the keystore, which are the
+// format, the serial number and the MAC. The parsed message is stored in frm
+// and the slot of the remote in slot if it is known. Returns VERDICT_ACCEPT if
+// the message may go on to have its rolling code checked.
+int verifier_authenticate(const struct verifier* vf, const uint8_t* data, int num, struct frame* frm, int* slot) {
+    *slot = -1;
+    if (frame_parse(data, num, frm) || cipher_find(frm->ver) == NULL)
+        return VERDICT_MALFORMED;
+    return verifier_identify(vf, data, frm, slot);
+}
+
+
+// Run the checks of verifier_authenticate() that follow the parsing of the
+// message.
+int verifier_identify(const struct verifier* vf, const uint8_t* data, const struct frame* frm, int* slot) {
+    if ((*slot = verifier_find(vf, frm->serial)) < 0)
+        return VERDICT_UNKNOWN;
+    if (frm->ver & FRAME_MAC) {
+        uint32_t m0, m1;
+        frame_mac_words(data, &m0, &m1);
+        if (key_mac_tag(verifier_keys(vf, *slot)->mk, m0, m1) != frm->mac)
+            return VERDICT_FORGED;
+    }
+    return VERDICT_ACCEPT;
+}
+
+
+// Verify a batch of up to VERIFIER_BATCH messages like verifier_check(),
+// storing the verdict and slot of each. The state of every remote is loaded
+// before any of them is checked so that the misses overlap, the keys that are
+// not cached are expanded together, and the rolling codes are decrypted
+// together with the batch kernel of their cipher.
+void verifier_check_batch(struct verifier* vf, const uint8_t* const* data, const uint8_t* lens, int num, int* verdicts, int* slots) {
+    const struct fob_keys* keys[FRAME_CIPHER+1][VERIFIER_BATCH];
+    uint32_t blocks[FRAME_CIPHER+1][VERIFIER_BATCH];
+    uint32_t codes[VERIFIER_BATCH];
+    uint8_t which[FRAME_CIPHER+1][VERIFIER_BATCH];
+    int cnt[FRAME_CIPHER+1] = {0};
+    struct frame frms[VERIFIER_BATCH];
+    int idx, ver, slot;
+
+    // Parse every message and load the state of its remote
+    for (idx = 0; idx < num; idx++) {
+        verdicts[idx] = VERDICT_ACCEPT;
+        slots[idx] = -1;
+        if (frame_parse(data[idx], lens[idx], &frms[idx]) || cipher_find(frms[idx].ver) == NULL)
+            verdicts[idx] = VERDICT_MALFORMED;
+        else
+            verifier_prefetch_index(vf, frms[idx].serial);
+    }
+    for (idx = 0; idx < num; idx++)
+        if (verdicts[idx] == VERDICT_ACCEPT && (slot = verifier_guess(vf, frms[idx].serial)) >= 0)
+            verifier_prefetch(vf, slot);
+
+    // Expand the keys of the remotes that are not cached together
+    if (vf->cache != NULL) {
+        int found[VERIFIER_BATCH], num_found = 0;
+        for (idx = 0; idx < num; idx++)
+            if (verdicts[idx] == VERDICT_ACCEPT && (slot = verifier_find(vf, frms[idx].serial)) >= 0)
+                found[num_found++] = slot;
+        if (num_found > 0)
+            keycache_get_batch(vf->cache, found, num_found, keys[0]);
+    }
+
+    // Authenticate the messages and group them by cipher
+    for (idx = 0; idx < num; idx++) {
+        if (verdicts[idx] != VERDICT_ACCEPT)
+            continue;
+        if ((verdicts[idx] = verifier_identify(vf, data[idx], &frms[idx], &slots[idx])) != VERDICT_ACCEPT)
+            continue;
+        if (vf->states[slots[idx]].state != FOB_ENABLED) {
+            verdicts[idx] = VERDICT_DISABLED;
+            continue;
+        }
+        ver = frms[idx].ver & FRAME_CIPHER;
+        keys[ver][cnt[ver]] = verifier_keys(vf, slots[idx]);
+        blocks[ver][cnt[ver]] = frms[idx].block;
+        which[ver][cnt[ver]++] = idx;
+    }
+
+    // Decrypt and check the rolling codes against the channel store
+    for (ver = 0; ver <= FRAME_CIPHER; ver++) {
+        if (cnt[ver] == 0)
+            continue;
+        ciphers[ver].decrypt_each(keys[ver], blocks[ver], codes, cnt[ver]);
+        for (idx = 0; idx < cnt[ver]; idx++) {
+            slot = slots[which[ver][idx]];
+            verifier_touch(vf, slot, 0);
+            verdicts[which[ver][idx]] = replay_update(&vf->states[slot].replay, codes[idx], vf->window, vf->replay);
+        }
+    }
+}
+
+
+// Form the message that the remote in a slot sends for a rolling code, just
+// like transmit_code() does. Returns the length of the message, or 0 if the
+// frame marker appears in it, in which case the remote skips the code.
+int verifier_frame(const struct verifier* vf, int slot, uint8_t ver, uint32_t code, uint8_t* data) {
+    const struct fob_keys* keys = verifier_keys(vf, slot);
+    struct frame frm;
+    int num;
+
+    frm.ver = ver;
+    frm.chan = vf->serials[slot] % FRAME_CHANS;
+    frm.serial = vf->serials[slot];
+    frm.mac = 0;
+    cipher_find(ver)->encrypt(keys, &code, &frm.block, 1);
+    frame_build(&frm, data);
+    num = frame_length(data[4]);
+    if (ver & FRAME_MAC) {
+        uint32_t m0, m1;
+        frame_mac_words(data, &m0, &m1);
+        frm.mac = key_mac_tag(keys->mk, m0, m1);
+        frame_build(&frm, data);
+    }
+    return frame_valid(data, num) ? num : 0;
+}
+
+
+// Accept a rolling code against the packed state of a remote if it is within
+// the window ahead or is an unused code up to width behind. The state is
+// updated with a single compare and swap, which is retried if another thread
+// changed it in the meantime. Returns the verdict on the code.
+int replay_update(uint64_t* replay, uint32_t code, uint32_t window, uint32_t width) {
+    uint64_t old = __atomic_load_n(replay, __ATOMIC_RELAXED), new;
+
+    do {
+        uint32_t next = old;
+        uint32_t seen = old >> 32;
+        uint32_t ahead = code - next;
+        uint32_t back = next - 1 - code;
+
+        if (ahead < window) {
+            // Slide the bitmap forward so that the code is the newest bit
+            seen = ((ahead < 31) ? seen << (ahead + 1) : 0) | 1;
+            new = (uint64_t)seen << 32 | (uint32_t)(code + 1);
+        } else if (back < width && !((seen >> back) & 1)) {
+            new = old | (uint64_t)1 << (32 + back);
+        } else {
+            return (back < width) ? VERDICT_REPLAY : VERDICT_WINDOW;
+        }
+    } while (!__atomic_compare_exchange_n(replay, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return VERDICT_ACCEPT;
+}
+
+
+// Hash a serial number into the index. This is a multiplicative hash, which
+// spreads the sequential serials of a production run across the index.
+uint32_t verifier_hash(uint32_t serial) {
+    return (serial * 0x9E3779B1u) >> 8;
+}
+
+
+#endif /* _VERIFIER_VERIFIER_H */
@@ -0,0 +1,1425 @@
+// Copyright 2008, Joe Tsai. All rights reserved.
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE.md file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../pic14/ihex.h"
+#include "../pic14/pic14.h"
+#include "../pic14/sim.h"
+
+
+/* Helper macros */
+#define PRINT_RETURN(st, rc) { fprintf(stderr, st); return rc; }
+#define MAX(x,y) ((x) > (y) ? (x) : (y))
+
+/* Limits of the analysis */
+#define MAX_ROM    0x2000
+#define MAX_FUNCS  256
+#define MAX_CALLS  64
+#define MAX_NOTES  1024
+#define MAX_NODES  4096
+#define MAX_EDGES  16384
+
+/* Results of the analysis that are not cycle counts */
+#define WCET_UNBOUNDED  -1
+#define WCET_ERROR      -2
+
+/* Values of W that are not constants */
+#define W_UNKNOWN  -1
+#define W_PCLATH   -2
+
+/* Indices of the constant state beyond the 512 file registers */
+#define CONST_W     512
+#define CONST_RP0   513
+#define CONST_RP1   514
+#define NUM_CONSTS  515
+
+/* Annotation kinds */
+enum note_kind { NOTE_FUNC, NOTE_LOOP, NOTE_INIT };
+
+
+/* An annotation from the annotation file */
+struct note {
+    int kind;
+    uint16_t addr;
+    uint16_t reg;
+    uint32_t val;
+    char name[32];
+};
+
+/* A function discovered through the call graph */
+struct func {
+    uint16_t entry;
+    char name[32];
+    int num_calls;
+    int calls[MAX_CALLS];
+    int visit;
+    bool clobbers; // Whether PCLATH may differ from the entry page on return
+    int bank;      // Register bank selected on return or -1 if not known
+    int64_t wcet;
+    int64_t reach;
+    int64_t measured;
+    int timeouts;
+};
+
+/* The state tracked while exploring code, used to resolve page selection.
+ * MikroC saves PCLATH in a register around ROM table reads, so both W and
+ * one register may hold a copy of the known PCLATH bits. */
+struct pstate {
+    bool valid;
+    uint8_t mask;      // Bits of PCLATH<4:3> that are known
+    uint8_t val;       // Value of the known PCLATH bits
+    int16_t w;         // Constant value of W, W_UNKNOWN or W_PCLATH
+    uint8_t w_mask;    // Known bits of the PCLATH copy in W
+    uint8_t w_val;
+    int16_t save;      // Register holding a PCLATH copy or -1 if none
+    uint8_t save_mask; // Known bits of the PCLATH copy in the register
+    uint8_t save_val;
+};
+
+/* A node in the control flow graph, either a basic block or a loop */
+struct node {
+    uint16_t start, end;
+    int64_t cost;
+    int rpo;
+    int idom;
+};
+
+/* A weighted edge, where the weight is the cost of the source node up to
+ * and including the transfer of control. A destination of -1 is the sink. */
+struct edge {
+    int from, to;
+    int64_t w;
+    bool active;
+};
+
+
+/* Global variables */
+const struct pic14_device* dev;
+uint16_t rom[MAX_ROM];
+struct pic14_insn code[MAX_ROM];
+struct note notes[MAX_NOTES];
+int num_notes;
+struct func funcs[MAX_FUNCS];
+int num_funcs;
+int order[MAX_FUNCS];
+int num_order;
+uint8_t page_mask;
+bool verbose;
+
+/* Scratch space for the analysis of a single function */
+struct pstate states[MAX_ROM];
+int32_t targets[MAX_ROM];
+int block_of[MAX_ROM];
+struct node nodes[MAX_NODES];
+int num_nodes, num_blocks, entry_blk;
+struct edge edges[MAX_EDGES];
+int num_edges, num_block_edges;
+int owner[MAX_NODES];
+int64_t dist[MAX_NODES];
+int16_t block_consts[MAX_NODES][NUM_CONSTS];
+
+
+/* Global constants */
+const char help_msg[] = (
+    "Usage: wcet [-a notes] [-c mhz] [-d device] [-r addr] [-m] [-n runs] [-l] [-v] file.hex\n\n"
+    "Computes a static worst-case execution time bound in instruction cycles\n"
+    "for every function of a MikroC firmware image. Delay loops, shift loops and\n"
+    "counted for loops are bounded automatically, all other loops must be\n"
+    "bounded by the annotation file, which contains lines of the form:\n\n"
+    "    func ADDR NAME      Name the function at ADDR\n"
+    "    loop ADDR BOUND     The loop headed at ADDR runs at most BOUND times\n"
+    "    init ADDR REG VAL   Set register REG to VAL when measuring ADDR\n\n"
+    "    -r addr   Also bound the cycles from each function entry until addr\n"
+    "    -m        Cross-check the bounds by simulating every function\n"
+    "    -l        List the disassembly of every function\n"
+);
+
+
+int load_notes(const char* path);
+struct note* find_note(int kind, uint16_t addr);
+int add_func(uint16_t entry);
+int explore(uint16_t entry, int fidx, bool report);
+void transfer(const struct pic14_insn* insn, struct pstate* st);
+int sort_funcs(int fidx);
+int64_t analyse(int fidx, int32_t target);
+int loop_body(int hdr, int* body);
+bool loop_exits(int* body, int num_body);
+int build_graph(int fidx, int32_t target);
+void add_edge(int from, int to, int64_t w);
+int compute_dominators();
+bool dominates(int a, int b);
+int collapse_loop(int hdr, int* body, int num_body, uint32_t bound);
+bool writes_reg(const struct pic14_insn* insn, uint8_t f);
+bool writes_w(const struct pic14_insn* insn);
+bool writes_wz(const struct pic14_insn* insn);
+int const_index(const int16_t* cs, uint8_t f);
+void const_transfer(uint16_t addr, int16_t* cs);
+void propagate_consts();
+int entry_value(int hdr, bool* in_body, int f);
+uint32_t loop_bound(int hdr, int* body, int num_body);
+uint32_t for_bound(int hdr, bool* in_body, int* body, int num_body);
+int longest_path(int src, int* in_set, int stamp, int hdr, int64_t* iter);
+void measure(int fidx, int runs);
+void list_func(int fidx);
+
+
+int main(int argc, char* argv[]) {
+    struct ihex_image img;
+    int opt, idx, runs = 20;
+    int32_t target = -1;
+    bool do_measure = false, do_list = false;
+    double mhz = 8.0;
+    const char* notes_path = NULL;
+    const char* dev_name = NULL;
+
+    while ((opt = getopt(argc, argv, "a:c:d:r:mn:lvh")) != -1) {
+        switch (opt) {
+        case 'a': notes_path = optarg; break;
+        case 'c': mhz = atof(optarg); break;
+        case 'd': dev_name = optarg; break;
+        case 'r': target = strtol(optarg, NULL, 0); break;
+        case 'm': do_measure = true; break;
+        case 'n': runs = atoi(optarg); break;
+        case 'l': do_list = true; break;
+        case 'v': verbose = true; break;
+        default: PRINT_RETURN(help_msg, -1);
+        }
+    }
+    if (optind+1 != argc || mhz <= 0)
+        PRINT_RETURN(help_msg, -1);
+
+    // Load the firmware image
+    if (ihex_load(argv[optind], &img))
+        return -1;
+    int top = ihex_rom(&img, rom, MAX_ROM);
+    dev = pic14_find_device(dev_name ? dev_name : (top > 0x800 ? "16f877a" : "12f683"));
+    if (dev == NULL)
+        PRINT_RETURN("Unknown device\n", -1);
+    for (idx = 0; idx < MAX_ROM; idx++)
+        pic14_decode(rom[idx], &code[idx]);
+    if (notes_path != NULL && load_notes(notes_path))
+        return -1;
+
+    // Only the page bits needed to address the used memory are tracked.
+    // Branches to unused pages would execute erased memory.
+    page_mask = (top > 0x1000) ? 0x18 : (top > 0x800) ? 0x08 : 0x00;
+
+    // Discover all functions reachable from the reset vector. Exploration
+    // is repeated until the set of functions that clobber PCLATH is stable.
+    int num_clobbers = -1, prev_funcs = 0;
+    add_func(0x000);
+    while (num_funcs != prev_funcs || num_clobbers != 0) {
+        prev_funcs = num_funcs;
+        num_clobbers = 0;
+        for (idx = 0; idx < num_funcs; idx++) {
+            bool clobbers = funcs[idx].clobbers;
+            explore(funcs[idx].entry, idx, false);
+            num_clobbers += (clobbers != funcs[idx].clobbers);
+        }
+    }
+    for (idx = 0; idx < num_funcs; idx++)
+        if (explore(funcs[idx].entry, idx, true))
+            return -1;
+    for (idx = 0; idx < num_funcs; idx++)
+        if (sort_funcs(idx))
+            return -1;
+
+    // Bound every function callees first
+    for (idx = 0; idx < num_order; idx++)
+        funcs[order[idx]].wcet = analyse(order[idx], -1);
+    for (idx = 0; idx < num_order && target >= 0; idx++)
+        funcs[order[idx]].reach = analyse(order[idx], target);
+    for (idx = 0; idx < num_funcs && do_measure; idx++)
+        measure(idx, runs);
+
+    // Print the results
+    printf("%-6s %-20s %12s %12s", "addr", "function", "wcet", "wcet_ms");
+    if (target >= 0)
+        printf(" %12s", "reach");
+    if (do_measure)
+        printf(" %12s", "measured");
+    printf("\n");
+    int bad = 0;
+    for (idx = 0; idx < num_funcs; idx++) {
+        struct func* fn = &funcs[idx];
+        printf("0x%03X  %-20s ", fn->entry, fn->name);
+        if (fn->wcet >= 0)
+            printf("%12lld %12.3f", (long long)fn->wcet, fn->wcet*4/mhz/1000);
+        else
+            printf("%12s %12s", fn->wcet == WCET_UNBOUNDED ? "unbounded" : "error", "-");
+        if (target >= 0 && fn->reach >= 0)
+            printf(" %12lld", (long long)fn->reach);
+        else if (target >= 0)
+            printf(" %12s", "-");
+        if (do_measure && fn->measured >= 0)
+            printf(" %12lld", (long long)fn->measured);
+        else if (do_measure)
+            printf(" %12s", "timeout");
+        if (do_measure && fn->wcet >= 0 && fn->measured > fn->wcet) {
+            printf("  EXCEEDS BOUND");
+            bad = 1;
+        }
+        printf("\n");
+    }
+    for (idx = 0; idx < num_funcs && do_list; idx++)
+        list_func(idx);
+
+    return bad ? -1 : 0;
+}
+
+
+// Read the annotation file. Blank lines and text after a '#' are ignored.
+int load_notes(const char* path) {
+    char line[256], kind[16];
+    unsigned int addr, reg, val;
+    int lnum = 0;
+
+    FILE* in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "%s: could not open file\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        struct note* nt = &notes[num_notes];
+        char* cmt = strchr(line, '#');
+        lnum++;
+        if (cmt != NULL)
+            *cmt = '\0';
+        if (sscanf(line, "%15s", kind) != 1)
+            continue;
+        if (num_notes >= MAX_NOTES) {
+            fprintf(stderr, "%s:%d: too many annotations\n", path, lnum);
+            fclose(in);
+            return -1;
+        }
+
+        memset(nt, 0, sizeof(*nt));
+        if (strcmp(kind, "func") == 0 && sscanf(line, "%*s %i %31s", &addr, nt->name) == 2) {
+            nt->kind = NOTE_FUNC;
+        } else if (strcmp(kind, "loop") == 0 && sscanf(line, "%*s %i %i", &addr, &val) == 2) {
+            nt->kind = NOTE_LOOP;
+        } else if (strcmp(kind, "init") == 0 && sscanf(line, "%*s %i %i %i", &addr, &reg, &val) == 3) {
+            nt->kind = NOTE_INIT;
+        } else {
+            fprintf(stderr, "%s:%d: malformed annotation\n", path, lnum);
+            fclose(in);
+            return -1;
+        }
+        nt->addr = addr;
+        nt->reg = reg;
+        nt->val = val;
+        num_notes++;
+    }
+    fclose(in);
+    return 0;
+}
+
+
+// Find the first annotation of the given kind for the address.
+struct note* find_note(int kind, uint16_t addr) {
+    int idx;
+    for (idx = 0; idx < num_notes; idx++)
+        if (notes[idx].kind == kind && notes[idx].addr == addr)
+            return &notes[idx];
+    return NULL;
+}
+
+
+// Register a function entry point and return its index.
+int add_func(uint16_t entry) {
+    int idx;
+    for (idx = 0; idx < num_funcs; idx++)
+        if (funcs[idx].entry == entry)
+            return idx;
+    if (num_funcs >= MAX_FUNCS)
+        return -1;
+
+    struct func* fn = &funcs[num_funcs];
+    struct note* nt = find_note(NOTE_FUNC, entry);
+    memset(fn, 0, sizeof(*fn));
+    fn->entry = entry;
+    fn->wcet = fn->reach = fn->measured = WCET_ERROR;
+    fn->bank = -1;
+    if (nt != NULL)
+        snprintf(fn->name, sizeof(fn->name), "%s", nt->name);
+    else if (entry == 0)
+        snprintf(fn->name, sizeof(fn->name), "reset");
+    else
+        snprintf(fn->name, sizeof(fn->name), "sub_%03X", entry);
+    return num_funcs++;
+}
+
+
+// Apply the effect of an instruction on the tracked PCLATH bits and W.
+void transfer(const struct pic14_insn* insn, struct pstate* st) {
+    bool to_pclath = (insn->f == REG_PCLATH);
+    bool writes_f = false;
+
+    switch (insn->op) {
+    case OP_MOVLW:
+        st->w = insn->k;
+        return;
+    case OP_MOVWF:
+        if (to_pclath && st->w == W_PCLATH) {
+            st->mask = st->w_mask;
+            st->val = st->w_val;
+        } else if (to_pclath) {
+            st->mask = (st->w >= 0) ? 0x18 : 0x00;
+            st->val = (st->w >= 0) ? (st->w & 0x18) : 0x00;
+        } else if (st->w == W_PCLATH) {
+            st->save = insn->f;
+            st->save_mask = st->w_mask;
+            st->save_val = st->w_val;
+        } else if (insn->f == st->save) {
+            st->save = -1;
+        }
+        return;
+    case OP_MOVF:
+        if (insn->d)
+            break;
+        if (to_pclath || insn->f == st->save) {
+            st->w = W_PCLATH;
+            st->w_mask = to_pclath ? st->mask : st->save_mask;
+            st->w_val = to_pclath ? st->val : st->save_val;
+            return;
+        }
+        break;
+    case OP_CLRF:
+        if (to_pclath)
+            st->mask = 0x18, st->val = 0x00;
+        if (insn->f == st->save)
+            st->save = -1;
+        return;
+    case OP_BCF:
+    case OP_BSF:
+        if (to_pclath && (insn->b == 3 || insn->b == 4)) {
+            st->mask |= 1 << insn->b;
+            st->val &= ~(1 << insn->b);
+            st->val |= (insn->op == OP_BSF) << insn->b;
+        }
+        if (insn->f == st->save)
+            st->save = -1;
+        return;
+    case OP_BTFSC: case OP_BTFSS: case OP_NOP: case OP_CLRWDT: case OP_SLEEP:
+    case OP_GOTO:
+        return;
+    case OP_CALL:
+        st->w = W_UNKNOWN;
+        return;
+    }
+
+    // Any other instruction may write W or the register
+    writes_f = (insn->op <= OP_XORWF && insn->d);
+    if (writes_f && to_pclath)
+        st->mask = st->val = 0;
+    if (writes_f && insn->f == st->save)
+        st->save = -1;
+    if (!writes_f)
+        st->w = W_UNKNOWN;
+}
+
+
+// Explore the code reachable from the function entry point, resolving the
+// page selected by PCLATH for every CALL and GOTO. Newly found call targets
+// are registered as functions. The targets array receives the resolved
+// destination of each branch.
+//
+// MikroC restores PCLATH after calling into another page, so a call is
+// assumed to preserve PCLATH unless the callee is seen to return with a
+// different page selected, as happens with computed jumps into ROM tables.
+int explore(uint16_t entry, int fidx, bool report) {
+    static uint16_t work[MAX_ROM];
+    int num_work = 0;
+
+    memset(states, 0, sizeof(states));
+    memset(targets, 0xFF, sizeof(targets));
+    states[entry].valid = true;
+    states[entry].mask = 0x18;
+    states[entry].val = (entry >> 8) & 0x18;
+    states[entry].w = W_UNKNOWN;
+    states[entry].save = -1;
+    work[num_work++] = entry;
+
+    while (num_work > 0) {
+        uint16_t addr = work[--num_work];
+        const struct pic14_insn* insn = &code[addr];
+        struct pstate st = states[addr];
+        uint16_t succ[2];
+        int num_succ = 0, idx;
+
+        if (insn->op == OP_INVALID) {
+            if (report)
+                fprintf(stderr, "0x%03X: invalid instruction in %s\n", addr, funcs[fidx].name);
+            return -1;
+        }
+
+        // Resolve the branch target using the known page bits
+        if (insn->op == OP_CALL || insn->op == OP_GOTO) {
+            int32_t dest = insn->k | (st.val & page_mask) << 8;
+            if ((st.mask & page_mask) != page_mask) {
+                if (report) {
+                    fprintf(stderr, "0x%03X: cannot resolve PCLATH page in %s\n", addr, funcs[fidx].name);
+                    return -1;
+                }
+                continue;
+            }
+            targets[addr] = dest;
+            if (insn->op == OP_CALL) {
+                int callee = add_func(dest);
+                struct func* fn = &funcs[fidx];
+                if (callee < 0)
+                    PRINT_RETURN("Too many functions\n", -1);
+                for (idx = 0; idx < fn->num_calls && fn->calls[idx] != callee; idx++) {}
+                if (idx == fn->num_calls && fn->num_calls < MAX_CALLS)
+                    fn->calls[fn->num_calls++] = callee;
+                if (funcs[callee].clobbers)
+                    st.mask = st.val = 0;
+            }
+        }
+
+        // Determine the successors
+        transfer(insn, &st);
+        switch (insn->op) {
+        case OP_GOTO:
+            succ[num_succ++] = targets[addr];
+            break;
+        case OP_RETURN: case OP_RETLW: case OP_RETFIE:
+            if ((st.mask & page_mask) != page_mask || ((st.val ^ (entry >> 8)) & page_mask))
+                funcs[fidx].clobbers = true;
+            break;
+        default:
+            if (pic14_writes_pcl(insn)) {
+                funcs[fidx].clobbers = true;
+                break;
+            }
+            succ[num_succ++] = addr+1;
+            if (pic14_is_skip(insn))
+                succ[num_succ++] = addr+2;
+        }
+
+        // Merge the state into the successors
+        for (idx = 0; idx < num_succ; idx++) {
+            struct pstate* ns = &states[succ[idx] % MAX_ROM];
+            struct pstate old = *ns;
+            if (succ[idx] >= dev->rom_words) {
+                fprintf(stderr, "0x%03X: control flows past the end of memory\n", addr);
+                return -1;
+            }
+            if (!ns->valid) {
+                *ns = st;
+            } else {
+                ns->mask &= st.mask & ~(ns->val ^ st.val);
+                ns->val &= ns->mask;
+                if (ns->w != st.w || (st.w == W_PCLATH && (ns->w_mask != st.w_mask || ns->w_val != st.w_val)))
+                    ns->w = W_UNKNOWN;
+                if (ns->save != st.save || ns->save_mask != st.save_mask || ns->save_val != st.save_val)
+                    ns->save = -1;
+            }
+            if (!old.valid || memcmp(&old, ns, sizeof(old)) != 0)
+                work[num_work++] = succ[idx];
+        }
+    }
+    return 0;
+}
+
+
+// Order the functions such that every callee precedes its callers.
+int sort_funcs(int fidx) {
+    struct func* fn = &funcs[fidx];
+    int idx;
+
+    if (fn->visit == 2)
+        return 0;
+    if (fn->visit == 1) {
+        fprintf(stderr, "Recursion through %s is not supported\n", fn->name);
+        return -1;
+    }
+    fn->visit = 1;
+    for (idx = 0; idx < fn->num_calls; idx++)
+        if (sort_funcs(fn->calls[idx]))
+            return -1;
+    fn->visit = 2;
+    order[num_order++] = fidx;
+    return 0;
+}
+
+
+// Compute the worst-case number of cycles from entering the function until it
+// returns. If a target address is given, compute instead the worst-case number
+// of cycles from entering the function until the target is first reached,
+// whether directly or within a callee.
+int64_t analyse(int fidx, int32_t target) {
+    static int body[MAX_NODES], hdrs[MAX_NODES], sizes[MAX_NODES];
+    static int in_set[MAX_NODES];
+    int num_hdrs = 0, idx, jdx;
+    struct func* fn = &funcs[fidx];
+
+    if (explore(fn->entry, fidx, true) || build_graph(fidx, target) || compute_dominators())
+        return WCET_ERROR;
+    propagate_consts();
+
+    // Record the bank that the function returns in for the use of callers
+    bool first = true;
+    for (idx = 0; idx < num_blocks && target < 0; idx++) {
+        const struct pic14_insn* last = &code[nodes[idx].end];
+        int16_t* cs = block_consts[idx];
+        if (last->op != OP_RETURN && last->op != OP_RETLW && last->op != OP_RETFIE && !pic14_writes_pcl(last))
+            continue;
+        int bank = (cs[CONST_RP0] < 0 || cs[CONST_RP1] < 0) ? -1 : (cs[CONST_RP1] << 1) | cs[CONST_RP0];
+        fn->bank = (first || fn->bank == bank) ? bank : -1;
+        first = false;
+    }
+
+    // Every retreating edge must be a back edge for the loops to be natural
+    for (idx = 0; idx < num_block_edges; idx++) {
+        struct edge* eg = &edges[idx];
+        if (eg->to < 0 || nodes[eg->from].rpo < 0 || nodes[eg->from].rpo < nodes[eg->to].rpo)
+            continue;
+        if (!dominates(eg->to, eg->from)) {
+            fprintf(stderr, "0x%03X: irreducible loop in %s\n", nodes[eg->to].start, fn->name);
+            return WCET_ERROR;
+        }
+    }
+
+    // Find the loops, innermost first since they have smaller bodies
+    for (idx = 0; idx < num_blocks; idx++) {
+        int num_body = loop_body(idx, body);
+        if (num_body == 0)
+            continue;
+        for (jdx = num_hdrs; jdx > 0 && sizes[jdx-1] > num_body; jdx--) {
+            hdrs[jdx] = hdrs[jdx-1];
+            sizes[jdx] = sizes[jdx-1];
+        }
+        hdrs[jdx] = idx;
+        sizes[jdx] = num_body;
+        num_hdrs++;
+    }
+
+    // Collapse every loop into a single node
+    for (idx = 0; idx < num_hdrs; idx++) {
+        int hdr = hdrs[idx];
+        int num_body = loop_body(hdr, body);
+        uint32_t bound = loop_bound(hdr, body, num_body);
+        if (bound == 0 && !loop_exits(body, num_body)) {
+            // A loop that is never left does not need a bound, since the
+            // function does not return through it
+            bound = 1;
+        } else if (bound == 0) {
+            if (target < 0)
+                fprintf(stderr, "0x%03X: unbounded loop in %s\n", nodes[hdr].start, fn->name);
+            return WCET_ERROR;
+        }
+        if (collapse_loop(hdr, body, num_body, bound)) {
+            fprintf(stderr, "0x%03X: irreducible loop in %s\n", nodes[hdr].start, fn->name);
+            return WCET_ERROR;
+        }
+    }
+
+    // The longest path from the entry to the sink is the bound
+    int64_t wcet;
+    for (idx = 0; idx < num_nodes; idx++)
+        in_set[idx] = 1;
+    if (longest_path(owner[entry_blk], in_set, 1, -1, &wcet))
+        return WCET_ERROR;
+    return wcet;
+}
+
+
+// Collect the blocks of the natural loop with the given header, which are the
+// blocks that reach a back edge to the header without passing through it.
+// Returns the number of blocks including the header, or 0 if it is no header.
+int loop_body(int hdr, int* body) {
+    static int stack[MAX_EDGES];
+    static bool in_body[MAX_NODES];
+    int num_body = 0, num_stack = 0, idx;
+
+    for (idx = 0; idx < num_block_edges; idx++) {
+        struct edge* eg = &edges[idx];
+        if (eg->to == hdr && eg->from < num_blocks && dominates(hdr, eg->from))
+            stack[num_stack++] = eg->from;
+    }
+    if (num_stack == 0)
+        return 0;
+
+    memset(in_body, 0, sizeof(in_body));
+    body[num_body++] = hdr;
+    in_body[hdr] = true;
+    while (num_stack > 0) {
+        int blk = stack[--num_stack];
+        if (in_body[blk])
+            continue;
+        in_body[blk] = true;
+        body[num_body++] = blk;
+        for (idx = 0; idx < num_block_edges; idx++)
+            if (edges[idx].to == blk && edges[idx].from < num_blocks && num_stack < MAX_EDGES)
+                stack[num_stack++] = edges[idx].from;
+    }
+    return num_body;
+}
+
+
+// Report whether any edge leaves the loop, either to a block outside of the
+// loop or by returning.
+bool loop_exits(int* body, int num_body) {
+    static bool in_body[MAX_NODES];
+    int idx;
+
+    memset(in_body, 0, sizeof(in_body));
+    for (idx = 0; idx < num_body; idx++)
+        in_body[body[idx]] = true;
+    for (idx = 0; idx < num_block_edges; idx++) {
+        struct edge* eg = &edges[idx];
+        if (in_body[eg->from] && (eg->to < 0 || !in_body[eg->to]))
+            return true;
+    }
+    return false;
+}
+
+
+// Split the explored code into basic blocks and connect them. The cost of a
+// block includes the cost of its callees. When computing the cycles until a
+// target is reached, paths end at the target or at calls to functions that
+// may reach the target, instead of at returns.
+int build_graph(int fidx, int32_t target) {
+    static bool leader[MAX_ROM+2];
+    int addr, idx;
+
+    memset(leader, 0, sizeof(leader));
+    memset(block_of, 0xFF, sizeof(block_of));
+    num_nodes = num_edges = 0;
+
+    // Mark the first instruction of every block
+    leader[funcs[fidx].entry] = true;
+    for (addr = 0; addr < dev->rom_words; addr++) {
+        const struct pic14_insn* insn = &code[addr];
+        if (!states[addr].valid)
+            continue;
+        if (insn->op == OP_GOTO)
+            leader[targets[addr]] = true;
+        if (pic14_is_skip(insn))
+            leader[addr+2] = true;
+        if (pic14_is_skip(insn) || insn->op == OP_GOTO || insn->op == OP_RETURN ||
+            insn->op == OP_RETLW || insn->op == OP_RETFIE || pic14_writes_pcl(insn))
+            leader[addr+1] = true;
+        if (addr == target)
+            leader[addr] = true;
+    }
+
+    // Form the blocks and compute their costs
+    for (addr = 0; addr < dev->rom_words; addr++) {
+        if (!states[addr].valid)
+            continue;
+        if (leader[addr] || addr == 0 || !states[addr-1].valid) {
+            if (num_nodes >= MAX_NODES)
+                PRINT_RETURN("Too many basic blocks\n", -1);
+            memset(&nodes[num_nodes], 0, sizeof(nodes[0]));
+            nodes[num_nodes].start = addr;
+            owner[num_nodes] = num_nodes;
+            num_nodes++;
+        }
+        block_of[addr] = num_nodes-1;
+        nodes[num_nodes-1].end = addr;
+    }
+    num_blocks = num_nodes;
+    entry_blk = block_of[funcs[fidx].entry];
+
+    for (idx = 0; idx < num_blocks; idx++) {
+        struct node* nd = &nodes[idx];
+        int64_t cost = 0;
+
+        if (nd->start == target) {
+            add_edge(idx, -1, 0);
+            continue;
+        }
+        for (addr = nd->start; addr <= nd->end; addr++) {
+            const struct pic14_insn* insn = &code[addr];
+            cost += pic14_cycles(insn);
+            if (insn->op != OP_CALL)
+                continue;
+
+            struct func* callee = &funcs[add_func(targets[addr])];
+            if (target >= 0 && callee->reach >= 0)
+                add_edge(idx, -1, cost + callee->reach);
+            if (callee->wcet == WCET_ERROR) {
+                if (target < 0)
+                    fprintf(stderr, "0x%03X: call to unanalysable %s\n", addr, callee->name);
+                return -1;
+            }
+            if (callee->wcet == WCET_UNBOUNDED) {
+                // The path never continues past a call that never returns
+                cost = -1;
+                break;
+            }
+            cost += callee->wcet;
+        }
+        nd->cost = cost;
+        if (cost < 0)
+            continue;
+
+        // Connect the block to its successors
+        const struct pic14_insn* last = &code[nd->end];
+        if (last->op == OP_GOTO) {
+            add_edge(idx, block_of[targets[nd->end]], cost);
+        } else if (last->op == OP_RETURN || last->op == OP_RETLW || last->op == OP_RETFIE) {
+            if (target < 0)
+                add_edge(idx, -1, cost);
+        } else if (pic14_writes_pcl(last)) {
+            // MikroC only uses computed jumps to enter a table of RETLW
+            // instructions, which then returns to the caller.
+            if (target < 0)
+                add_edge(idx, -1, cost + 2);
+        } else {
+            add_edge(idx, block_of[nd->end+1], cost);
+            if (pic14_is_skip(last))
+                add_edge(idx, block_of[nd->end+2], cost+1);
+        }
+    }
+    num_block_edges = num_edges;
+    return (num_edges < MAX_EDGES) ? 0 : -1;
+}
+
+
+// Add an edge between two nodes.
+void add_edge(int from, int to, int64_t w) {
+    if (num_edges >= MAX_EDGES)
+        return;
+    edges[num_edges].from = from;
+    edges[num_edges].to = to;
+    edges[num_edges].w = w;
+    edges[num_edges].active = true;
+    num_edges++;
+}
+
+
+// Compute the immediate dominators of the basic blocks using the iterative
+// algorithm by Cooper, Harvey and Kennedy over a reverse post-order.
+int compute_dominators() {
+    static int post[MAX_NODES], stack[MAX_NODES], next[MAX_NODES];
+    int num_post = 0, num_stack = 0, idx;
+    bool changed = true;
+
+    for (idx = 0; idx < num_blocks; idx++) {
+        nodes[idx].rpo = -1;
+        nodes[idx].idom = -1;
+        next[idx] = 0;
+    }
+
+    // Depth first search from the entry block to get the post-order
+    stack[num_stack++] = entry_blk;
+    nodes[entry_blk].rpo = 0;
+    while (num_stack > 0) {
+        int blk = stack[num_stack-1];
+        for (; next[blk] < num_block_edges; next[blk]++) {
+            struct edge* eg = &edges[next[blk]];
+            if (eg->from == blk && eg->to >= 0 && nodes[eg->to].rpo < 0)
+                break;
+        }
+        if (next[blk] < num_block_edges) {
+            int to = edges[next[blk]].to;
+            nodes[to].rpo = 0;
+            stack[num_stack++] = to;
+        } else {
+            post[num_post++] = blk;
+            num_stack--;
+        }
+    }
+    for (idx = 0; idx < num_post; idx++)
+        nodes[post[idx]].rpo = num_post-1-idx;
+
+    // Iterate until the dominators converge
+    nodes[entry_blk].idom = entry_blk;
+    while (changed) {
+        changed = false;
+        for (idx = num_post-1; idx >= 0; idx--) {
+            int blk = post[idx], jdx, dom = -1;
+            if (blk == entry_blk)
+                continue;
+            for (jdx = 0; jdx < num_block_edges; jdx++) {
+                int pred = edges[jdx].from;
+                if (edges[jdx].to != blk || nodes[pred].idom < 0)
+                    continue;
+                if (dom < 0) {
+                    dom = pred;
+                    continue;
+                }
+                while (dom != pred) {
+                    while (nodes[dom].rpo > nodes[pred].rpo)
+                        dom = nodes[dom].idom;
+                    while (nodes[pred].rpo > nodes[dom].rpo)
+                        pred = nodes[pred].idom;
+                }
+            }
+            if (dom != nodes[blk].idom) {
+                nodes[blk].idom = dom;
+                changed = true;
+            }
+        }
+    }
+    return 0;
+}
+
+
+// Report whether block a dominates block b.
+bool dominates(int a, int b) {
+    if (nodes[b].rpo < 0)
+        return false;
+    while (b != a && b != entry_blk)
+        b = nodes[b].idom;
+    return b == a;
+}
+
+
+// Report whether the instruction writes to the file register.
+bool writes_reg(const struct pic14_insn* insn, uint8_t f) {
+    if (insn->f != f && insn->f != REG_INDF)
+        return false;
+    switch (insn->op) {
+    case OP_MOVWF: case OP_CLRF: case OP_BCF: case OP_BSF:
+        return true;
+    }
+    return insn->op <= OP_XORWF && insn->op != OP_CLRW && insn->op != OP_NOP && insn->d;
+}
+
+
+// Report whether the instruction writes W.
+bool writes_w(const struct pic14_insn* insn) {
+    switch (insn->op) {
+    case OP_MOVWF: case OP_CLRF: case OP_NOP:
+        return false;
+    case OP_CLRW: case OP_ADDLW: case OP_ANDLW: case OP_IORLW: case OP_MOVLW:
+    case OP_SUBLW: case OP_XORLW: case OP_RETLW: case OP_CALL:
+        return true;
+    }
+    return insn->op <= OP_XORWF && !insn->d;
+}
+
+
+// Report whether the instruction writes W or the zero flag.
+bool writes_wz(const struct pic14_insn* insn) {
+    switch (insn->op) {
+    case OP_ADDWF: case OP_ANDWF: case OP_CLRF: case OP_CLRW: case OP_COMF:
+    case OP_DECF: case OP_INCF: case OP_IORWF: case OP_MOVF: case OP_SUBWF:
+    case OP_XORWF: case OP_ADDLW: case OP_ANDLW: case OP_IORLW: case OP_SUBLW:
+    case OP_XORLW:
+        return true;
+    }
+    return writes_w(insn) || writes_reg(insn, REG_STATUS);
+}
+
+
+// Map a register to its index in the constant state for the known bank, or
+// return -1 if the bank is not known and the register is banked.
+int const_index(const int16_t* cs, uint8_t f) {
+    switch (f) {
+    case REG_PCL: case REG_STATUS: case REG_FSR: case REG_PCLATH: case REG_INTCON:
+        return f;
+    }
+    if (f >= 0x70)
+        return f;
+    if (f == REG_INDF || cs[CONST_RP0] < 0 || cs[CONST_RP1] < 0)
+        return -1;
+    return (cs[CONST_RP1] << 8) | (cs[CONST_RP0] << 7) | f;
+}
+
+
+// Apply the effect of an instruction on the known register constants. A call
+// leaves every register unknown except for the bank that the callee returns in.
+void const_transfer(uint16_t addr, int16_t* cs) {
+    const struct pic14_insn* insn = &code[addr];
+    int idx = const_index(cs, insn->f);
+    int val = (idx >= 0) ? cs[idx] : -1;
+    int w = cs[CONST_W];
+    int res = -1;
+
+    switch (insn->op) {
+    case OP_MOVLW: cs[CONST_W] = insn->k; return;
+    case OP_CLRW:  cs[CONST_W] = 0; return;
+    case OP_ADDLW: cs[CONST_W] = (w < 0) ? -1 : (w + insn->k) & 0xFF; return;
+    case OP_SUBLW: cs[CONST_W] = (w < 0) ? -1 : (insn->k - w) & 0xFF; return;
+    case OP_ANDLW: cs[CONST_W] = (w < 0) ? -1 : (w & insn->k); return;
+    case OP_IORLW: cs[CONST_W] = (w < 0) ? -1 : (w | insn->k); return;
+    case OP_XORLW: cs[CONST_W] = (w < 0) ? -1 : (w ^ insn->k); return;
+    case OP_MOVWF: res = w; break;
+    case OP_CLRF:  res = 0; break;
+    case OP_MOVF:  res = val; break;
+    case OP_COMF:  res = (val < 0) ? -1 : ~val & 0xFF; break;
+    case OP_INCF: case OP_INCFSZ: res = (val < 0) ? -1 : (val + 1) & 0xFF; break;
+    case OP_DECF: case OP_DECFSZ: res = (val < 0) ? -1 : (val - 1) & 0xFF; break;
+    case OP_SWAPF: res = (val < 0) ? -1 : ((val << 4) | (val >> 4)) & 0xFF; break;
+    case OP_ADDWF: res = (val < 0 || w < 0) ? -1 : (val + w) & 0xFF; break;
+    case OP_SUBWF: res = (val < 0 || w < 0) ? -1 : (val - w) & 0xFF; break;
+    case OP_ANDWF: res = (val < 0 || w < 0) ? -1 : (val & w); break;
+    case OP_IORWF: res = (val < 0 || w < 0) ? -1 : (val | w); break;
+    case OP_XORWF: res = (val < 0 || w < 0) ? -1 : (val ^ w); break;
+    case OP_BCF:   res = (val < 0) ? -1 : val & ~(1 << insn->b); break;
+    case OP_BSF:   res = (val < 0) ? -1 : val | (1 << insn->b); break;
+    case OP_CALL:
+        for (idx = 0; idx < NUM_CONSTS; idx++)
+            cs[idx] = -1;
+        idx = funcs[add_func(targets[addr])].bank;
+        if (idx >= 0) {
+            cs[CONST_RP0] = (idx >> 0) & 1;
+            cs[CONST_RP1] = (idx >> 1) & 1;
+        }
+        return;
+    default:
+        return;
+    }
+
+    // Store the result to W or to the register
+    if (insn->op != OP_MOVWF && insn->op != OP_CLRF && insn->op != OP_BCF &&
+        insn->op != OP_BSF && !insn->d) {
+        cs[CONST_W] = res;
+        return;
+    }
+    if (insn->f == REG_STATUS && (insn->op == OP_BCF || insn->op == OP_BSF)) {
+        if (insn->b == STATUS_RP0)
+            cs[CONST_RP0] = (insn->op == OP_BSF);
+        if (insn->b == STATUS_RP1)
+            cs[CONST_RP1] = (insn->op == OP_BSF);
+    } else if (insn->f == REG_STATUS) {
+        cs[CONST_RP0] = cs[CONST_RP1] = -1;
+    }
+    if (idx >= 0) {
+        cs[idx] = res;
+    } else if (insn->f == REG_INDF) {
+        for (idx = 0; idx < CONST_W; idx++)
+            cs[idx] = -1;
+    } else {
+        for (idx = 0; idx < 4; idx++)
+            cs[(idx << 7) | insn->f] = -1;
+    }
+}
+
+
+// Propagate the register constants through the basic blocks of the function
+// until they converge, storing the constants known at the end of each block.
+void propagate_consts() {
+    static int16_t in[NUM_CONSTS];
+    static bool seen[MAX_NODES], queued[MAX_NODES];
+    static int work[MAX_NODES];
+    int num_work = 0, idx, jdx, addr;
+
+    memset(seen, 0, sizeof(seen));
+    memset(queued, 0, sizeof(queued));
+    for (idx = 0; idx < num_blocks; idx++)
+        memset(block_consts[idx], 0xFF, sizeof(block_consts[idx]));
+    work[num_work++] = entry_blk;
+    queued[entry_blk] = true;
+
+    while (num_work > 0) {
+        int blk = work[--num_work];
+        queued[blk] = false;
+
+        // Merge the constants at the end of every predecessor
+        bool first = true;
+        memset(in, 0xFF, sizeof(in));
+        for (idx = 0; idx < num_block_edges; idx++) {
+            struct edge* eg = &edges[idx];
+            if (eg->to != blk || !seen[eg->from])
+                continue;
+            for (jdx = 0; jdx < NUM_CONSTS; jdx++)
+                in[jdx] = (first || in[jdx] == block_consts[eg->from][jdx]) ? block_consts[eg->from][jdx] : -1;
+            first = false;
+        }
+        for (addr = nodes[blk].start; addr <= nodes[blk].end; addr++)
+            const_transfer(addr, in);
+
+        // Revisit the successors if anything changed
+        if (seen[blk] && memcmp(in, block_consts[blk], sizeof(in)) == 0)
+            continue;
+        seen[blk] = true;
+        memcpy(block_consts[blk], in, sizeof(in));
+        for (idx = 0; idx < num_block_edges; idx++) {
+            struct edge* eg = &edges[idx];
+            if (eg->from == blk && eg->to >= 0 && !queued[eg->to]) {
+                work[num_work++] = eg->to;
+                queued[eg->to] = true;
+            }
+        }
+    }
+}
+
+
+// Find the constant value that a register, or W if f is negative, holds when
+// entering the loop. Returns -1 if the value is not the same for every entry.
+int entry_value(int hdr, bool* in_body, int f) {
+    int val = -1, idx;
+
+    for (idx = 0; idx < num_block_edges; idx++) {
+        struct edge* eg = &edges[idx];
+        int16_t* cs = block_consts[eg->from];
+        if (eg->to != hdr || in_body[eg->from])
+            continue;
+
+        int ci = (f < 0) ? CONST_W : const_index(cs, f);
+        int cur = (ci < 0) ? -1 : cs[ci];
+        if (cur < 0 || (val >= 0 && val != cur))
+            return -1;
+        val = cur;
+    }
+    return val;
+}
+
+
+// Determine the maximum number of times the loop header may execute each time
+// the loop is entered. Annotations take precedence. Otherwise, three patterns
+// emitted by MikroC are recognized:
+//
+//  * A DECFSZ or INCFSZ counter that exits the loop when it reaches zero, which
+//    is how delay_ms() is implemented.
+//  * A W register counter that is decremented by ADDLW 0xFF and exits when the
+//    zero flag is set, which is how shifts by a variable amount are done.
+//  * A signed 8-bit index compared against a constant at the header and
+//    stepped once per iteration, which is how counted for loops are done.
+//
+// If every entry into the loop initializes the counter with a constant, the
+// constant gives the bound. Otherwise, the width of the 8-bit counter does.
+// Returns 0 if no bound is known.
+uint32_t loop_bound(int hdr, int* body, int num_body) {
+    static bool in_body[MAX_NODES];
+    int idx, jdx, addr;
+    struct note* nt = find_note(NOTE_LOOP, nodes[hdr].start);
+
+    if (nt != NULL)
+        return nt->val;
+
+    memset(in_body, 0, sizeof(in_body));
+    for (idx = 0; idx < num_body; idx++)
+        in_body[body[idx]] = true;
+
+    for (idx = 0; idx < num_body; idx++) {
+        int blk = body[idx];
+        uint16_t end = nodes[blk].end;
+        const struct pic14_insn* ctr = &code[end];
+        bool ok = true;
+
+        // The counter must exit the loop when it skips and stay otherwise
+        if ((ctr->op != OP_DECFSZ && ctr->op != OP_INCFSZ) || !ctr->d)
+            continue;
+        if (in_body[block_of[end+2]] || !in_body[block_of[end+1]])
+            continue;
+
+        // The counter must be updated on every iteration
+        for (jdx = 0; jdx < num_block_edges && ok; jdx++) {
+            struct edge* eg = &edges[jdx];
+            if (eg->to == hdr && in_body[eg->from])
+                ok = dominates(blk, eg->from);
+        }
+
+        // The counter must not be modified elsewhere in the loop
+        for (jdx = 0; jdx < num_body && ok; jdx++) {
+            for (addr = nodes[body[jdx]].start; addr <= nodes[body[jdx]].end; addr++) {
+                const struct pic14_insn* insn = &code[addr];
+                if (insn->op == OP_CALL || (writes_reg(insn, ctr->f) && addr != end))
+                    ok = false;
+            }
+        }
+        if (!ok)
+            continue;
+
+        int init = entry_value(hdr, in_body, ctr->f);
+        uint32_t bound = 256;
+        if (init > 0 && ctr->op == OP_DECFSZ)
+            bound = init;
+        else if (init > 0 && ctr->op == OP_INCFSZ)
+            bound = 256 - init;
+        if (verbose)
+            fprintf(stderr, "0x%03X: loop bounded by counter 0x%02X to %u\n", nodes[hdr].start, ctr->f, bound);
+        return bound;
+    }
+
+    // Look for a signed compare of an index against a constant at the header
+    uint16_t end = nodes[hdr].end;
+    uint32_t bound = for_bound(hdr, in_body, body, num_body);
+    if (bound > 0)
+        return bound;
+
+    // Look for a zero test at the header that exits the loop
+    const struct pic14_insn* test = &code[end];
+    int zero_succ = (test->op == OP_BTFSC) ? end+1 : end+2;
+    int other_succ = (test->op == OP_BTFSC) ? end+2 : end+1;
+    bool found = false;
+    if ((test->op != OP_BTFSC && test->op != OP_BTFSS) || test->f != REG_STATUS || test->b != STATUS_Z)
+        return 0;
+    if (in_body[block_of[zero_succ]] || !in_body[block_of[other_succ]])
+        return 0;
+
+    // W must only be changed by a single decrement on every iteration
+    for (idx = 0; idx < num_body; idx++) {
+        int blk = body[idx];
+        for (addr = nodes[blk].start; addr <= nodes[blk].end; addr++) {
+            const struct pic14_insn* insn = &code[addr];
+            if (insn->op == OP_ADDLW && insn->k == 0xFF && !found) {
+                found = true;
+                for (jdx = 0; jdx < num_block_edges; jdx++) {
+                    struct edge* eg = &edges[jdx];
+                    if (eg->to == hdr && in_body[eg->from] && !dominates(blk, eg->from))
+                        return 0;
+                }
+            } else if (writes_wz(insn)) {
+                return 0;
+            }
+        }
+    }
+    if (!found)
+        return 0;
+
+    int init = entry_value(hdr, in_body, -1);
+    bound = (init >= 0) ? init+1 : 257;
+    if (verbose)
+        fprintf(stderr, "0x%03X: loop bounded by W to %u\n", nodes[hdr].start, bound);
+    return bound;
+}
+
+
+// Bound a loop whose header tests a signed 8-bit index against a constant limit.
+// MikroC compiles the test "idx < lim" to the following sequence, where the
+// test "idx >= lim" uses BTFSS instead:
+//
+//      MOVLW   0x80
+//      XORWF   idx,W
+//      MOVWF   tmp
+//      MOVLW   0x80
+//      XORLW   lim
+//      SUBWF   tmp,W
+//      BTFSC   STATUS,C
+//      GOTO    exit
+//
+// Returns 0 if the loop does not match or the index is not stepped towards the
+// limit exactly once on every iteration.
+uint32_t for_bound(int hdr, bool* in_body, int* body, int num_body) {
+    static const uint8_t ops[] = {OP_MOVLW, OP_XORWF, OP_MOVWF, OP_MOVLW, OP_XORLW, OP_SUBWF};
+    uint16_t end = nodes[hdr].end;
+    const struct pic14_insn* seq = &code[end-6];
+    int idx, jdx, addr, step = -1;
+
+    if (end < nodes[hdr].start+6)
+        return 0;
+    for (idx = 0; idx < 6; idx++)
+        if (seq[idx].op != ops[idx])
+            return 0;
+    if (seq[0].k != 0x80 || seq[3].k != 0x80 || seq[1].d || seq[5].d || seq[2].f != seq[5].f)
+        return 0;
+    if ((seq[6].op != OP_BTFSC && seq[6].op != OP_BTFSS) || seq[6].f != REG_STATUS || seq[6].b != STATUS_C)
+        return 0;
+    if (in_body[block_of[end+1]] || !in_body[block_of[end+2]])
+        return 0;
+
+    // The index must only be changed by a single step
+    bool up = (seq[6].op == OP_BTFSC);
+    uint8_t reg = seq[1].f;
+    for (idx = 0; idx < num_body; idx++) {
+        for (addr = nodes[body[idx]].start; addr <= nodes[body[idx]].end; addr++) {
+            const struct pic14_insn* insn = &code[addr];
+            if (insn->op == (up ? OP_INCF : OP_DECF) && insn->f == reg && insn->d && step < 0)
+                step = body[idx];
+            else if (writes_reg(insn, reg))
+                return 0;
+        }
+    }
+    if (step < 0)
+        return 0;
+    for (jdx = 0; jdx < num_block_edges; jdx++) {
+        struct edge* eg = &edges[jdx];
+        if (eg->to == hdr && in_body[eg->from] && !dominates(step, eg->from))
+            return 0;
+    }
+
+    // Count the iterations from the initial value, or from the far end of the
+    // signed range if it is not known
+    int init = entry_value(hdr, in_body, reg);
+    int lim = (int8_t)seq[4].k;
+    int first = (init >= 0) ? (int8_t)init : (up ? -128 : 127);
+    int count = up ? lim - first : first - lim + 1;
+    uint32_t bound = (count > 0) ? count + 1 : 1;
+    if (verbose)
+        fprintf(stderr, "0x%03X: loop bounded by index 0x%02X to %u\n", nodes[hdr].start, reg, bound);
+    return bound;
+}
+
+
+// Replace the loop by a new node. Leaving the new node along any exit costs
+// the longest iteration for all but the last iteration, plus the longest path
+// from the header to that exit within the last iteration.
+int collapse_loop(int hdr, int* body, int num_body, uint32_t bound) {
+    static int in_set[MAX_NODES];
+    static int stamp;
+    int64_t iter;
+    int idx, loop = num_nodes;
+    int hnode = owner[hdr];
+
+    if (num_nodes >= MAX_NODES)
+        return -1;
+    stamp++;
+    for (idx = 0; idx < num_body; idx++)
+        in_set[owner[body[idx]]] = stamp;
+
+    // Compute the longest path to every node and around the loop
+    if (longest_path(hnode, in_set, stamp, hnode, &iter))
+        return -1;
+
+    memset(&nodes[loop], 0, sizeof(nodes[0]));
+    nodes[loop].start = nodes[hdr].start;
+    nodes[loop].end = nodes[hdr].end;
+    owner[loop] = loop;
+    in_set[loop] = 0;
+    num_nodes++;
+
+    // Move the exits to the new node and remove the inner edges
+    int num = num_edges;
+    for (idx = 0; idx < num; idx++) {
+        struct edge* eg = &edges[idx];
+        if (!eg->active || in_set[eg->from] != stamp)
+            continue;
+        eg->active = false;
+        if (eg->to >= 0 && in_set[eg->to] == stamp)
+            continue;
+        add_edge(loop, eg->to, (int64_t)(bound-1)*iter + dist[eg->from] + eg->w);
+    }
+    if (num_edges >= MAX_EDGES)
+        return -1;
+
+    // Redirect the entries to the new node. The edges between the basic
+    // blocks are kept intact since the loop analysis relies on them.
+    num = num_edges;
+    for (idx = 0; idx < num; idx++) {
+        struct edge* eg = &edges[idx];
+        if (!eg->active || eg->to < 0 || in_set[eg->to] != stamp)
+            continue;
+        if (eg->to != hnode)
+            return -1;
+        eg->active = false;
+        add_edge(eg->from, loop, eg->w);
+    }
+    if (num_edges >= MAX_EDGES)
+        return -1;
+    for (idx = 0; idx < num_blocks; idx++)
+        if (in_set[owner[idx]] == stamp)
+            owner[idx] = loop;
+    return 0;
+}
+
+
+// Compute the longest path from the source to every node in the set over the
+// active edges, storing the distances in dist. Edges back to the header node
+// are not followed, but the longest path along them is returned in iter. When
+// no header is given, the longest path to the sink is returned in iter
+// instead, or WCET_UNBOUNDED if the sink cannot be reached.
+int longest_path(int src, int* in_set, int stamp, int hdr, int64_t* iter) {
+    static int post[MAX_NODES], stack[MAX_NODES], next[MAX_NODES], color[MAX_NODES];
+    int num_post = 0, num_stack = 0, idx, jdx;
+    bool found = false;
+
+    for (idx = 0; idx < num_nodes; idx++) {
+        color[idx] = 0;
+        next[idx] = 0;
+        dist[idx] = -1;
+    }
+
+    // Topologically sort the nodes reachable from the source
+    stack[num_stack++] = src;
+    color[src] = 1;
+    while (num_stack > 0) {
+        int nd = stack[num_stack-1];
+        for (; next[nd] < num_edges; next[nd]++) {
+            struct edge* eg = &edges[next[nd]];
+            if (!eg->active || eg->from != nd || eg->to < 0 || eg->to == hdr || in_set[eg->to] != stamp)
+                continue;
+            if (color[eg->to] == 1)
+                return -1;
+            if (color[eg->to] == 0)
+                break;
+        }
+        if (next[nd] < num_edges) {
+            int to = edges[next[nd]].to;
+            color[to] = 1;
+            stack[num_stack++] = to;
+        } else {
+            color[nd] = 2;
+            post[num_post++] = nd;
+            num_stack--;
+        }
+    }
+
+    // Relax the edges in topological order
+    dist[src] = 0;
+    *iter = 0;
+    for (idx = num_post-1; idx >= 0; idx--) {
+        int nd = post[idx];
+        for (jdx = 0; jdx < num_edges; jdx++) {
+            struct edge* eg = &edges[jdx];
+            if (!eg->active || eg->from != nd)
+                continue;
+            int64_t len = dist[nd] + eg->w;
+            if (hdr >= 0 && eg->to == hdr) {
+                *iter = MAX(*iter, len);
+            } else if (hdr < 0 && eg->to < 0) {
+                *iter = MAX(*iter, len);
+                found = true;
+            } else if (eg->to >= 0 && in_set[eg->to] == stamp) {
+                dist[eg->to] = MAX(dist[eg->to], len);
+            }
+        }
+    }
+
+    if (hdr < 0 && !found)
+        *iter = WCET_UNBOUNDED;
+    return 0;
+}
+
+
+// Simulate the function repeatedly from random initial states, applying the
+// init annotations, and record the largest number of cycles observed.
+void measure(int fidx, int runs) {
+    static struct pic14_sim sim;
+    struct func* fn = &funcs[fidx];
+    int run, idx;
+    uint64_t limit = (fn->wcet > 0) ? 2*fn->wcet + 1000 : 20000000;
+
+    fn->measured = -1;
+    srand48(fn->entry);
+    for (run = 0; run < runs; run++) {
+        sim_reset(&sim, dev, rom);
+        for (idx = 0; idx < (int)sizeof(sim.ram); idx++)
+            sim.ram[idx] = lrand48();
+        for (idx = 0; idx < (int)sizeof(sim.eeprom); idx++)
+            sim.eeprom[idx] = lrand48();
+        sim.w = lrand48();
+        // MikroC code expects bank 0 to be selected for indirect accesses
+        sim.ram[REG_STATUS] &= ~((1 << STATUS_IRP) | (1 << STATUS_RP1) | (1 << STATUS_RP0));
+        for (idx = 0; idx < num_notes; idx++)
+            if (notes[idx].kind == NOTE_INIT && notes[idx].addr == fn->entry)
+                sim.ram[sim_map(&sim, notes[idx].reg)] = notes[idx].val;
+
+        int ret = sim_call(&sim, fn->entry, limit);
+        if (ret == SIM_RETURN)
+            fn->measured = MAX(fn->measured, (int64_t)sim.cycles);
+        else
+            fn->timeouts++;
+    }
+}
+
+
+// Print the disassembly of a function.
+void list_func(int fidx) {
+    char buf[32];
+    int addr;
+
+    if (explore(funcs[fidx].entry, fidx, true))
+        return;
+    printf("\n%s:\n", funcs[fidx].name);
+    for (addr = 0; addr < dev->rom_words; addr++) {
+        if (!states[addr].valid)
+            continue;
+        pic14_format(&code[addr], buf, sizeof(buf));
+        printf("    0x%03X  %04X  %s\n", addr, rom[addr], buf);
+    }
+}